@@ -0,0 +1,1048 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: attest_bench.c
+ *      Measure throughput and latency of the verification path.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <json-c/json.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509v3.h>
+
+#include "ctx_json.h"
+#include "ctx_tlv.h"
+#include "event_log.h"
+#include "enroll_server.h"
+#include "pcr.h"
+#include "tss.h"
+#include "util.h"
+
+#define MAX_INPUTS 16
+#define DEFAULT_ITERATIONS 100
+#define DEFAULT_DATA_SIZE (1024 * 1024)
+#define EXTEND_OPS 10000
+#define EXTEND_PCR 10
+#define HMAC_KEY_LEN 32
+#define CERT_KEY_BITS 2048
+#define CERT_DAYS 1
+#define NSEC_PER_SEC 1000000000ULL
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+struct bench_input {
+	char *label;
+	char *path;
+};
+
+struct bench_quote {
+	uint8_t hmac_key[HMAC_KEY_LEN];
+	EVP_PKEY *ak_key;
+	char *ak_cert;
+	char *ca_cert;
+	TPML_PCR_SELECTION pcr_selection;
+	TPMT_HA pcr_digest;
+	char *message;
+};
+
+struct bench_ctx {
+	struct bench_input logs[MAX_INPUTS];
+	struct bench_input aux[MAX_INPUTS];
+	int num_logs;
+	int num_aux;
+	char *reqs_path;
+	char *alg_name;
+	TPMI_ALG_HASH alg;
+	uint8_t pcr_bank_mask;
+	size_t data_size;
+	/* set up by the benchmark */
+	attest_ctx_data *d_ctx;
+	attest_ctx_verifier *v_ctx;
+	attest_ctx_verifier *reqs;
+	unsigned char *data;
+	char *encoded;
+	size_t encoded_len;
+	char *json;
+	struct bench_quote quote;
+	size_t bytes;
+	int ops;
+};
+
+/* prepare() is called before each run() and is not measured */
+struct bench {
+	const char *name;
+	int (*setup)(struct bench_ctx *ctx);
+	int (*prepare)(struct bench_ctx *ctx);
+	int (*run)(struct bench_ctx *ctx);
+};
+
+static int bench_add_input(struct bench_input *inputs, int *num_inputs,
+			   char *arg)
+{
+	char *sep = strchr(arg, '=');
+
+	if (!sep || sep == arg || *num_inputs == MAX_INPUTS)
+		return -EINVAL;
+
+	*sep = '\0';
+	inputs[*num_inputs].label = arg;
+	inputs[*num_inputs].path = sep + 1;
+	(*num_inputs)++;
+	return 0;
+}
+
+/* event logs and aux data, shared by all runs */
+static int bench_setup_data(struct bench_ctx *ctx)
+{
+	struct data_item *item;
+	int rc, i;
+
+	rc = attest_ctx_data_init_flags(&ctx->d_ctx, CTX_IN_MEMORY);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < ctx->num_logs; i++) {
+		rc = attest_ctx_data_add_file(ctx->d_ctx, CTX_EVENT_LOG,
+					      ctx->logs[i].path,
+					      ctx->logs[i].label);
+		if (rc)
+			return rc;
+	}
+
+	for (i = 0; i < ctx->num_aux; i++) {
+		rc = attest_ctx_data_add_file(ctx->d_ctx, CTX_AUX_DATA,
+					      ctx->aux[i].path,
+					      ctx->aux[i].label);
+		if (rc)
+			return rc;
+	}
+
+	list_for_each_entry(item, &ctx->d_ctx->ctx_data[CTX_EVENT_LOG], list)
+		ctx->bytes += item->len;
+
+	return 0;
+}
+
+static int bench_setup_reqs(struct bench_ctx *ctx)
+{
+	int rc;
+
+	if (!ctx->reqs_path)
+		return -ENOENT;
+
+	rc = attest_ctx_verifier_init(&ctx->reqs);
+	if (rc)
+		return rc;
+
+	return attest_ctx_verifier_req_add_json_file(ctx->reqs,
+						     ctx->reqs_path);
+}
+
+static int bench_parse_common(struct bench_ctx *ctx, int verify)
+{
+	attest_ctx_verifier *v_ctx;
+	int rc;
+
+	rc = attest_ctx_verifier_init(&v_ctx);
+	if (rc)
+		return rc;
+
+	attest_ctx_verifier_set_pcr_banks(v_ctx, ctx->pcr_bank_mask);
+
+	if (verify) {
+		rc = attest_ctx_verifier_req_copy(v_ctx, ctx->reqs);
+		if (rc)
+			goto out;
+	}
+
+	rc = attest_pcr_init(v_ctx);
+	if (rc)
+		goto out;
+
+	rc = attest_event_log_parse_verify(ctx->d_ctx, v_ctx, verify);
+	attest_pcr_cleanup(v_ctx);
+out:
+	attest_ctx_verifier_cleanup(v_ctx);
+	return rc;
+}
+
+static int bench_parse_setup(struct bench_ctx *ctx)
+{
+	if (!ctx->num_logs)
+		return -ENOENT;
+
+	return bench_setup_data(ctx);
+}
+
+static int bench_parse_run(struct bench_ctx *ctx)
+{
+	return bench_parse_common(ctx, 0);
+}
+
+static int bench_verify_setup(struct bench_ctx *ctx)
+{
+	int rc;
+
+	rc = bench_parse_setup(ctx);
+	if (rc)
+		return rc;
+
+	return bench_setup_reqs(ctx);
+}
+
+static int bench_verify_run(struct bench_ctx *ctx)
+{
+	return bench_parse_common(ctx, 1);
+}
+
+static int bench_extend_setup(struct bench_ctx *ctx)
+{
+	int rc;
+
+	rc = attest_ctx_verifier_init(&ctx->v_ctx);
+	if (rc)
+		return rc;
+
+	attest_ctx_verifier_set_pcr_banks(ctx->v_ctx, ctx->pcr_bank_mask);
+
+	ctx->data = malloc(SHA512_DIGEST_LENGTH);
+	if (!ctx->data)
+		return -ENOMEM;
+
+	RAND_bytes(ctx->data, SHA512_DIGEST_LENGTH);
+	ctx->ops = EXTEND_OPS;
+
+	return attest_pcr_init(ctx->v_ctx);
+}
+
+static int bench_extend_run(struct bench_ctx *ctx)
+{
+	int rc, i;
+
+	for (i = 0; i < ctx->ops; i++) {
+		rc = attest_pcr_extend(ctx->v_ctx, EXTEND_PCR, ctx->alg,
+				       ctx->data);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static int bench_encode_setup(struct bench_ctx *ctx)
+{
+	ctx->data = malloc(ctx->data_size);
+	if (!ctx->data)
+		return -ENOMEM;
+
+	RAND_bytes(ctx->data, ctx->data_size);
+	ctx->bytes = ctx->data_size;
+	return 0;
+}
+
+static int bench_encode_run(struct bench_ctx *ctx)
+{
+	size_t len;
+	char *out;
+	int rc;
+
+	rc = attest_util_encode_data(ctx->data_size, ctx->data, 0, &len, &out);
+	if (!rc)
+		free(out);
+
+	return rc;
+}
+
+static int bench_decode_setup(struct bench_ctx *ctx)
+{
+	int rc;
+
+	rc = bench_encode_setup(ctx);
+	if (rc)
+		return rc;
+
+	rc = attest_util_encode_data(ctx->data_size, ctx->data, 0,
+				     &ctx->encoded_len, &ctx->encoded);
+	if (rc)
+		return rc;
+
+	ctx->bytes = ctx->encoded_len;
+	return 0;
+}
+
+static int bench_decode_run(struct bench_ctx *ctx)
+{
+	unsigned char *out;
+	size_t len;
+	int rc;
+
+	rc = attest_util_decode_data(ctx->encoded_len, ctx->encoded, 0, &len,
+				     &out);
+	if (!rc)
+		free(out);
+
+	return rc;
+}
+
+static int bench_json_setup(struct bench_ctx *ctx)
+{
+	int rc;
+
+	rc = bench_parse_setup(ctx);
+	if (rc)
+		return rc;
+
+	rc = attest_ctx_data_print_json(ctx->d_ctx, &ctx->json);
+	if (rc)
+		return rc;
+
+	ctx->bytes = strlen(ctx->json);
+	return 0;
+}
+
+static int bench_json_run(struct bench_ctx *ctx)
+{
+	attest_ctx_data *d_ctx;
+	int rc;
+
+	rc = attest_ctx_data_init_flags(&d_ctx, CTX_IN_MEMORY);
+	if (rc)
+		return rc;
+
+	rc = attest_ctx_data_add_json_data(d_ctx, ctx->json, ctx->bytes);
+	attest_ctx_data_cleanup(d_ctx);
+	return rc;
+}
+
+static EVP_PKEY *quote_key_new(void)
+{
+	EVP_PKEY_CTX *pctx;
+	EVP_PKEY *key = NULL;
+
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	if (!pctx)
+		return NULL;
+
+	if (EVP_PKEY_keygen_init(pctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_keygen_bits(pctx, CERT_KEY_BITS) <= 0 ||
+	    EVP_PKEY_keygen(pctx, &key) <= 0)
+		key = NULL;
+
+	EVP_PKEY_CTX_free(pctx);
+	return key;
+}
+
+static int quote_cert_add_ext(X509 *cert, X509 *issuer, int nid,
+			      char *value)
+{
+	X509V3_CTX ext_ctx;
+	X509_EXTENSION *ext;
+	int rc;
+
+	X509V3_set_ctx(&ext_ctx, issuer, cert, NULL, NULL, 0);
+
+	ext = X509V3_EXT_conf_nid(NULL, &ext_ctx, nid, value);
+	if (!ext)
+		return -EINVAL;
+
+	rc = X509_add_ext(cert, ext, -1);
+	X509_EXTENSION_free(ext);
+	return rc == 1 ? 0 : -EINVAL;
+}
+
+/* issuer is NULL for the self-signed CA certificate */
+static X509 *quote_cert_new(const char *cn, EVP_PKEY *key, X509 *issuer,
+			    EVP_PKEY *issuer_key)
+{
+	X509_NAME *name;
+	X509 *cert;
+	int rc = -EINVAL;
+
+	cert = X509_new();
+	if (!cert)
+		return NULL;
+
+	if (!X509_set_version(cert, 2) ||
+	    !ASN1_INTEGER_set(X509_get_serialNumber(cert), issuer ? 2 : 1) ||
+	    !X509_gmtime_adj(X509_get_notBefore(cert), 0) ||
+	    !X509_gmtime_adj(X509_get_notAfter(cert), CERT_DAYS * 86400L) ||
+	    !X509_set_pubkey(cert, key))
+		goto out;
+
+	name = X509_get_subject_name(cert);
+	if (!X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+					(unsigned char *)cn, -1, -1, 0))
+		goto out;
+
+	if (!X509_set_issuer_name(cert, issuer ?
+				  X509_get_subject_name(issuer) : name))
+		goto out;
+
+	if (!issuer) {
+		issuer = cert;
+		issuer_key = key;
+
+		rc = quote_cert_add_ext(cert, issuer, NID_basic_constraints,
+					"critical,CA:TRUE");
+		if (rc)
+			goto out;
+
+		rc = quote_cert_add_ext(cert, issuer, NID_key_usage,
+					"critical,keyCertSign,cRLSign");
+	} else {
+		rc = quote_cert_add_ext(cert, issuer, NID_key_usage,
+					"critical,digitalSignature");
+	}
+
+	if (rc)
+		goto out;
+
+	rc = X509_sign(cert, issuer_key, EVP_sha256()) > 0 ? 0 : -EINVAL;
+out:
+	if (rc) {
+		X509_free(cert);
+		cert = NULL;
+	}
+
+	return cert;
+}
+
+static char *quote_cert_pem(X509 *cert)
+{
+	char *pem = NULL, *data;
+	long len;
+	BIO *bio;
+
+	bio = BIO_new(BIO_s_mem());
+	if (!bio)
+		return NULL;
+
+	if (!PEM_write_bio_X509(bio, cert))
+		goto out;
+
+	len = BIO_get_mem_data(bio, &data);
+
+	pem = malloc(len + 1);
+	if (!pem)
+		goto out;
+
+	memcpy(pem, data, len);
+	pem[len] = '\0';
+out:
+	BIO_free(bio);
+	return pem;
+}
+
+/* TPMS_ATTEST signed by a software AK, in place of TPM2_Quote() */
+static int quote_sign(struct bench_ctx *ctx, int nonce_len, uint8_t *nonce,
+		      UINT16 *attest_len, BYTE **attest, UINT16 *sig_len,
+		      BYTE **sig)
+{
+	struct bench_quote *q = &ctx->quote;
+	EVP_PKEY_CTX *pctx = NULL;
+	TPMS_ATTEST a;
+	TPMT_SIGNATURE s;
+	TPMT_HA digest;
+	size_t len = sizeof(s.signature.rsassa.sig.t.buffer);
+	int rc, digest_len = TSS_GetDigestSize(ctx->alg);
+
+	if (nonce_len > sizeof(a.extraData.t.buffer))
+		return -EINVAL;
+
+	memset(&a, 0, sizeof(a));
+	a.magic = TPM_GENERATED_VALUE;
+	a.type = TPM_ST_ATTEST_QUOTE;
+	a.extraData.t.size = nonce_len;
+	memcpy(a.extraData.t.buffer, nonce, nonce_len);
+	a.attested.quote.pcrSelect = q->pcr_selection;
+	a.attested.quote.pcrDigest.t.size = digest_len;
+	memcpy(a.attested.quote.pcrDigest.t.buffer,
+	       (uint8_t *)&q->pcr_digest.digest, digest_len);
+
+	rc = TSS_Structure_Marshal(attest, attest_len, &a,
+				   (MarshalFunction_t)TSS_TPMS_ATTEST_Marshal);
+	if (rc)
+		return -ENOMEM;
+
+	digest.hashAlg = ctx->alg;
+	rc = TSS_Hash_Generate(&digest, *attest_len, *attest, 0, NULL);
+	if (rc)
+		return -EINVAL;
+
+	rc = -EINVAL;
+
+	pctx = EVP_PKEY_CTX_new(q->ak_key, NULL);
+	if (!pctx)
+		return -ENOMEM;
+
+	if (EVP_PKEY_sign_init(pctx) <= 0 ||
+	    EVP_PKEY_CTX_set_signature_md(pctx,
+			EVP_get_digestbyname(ctx->alg_name)) <= 0 ||
+	    EVP_PKEY_sign(pctx, s.signature.rsassa.sig.t.buffer, &len,
+			  (uint8_t *)&digest.digest, digest_len) <= 0)
+		goto out;
+
+	s.sigAlg = TPM_ALG_RSASSA;
+	s.signature.rsassa.hash = ctx->alg;
+	s.signature.rsassa.sig.t.size = len;
+
+	rc = TSS_Structure_Marshal(sig, sig_len, &s,
+				   (MarshalFunction_t)TSS_TPMT_SIGNATURE_Marshal);
+	if (rc)
+		rc = -ENOMEM;
+out:
+	EVP_PKEY_CTX_free(pctx);
+	return rc;
+}
+
+/* PCRs of the logs provided, and their digest after replaying the logs */
+static int quote_setup_pcrs(struct bench_ctx *ctx)
+{
+	struct bench_quote *q = &ctx->quote;
+	TPMS_PCR_SELECTION *sel = q->pcr_selection.pcrSelections;
+	attest_ctx_verifier *v_ctx;
+	int rc, i;
+
+	q->pcr_selection.count = 1;
+	sel->hash = ctx->alg;
+	sel->sizeofSelect = 3;
+
+	for (i = 0; i < ctx->num_logs; i++) {
+		if (!strcmp(ctx->logs[i].label, "bios"))
+			sel->pcrSelect[0] = 0xff;
+		else if (!strcmp(ctx->logs[i].label, "ima"))
+			sel->pcrSelect[EXTEND_PCR / 8] |= 1 << (EXTEND_PCR % 8);
+	}
+
+	rc = attest_ctx_verifier_init(&v_ctx);
+	if (rc)
+		return rc;
+
+	attest_ctx_verifier_set_pcr_banks(v_ctx, ctx->pcr_bank_mask);
+
+	rc = attest_pcr_init(v_ctx);
+	if (rc)
+		goto out;
+
+	rc = attest_event_log_parse_verify(ctx->d_ctx, v_ctx, 0);
+	if (!rc) {
+		q->pcr_digest.hashAlg = ctx->alg;
+		rc = attest_pcr_calc_digest(v_ctx, &q->pcr_digest,
+					    &q->pcr_selection);
+	}
+
+	attest_pcr_cleanup(v_ctx);
+out:
+	attest_ctx_verifier_cleanup(v_ctx);
+	return rc;
+}
+
+static int bench_quote_setup(struct bench_ctx *ctx)
+{
+	struct bench_quote *q = &ctx->quote;
+	EVP_PKEY *ca_key = NULL;
+	X509 *ca_cert = NULL, *ak_cert = NULL;
+	int rc;
+
+	if (!ctx->reqs_path)
+		return -ENOENT;
+
+	rc = bench_setup_data(ctx);
+	if (rc)
+		return rc;
+
+	rc = quote_setup_pcrs(ctx);
+	if (rc)
+		return rc;
+
+	RAND_bytes(q->hmac_key, sizeof(q->hmac_key));
+
+	rc = -EINVAL;
+
+	ca_key = quote_key_new();
+	q->ak_key = quote_key_new();
+	if (!ca_key || !q->ak_key)
+		goto out;
+
+	ca_cert = quote_cert_new("attest-tools bench CA", ca_key, NULL, NULL);
+	if (!ca_cert)
+		goto out;
+
+	ak_cert = quote_cert_new("attest-tools bench AK", q->ak_key, ca_cert,
+				 ca_key);
+	if (!ak_cert)
+		goto out;
+
+	q->ca_cert = quote_cert_pem(ca_cert);
+	q->ak_cert = quote_cert_pem(ak_cert);
+	if (q->ca_cert && q->ak_cert)
+		rc = 0;
+out:
+	EVP_PKEY_free(ca_key);
+	X509_free(ca_cert);
+	X509_free(ak_cert);
+	return rc;
+}
+
+static int quote_copy_items(attest_ctx_data *d_ctx, attest_ctx_data *src,
+			    enum ctx_fields field)
+{
+	struct data_item *item;
+	int rc;
+
+	list_for_each_entry(item, &src->ctx_data[field], list) {
+		rc = attest_ctx_data_add_copy(d_ctx, field, item->len,
+					      item->data, item->label);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+/* each quote needs a new nonce, nonces cannot be used twice */
+static int bench_quote_prepare(struct bench_ctx *ctx)
+{
+	struct bench_quote *q = &ctx->quote;
+	attest_ctx_data *d_ctx;
+	struct data_item *nonce;
+	char *nonce_req = NULL, *nonce_resp = NULL;
+	BYTE *attest = NULL, *sig = NULL;
+	UINT16 attest_len = 0, sig_len = 0;
+	int rc;
+
+	free(q->message);
+	q->message = NULL;
+
+	rc = attest_ctx_data_init_flags(&d_ctx, CTX_IN_MEMORY);
+	if (rc)
+		return rc;
+
+	rc = attest_ctx_data_add_copy(d_ctx, CTX_AK_CERT, strlen(q->ak_cert),
+				      (unsigned char *)q->ak_cert, NULL);
+	if (!rc)
+		rc = attest_ctx_data_print_json(d_ctx, &nonce_req);
+
+	attest_ctx_data_cleanup(d_ctx);
+
+	if (rc)
+		return rc;
+
+	rc = attest_enroll_msg_gen_quote_nonce(sizeof(q->hmac_key),
+					       q->hmac_key, nonce_req,
+					       &nonce_resp);
+	if (rc)
+		goto out;
+
+	rc = attest_ctx_data_init_flags(&d_ctx, CTX_IN_MEMORY);
+	if (rc)
+		goto out;
+
+	rc = attest_ctx_data_add_msg(d_ctx, nonce_resp);
+	if (rc)
+		goto out_cleanup;
+
+	nonce = attest_ctx_data_get(d_ctx, CTX_NONCE);
+	if (!nonce) {
+		rc = -ENOENT;
+		goto out_cleanup;
+	}
+
+	rc = quote_sign(ctx, nonce->len, nonce->data, &attest_len, &attest,
+			&sig_len, &sig);
+	if (rc)
+		goto out_cleanup;
+
+	rc = attest_ctx_data_add_copy(d_ctx, CTX_AK_CERT, strlen(q->ak_cert),
+				      (unsigned char *)q->ak_cert, NULL);
+	if (!rc)
+		rc = attest_ctx_data_add_copy(d_ctx, CTX_PRIVACY_CA_CERT,
+					      strlen(q->ca_cert),
+					      (unsigned char *)q->ca_cert, NULL);
+	if (!rc)
+		rc = attest_ctx_data_add_copy(d_ctx, CTX_TPMS_ATTEST,
+					      attest_len, attest, NULL);
+	if (!rc)
+		rc = attest_ctx_data_add_copy(d_ctx, CTX_TPMS_ATTEST_SIG,
+					      sig_len, sig, NULL);
+	if (!rc)
+		rc = quote_copy_items(d_ctx, ctx->d_ctx, CTX_EVENT_LOG);
+	if (!rc)
+		rc = quote_copy_items(d_ctx, ctx->d_ctx, CTX_AUX_DATA);
+	if (!rc)
+		rc = attest_ctx_data_print_json(d_ctx, &q->message);
+out_cleanup:
+	attest_ctx_data_cleanup(d_ctx);
+out:
+	free(attest);
+	free(sig);
+	free(nonce_req);
+	free(nonce_resp);
+	return rc;
+}
+
+static int bench_quote_run(struct bench_ctx *ctx)
+{
+	uint8_t *mask = ctx->quote.pcr_selection.pcrSelections[0].pcrSelect;
+	char *message_out = NULL;
+	int rc;
+
+	rc = attest_enroll_msg_process_quote(HMAC_KEY_LEN,
+					     ctx->quote.hmac_key, 3, mask,
+					     ctx->reqs_path, 0,
+					     ctx->quote.message, &message_out);
+	free(message_out);
+	return rc;
+}
+
+static struct bench benchmarks[] = {
+	{.name = "parse", .setup = bench_parse_setup, .run = bench_parse_run},
+	{.name = "verify", .setup = bench_verify_setup,
+	 .run = bench_verify_run},
+	{.name = "extend", .setup = bench_extend_setup,
+	 .run = bench_extend_run},
+	{.name = "encode", .setup = bench_encode_setup,
+	 .run = bench_encode_run},
+	{.name = "decode", .setup = bench_decode_setup,
+	 .run = bench_decode_run},
+	{.name = "json", .setup = bench_json_setup, .run = bench_json_run},
+	{.name = "quote", .setup = bench_quote_setup,
+	 .prepare = bench_quote_prepare, .run = bench_quote_run},
+};
+
+static void bench_cleanup(struct bench_ctx *ctx)
+{
+	if (ctx->v_ctx) {
+		attest_pcr_cleanup(ctx->v_ctx);
+		attest_ctx_verifier_cleanup(ctx->v_ctx);
+	}
+
+	if (ctx->reqs)
+		attest_ctx_verifier_cleanup(ctx->reqs);
+
+	if (ctx->d_ctx)
+		attest_ctx_data_cleanup(ctx->d_ctx);
+
+	EVP_PKEY_free(ctx->quote.ak_key);
+	free(ctx->quote.ak_cert);
+	free(ctx->quote.ca_cert);
+	free(ctx->quote.message);
+	free(ctx->data);
+	free(ctx->encoded);
+	free(ctx->json);
+}
+
+/* output of the library is discarded, unless debugging is requested */
+static int quiet_begin(void)
+{
+	int saved_fd, null_fd;
+
+	fflush(stdout);
+
+	saved_fd = dup(STDOUT_FILENO);
+	if (saved_fd < 0)
+		return -1;
+
+	null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd >= 0) {
+		dup2(null_fd, STDOUT_FILENO);
+		close(null_fd);
+	}
+
+	return saved_fd;
+}
+
+static void quiet_end(int saved_fd)
+{
+	if (saved_fd < 0)
+		return;
+
+	fflush(stdout);
+	dup2(saved_fd, STDOUT_FILENO);
+	close(saved_fd);
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	uint64_t x = *(uint64_t *)a, y = *(uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double sample_us(uint64_t *samples, int num_samples, int pct,
+			int ops)
+{
+	return samples[(num_samples - 1) * pct / 100] / 1000.0 / ops;
+}
+
+/* latencies are per operation, peak RSS includes the setup */
+static void bench_report(struct bench *b, struct bench_ctx *ctx,
+			 uint64_t *samples, int num_samples, int errors,
+			 int rc)
+{
+	struct rusage usage;
+	json_object *root;
+	uint64_t total = 0;
+	double total_sec;
+	int i;
+
+	root = json_object_new_object();
+	if (!root)
+		return;
+
+	json_object_object_add(root, "bench", json_object_new_string(b->name));
+	json_object_object_add(root, "rc", json_object_new_int(rc));
+
+	if (num_samples) {
+		for (i = 0; i < num_samples; i++)
+			total += samples[i];
+
+		qsort(samples, num_samples, sizeof(*samples), compare_samples);
+		total_sec = (double)total / NSEC_PER_SEC;
+
+		json_object_object_add(root, "iterations",
+				       json_object_new_int(num_samples));
+		json_object_object_add(root, "ops_per_iteration",
+				       json_object_new_int(ctx->ops));
+		json_object_object_add(root, "errors",
+				       json_object_new_int(errors));
+		json_object_object_add(root, "ops_per_sec",
+			json_object_new_double(total_sec ?
+			(double)num_samples * ctx->ops / total_sec : 0));
+
+		if (ctx->bytes)
+			json_object_object_add(root, "mb_per_sec",
+				json_object_new_double(total_sec ?
+				(double)num_samples * ctx->bytes /
+				total_sec / 1000000 : 0));
+
+		json_object_object_add(root, "p50_us", json_object_new_double(
+			sample_us(samples, num_samples, 50, ctx->ops)));
+		json_object_object_add(root, "p90_us", json_object_new_double(
+			sample_us(samples, num_samples, 90, ctx->ops)));
+		json_object_object_add(root, "p99_us", json_object_new_double(
+			sample_us(samples, num_samples, 99, ctx->ops)));
+		json_object_object_add(root, "max_us", json_object_new_double(
+			sample_us(samples, num_samples, 100, ctx->ops)));
+	}
+
+	if (!getrusage(RUSAGE_SELF, &usage))
+		json_object_object_add(root, "peak_rss_kb",
+				       json_object_new_int64(usage.ru_maxrss));
+
+	printf("%s\n", json_object_to_json_string_ext(root,
+						      JSON_C_TO_STRING_PLAIN));
+	json_object_put(root);
+}
+
+static int bench_run(struct bench *b, struct bench_ctx *ctx, int iterations,
+		     int warmup, int debug)
+{
+	struct timespec start, end;
+	uint64_t *samples;
+	int rc, i, num_samples = 0, errors = 0, saved_fd = -1;
+
+	samples = calloc(iterations, sizeof(*samples));
+	if (!samples)
+		return -ENOMEM;
+
+	if (!debug)
+		saved_fd = quiet_begin();
+
+	ctx->ops = 1;
+
+	rc = b->setup(ctx);
+	if (rc)
+		goto out;
+
+	for (i = 0; i < warmup + iterations; i++) {
+		if (b->prepare) {
+			rc = b->prepare(ctx);
+			if (rc)
+				break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		rc = b->run(ctx);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (rc)
+			errors++;
+
+		if (i < warmup)
+			continue;
+
+		samples[num_samples++] = (end.tv_sec - start.tv_sec) *
+					 NSEC_PER_SEC + end.tv_nsec -
+					 start.tv_nsec;
+	}
+out:
+	if (!debug)
+		quiet_end(saved_fd);
+
+	bench_report(b, ctx, samples, num_samples, errors, rc);
+	free(samples);
+	return rc ? rc : (errors ? -EINVAL : 0);
+}
+
+static struct option long_options[] = {
+	{"bench", 1, 0, 'b'},
+	{"log", 1, 0, 'l'},
+	{"aux", 1, 0, 'x'},
+	{"reqs", 1, 0, 'r'},
+	{"alg", 1, 0, 'a'},
+	{"iterations", 1, 0, 'n'},
+	{"warmup", 1, 0, 'w'},
+	{"data-size", 1, 0, 's'},
+	{"debug", 0, 0, 'd'},
+	{"help", 0, 0, 'h'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+static void usage(char *argv0)
+{
+	fprintf(stdout, "Usage: %s [options]\n\n"
+		"Options:\n"
+		"\t-b, --bench <name>            benchmark: parse, verify, "
+		"extend, encode,\n"
+		"\t                              decode, json, quote\n"
+		"\t-l, --log <label>=<file>      event log (e.g. bios, ima)\n"
+		"\t-x, --aux <label>=<file>      aux data (e.g. "
+		"x509_ima.der)\n"
+		"\t-r, --reqs <file>             verifier requirements "
+		"(verify, quote)\n"
+		"\t-a, --alg <alg>               PCR bank and quote hash "
+		"(default: sha256)\n"
+		"\t-n, --iterations <num>        measured iterations "
+		"(default: 100)\n"
+		"\t-w, --warmup <num>            iterations not measured "
+		"(default: 1)\n"
+		"\t-s, --data-size <size>        data size for encode, decode "
+		"(default: 1M)\n"
+		"\t-d, --debug                   print output of the library\n"
+		"\t-h, --help                    print this help message\n"
+		"\t-v, --version                 print package version\n"
+		"\n"
+		"Report bugs to " PACKAGE_BUGREPORT "\n",
+		argv0);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx ctx = { .alg_name = "sha256",
+				 .data_size = DEFAULT_DATA_SIZE };
+	struct bench *b = NULL;
+	int rc, option_index, c, i, iterations = DEFAULT_ITERATIONS;
+	int warmup = 1, debug = 0;
+
+	while (1) {
+		option_index = 0;
+		c = getopt_long(argc, argv, "b:l:x:r:a:n:w:s:dhv",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'b':
+				for (i = 0; i < ARRAY_SIZE(benchmarks); i++)
+					if (!strcmp(optarg,
+						    benchmarks[i].name))
+						b = benchmarks + i;
+				break;
+			case 'l':
+				if (bench_add_input(ctx.logs, &ctx.num_logs,
+						    optarg) < 0) {
+					printf("Invalid event log %s\n",
+					       optarg);
+					return 1;
+				}
+				break;
+			case 'x':
+				if (bench_add_input(ctx.aux, &ctx.num_aux,
+						    optarg) < 0) {
+					printf("Invalid aux data %s\n",
+					       optarg);
+					return 1;
+				}
+				break;
+			case 'r':
+				ctx.reqs_path = optarg;
+				break;
+			case 'a':
+				ctx.alg_name = optarg;
+				break;
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'w':
+				warmup = atoi(optarg);
+				break;
+			case 's':
+				ctx.data_size = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				debug = 1;
+				break;
+			case 'h':
+				usage(argv[0]);
+				break;
+			case 'v':
+				fprintf(stdout, "%s " VERSION "\n"
+					"Copyright 2026 attest-tools contributors\n"
+					"License GPLv2: GNU GPL version 2\n",
+					argv[0]);
+				exit(0);
+			default:
+				printf("Unknown option '%c'\n", c);
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (!b) {
+		printf("Benchmark not specified or invalid\n");
+		return 1;
+	}
+
+	if (iterations <= 0 || warmup < 0 || !ctx.data_size) {
+		printf("Invalid number of iterations or data size\n");
+		return 1;
+	}
+
+	ctx.alg = attest_pcr_bank_alg_from_name(ctx.alg_name,
+						strlen(ctx.alg_name));
+
+	for (i = 0; i < PCR_BANK__LAST; i++)
+		if (attest_pcr_bank_alg(i) == ctx.alg)
+			ctx.pcr_bank_mask = 1 << i;
+
+	if (!ctx.pcr_bank_mask) {
+		printf("Unsupported algorithm %s\n", ctx.alg_name);
+		return 1;
+	}
+
+	OpenSSL_add_all_algorithms();
+
+	rc = bench_run(b, &ctx, iterations, warmup, debug);
+	bench_cleanup(&ctx);
+	return rc ? 1 : 0;
+}
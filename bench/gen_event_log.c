@@ -0,0 +1,612 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: gen_event_log.c
+ *      Generate synthetic BIOS and IMA event logs for benchmarks.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/mman.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "util.h"
+
+#define SHA1_LEN 20
+#define SHA256_LEN 32
+
+#define BIOS_ALG_SHA1 0x0004
+#define BIOS_ALG_SHA256 0x000b
+#define BIOS_EV_POST_CODE 1
+#define BIOS_EV_NO_ACTION 3
+#define BIOS_EV_SEPARATOR 4
+#define BIOS_SPEC_ID_SIGNATURE "Spec ID Event03"
+#define BIOS_SPEC_ID_LEN 37
+#define BIOS_NUM_PCRS 8
+#define BIOS_MAX_EVENT_SIZE 65536
+
+#define IMA_PCR 10
+#define IMA_BOOT_AGGREGATE_PCRS 10
+#define IMA_MAX_NAME_LEN 255
+#define IMA_MAX_SIG_LEN 1024
+#define IMA_MAX_TEMPLATE_DATA_LEN 2048
+#define IMA_CERT_NAME "/etc/keys/x509_ima.der"
+
+#define EVM_IMA_XATTR_DIGSIG 3
+#define DIGSIG_VERSION_2 2
+#define DIGSIG_HDR_LEN 9
+#define HASH_ALGO_SHA256 4
+
+enum log_types { LOG_BIOS, LOG_IMA_NG, LOG_IMA_SIG, LOG__LAST };
+
+static const char *log_types_str[LOG__LAST] = {
+	[LOG_BIOS] = "bios",
+	[LOG_IMA_NG] = "ima-ng",
+	[LOG_IMA_SIG] = "ima-sig",
+};
+
+struct gen_buf {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+};
+
+struct ima_signer {
+	EVP_PKEY *key;
+	uint8_t keyid[4];
+	unsigned char cert_digest[SHA256_LEN];
+};
+
+/* the same seed produces the same log */
+static uint64_t rand_state = 1;
+
+static void rand_fill(unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		rand_state ^= rand_state << 13;
+		rand_state ^= rand_state >> 7;
+		rand_state ^= rand_state << 17;
+		buf[i] = rand_state >> 32;
+	}
+}
+
+static int buf_add(struct gen_buf *b, const void *data, size_t len)
+{
+	unsigned char *new_data;
+	size_t new_size = b->size ? b->size : 65536;
+
+	while (new_size < b->len + len)
+		new_size *= 2;
+
+	if (new_size != b->size) {
+		new_data = realloc(b->data, new_size);
+		if (!new_data)
+			return -ENOMEM;
+
+		b->data = new_data;
+		b->size = new_size;
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+static int buf_add_u8(struct gen_buf *b, uint8_t value)
+{
+	return buf_add(b, &value, sizeof(value));
+}
+
+static int buf_add_u16(struct gen_buf *b, uint16_t value)
+{
+	return buf_add(b, &value, sizeof(value));
+}
+
+static int buf_add_u32(struct gen_buf *b, uint32_t value)
+{
+	return buf_add(b, &value, sizeof(value));
+}
+
+static int calc_digest(const char *algo, unsigned char *digest, size_t len,
+		       const void *data)
+{
+	int digest_len;
+
+	return attest_util_calc_digest(algo, &digest_len, digest, len,
+				       (void *)data);
+}
+
+/* header in the TPM 1.2 format, announcing the algorithms of events */
+static int gen_bios_header(struct gen_buf *b)
+{
+	unsigned char signature[16] = BIOS_SPEC_ID_SIGNATURE;
+	unsigned char zero[SHA1_LEN] = { 0 };
+	int rc = 0;
+
+	rc |= buf_add_u32(b, 0);
+	rc |= buf_add_u32(b, BIOS_EV_NO_ACTION);
+	rc |= buf_add(b, zero, sizeof(zero));
+	rc |= buf_add_u32(b, BIOS_SPEC_ID_LEN);
+	rc |= buf_add(b, signature, sizeof(signature));
+	rc |= buf_add_u32(b, 0);	/* platform class */
+	rc |= buf_add_u8(b, 0);		/* spec version minor */
+	rc |= buf_add_u8(b, 2);		/* spec version major */
+	rc |= buf_add_u8(b, 0);		/* spec errata */
+	rc |= buf_add_u8(b, 2);		/* uintn size */
+	rc |= buf_add_u32(b, 2);
+	rc |= buf_add_u16(b, BIOS_ALG_SHA1);
+	rc |= buf_add_u16(b, SHA1_LEN);
+	rc |= buf_add_u16(b, BIOS_ALG_SHA256);
+	rc |= buf_add_u16(b, SHA256_LEN);
+	rc |= buf_add_u8(b, 0);		/* vendor info size */
+
+	return rc ? -ENOMEM : 0;
+}
+
+static int gen_bios_event(struct gen_buf *b, uint32_t pcr, uint32_t type,
+			  uint32_t event_size, unsigned char *event)
+{
+	unsigned char sha1[SHA1_LEN], sha256[SHA256_LEN];
+	int rc;
+
+	rc = calc_digest("sha1", sha1, event_size, event);
+	if (rc)
+		return rc;
+
+	rc = calc_digest("sha256", sha256, event_size, event);
+	if (rc)
+		return rc;
+
+	rc |= buf_add_u32(b, pcr);
+	rc |= buf_add_u32(b, type);
+	rc |= buf_add_u32(b, 2);
+	rc |= buf_add_u16(b, BIOS_ALG_SHA1);
+	rc |= buf_add(b, sha1, sizeof(sha1));
+	rc |= buf_add_u16(b, BIOS_ALG_SHA256);
+	rc |= buf_add(b, sha256, sizeof(sha256));
+	rc |= buf_add_u32(b, event_size);
+	rc |= buf_add(b, event, event_size);
+
+	return rc ? -ENOMEM : 0;
+}
+
+/* num_entries events on PCRs 0-7, followed by one separator per PCR */
+static int gen_bios(struct gen_buf *b, int num_entries, int event_size)
+{
+	unsigned char event[BIOS_MAX_EVENT_SIZE], separator[4] = { 0 };
+	int rc, i;
+
+	rc = gen_bios_header(b);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < num_entries; i++) {
+		rand_fill(event, event_size);
+
+		rc = gen_bios_event(b, i % BIOS_NUM_PCRS, BIOS_EV_POST_CODE,
+				    event_size, event);
+		if (rc)
+			return rc;
+	}
+
+	for (i = 0; i < BIOS_NUM_PCRS; i++) {
+		rc = gen_bios_event(b, i, BIOS_EV_SEPARATOR, sizeof(separator),
+				    separator);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void extend_sha256(unsigned char *pcr, const unsigned char *digest)
+{
+	unsigned char buf[SHA256_LEN * 2];
+
+	memcpy(buf, pcr, SHA256_LEN);
+	memcpy(buf + SHA256_LEN, digest, SHA256_LEN);
+	calc_digest("sha256", pcr, sizeof(buf), buf);
+}
+
+/* only logs written by gen_bios() are replayed, the SHA256 bank is used */
+static int replay_bios(const char *path,
+		       unsigned char pcrs[][SHA256_LEN])
+{
+	const size_t event_head = 3 * sizeof(uint32_t) +
+				  2 * sizeof(uint16_t) + SHA1_LEN + SHA256_LEN;
+	const size_t header_len = 3 * sizeof(uint32_t) + SHA1_LEN +
+				  BIOS_SPEC_ID_LEN;
+	unsigned char *data, *ptr;
+	uint32_t pcr, event_size;
+	size_t len, offset;
+	int rc;
+
+	rc = attest_util_read_file(path, &len, &data);
+	if (rc)
+		return rc;
+
+	rc = -EINVAL;
+
+	if (len < header_len)
+		goto out;
+
+	for (offset = header_len; offset < len; offset += event_size) {
+		if (len - offset < event_head + sizeof(event_size))
+			goto out;
+
+		ptr = data + offset;
+		memcpy(&pcr, ptr, sizeof(pcr));
+		if (pcr >= BIOS_NUM_PCRS)
+			goto out;
+
+		memcpy(&event_size, ptr + event_head, sizeof(event_size));
+		offset += event_head + sizeof(event_size);
+
+		if (len - offset < event_size)
+			goto out;
+
+		extend_sha256(pcrs[pcr], ptr + event_head - SHA256_LEN);
+	}
+
+	rc = 0;
+out:
+	munmap(data, len);
+	return rc;
+}
+
+static int ima_sign(struct ima_signer *signer, const unsigned char *digest,
+		    unsigned char *sig, uint32_t *sig_len)
+{
+	EVP_PKEY_CTX *ctx;
+	size_t len = IMA_MAX_SIG_LEN - DIGSIG_HDR_LEN;
+	int rc = -EINVAL;
+
+	ctx = EVP_PKEY_CTX_new(signer->key, NULL);
+	if (!ctx)
+		return -ENOMEM;
+
+	if (EVP_PKEY_sign_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) <= 0 ||
+	    EVP_PKEY_sign(ctx, sig + DIGSIG_HDR_LEN, &len, digest,
+			  SHA256_LEN) <= 0)
+		goto out;
+
+	sig[0] = EVM_IMA_XATTR_DIGSIG;
+	sig[1] = DIGSIG_VERSION_2;
+	sig[2] = HASH_ALGO_SHA256;
+	memcpy(sig + 3, signer->keyid, sizeof(signer->keyid));
+	sig[7] = len >> 8;
+	sig[8] = len & 0xff;
+
+	*sig_len = DIGSIG_HDR_LEN + len;
+	rc = 0;
+out:
+	EVP_PKEY_CTX_free(ctx);
+	return rc;
+}
+
+/* template data: d-ng|n-ng, followed by sig for ima-sig */
+static int gen_ima_entry(struct gen_buf *b, enum log_types type,
+			 const unsigned char *digest, const char *name,
+			 const unsigned char *sig, uint32_t sig_len)
+{
+	unsigned char data[IMA_MAX_TEMPLATE_DATA_LEN], *ptr = data;
+	unsigned char template_digest[SHA1_LEN];
+	const char *template = log_types_str[type];
+	const char algo[] = "sha256:";
+	uint32_t len;
+	int rc;
+
+	len = sizeof(algo) + SHA256_LEN;
+	memcpy(ptr, &len, sizeof(len));
+	memcpy(ptr + sizeof(len), algo, sizeof(algo));
+	memcpy(ptr + sizeof(len) + sizeof(algo), digest, SHA256_LEN);
+	ptr += sizeof(len) + len;
+
+	len = strlen(name) + 1;
+	memcpy(ptr, &len, sizeof(len));
+	memcpy(ptr + sizeof(len), name, len);
+	ptr += sizeof(len) + len;
+
+	if (type == LOG_IMA_SIG) {
+		memcpy(ptr, &sig_len, sizeof(sig_len));
+		memcpy(ptr + sizeof(sig_len), sig, sig_len);
+		ptr += sizeof(sig_len) + sig_len;
+	}
+
+	rc = calc_digest("sha1", template_digest, ptr - data, data);
+	if (rc)
+		return rc;
+
+	rc |= buf_add_u32(b, IMA_PCR);
+	rc |= buf_add(b, template_digest, sizeof(template_digest));
+	rc |= buf_add_u32(b, strlen(template));
+	rc |= buf_add(b, template, strlen(template));
+	rc |= buf_add_u32(b, ptr - data);
+	rc |= buf_add(b, data, ptr - data);
+
+	return rc ? -ENOMEM : 0;
+}
+
+static int gen_ima(struct gen_buf *b, enum log_types type, int num_entries,
+		   const char *bios_path, struct ima_signer *signer)
+{
+	unsigned char pcrs[IMA_BOOT_AGGREGATE_PCRS][SHA256_LEN];
+	unsigned char digest[SHA256_LEN], sig[IMA_MAX_SIG_LEN];
+	char name[IMA_MAX_NAME_LEN + 1];
+	uint32_t sig_len = 0;
+	int rc, i;
+
+	/* without BIOS log, the boot aggregate is calculated on zero PCRs */
+	memset(pcrs, 0, sizeof(pcrs));
+
+	if (bios_path) {
+		rc = replay_bios(bios_path, pcrs);
+		if (rc) {
+			printf("Cannot replay BIOS event log %s\n", bios_path);
+			return rc;
+		}
+	}
+
+	rc = calc_digest("sha256", digest, sizeof(pcrs), pcrs);
+	if (rc)
+		return rc;
+
+	rc = gen_ima_entry(b, type, digest, "boot_aggregate", NULL, 0);
+	if (rc)
+		return rc;
+
+	if (signer) {
+		rc = gen_ima_entry(b, type, signer->cert_digest, IMA_CERT_NAME,
+				   NULL, 0);
+		if (rc)
+			return rc;
+	}
+
+	for (i = 0; i < num_entries; i++) {
+		rand_fill(digest, sizeof(digest));
+		snprintf(name, sizeof(name), "/usr/bin/file%d", i);
+
+		if (signer) {
+			rc = ima_sign(signer, digest, sig, &sig_len);
+			if (rc)
+				return rc;
+		}
+
+		rc = gen_ima_entry(b, type, digest, name, sig, sig_len);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+/* the key ID is taken from the certificate, as the ima_sig verifier does */
+static int load_signer(const char *key_path, const char *cert_path,
+		       struct ima_signer *signer)
+{
+	ASN1_OCTET_STRING *skid = NULL;
+	const unsigned char *ptr;
+	unsigned char *cert_data;
+	size_t cert_len;
+	X509 *cert = NULL;
+	FILE *fp;
+	int rc;
+
+	fp = fopen(key_path, "r");
+	if (!fp) {
+		printf("Cannot open %s\n", key_path);
+		return -ENOENT;
+	}
+
+	signer->key = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+	fclose(fp);
+
+	if (!signer->key) {
+		printf("Cannot read private key %s\n", key_path);
+		return -EINVAL;
+	}
+
+	rc = attest_util_read_file(cert_path, &cert_len, &cert_data);
+	if (rc) {
+		printf("Cannot read %s\n", cert_path);
+		return rc;
+	}
+
+	rc = -EINVAL;
+
+	ptr = cert_data;
+	cert = d2i_X509(NULL, &ptr, cert_len);
+	if (!cert) {
+		printf("Cannot parse DER certificate %s\n", cert_path);
+		goto out;
+	}
+
+	skid = X509_get_ext_d2i(cert, NID_subject_key_identifier, NULL, NULL);
+	if (!skid || ASN1_STRING_length(skid) < sizeof(signer->keyid)) {
+		printf("Subject key identifier not found in %s\n", cert_path);
+		goto out;
+	}
+
+	memcpy(signer->keyid, ASN1_STRING_get0_data(skid) +
+	       ASN1_STRING_length(skid) - sizeof(signer->keyid),
+	       sizeof(signer->keyid));
+
+	rc = calc_digest("sha256", signer->cert_digest, cert_len, cert_data);
+out:
+	ASN1_OCTET_STRING_free(skid);
+	X509_free(cert);
+	munmap(cert_data, cert_len);
+	return rc;
+}
+
+static struct option long_options[] = {
+	{"type", 1, 0, 't'},
+	{"num-entries", 1, 0, 'n'},
+	{"event-size", 1, 0, 's'},
+	{"seed", 1, 0, 'S'},
+	{"bios-log", 1, 0, 'b'},
+	{"key", 1, 0, 'k'},
+	{"cert", 1, 0, 'c'},
+	{"output", 1, 0, 'o'},
+	{"help", 0, 0, 'h'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+static void usage(char *argv0)
+{
+	fprintf(stdout, "Usage: %s [options]\n\n"
+		"Options:\n"
+		"\t-t, --type <type>             log type: bios, ima-ng, "
+		"ima-sig\n"
+		"\t-n, --num-entries <num>       number of entries "
+		"(default: 1000)\n"
+		"\t-s, --event-size <size>       size of BIOS events "
+		"(default: 64)\n"
+		"\t-S, --seed <seed>             seed of generated data "
+		"(default: 1)\n"
+		"\t-b, --bios-log <file>         BIOS log for the IMA boot "
+		"aggregate\n"
+		"\t-k, --key <file>              PEM private key to sign "
+		"IMA entries\n"
+		"\t-c, --cert <file>             DER certificate of the "
+		"signing key\n"
+		"\t-o, --output <file>           event log (default: stdout)\n"
+		"\t-h, --help                    print this help message\n"
+		"\t-v, --version                 print package version\n"
+		"\n"
+		"Report bugs to " PACKAGE_BUGREPORT "\n",
+		argv0);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct gen_buf b = { 0 };
+	struct ima_signer signer = { 0 };
+	enum log_types type = LOG__LAST;
+	char *key_path = NULL, *cert_path = NULL, *bios_path = NULL;
+	char *output_path = NULL;
+	int rc, option_index, c, num_entries = 1000, event_size = 64;
+	FILE *fp = stdout;
+
+	while (1) {
+		option_index = 0;
+		c = getopt_long(argc, argv, "t:n:s:S:b:k:c:o:hv", long_options,
+				&option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 't':
+				for (type = 0; type < LOG__LAST; type++)
+					if (!strcmp(optarg,
+						    log_types_str[type]))
+						break;
+				break;
+			case 'n':
+				num_entries = atoi(optarg);
+				break;
+			case 's':
+				event_size = atoi(optarg);
+				break;
+			case 'S':
+				rand_state = strtoull(optarg, NULL, 10) | 1;
+				break;
+			case 'b':
+				bios_path = optarg;
+				break;
+			case 'k':
+				key_path = optarg;
+				break;
+			case 'c':
+				cert_path = optarg;
+				break;
+			case 'o':
+				output_path = optarg;
+				break;
+			case 'h':
+				usage(argv[0]);
+				break;
+			case 'v':
+				fprintf(stdout, "%s " VERSION "\n"
+					"Copyright 2026 attest-tools contributors\n"
+					"License GPLv2: GNU GPL version 2\n",
+					argv[0]);
+				exit(0);
+			default:
+				printf("Unknown option '%c'\n", c);
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (type == LOG__LAST) {
+		printf("Log type not specified or invalid\n");
+		return 1;
+	}
+
+	if (num_entries < 0 || event_size <= 0 ||
+	    event_size > BIOS_MAX_EVENT_SIZE) {
+		printf("Invalid number of entries or event size\n");
+		return 1;
+	}
+
+	if ((key_path != NULL) != (cert_path != NULL) ||
+	    (key_path && type != LOG_IMA_SIG)) {
+		printf("Key and certificate are required to sign ima-sig "
+		       "entries\n");
+		return 1;
+	}
+
+	if (key_path) {
+		rc = load_signer(key_path, cert_path, &signer);
+		if (rc)
+			goto out;
+	}
+
+	if (type == LOG_BIOS)
+		rc = gen_bios(&b, num_entries, event_size);
+	else
+		rc = gen_ima(&b, type, num_entries, bios_path,
+			     key_path ? &signer : NULL);
+	if (rc)
+		goto out;
+
+	if (output_path) {
+		fp = fopen(output_path, "w");
+		if (!fp) {
+			printf("Cannot create %s\n", output_path);
+			rc = -EACCES;
+			goto out;
+		}
+	}
+
+	if (fwrite(b.data, 1, b.len, fp) != b.len)
+		rc = -EIO;
+
+	if (output_path && fclose(fp))
+		rc = -EIO;
+
+	if (rc)
+		printf("Cannot write event log\n");
+out:
+	EVP_PKEY_free(signer.key);
+	free(b.data);
+	return rc ? 1 : 0;
+}
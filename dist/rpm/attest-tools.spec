@@ -8,8 +8,8 @@ BuildRoot:      %{_tmppath}/%{name}-%{version}-%{release}-root-%(%{__id_u} -n)
 License:        GPLv2
 Url:            https://gitee.com/openeuler/attest-tools
 BuildRequires:  autoconf automake libcurl-devel libtool openssl-devel
-BuildRequires:  digest-list-tools-devel json-c-devel libcurl-devel tss2-devel
-Requires:       json-c curl tss2
+BuildRequires:  digest-list-tools-devel json-c-devel libcurl-devel tss2-devel zlib-devel
+Requires:       json-c curl tss2 zlib
 
 %if 0%{?suse_version}
 BuildRequires:  libopenssl-devel
@@ -63,6 +63,7 @@ rm -rf $RPM_BUILD_ROOT
 %config(noreplace) %{_sysconfdir}/sysconfig/attest_ra_server
 %config(noreplace) %{_sysconfdir}/sysconfig/attest_tls_server
 %{_unitdir}/attest_ra_server.service
+%{_unitdir}/attest_ra_server.socket
 %{_unitdir}/attest_tls_server.service
 %{_libdir}/libenroll_client.so
 %{_libdir}/libverifier_ima_policy.so
@@ -72,6 +73,7 @@ rm -rf $RPM_BUILD_ROOT
 %{_libdir}/libverifier_dummy.so
 %{_libdir}/libenroll_server.so
 %{_libdir}/libverifier_ima_cp.so
+%{_libdir}/libverifier_ima_allowlist.so
 %{_libdir}/libverifier_ima_sig.so
 %{_libdir}/libverifier_evm_key.so
 %{_libdir}/libeventlog_ima.so
@@ -84,6 +86,10 @@ rm -rf $RPM_BUILD_ROOT
 %{_bindir}/attest_tls_server
 %{_bindir}/attest_ra_server
 %{_bindir}/attest_ra_client
+%{_bindir}/attest_ra_fleet
+%{_bindir}/attest_ra_load
+%{_bindir}/attest_verify_quotes
+%{_bindir}/attest_build_allowlist
 %{_bindir}/attest_create_skae
 %{_bindir}/attest_certify.sh
 %{_bindir}/ekcert_read.sh
@@ -31,5 +31,8 @@
 #define SYM_KEY_PUB_PATH ATTEST_TOOLS_CONF_DIR "sym_key_pub.bin"
 #define SYM_KEY_POLICY_PATH ATTEST_TOOLS_CONF_DIR "sym_key_policy.txt"
 #define SYM_KEY_BLOB ATTEST_TOOLS_CONF_DIR "trusted_key.blob"
+#define IMA_CURSOR_PATH ATTEST_TOOLS_CONF_DIR "ima_cursor.txt"
+#define IMA_CURSOR_NEW_PATH IMA_CURSOR_PATH ".new"
+#define IMA_ALLOWLIST_PATH ATTEST_TOOLS_CONF_DIR "ima_allowlist.bin"
 
 #endif /*_CONF_H*/
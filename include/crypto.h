@@ -31,5 +31,9 @@ int attest_crypto_verify_cert(attest_ctx_data *d_ctx,
 			      attest_ctx_verifier *v_ctx,
 			      enum ctx_fields cert, enum ctx_fields ca,
 			      X509 **x509);
+int attest_crypto_make_credential(EVP_PKEY *ek_pub, TPM2B_DIGEST *cred,
+				  TPM2B_NAME *name, BYTE **cred_blob,
+				  UINT16 *cred_blob_len, BYTE **secret,
+				  UINT16 *secret_len);
 
 #endif /*_CRYPTO_H*/
@@ -18,6 +18,10 @@
 #include "list.h"
 #include "stdint.h"
 
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
 #define MAX_PATH_LENGTH 2048
 
 enum ctx_fields { CTX_PRIVACY_CA_CERT, CTX_AK_CERT, CTX_TPM_AK_KEY,
@@ -26,38 +30,143 @@ enum ctx_fields { CTX_PRIVACY_CA_CERT, CTX_AK_CERT, CTX_TPM_AK_KEY,
 		  CTX_CRED, CTX_CRED_HMAC, CTX_CREDBLOB, CTX_SECRET, CTX_CSR,
 		  CTX_KEY_CERT, CTX_CA_CERT, CTX_HOSTNAME, CTX_TPM_SYM_KEY,
 		  CTX_NONCE, CTX_NONCE_HMAC, CTX_TPMS_ATTEST,
-		  CTX_TPMS_ATTEST_SIG, CTX__LAST };
+		  CTX_TPMS_ATTEST_SIG, CTX_EVENT_LOG_OFFSET, CTX_AUX_DIGEST,
+		  CTX__LAST };
+
+/* fields whose items are identified by a label instead of an index */
+#define CTX_FIELD_LABELED(field) \
+	((field) == CTX_EVENT_LOG || (field) == CTX_AUX_DATA || \
+	 (field) == CTX_EVENT_LOG_OFFSET)
 
-enum data_formats { DATA_FMT_BASE64, DATA_FMT_URI, DATA_FMT__LAST };
+enum data_formats { DATA_FMT_BASE64, DATA_FMT_URI, DATA_FMT_ZLIB_BASE64,
+		    DATA_FMT__LAST };
 
 struct data_item {
 	struct list_head list;
+	struct list_head label_list;
+	struct list_head digests;
 	char *mapped_file;
 	size_t len;
 	unsigned char *data;
 	char *label;
+	uint16_t flags;
 };
 
+#define DATA_ITEM_IN_MEMORY		0x0001
+#define DATA_ITEM_REF			0x0002
+#define DATA_ITEM_STORED		0x0004
+#define DATA_ITEM_BORROWED		0x0008
+#define DATA_ITEM_PENDING		0x0010
+
+#define CTX_LABEL_HASH_SIZE 64
+
 #define CTX_INIT			0x01
 #define CTX_ALLOW_IMA_VIOLATIONS	0x02
 #define CTX_SKIP_SIG_VER		0x04
+#define CTX_IN_MEMORY			0x08
+#define CTX_CHECKPOINT			0x10
+#define CTX_DOWNLOAD_BATCH		0x20
+#define CTX_COMPRESS			0x40
+#define CTX_LOG_TIMING			0x80
+#define CTX_ALLOW_NONCE_REUSE		0x100
+#define CTX_SKIP_NONCE_HMAC		0x200
+#define CTX_RESTRICT_URI		0x400
+
+/**
+ * Prototype of the function to get data from a content-addressed store
+ * @param[in] algo		digest algorithm
+ * @param[in] digest_len	digest length
+ * @param[in] digest		digest
+ * @param[in,out] len		data length
+ * @param[in,out] data		data (to be freed by the caller)
+ *
+ * @returns 0 on success, a negative value on error
+ */
+typedef int (*data_store_get_func)(const char *algo, int digest_len,
+				   const uint8_t *digest, size_t *len,
+				   unsigned char **data);
+
+/**
+ * Prototype of the function to add data to a content-addressed store
+ * @param[in] algo		digest algorithm
+ * @param[in] digest_len	digest length
+ * @param[in] digest		digest
+ * @param[in] len		data length
+ * @param[in] data		data
+ */
+typedef void (*data_store_put_func)(const char *algo, int digest_len,
+				    const uint8_t *digest, size_t len,
+				    const unsigned char *data);
+
+/**
+ * Prototype of the function to reserve memory for data of data contexts
+ * @param[in] priv	data passed to attest_ctx_data_set_memory_funcs()
+ * @param[in] len	length of memory to reserve
+ *
+ * @returns 0 on success, a negative value if memory is not available
+ */
+typedef int (*data_memory_get_func)(void *priv, size_t len);
+
+/**
+ * Prototype of the function to release memory reserved for data
+ * @param[in] priv	data passed to attest_ctx_data_set_memory_funcs()
+ * @param[in] len	length of memory to release
+ */
+typedef void (*data_memory_put_func)(void *priv, size_t len);
 
 typedef struct {
 	struct list_head ctx_data[CTX__LAST];
+	struct list_head digest_indexes;
+	struct list_head label_index[CTX_LABEL_HASH_SIZE];
+	struct list_head downloads;
 	char *data_dir;
+	data_store_get_func store_get;
+	data_store_put_func store_put;
+	size_t decompressed_len;
+	size_t memory_used;
+	int num_downloads;
 	uint16_t flags;
 } attest_ctx_data;
 
+#define CTX_LOG_ARENA_SIZE 16
+
+/* reason of a failed log without one is "<cause operation> failed" */
+struct verification_log {
+	struct list_head list;
+	const char *operation;
+	const char *result;
+	char *reason;
+	struct verification_log *cause;
+	struct timespec start;
+	struct timespec end;
+	size_t entries;
+	size_t bytes;
+};
+
 typedef struct {
 	struct list_head event_logs;
 	struct list_head verifiers;
 	struct list_head logs;
 	void *pcr;
+	void *checkpoint;
+	void *new_checkpoint;
+	void *arena;
+	struct verification_log log_arena[CTX_LOG_ARENA_SIZE];
+	int log_arena_used;
+	pthread_mutex_t logs_lock;
 	uint8_t pcr_mask[3];
+	uint8_t pcr_bank_mask;
 	unsigned char key[64];
 	uint16_t flags;
+	int num_threads;
 } attest_ctx_verifier;
 
+/* logs of a thread running a verifier concurrently with the others */
+struct verification_thread_logs {
+	attest_ctx_verifier *ctx;
+	struct list_head logs;
+};
+
 /** @ingroup verifier-api
  * Prototype of the function to verify event logs
  * @param[in] d_ctx	data context
@@ -68,20 +177,104 @@ typedef struct {
 typedef int (*verifier_func)(attest_ctx_data *d_ctx,
 			     attest_ctx_verifier *v_ctx);
 
+/** @ingroup verifier-api
+ * Prototype of the function to parse the requirement of a verifier
+ * @param[in] v_ctx	verifier context the requirement is added to
+ * @param[in] req	requirement
+ * @param[in,out] priv	parsed requirement
+ *
+ * Errors are reported with check_goto(), in the log of v_ctx.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+typedef int (*verifier_init_func)(attest_ctx_verifier *v_ctx,
+				  const char *req, void **priv);
+
+/** @ingroup verifier-api
+ * Prototype of the function to free a parsed requirement
+ * @param[in] priv	parsed requirement
+ */
+typedef void (*verifier_cleanup_func)(void *priv);
+
+struct event_log;
+struct event_log_entry;
+
+/** @ingroup verifier-api
+ * Prototype of the function called before event log entries are verified
+ * @param[in] d_ctx	data context
+ * @param[in] v_ctx	verifier context
+ * @param[in,out] state	verification state, passed to the other functions
+ *
+ * @returns 0 on success, a negative value on error
+ */
+typedef int (*verifier_begin_func)(attest_ctx_data *d_ctx,
+				   attest_ctx_verifier *v_ctx, void **state);
+
+/** @ingroup verifier-api
+ * Prototype of the function to verify an event log entry
+ * @param[in] d_ctx	data context
+ * @param[in] v_ctx	verifier context
+ * @param[in] event_log	event log the entry belongs to
+ * @param[in] log_entry	event log entry
+ * @param[in] state	verification state
+ *
+ * @returns 0 on success, a negative value on error
+ */
+typedef int (*verifier_entry_func)(attest_ctx_data *d_ctx,
+				   attest_ctx_verifier *v_ctx,
+				   struct event_log *event_log,
+				   struct event_log_entry *log_entry,
+				   void *state);
+
+/** @ingroup verifier-api
+ * Prototype of the function called after all entries have been verified
+ * @param[in] d_ctx	data context
+ * @param[in] v_ctx	verifier context
+ * @param[in] state	verification state, to be freed
+ * @param[in] rc	error of the verification of the entries, 0 on success
+ *
+ * @returns 0 on success, a negative value on error
+ */
+typedef int (*verifier_end_func)(attest_ctx_data *d_ctx,
+				 attest_ctx_verifier *v_ctx, void *state,
+				 int rc);
+
+/*
+ * Verifiers either provide func(), or begin(), on_entry() and end() to
+ * verify entries while the event logs are walked once for all verifiers.
+ *
+ * Members after req are not known to plugins built before they were added.
+ * Plugins export the size of the structure they were built with in
+ * func_size, and those without it are assumed to provide only the members
+ * until req (VERIFIER_STRUCT_SIZE_V0). New members must be added at the end.
+ */
 struct verifier_struct {
 	struct list_head list;
 	const char *id;
 	void *handle;
 	verifier_func func;
 	char *req;
+	verifier_init_func init;
+	verifier_cleanup_func cleanup;
+	verifier_begin_func begin;
+	verifier_entry_func on_entry;
+	verifier_end_func end;
+	void *priv;
+	void *state;
+	uint16_t flags;
 };
 
-struct verification_log {
-	struct list_head list;
-	const char *operation;
-	const char *result;
-	char *reason;
-};
+#define VERIFIER_STRUCT_SIZE_V0 offsetof(struct verifier_struct, init)
+
+/* requirement and parsed requirement owned by another verifier context */
+#define VERIFIER_REQ_SHARED	0x0001
+/* begin() succeeded, end() must be called */
+#define VERIFIER_STARTED	0x0002
+/*
+ * func() only reads the event logs and the PCRs, and only marks entries as
+ * processed: it can run concurrently with other verifiers
+ */
+#define VERIFIER_PARALLEL	0x0004
 
 extern struct verification_log unknown_log;
 
@@ -110,26 +303,50 @@ int attest_ctx_data_add(attest_ctx_data *ctx, enum ctx_fields field,
 int attest_ctx_data_add_copy(attest_ctx_data *ctx, enum ctx_fields field,
 			     size_t len, unsigned char *data,
 			     const char *label);
+int attest_ctx_data_add_ref(attest_ctx_data *ctx, enum ctx_fields field,
+			    char *path, const char *label);
 int attest_ctx_data_add_file(attest_ctx_data *ctx, enum ctx_fields field,
 			     char *path, const char *label);
 int attest_ctx_data_add_dir(attest_ctx_data *ctx, enum ctx_fields field,
 			    char *dir_path, const char *label);
+int attest_ctx_data_add_decoded(attest_ctx_data *ctx, enum ctx_fields field,
+				size_t len, unsigned char *data,
+				const char *label);
+int attest_ctx_data_add_borrowed(attest_ctx_data *ctx, enum ctx_fields field,
+				 size_t len, unsigned char *data,
+				 const char *label);
 int attest_ctx_data_add_string(attest_ctx_data *ctx, enum ctx_fields field,
 			     const char *string, const char *label);
+void attest_ctx_data_download_begin(attest_ctx_data *ctx);
+int attest_ctx_data_download_end(attest_ctx_data *ctx);
 int attest_ctx_data_new_string(enum data_formats fmt, size_t data_len,
 			       unsigned char *data, char **string);
+int attest_ctx_data_item_check(struct data_item *item);
 struct data_item *attest_ctx_data_lookup_by_label(attest_ctx_data *ctx,
 						  const char *label);
 struct data_item *attest_ctx_data_lookup_by_digest(attest_ctx_data *ctx,
 				const char *algo, const uint8_t *digest);
+void attest_ctx_data_set_store(attest_ctx_data *ctx, data_store_get_func get,
+			       data_store_put_func put);
+void attest_ctx_data_set_memory_funcs(data_memory_get_func get,
+				      data_memory_put_func put, void *priv);
+int attest_ctx_data_load_uri_allowlist(const char *path);
+char *attest_ctx_data_get_dir(attest_ctx_data *ctx);
+char *attest_ctx_data_get_path(attest_ctx_data *ctx, struct data_item *item);
 attest_ctx_data *attest_ctx_data_get_global(void);
 int attest_ctx_data_init(attest_ctx_data **ctx);
+int attest_ctx_data_init_flags(attest_ctx_data **ctx, uint16_t flags);
 void attest_ctx_data_cleanup(attest_ctx_data *ctx);
 
+void *attest_ctx_plugin_get_sym(const char *library_name, const char *sym_name);
+void attest_ctx_plugin_cleanup(void);
+
 struct verifier_struct *attest_ctx_verifier_lookup(attest_ctx_verifier *ctx,
 						   const char *id);
 int attest_ctx_verifier_req_add(attest_ctx_verifier *ctx,
 				const char *verifier_str, const char *req);
+int attest_ctx_verifier_req_copy(attest_ctx_verifier *ctx,
+				 attest_ctx_verifier *src);
 struct verification_log *attest_ctx_verifier_add_log(attest_ctx_verifier *ctx,
 						     const char *operation);
 struct verification_log *attest_ctx_verifier_get_log(attest_ctx_verifier *ctx);
@@ -137,6 +354,13 @@ void attest_ctx_verifier_set_log(struct verification_log *log,
 				 const char *fmt, ...);
 void attest_ctx_verifier_end_log(attest_ctx_verifier *ctx,
 				 struct verification_log *log, int result);
+void attest_ctx_verifier_log_account(struct verification_log *log,
+				     size_t entries, size_t bytes);
+void attest_ctx_verifier_thread_logs_start(attest_ctx_verifier *ctx,
+				struct verification_thread_logs *thread_logs);
+void attest_ctx_verifier_thread_logs_stop(void);
+void attest_ctx_verifier_thread_logs_splice(
+				struct verification_thread_logs *thread_logs);
 attest_ctx_verifier *attest_ctx_verifier_get_global(void);
 int attest_ctx_verifier_init(attest_ctx_verifier **ctx);
 int attest_ctx_verifier_set_key(attest_ctx_verifier *ctx, int key_len,
@@ -144,6 +368,11 @@ int attest_ctx_verifier_set_key(attest_ctx_verifier *ctx, int key_len,
 int attest_ctx_verifier_set_pcr_mask(attest_ctx_verifier *ctx,
 				     int pcr_mask_len, uint8_t *pcr_mask);
 void attest_ctx_verifier_set_flags(attest_ctx_verifier *ctx, uint16_t flags);
+void attest_ctx_verifier_set_num_threads(attest_ctx_verifier *ctx,
+					 int num_threads);
+int attest_ctx_verifier_get_num_threads(attest_ctx_verifier *ctx);
+void attest_ctx_verifier_set_pcr_banks(attest_ctx_verifier *ctx,
+				       uint8_t pcr_bank_mask);
 void attest_ctx_verifier_cleanup(attest_ctx_verifier *ctx);
 
 #endif /*_CTX_H*/
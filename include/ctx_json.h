@@ -35,6 +35,10 @@ int attest_ctx_data_json_get_by_field(char *json_data, enum ctx_fields field,
 
 int attest_ctx_verifier_req_add_json_file(attest_ctx_verifier *ctx,
 					  const char *path);
+int attest_ctx_verifier_req_write_json(attest_ctx_verifier *ctx, char **buf,
+				       size_t *size);
+int attest_ctx_verifier_result_write_json(attest_ctx_verifier *ctx, char **buf,
+					  size_t *size);
 char *attest_ctx_verifier_req_print_json(attest_ctx_verifier *ctx);
 char *attest_ctx_verifier_result_print_json(attest_ctx_verifier *ctx);
 char *attest_ctx_verifier_output_print_json(attest_ctx_verifier *ctx);
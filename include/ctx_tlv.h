@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: ctx_tlv.h
+ *      Header of ctx_tlv.c.
+ */
+
+#ifndef _CTX_TLV_H
+#define _CTX_TLV_H
+
+#include "ctx.h"
+
+#define TLV_MAGIC "ATLV"
+#define TLV_MAGIC_LEN 4
+
+enum ctx_msg_formats { CTX_MSG_JSON, CTX_MSG_TLV, CTX_MSG__LAST };
+
+/* all integers are in network byte order */
+struct tlv_msg_hdr {
+	uint8_t magic[TLV_MAGIC_LEN];
+	uint32_t len;
+} __attribute__((packed));
+
+/* followed by label_len bytes of label and len bytes of data */
+struct tlv_hdr {
+	uint16_t field;
+	uint16_t label_len;
+	uint32_t len;
+} __attribute__((packed));
+
+int attest_ctx_data_add_tlv(attest_ctx_data *ctx, size_t len,
+			    unsigned char *data);
+int attest_ctx_data_print_tlv(attest_ctx_data *ctx, size_t *len,
+			      unsigned char **data);
+
+enum ctx_msg_formats attest_ctx_msg_get_format(const char *msg);
+size_t attest_ctx_msg_len(const char *msg);
+int attest_ctx_msg_check(const char *msg, size_t len);
+int attest_ctx_data_add_msg(attest_ctx_data *ctx, char *msg);
+int attest_ctx_data_print_msg(attest_ctx_data *ctx, enum ctx_msg_formats fmt,
+			      char **msg);
+
+#endif /*_CTX_TLV_H*/
@@ -21,6 +21,7 @@
 #include <openssl/evp.h>
 
 #include "ctx.h"
+#include "ctx_tlv.h"
 #include "tss.h"
 
 int attest_enroll_add_ek_cert(attest_ctx_data *d_ctx, TSS_CONTEXT *tssContext);
@@ -39,9 +40,13 @@ int attest_enroll_add_csr(char *key_path, char *csr_subject_entries[],
 int attest_enroll_add_quote(attest_ctx_data *d_ctx, TSS_CONTEXT *tssContext,
 			    char *akPrivPath, char *akPubPath, int nonce_len,
 			    uint8_t *nonce, TPML_PCR_SELECTION *pcr_selection);
+int attest_enroll_session_open(char *privacy_ca_dir,
+			       TPM_HANDLE ak_persistent_handle);
+void attest_enroll_session_close(void);
 int attest_enroll_create_sym_key(int kernel_bios_log, int kernel_ima_log,
 				 char *pcr_alg_name, char *pcr_list_str);
 int attest_enroll_generate_ak(void);
+void attest_enroll_msg_set_format(enum ctx_msg_formats fmt);
 int attest_enroll_msg_ak_challenge_request(char *certListPath, char **message_out);
 int attest_enroll_msg_ak_cert_request(char *message_in, char* hostname,
 				      char **message_out);
@@ -51,10 +56,13 @@ int attest_enroll_msg_key_cert_request(int kernel_bios_log, int kernel_ima_log,
 				       int send_unsigned_files, char *csr_subject_entries[],
 				       char *url, char **attest_data, char **message_out);
 int attest_enroll_msg_key_cert_response(char *message_in);
-int attest_enroll_msg_quote_nonce_request(char **message_out);
+int attest_enroll_msg_quote_nonce_request(int kernel_ima_log,
+					  int send_unsigned_files,
+					  char **message_out);
 int attest_enroll_msg_quote_request(char *certListPath, int kernel_bios_log,
 				    int kernel_ima_log, char *pcr_alg_name,
 				    char *pcr_list_str, int skip_sig_ver,
-				    int send_unsigned_files, char *message_in,
-				    char **message_out);
+				    int send_unsigned_files, int compress_data,
+				    char *message_in, char **message_out);
+int attest_enroll_update_ima_cursor(int verified);
 #endif /*ENROLL_CLIENT_H*/
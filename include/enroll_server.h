@@ -36,10 +36,15 @@ int attest_enroll_make_cert(attest_ctx_data *d_ctx_in, attest_ctx_data *d_ctx_ou
 			    attest_ctx_verifier *v_ctx, char *cert_subject_entries[],
 			    size_t num_subject_entries, char *pcaKeyPath,
 			    char *pcaKeyPassword, char *pcaCertPath);
+int attest_enroll_load_reqs(char *reqPath);
+void attest_enroll_unload_reqs(void);
+int attest_enroll_load_hmac_keys(char *keysPath);
+int attest_enroll_load_replay_hmac_keys(char *keysPath);
 int attest_enroll_process_csr(attest_ctx_data *d_ctx_in,
 			      attest_ctx_verifier *v_ctx, char *reqPath,
 			      char **csr_str);
 
+void attest_enroll_log_errors_only(void);
 int attest_enroll_msg_make_credential(uint8_t *hmac_key, int hmac_key_len,
 				     char *pcaKeyPath, char *pcaKeyPassword,
 				     char *pcaCertPath, char *message_in,
@@ -53,6 +58,13 @@ int attest_enroll_msg_make_cert(uint8_t *hmac_key, int hmac_key_len,
 int attest_enroll_msg_process_csr(int pcr_mask_len, uint8_t *pcr_mask,
 				  char *reqPath, uint16_t verifier_flags,
 				  char *message_in, char **csr_str);
+int attest_enroll_load_ca(char *caKeyPath, char *caKeyPassword,
+			  char *caCertPath, char *openssl_ca_section);
+int attest_enroll_reload_ca(char *caKeyPath, char *caKeyPassword,
+			    char *caCertPath, char *openssl_ca_section);
+int attest_enroll_reload(char *reqPath, char *keysPath, char *caKeyPath,
+			 char *caKeyPassword, char *caCertPath,
+			 char *openssl_ca_section, int reload_plugins);
 int attest_enroll_sign_csr(char *caKeyPath, char *caKeyPassword,
 			   char *caCertPath, char *openssl_ca_section,
 			   char *csr_str, char **cert_str);
@@ -64,4 +76,22 @@ int attest_enroll_msg_process_quote(int hmac_key_len, uint8_t *hmac_key,
 				    int pcr_mask_len, uint8_t *pcr_mask,
 				    char *reqPath, uint16_t verifier_flags,
 				    char *message_in, char **message_out);
+int attest_enroll_verify_quote(int hmac_key_len, uint8_t *hmac_key,
+			       int pcr_mask_len, uint8_t *pcr_mask,
+			       char *reqPath, uint16_t verifier_flags,
+			       char *message_in, char **logs);
+
+/**
+ * Prototype of the function notifying that a batch of quotes was started,
+ * so that idle threads call attest_enroll_quote_batch_help()
+ */
+typedef void (*quote_batch_notify_func)(void);
+
+void attest_enroll_set_quote_batch_notify(quote_batch_notify_func notify);
+int attest_enroll_quote_batch_help(void);
+int attest_enroll_msg_process_quote_batch(int hmac_key_len, uint8_t *hmac_key,
+					  int pcr_mask_len, uint8_t *pcr_mask,
+					  char *reqPath,
+					  uint16_t verifier_flags,
+					  char *message_in, char **message_out);
 #endif /*_ENROLL_SERVER_H*/
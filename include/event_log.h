@@ -40,27 +40,93 @@
  * @param[in,out] parsed_log	library-specific structure of a parsed log entry
  * @param[in,out] first_parsed_log	first parsed log
  *
+ * Parsed log entries must be allocated with attest_event_log_alloc().
+ *
  * @returns 0 on success, a negative value on error
  */
 typedef int (*parse_log_func)(attest_ctx_verifier *v_ctx,
 			      uint32_t *remaining_len, unsigned char **data,
 			      void **parsed_log, void **first_parsed_log);
 
+/**
+ * @ingroup event-log-api
+ * Prototype of the function to get the name of a parsed log entry (optional)
+ *
+ * @param[in] parsed_log	library-specific structure of a parsed log entry
+ *
+ * @returns name on success, NULL if the entry has no name
+ */
+typedef const char *(*log_entry_name_func)(void *parsed_log);
+
+#define EVENT_LOG_NAME_HASH_SIZE 1024
+
+/* data item digest found in a log entry by name */
+struct event_log_ref {
+	struct list_head list;
+	char *name;
+	char *algo;
+	uint32_t digest_len;
+	uint8_t digest[0];
+};
+
 struct event_log {
 	struct list_head list;
 	struct list_head logs;
+	struct list_head refs;
+	struct list_head *name_index;
 	const char *id;
+	uint32_t offset;
 };
 
 #define LOG_ENTRY_PROCESSED 0x0001
 struct event_log_entry {
 	struct list_head list;
+	struct list_head name_list;
 	uint16_t flags;
 	void *log;
+	const char *name;
+};
+
+/* entries can be marked by verifiers running concurrently */
+static inline void attest_event_log_entry_set_processed(
+					struct event_log_entry *log_entry)
+{
+	__atomic_or_fetch(&log_entry->flags, LOG_ENTRY_PROCESSED,
+			  __ATOMIC_RELAXED);
+}
+
+static inline int attest_event_log_entry_processed(
+					struct event_log_entry *log_entry)
+{
+	return __atomic_load_n(&log_entry->flags, __ATOMIC_RELAXED) &
+	       LOG_ENTRY_PROCESSED;
+}
+
+struct event_log_checkpoint_log {
+	struct list_head list;
+	struct list_head refs;
+	char *id;
+	uint32_t num_entries;
+};
+
+/* state after the verification of event logs, to resume it later */
+struct event_log_checkpoint {
+	struct list_head logs;
+	void *pcr;
+	uint8_t pcr_bank_mask;
 };
 
 struct event_log *attest_event_log_get(attest_ctx_verifier *v_ctx,
 				       const char *id);
+void *attest_event_log_alloc(attest_ctx_verifier *v_ctx, size_t size);
+int attest_event_log_add_ref(struct event_log *log, const char *name,
+			     const char *algo, uint32_t digest_len,
+			     const uint8_t *digest);
+struct event_log_checkpoint *attest_event_log_checkpoint_dup(
+				struct event_log_checkpoint *checkpoint);
+void attest_event_log_checkpoint_free(struct event_log_checkpoint *checkpoint);
+struct event_log_entry *attest_event_log_lookup_by_name(struct event_log *log,
+			const char *name, struct event_log_entry *prev);
 int attest_event_log_verify_digest(attest_ctx_verifier *v_ctx,
 				   uint32_t digest_len, uint8_t *digest,
 				   uint32_t data_len, uint8_t *data,
@@ -56,9 +56,22 @@ struct ima_template_entry {
 	unsigned char data[0];
 };
 
+/* fields of an IMA log entry, resolved once at parse time */
+struct ima_entry_fields {
+	const char *algo;
+	const unsigned char *digest;
+	const char *name;
+	const unsigned char *sig;
+	uint32_t algo_len;
+	uint32_t digest_len;
+	uint32_t name_len;
+	uint32_t sig_len;
+};
+
 struct ima_log_entry {
 	struct ima_template_entry *entry;
 	struct ima_template_desc *desc;
+	struct ima_entry_fields fields;
 	struct ima_field_data template_data[0];
 };
 
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: hash.h
+ *      Header of hash.c.
+ */
+
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdint.h>
+
+#include <ibmtss/tss.h>
+
+struct hash_req {
+	TPM_ALG_ID alg;
+	uint32_t len;
+	const uint8_t *data;
+	uint8_t *digest;
+};
+
+int attest_hash_data(TPM_ALG_ID alg, uint32_t len, const uint8_t *data,
+		     uint8_t *digest);
+int attest_hash_batch(int num_reqs, struct hash_req *reqs);
+int attest_hash_extend(TPM_ALG_ID alg, uint8_t *pcr, const uint8_t *digest);
+
+#endif /*_HASH_H*/
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: ima_allowlist.h
+ *      Header of ima_allowlist.c and attest_build_allowlist.c.
+ */
+
+#ifndef _IMA_ALLOWLIST_H
+#define _IMA_ALLOWLIST_H
+
+#include <stdint.h>
+
+/*
+ * Table layout (native byte order, offsets aligned to 8 bytes):
+ *
+ * struct ima_allowlist_hdr
+ * struct ima_allowlist_alg_hdr[num_algs]
+ * for each algorithm:
+ *     uint32_t index[IMA_ALLOWLIST_INDEX_SIZE + 1]
+ *     uint8_t digests[num_digests][digest_len] (sorted)
+ *
+ * index[p] is the number of digests whose first two bytes are less than p.
+ */
+#define IMA_ALLOWLIST_MAGIC "IMAALLOW"
+#define IMA_ALLOWLIST_VERSION 1
+#define IMA_ALLOWLIST_INDEX_SIZE 65536
+#define IMA_ALLOWLIST_ALGO_LEN 16
+#define IMA_ALLOWLIST_MAX_DIGEST_LEN 64
+
+struct ima_allowlist_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_algs;
+} __attribute__((packed));
+
+struct ima_allowlist_alg_hdr {
+	char algo[IMA_ALLOWLIST_ALGO_LEN];
+	uint32_t digest_len;
+	uint32_t num_digests;
+	uint64_t index_offset;
+	uint64_t digests_offset;
+} __attribute__((packed));
+
+static inline uint32_t ima_allowlist_prefix(const uint8_t *digest)
+{
+	return (digest[0] << 8) | digest[1];
+}
+
+#endif /*_IMA_ALLOWLIST_H*/
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: metrics.h
+ *      Header of metrics.c.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+
+#define METRIC_REQUESTS			"attest_requests_total"
+#define METRIC_REQUEST_ERRORS		"attest_request_errors_total"
+#define METRIC_REQUEST_DURATION		"attest_request_duration_seconds"
+#define METRIC_REQUESTS_IN_FLIGHT	"attest_requests_in_flight"
+#define METRIC_REQUESTS_REJECTED	"attest_requests_rejected_total"
+#define METRIC_STAGE_DURATION		"attest_stage_duration_seconds"
+#define METRIC_CACHE_LOOKUPS		"attest_cache_lookups_total"
+#define METRIC_RECEIVED_BYTES		"attest_received_bytes_total"
+#define METRIC_DECODED_BYTES		"attest_decoded_bytes_total"
+#define METRIC_EVENT_LOG_ENTRIES	"attest_event_log_entries_total"
+
+void attest_metrics_enable(void);
+uint64_t attest_metrics_time_us(void);
+void attest_metrics_inc(const char *name, uint64_t value,
+			const char *labels_fmt, ...);
+void attest_metrics_gauge_add(const char *name, int64_t delta,
+			      const char *labels_fmt, ...);
+void attest_metrics_observe(const char *name, uint64_t usec,
+			    const char *labels_fmt, ...);
+void attest_metrics_cache(const char *cache, int hit);
+char *attest_metrics_print(void);
+int attest_metrics_serve(const char *bind_addr, int port);
+
+#endif /*_METRICS_H*/
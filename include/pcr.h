@@ -25,10 +25,19 @@
 enum pcr_banks { PCR_BANK_SHA1, PCR_BANK_SHA256, PCR_BANK_SHA384,
 		 PCR_BANK_SHA512, PCR_BANK__LAST };
 
+#define PCR_ARRAY_SIZE (sizeof(TPMT_HA) * PCR_BANK__LAST * IMPLEMENTATION_PCR)
+#define PCR_BANK_MASK_ALL ((1 << PCR_BANK__LAST) - 1)
+
 TPM_ALG_ID attest_pcr_bank_alg(enum pcr_banks bank_id);
 TPM_ALG_ID attest_pcr_bank_alg_from_name(char *alg_name, int alg_name_len);
 int attest_pcr_init(attest_ctx_verifier *v_ctx);
 void attest_pcr_cleanup(attest_ctx_verifier *v_ctx);
+uint8_t attest_pcr_bank_mask(attest_ctx_verifier *v_ctx);
+int attest_pcr_bank_selected(attest_ctx_verifier *v_ctx, TPMI_ALG_HASH alg);
+int attest_pcr_select_banks(attest_ctx_verifier *v_ctx,
+			    TPML_PCR_SELECTION *pcrs);
+void *attest_pcr_snapshot(attest_ctx_verifier *v_ctx);
+int attest_pcr_restore(attest_ctx_verifier *v_ctx, void *snapshot);
 TPMT_HA *attest_pcr_get(attest_ctx_verifier *v_ctx, int pcr_num,
 			TPMI_ALG_HASH alg);
 int attest_pcr_extend(attest_ctx_verifier *v_ctx, unsigned int pcr_num,
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: ra_async.h
+ *      Header of ra_async.c.
+ */
+
+#ifndef _RA_ASYNC_H
+#define _RA_ASYNC_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "list.h"
+
+/* largest response accepted from a RA server */
+#define RA_ASYNC_MAX_MSG_LEN (64 * 1024 * 1024)
+
+enum ra_async_states { RA_ASYNC_CONNECT, RA_ASYNC_SEND, RA_ASYNC_RECV_LEN,
+		       RA_ASYNC_RECV };
+
+struct ra_async_req;
+
+/* message_out is freed when the callback returns */
+typedef void (*ra_async_done_func)(struct ra_async_req *req, int rc,
+				   char *message_out);
+
+struct ra_async_req {
+	struct list_head list;
+	char *host;
+	char *port;
+	int op;
+	size_t len;
+	const char *message;
+	ra_async_done_func done;
+	void *priv;
+	struct timespec start;
+	int scheduled;
+	enum ra_async_states state;
+	int fd;
+	unsigned char hdr[sizeof(size_t) + sizeof(int)];
+	size_t off;
+	size_t resp_len;
+	char *resp;
+};
+
+struct ra_async {
+	int epfd;
+	int max_in_flight;
+	int timeout_ms;
+	int num_in_flight;
+	struct list_head pending;
+	struct list_head in_flight;
+};
+
+int attest_ra_async_init(struct ra_async **a, int max_in_flight,
+			 int timeout_ms);
+void attest_ra_async_cleanup(struct ra_async *a);
+int attest_ra_async_add(struct ra_async *a, const char *host,
+			const char *port, int op, size_t len,
+			const char *message, ra_async_done_func done,
+			void *priv);
+int attest_ra_async_add_at(struct ra_async *a, const char *host,
+			   const char *port, int op, size_t len,
+			   const char *message, ra_async_done_func done,
+			   void *priv, const struct timespec *start);
+int attest_ra_async_run(struct ra_async *a);
+
+#endif /*_RA_ASYNC_H*/
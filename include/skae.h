@@ -17,6 +17,7 @@
 
 #include <openssl/pem.h>
 #include <openssl/x509.h>
+#include <openssl/ssl.h>
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000
 #define ASN1_STRING_get0_data(obj) ASN1_STRING_data(obj)
@@ -33,6 +34,14 @@ int skae_verify_x509_req(attest_ctx_data *d_ctx,
 			 attest_ctx_verifier *v_ctx, X509_REQ *req);
 int skae_callback(int preverify, X509_STORE_CTX* x509_ctx);
 
+/* contexts used by skae_callback() for a connection */
+struct skae_callback_ctx {
+	attest_ctx_data *d_ctx;
+	attest_ctx_verifier *v_ctx;
+};
+
+int skae_callback_set_ctx(SSL *ssl, struct skae_callback_ctx *ctx);
+
 int skae_create(enum skae_versions version,
 		size_t tpms_attest_len, unsigned char *tpms_attest,
 		size_t sig_len, unsigned char *sig,
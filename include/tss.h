@@ -25,6 +25,9 @@
 enum key_types { KEY_TYPE_AK, KEY_TYPE_ASYM_DEC, KEY_TYPE_SYM_HMAC,
 		 KEY_TYPE_PRIMARY, KEY_TYPE__LAST };
 
+typedef int (*pcrread_func)(void *priv, TPMI_DH_PCR pcr, TPMI_ALG_HASH halg,
+			    TPM2B_DIGEST *digest);
+
 int attest_tss_nvreadpublic(TSS_CONTEXT *tssContext, int nvIndex,
 			    size_t *nvdata_len);
 int attest_tss_nvread(TSS_CONTEXT *tssContext, int nvIndex, size_t nvdata_len,
@@ -63,6 +66,9 @@ int attest_tss_load_certify(TSS_CONTEXT *tssContext, char *akPrivPath,
 			UINT16 *signature_len, BYTE **signature);
 int attest_tss_pcrread(TSS_CONTEXT *tssContext, TPMI_DH_PCR pcr,
 		       TPMI_ALG_HASH halg, BYTE *pcr_value);
+int attest_tss_pcrread_multi(TSS_CONTEXT *tssContext,
+			     const TPML_PCR_SELECTION *selection,
+			     pcrread_func func, void *priv);
 int attest_tss_loadexternal(TSS_CONTEXT *tssContext, EVP_PKEY *ek_pub,
 			    TPM_HANDLE *handle);
 int attest_tss_makecredential(TSS_CONTEXT *tssContext, TPM_HANDLE ek_handle,
@@ -75,6 +81,8 @@ int attest_tss_quote(TSS_CONTEXT *tssContext, TPM_HANDLE ak_handle,
 		     UINT16 *quote_len, BYTE **quote, UINT16 *signature_len,
 		     BYTE **signature);
 int attest_tss_check_key(TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle);
+int attest_tss_readpublic(TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle,
+			  UINT16 *public_len, BYTE **public);
 int attest_tss_evictcontrol(TSS_CONTEXT *tssContext, TPM_HANDLE objectHandle,
 			    TPM_HANDLE persistentHandle);
 
@@ -15,25 +15,54 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
+#include <stddef.h>
+#include <time.h>
+
+struct download_item {
+	const char *url;
+	int fd;
+	unsigned char *data;
+	size_t len;
+	size_t size;
+	int rc;
+};
+
 int attest_util_read_file(const char *path, size_t *len, unsigned char **data);
 int attest_util_read_seq_file(const char *path, size_t *len,
 			      unsigned char **data);
+int attest_util_read_seq_file_offset(const char *path, size_t offset,
+				     size_t *len, unsigned char **data);
 int attest_util_write_file(const char *path, size_t len, unsigned char *data,
 			   int append);
 int attest_util_copy_file(const char *path_source, const char *path_dest);
 int attest_util_read_buf(int fd, unsigned char *buf, size_t buf_len);
 int attest_util_write_buf(int fd, unsigned char *buf, size_t buf_len);
+int attest_util_read_buf_deadline(int fd, unsigned char *buf, size_t buf_len,
+				  const struct timespec *deadline);
+int attest_util_write_buf_deadline(int fd, unsigned char *buf, size_t buf_len,
+				   const struct timespec *deadline);
 int attest_util_calc_digest(const char *algo, int *digest_len,
 			    unsigned char *digest, int len, void *data);
 int attest_util_decode_data(size_t input_len, const char *input, int offset,
 			    size_t *output_len, unsigned char **output);
 int attest_util_encode_data(size_t input_len, const unsigned char *input,
 			    int offset, size_t *output_len, char **output);
+int attest_util_compress_data(size_t input_len, const unsigned char *input,
+			      size_t *output_len, unsigned char **output);
+int attest_util_decompress_data(size_t input_len, const unsigned char *input,
+				size_t max_output_len,
+				int (*reserve)(void *priv, size_t len),
+				void *priv, size_t *output_len,
+				unsigned char **output);
 int attest_util_download_data(const char *url, int fd);
+int attest_util_download_items(int num_items, struct download_item *items);
 int attest_util_check_mask(int mask_in_len, uint8_t *mask_in,
 			   int mask_ref_len, uint8_t *mask_ref);
 int attest_util_parse_pcr_list(const char *pcr_list_str, int pcr_list_num,
 			       int *pcr_list);
+unsigned int attest_util_hash_str(const char *str, unsigned int hash);
+
+#define HASH_STR_INIT 5381
 
 int _hex2bin(unsigned char *dst, const char *src, size_t count);
 char *_bin2hex(char *dst, const void *src, size_t count);
@@ -52,9 +52,31 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <endian.h>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
 
 #include "crypto.h"
+#include "metrics.h"
+
+#define CRED_LABEL_IDENTITY "IDENTITY"
+#define CRED_SYM_KEY_LEN 16
+#define CRED_MAX_SECRET_LEN 512
+#define CRED_MAX_ECC_LEN 66
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+#define X509_up_ref(x) CRYPTO_add(&(x)->references, 1, CRYPTO_LOCK_X509)
+#endif
 
 static int attest_crypto_verify_sig_rsa(attest_ctx_verifier *v_ctx,
 					TPMT_SIGNATURE *tpmtsig,
@@ -179,18 +201,265 @@ out:
 	return rc;
 }
 
+#define CA_STORE_CACHE_SIZE 64
+#define CERT_CACHE_SIZE 1024
+#define CERT_CACHE_TIMEOUT 300
+
+/* trust stores built from the same CA certificates, shared by requests */
+struct ca_store_entry {
+	struct list_head list;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	X509_STORE *store;
+	int refcount;
+};
+
+/* certificates successfully verified with a trust store */
+struct cert_entry {
+	struct list_head list;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	X509 *cert;
+	time_t verified;
+};
+
+static pthread_mutex_t crypto_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(ca_store_cache);
+static LIST_HEAD(cert_cache);
+static int ca_store_cache_num;
+static int cert_cache_num;
+
+static int attest_crypto_calc_key(uint8_t *prefix, struct list_head *head,
+				  struct data_item *item, uint8_t *key)
+{
+	struct data_item *cur_item;
+	EVP_MD_CTX *mdctx;
+	uint64_t len;
+	int rc = -EINVAL;
+
+	mdctx = EVP_MD_CTX_create();
+	if (!mdctx)
+		return -ENOMEM;
+
+	if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1)
+		goto out;
+
+	if (prefix &&
+	    EVP_DigestUpdate(mdctx, prefix, SHA256_DIGEST_LENGTH) != 1)
+		goto out;
+
+	if (head) {
+		list_for_each_entry(cur_item, head, list) {
+			len = cur_item->len;
+			if (EVP_DigestUpdate(mdctx, &len, sizeof(len)) != 1 ||
+			    EVP_DigestUpdate(mdctx, cur_item->data,
+					     cur_item->len) != 1)
+				goto out;
+		}
+	}
+
+	if (item && EVP_DigestUpdate(mdctx, item->data, item->len) != 1)
+		goto out;
+
+	if (EVP_DigestFinal_ex(mdctx, key, NULL) != 1)
+		goto out;
+
+	rc = 0;
+out:
+	EVP_MD_CTX_destroy(mdctx);
+	return rc;
+}
+
+static X509 *attest_crypto_read_cert(struct data_item *item)
+{
+	X509 *cert;
+	BIO *bio;
+
+	bio = BIO_new_mem_buf((void*)item->data, item->len);
+	if (!bio)
+		return NULL;
+
+	cert = PEM_read_bio_X509(bio, NULL, 0, NULL);
+	BIO_free(bio);
+	return cert;
+}
+
+static struct ca_store_entry *attest_crypto_lookup_store(uint8_t *key)
+{
+	struct ca_store_entry *entry;
+
+	list_for_each_entry(entry, &ca_store_cache, list) {
+		if (memcmp(entry->key, key, SHA256_DIGEST_LENGTH))
+			continue;
+
+		list_del(&entry->list);
+		list_add(&entry->list, &ca_store_cache);
+		entry->refcount++;
+		return entry;
+	}
+
+	return NULL;
+}
+
+static void attest_crypto_evict_store(void)
+{
+	struct ca_store_entry *entry;
+
+	if (ca_store_cache_num <= CA_STORE_CACHE_SIZE)
+		return;
+
+	list_for_each_entry_reverse(entry, &ca_store_cache, list) {
+		if (entry->refcount)
+			continue;
+
+		list_del(&entry->list);
+		X509_STORE_free(entry->store);
+		free(entry);
+		ca_store_cache_num--;
+		break;
+	}
+}
+
+static struct ca_store_entry *attest_crypto_get_store(
+					attest_ctx_verifier *v_ctx,
+					struct list_head *head, uint8_t *key)
+{
+	struct ca_store_entry *entry, *new_entry = NULL;
+	struct data_item *ca_cert_item;
+	X509 *ca_cert;
+	int rc = 0;
+
+	current_log(v_ctx);
+
+	pthread_mutex_lock(&crypto_cache_lock);
+	entry = attest_crypto_lookup_store(key);
+	pthread_mutex_unlock(&crypto_cache_lock);
+
+	attest_metrics_cache("trust_store", entry != NULL);
+
+	if (entry)
+		return entry;
+
+	new_entry = calloc(1, sizeof(*new_entry));
+	check_goto(!new_entry, -ENOMEM, out, v_ctx, "out of memory");
+
+	new_entry->store = X509_STORE_new();
+	check_goto(!new_entry->store, -ENOMEM, out, v_ctx,
+		   "X509_STORE_new() error");
+
+	list_for_each_entry(ca_cert_item, head, list) {
+		ca_cert = attest_crypto_read_cert(ca_cert_item);
+		check_goto(!ca_cert, -EINVAL, out, v_ctx,
+			   "PEM_read_bio_X509() error: invalid CA cert");
+
+		X509_STORE_add_cert(new_entry->store, ca_cert);
+		X509_free(ca_cert);
+	}
+
+	memcpy(new_entry->key, key, SHA256_DIGEST_LENGTH);
+	new_entry->refcount = 1;
+
+	pthread_mutex_lock(&crypto_cache_lock);
+	/* another thread could have built the same store */
+	entry = attest_crypto_lookup_store(key);
+	if (!entry) {
+		list_add(&new_entry->list, &ca_store_cache);
+		ca_store_cache_num++;
+		entry = new_entry;
+		new_entry = NULL;
+		attest_crypto_evict_store();
+	}
+	pthread_mutex_unlock(&crypto_cache_lock);
+out:
+	if (new_entry) {
+		if (new_entry->store)
+			X509_STORE_free(new_entry->store);
+		free(new_entry);
+	}
+
+	return rc ? NULL : entry;
+}
+
+static void attest_crypto_put_store(struct ca_store_entry *entry)
+{
+	pthread_mutex_lock(&crypto_cache_lock);
+	entry->refcount--;
+	attest_crypto_evict_store();
+	pthread_mutex_unlock(&crypto_cache_lock);
+}
+
+static X509 *attest_crypto_lookup_cert(uint8_t *key)
+{
+	struct cert_entry *entry;
+	X509 *cert = NULL;
+
+	pthread_mutex_lock(&crypto_cache_lock);
+	list_for_each_entry(entry, &cert_cache, list) {
+		if (memcmp(entry->key, key, SHA256_DIGEST_LENGTH))
+			continue;
+
+		/* verify again, certificates or CAs could have expired */
+		if (time(NULL) - entry->verified > CERT_CACHE_TIMEOUT)
+			break;
+
+		list_del(&entry->list);
+		list_add(&entry->list, &cert_cache);
+		X509_up_ref(entry->cert);
+		cert = entry->cert;
+		break;
+	}
+	pthread_mutex_unlock(&crypto_cache_lock);
+
+	attest_metrics_cache("cert", cert != NULL);
+	return cert;
+}
+
+static void attest_crypto_add_cert(uint8_t *key, X509 *cert)
+{
+	struct cert_entry *entry;
+
+	pthread_mutex_lock(&crypto_cache_lock);
+	list_for_each_entry(entry, &cert_cache, list) {
+		if (!memcmp(entry->key, key, SHA256_DIGEST_LENGTH)) {
+			list_del(&entry->list);
+			X509_free(entry->cert);
+			cert_cache_num--;
+			goto add;
+		}
+	}
+
+	if (cert_cache_num == CERT_CACHE_SIZE) {
+		entry = list_last_entry(&cert_cache, struct cert_entry, list);
+		list_del(&entry->list);
+		X509_free(entry->cert);
+		cert_cache_num--;
+	} else {
+		entry = malloc(sizeof(*entry));
+		if (!entry)
+			goto out;
+	}
+add:
+	memcpy(entry->key, key, SHA256_DIGEST_LENGTH);
+	X509_up_ref(cert);
+	entry->cert = cert;
+	entry->verified = time(NULL);
+	list_add(&entry->list, &cert_cache);
+	cert_cache_num++;
+out:
+	pthread_mutex_unlock(&crypto_cache_lock);
+}
+
 int attest_crypto_verify_cert(attest_ctx_data *d_ctx,
 			      attest_ctx_verifier *v_ctx,
 			      enum ctx_fields cert, enum ctx_fields ca,
 			      X509 **x509)
 {
-	struct data_item *cert_item, *ca_cert_item;
-	X509 *ak_cert = NULL, *ca_cert;
-	X509_STORE *ca_store = NULL;
+	struct data_item *cert_item;
+	struct ca_store_entry *ca_store = NULL;
+	X509 *ak_cert = NULL;
 	X509_STORE_CTX *verifyCtx = NULL;
+	uint8_t store_key[SHA256_DIGEST_LENGTH];
+	uint8_t cert_key[SHA256_DIGEST_LENGTH];
 	struct list_head *head;
 	int rc, err;
-	BIO *bio;
 
 	current_log(v_ctx);
 
@@ -198,39 +467,32 @@ int attest_crypto_verify_cert(attest_ctx_data *d_ctx,
 	check_goto(!cert_item, -ENOENT, out, v_ctx,
 		   "AK certificate not provided");
 
-	bio = BIO_new_mem_buf((void*)cert_item->data, cert_item->len);
-	check_goto(!bio, -ENOMEM, out, v_ctx, "BIO_new_mem_buf() error");
-	ak_cert = PEM_read_bio_X509(bio, NULL, 0, NULL);
-	BIO_free(bio);
-
-	check_goto(!ak_cert, -EINVAL, out, v_ctx,
-		   "PEM_read_bio_X509() error: invalid AK");
-
-	ca_store  = X509_STORE_new();
-	check_goto(!ca_store, -ENOMEM, out, v_ctx, "X509_STORE_new() error");
-
 	head = &d_ctx->ctx_data[ca];
 
-	list_for_each_entry(ca_cert_item, head, list) {
-		bio = BIO_new_mem_buf((void*)ca_cert_item->data,
-				      ca_cert_item->len);
-		check_goto(!bio, -ENOMEM, out, v_ctx,
-			   "BIO_new_mem_buf() error");
+	rc = attest_crypto_calc_key(NULL, head, NULL, store_key);
+	check_goto(rc, rc, out, v_ctx, "cannot calculate CA certs digest");
 
-		ca_cert = PEM_read_bio_X509(bio, NULL, 0, NULL);
-		BIO_free(bio);
-		check_goto(!ca_cert, -EINVAL, out, v_ctx,
-			   "PEM_read_bio_X509() error: invalid CA cert");
+	rc = attest_crypto_calc_key(store_key, NULL, cert_item, cert_key);
+	check_goto(rc, rc, out, v_ctx, "cannot calculate cert digest");
 
-		X509_STORE_add_cert(ca_store, ca_cert);
-		X509_free(ca_cert);
+	ak_cert = attest_crypto_lookup_cert(cert_key);
+	if (ak_cert) {
+		*x509 = ak_cert;
+		return 0;
 	}
 
+	ak_cert = attest_crypto_read_cert(cert_item);
+	check_goto(!ak_cert, -EINVAL, out, v_ctx,
+		   "PEM_read_bio_X509() error: invalid AK");
+
+	ca_store = attest_crypto_get_store(v_ctx, head, store_key);
+	check_goto(!ca_store, -EINVAL, out, v_ctx, "cannot build trust store");
+
 	verifyCtx = X509_STORE_CTX_new();
 	check_goto(!verifyCtx, -ENOMEM, out, v_ctx,
 		   "X509_STORE_CTX_new() error");
 
-	rc = X509_STORE_CTX_init(verifyCtx, ca_store, ak_cert, NULL);
+	rc = X509_STORE_CTX_init(verifyCtx, ca_store->store, ak_cert, NULL);
 	check_goto(rc != 1, -EINVAL, out, v_ctx, "X509_STORE_CTX_init() error");
 
 	rc = X509_verify_cert(verifyCtx);
@@ -241,19 +503,345 @@ int attest_crypto_verify_cert(attest_ctx_data *d_ctx,
 	check_goto(rc != 1, -EINVAL, out, v_ctx,
 		   X509_verify_cert_error_string(err));
 
+	attest_crypto_add_cert(cert_key, ak_cert);
+
 	*x509 = ak_cert;
 	rc = 0;
 out:
-	if (ca_store != NULL)
-		X509_STORE_free(ca_store);
-
 	if (verifyCtx != NULL) {
 		X509_STORE_CTX_cleanup(verifyCtx);
 		X509_STORE_CTX_free(verifyCtx);
 	}
 
+	if (ca_store)
+		attest_crypto_put_store(ca_store);
+
 	if (rc)
 		X509_free(ak_cert);
 
 	return rc;
 }
+
+/* KDFa() of TPM 2.0 Part 1 (SP800-108 counter mode with HMAC) */
+static int attest_crypto_kdfa(const EVP_MD *md, uint8_t *key, int key_len,
+			      const char *label, uint8_t *context_u,
+			      int context_u_len, int bits, uint8_t *out)
+{
+	uint8_t digest[EVP_MAX_MD_SIZE], *buf, *ptr;
+	int label_len = strlen(label) + 1, len = (bits + 7) / 8, done;
+	int buf_len = 4 + label_len + context_u_len + 4;
+	unsigned int digest_len;
+	uint32_t counter, bits_be = htobe32(bits);
+
+	buf = malloc(buf_len);
+	if (!buf)
+		return -ENOMEM;
+
+	ptr = buf + 4;
+	memcpy(ptr, label, label_len);
+	ptr += label_len;
+	memcpy(ptr, context_u, context_u_len);
+	ptr += context_u_len;
+	memcpy(ptr, &bits_be, 4);
+
+	for (counter = 1, done = 0; done < len; counter++) {
+		*(uint32_t *)buf = htobe32(counter);
+
+		if (!HMAC(md, key, key_len, buf, buf_len, digest,
+			  &digest_len)) {
+			free(buf);
+			return -EINVAL;
+		}
+
+		if (digest_len > len - done)
+			digest_len = len - done;
+
+		memcpy(out + done, digest, digest_len);
+		done += digest_len;
+	}
+
+	free(buf);
+	return 0;
+}
+
+/* KDFe() of TPM 2.0 Part 1 (SP800-56A concatenation KDF), single block */
+static int attest_crypto_kdfe(const EVP_MD *md, uint8_t *z, int z_len,
+			      const char *label, uint8_t *party_u,
+			      uint8_t *party_v, int party_len, uint8_t *out)
+{
+	int label_len = strlen(label) + 1;
+	uint32_t counter = htobe32(1);
+	EVP_MD_CTX *ctx;
+	int rc = -EINVAL;
+
+	ctx = EVP_MD_CTX_create();
+	if (!ctx)
+		return -ENOMEM;
+
+	if (EVP_DigestInit_ex(ctx, md, NULL) == 1 &&
+	    EVP_DigestUpdate(ctx, &counter, sizeof(counter)) == 1 &&
+	    EVP_DigestUpdate(ctx, z, z_len) == 1 &&
+	    EVP_DigestUpdate(ctx, label, label_len) == 1 &&
+	    EVP_DigestUpdate(ctx, party_u, party_len) == 1 &&
+	    EVP_DigestUpdate(ctx, party_v, party_len) == 1 &&
+	    EVP_DigestFinal_ex(ctx, out, NULL) == 1)
+		rc = 0;
+
+	EVP_MD_CTX_destroy(ctx);
+	return rc;
+}
+
+/* seed encrypted with RSA-OAEP, with the EK name algorithm */
+static int attest_crypto_cred_seed_rsa(EVP_PKEY *ek_pub, const EVP_MD *md,
+				       uint8_t *seed, uint8_t *secret,
+				       size_t *secret_len)
+{
+	EVP_PKEY_CTX *ctx;
+	unsigned char *label;
+	int rc = -EINVAL;
+
+	if (RAND_bytes(seed, EVP_MD_size(md)) != 1)
+		return -EIO;
+
+	ctx = EVP_PKEY_CTX_new(ek_pub, NULL);
+	if (!ctx)
+		return -ENOMEM;
+
+	if (EVP_PKEY_encrypt_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_oaep_md(ctx, md) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, md) <= 0)
+		goto out;
+
+	label = OPENSSL_malloc(sizeof(CRED_LABEL_IDENTITY));
+	if (!label) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(label, CRED_LABEL_IDENTITY, sizeof(CRED_LABEL_IDENTITY));
+
+	if (EVP_PKEY_CTX_set0_rsa_oaep_label(ctx, label,
+					     sizeof(CRED_LABEL_IDENTITY)) <= 0) {
+		OPENSSL_free(label);
+		goto out;
+	}
+
+	if (EVP_PKEY_encrypt(ctx, secret, secret_len, seed,
+			     EVP_MD_size(md)) > 0)
+		rc = 0;
+out:
+	EVP_PKEY_CTX_free(ctx);
+	return rc;
+}
+
+static int attest_crypto_ec_coord(EVP_PKEY *pkey, int len, uint8_t *x,
+				  uint8_t *y)
+{
+	const EC_KEY *ec_key = EVP_PKEY_get0_EC_KEY(pkey);
+	BIGNUM *bn_x, *bn_y;
+	int rc = -EINVAL;
+
+	if (!ec_key)
+		return -EINVAL;
+
+	bn_x = BN_new();
+	bn_y = BN_new();
+
+	if (bn_x && bn_y &&
+	    EC_POINT_get_affine_coordinates_GFp(EC_KEY_get0_group(ec_key),
+						EC_KEY_get0_public_key(ec_key),
+						bn_x, bn_y, NULL) == 1 &&
+	    BN_bn2binpad(bn_x, x, len) == len &&
+	    (!y || BN_bn2binpad(bn_y, y, len) == len))
+		rc = 0;
+
+	BN_free(bn_x);
+	BN_free(bn_y);
+	return rc;
+}
+
+/* seed derived with ECDH from an ephemeral key, sent as TPMS_ECC_POINT */
+static int attest_crypto_cred_seed_ecc(EVP_PKEY *ek_pub, const EVP_MD *md,
+				       uint8_t *seed, uint8_t *secret,
+				       size_t *secret_len)
+{
+	uint8_t z[CRED_MAX_ECC_LEN], ek_x[CRED_MAX_ECC_LEN];
+	EVP_PKEY_CTX *ctx = NULL;
+	EVP_PKEY *ephemeral = NULL;
+	size_t z_len = sizeof(z);
+	uint8_t *ptr = secret;
+	int rc = -EINVAL;
+
+	ctx = EVP_PKEY_CTX_new(ek_pub, NULL);
+	if (!ctx)
+		return -ENOMEM;
+
+	if (EVP_PKEY_keygen_init(ctx) <= 0 ||
+	    EVP_PKEY_keygen(ctx, &ephemeral) <= 0)
+		goto out;
+
+	EVP_PKEY_CTX_free(ctx);
+
+	ctx = EVP_PKEY_CTX_new(ephemeral, NULL);
+	if (!ctx) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	if (EVP_PKEY_derive_init(ctx) <= 0 ||
+	    EVP_PKEY_derive_set_peer(ctx, ek_pub) <= 0 ||
+	    EVP_PKEY_derive(ctx, z, &z_len) <= 0)
+		goto out;
+
+	if (*secret_len < 2 * (2 + z_len))
+		goto out;
+
+	/* x and y of the ephemeral key, as TPM2B_ECC_PARAMETER */
+	*ptr++ = z_len >> 8;
+	*ptr++ = z_len & 0xff;
+
+	rc = attest_crypto_ec_coord(ephemeral, z_len, ptr, ptr + z_len + 2);
+	if (rc < 0)
+		goto out;
+
+	ptr += z_len;
+	*ptr++ = z_len >> 8;
+	*ptr++ = z_len & 0xff;
+
+	*secret_len = 2 * (2 + z_len);
+
+	rc = attest_crypto_ec_coord(ek_pub, z_len, ek_x, NULL);
+	if (rc < 0)
+		goto out;
+
+	rc = attest_crypto_kdfe(md, z, z_len, CRED_LABEL_IDENTITY, secret + 2,
+				ek_x, z_len, seed);
+out:
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(ephemeral);
+	return rc;
+}
+
+/**
+ * Make a credential in software, as TPM2_MakeCredential() does
+ * @param[in] ek_pub		EK public key (RSA or ECC)
+ * @param[in] cred		Credential
+ * @param[in] name		Name of the object the credential is bound to
+ * @param[in,out] cred_blob	Marshalled TPM2B_ID_OBJECT
+ * @param[in,out] cred_blob_len	TPM2B_ID_OBJECT length
+ * @param[in,out] secret	Marshalled TPM2B_ENCRYPTED_SECRET
+ * @param[in,out] secret_len	TPM2B_ENCRYPTED_SECRET length
+ *
+ * The EK is expected to have the default template, with SHA-256 as name
+ * algorithm and AES-128 CFB as symmetric algorithm.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_crypto_make_credential(EVP_PKEY *ek_pub, TPM2B_DIGEST *cred,
+				  TPM2B_NAME *name, BYTE **cred_blob,
+				  UINT16 *cred_blob_len, BYTE **secret,
+				  UINT16 *secret_len)
+{
+	const EVP_MD *md = EVP_sha256();
+	uint8_t seed[EVP_MAX_MD_SIZE], hmac_key[EVP_MAX_MD_SIZE];
+	uint8_t sym_key[CRED_SYM_KEY_LEN], iv[CRED_SYM_KEY_LEN] = { 0 };
+	uint8_t enc_secret[CRED_MAX_SECRET_LEN], *plain = NULL;
+	uint8_t *blob = NULL, *hmac_data = NULL, *enc_identity;
+	size_t enc_secret_len = sizeof(enc_secret);
+	int digest_len = EVP_MD_size(md), plain_len = 2 + cred->t.size;
+	int blob_len = 2 + 2 + digest_len + plain_len, out_len, rc;
+	unsigned int hmac_len;
+	EVP_CIPHER_CTX *ctx = NULL;
+
+	switch (EVP_PKEY_id(ek_pub)) {
+	case EVP_PKEY_RSA:
+		rc = attest_crypto_cred_seed_rsa(ek_pub, md, seed, enc_secret,
+						 &enc_secret_len);
+		break;
+	case EVP_PKEY_EC:
+		rc = attest_crypto_cred_seed_ecc(ek_pub, md, seed, enc_secret,
+						 &enc_secret_len);
+		break;
+	default:
+		rc = -ENOENT;
+		break;
+	}
+
+	if (rc < 0)
+		return rc;
+
+	rc = attest_crypto_kdfa(md, seed, digest_len, "STORAGE",
+				name->b.buffer, name->b.size,
+				CRED_SYM_KEY_LEN * 8, sym_key);
+	if (rc < 0)
+		goto out;
+
+	rc = attest_crypto_kdfa(md, seed, digest_len, "INTEGRITY", NULL, 0,
+				digest_len * 8, hmac_key);
+	if (rc < 0)
+		goto out;
+
+	rc = -ENOMEM;
+
+	plain = malloc(plain_len);
+	blob = malloc(blob_len);
+	hmac_data = malloc(plain_len + name->b.size);
+	*secret = malloc(2 + enc_secret_len);
+	ctx = EVP_CIPHER_CTX_new();
+
+	if (!plain || !blob || !hmac_data || !*secret || !ctx)
+		goto out;
+
+	/* encIdentity: credential as TPM2B_DIGEST, encrypted with AES-CFB */
+	plain[0] = cred->t.size >> 8;
+	plain[1] = cred->t.size & 0xff;
+	memcpy(plain + 2, cred->t.buffer, cred->t.size);
+
+	enc_identity = blob + 2 + 2 + digest_len;
+
+	rc = -EINVAL;
+
+	if (EVP_EncryptInit_ex(ctx, EVP_aes_128_cfb128(), NULL, sym_key,
+			       iv) != 1 ||
+	    EVP_EncryptUpdate(ctx, enc_identity, &out_len, plain,
+			      plain_len) != 1 || out_len != plain_len)
+		goto out;
+
+	/* outerHMAC over encIdentity and name */
+	memcpy(hmac_data, enc_identity, plain_len);
+	memcpy(hmac_data + plain_len, name->b.buffer, name->b.size);
+
+	if (!HMAC(md, hmac_key, digest_len, hmac_data,
+		  plain_len + name->b.size, blob + 4, &hmac_len))
+		goto out;
+
+	blob[0] = (blob_len - 2) >> 8;
+	blob[1] = (blob_len - 2) & 0xff;
+	blob[2] = hmac_len >> 8;
+	blob[3] = hmac_len & 0xff;
+
+	(*secret)[0] = enc_secret_len >> 8;
+	(*secret)[1] = enc_secret_len & 0xff;
+	memcpy(*secret + 2, enc_secret, enc_secret_len);
+
+	*cred_blob = blob;
+	*cred_blob_len = blob_len;
+	*secret_len = 2 + enc_secret_len;
+	blob = NULL;
+	rc = 0;
+out:
+	if (rc) {
+		free(*secret);
+		*secret = NULL;
+	}
+
+	OPENSSL_cleanse(seed, sizeof(seed));
+	OPENSSL_cleanse(sym_key, sizeof(sym_key));
+	OPENSSL_cleanse(hmac_key, sizeof(hmac_key));
+	EVP_CIPHER_CTX_free(ctx);
+	free(hmac_data);
+	free(plain);
+	free(blob);
+	return rc;
+}
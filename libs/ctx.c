@@ -47,17 +47,27 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ctx.h"
 #include "util.h"
+#include "event_log.h"
+#include "metrics.h"
 
 #define TEMP_DIR_TEMPLATE "/tmp/attest-temp-dir-XXXXXX"
 #define TEMP_FILE_TEMPLATE "attest-temp-file-XXXXXX"
 
 #define MAX_DIGEST_SIZE 128
 #define MAX_LOG_LENGTH 1024
+#define PLUGIN_HASH_SIZE 64
+#define DIGEST_HASH_SIZE 256
+/* maximum length of data decompressed for a data context */
+#define MAX_DECOMPRESSED_LEN (256 * 1024 * 1024)
+/* maximum number of URI items of a data context */
+#define MAX_DOWNLOADS 64
 
 attest_ctx_data global_ctx_data = {0};
 attest_ctx_verifier global_ctx_verifier = {0};
@@ -66,6 +76,19 @@ struct verification_log unknown_log = {{&unknown_log.list, &unknown_log.list},
 					"unknown log", "fail",
 					"unknown_reason"};
 
+/* memory budget of the application, shared by all data contexts */
+static data_memory_get_func data_memory_get;
+static data_memory_put_func data_memory_put;
+static void *data_memory_priv;
+
+/* URL prefixes of URI items resolved for contexts with CTX_RESTRICT_URI */
+static char **uri_allowlist;
+static int uri_allowlist_len;
+
+/* logs of verifiers running concurrently are added to a list per thread */
+static pthread_once_t thread_logs_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_logs_key;
+
 static const char *ctx_fields_str[CTX__LAST] = {
 	[CTX_PRIVACY_CA_CERT] = "privacy_ca_cert",
 	[CTX_AK_CERT] = "ak_cert",
@@ -90,11 +113,30 @@ static const char *ctx_fields_str[CTX__LAST] = {
 	[CTX_NONCE_HMAC] = "nonce_hmac",
 	[CTX_TPMS_ATTEST] = "tpms_attest",
 	[CTX_TPMS_ATTEST_SIG] = "tpms_attest_sig",
+	[CTX_EVENT_LOG_OFFSET] = "event_log_offset",
+	[CTX_AUX_DIGEST] = "aux_digest",
 };
 
 static const char *data_formats_str[DATA_FMT__LAST] = {
 	[DATA_FMT_BASE64] = "base64",
 	[DATA_FMT_URI] = "uri",
+	[DATA_FMT_ZLIB_BASE64] = "zlib+base64",
+};
+
+/* digest of a data item, linked to the item and to a digest index */
+struct data_digest {
+	struct list_head list;
+	struct list_head hash_list;
+	struct data_item *item;
+	uint8_t digest[MAX_DIGEST_SIZE];
+};
+
+/* aux data items indexed by digest, one for each algorithm */
+struct digest_index {
+	struct list_head list;
+	char *algo;
+	int digest_len;
+	struct list_head buckets[DIGEST_HASH_SIZE];
 };
 
 /**
@@ -163,37 +205,248 @@ enum data_formats attest_ctx_data_lookup_format(const char *fmt, int fmt_len)
 					     data_formats_str);
 }
 
+static unsigned int attest_ctx_data_label_hash(const char *label)
+{
+	return attest_util_hash_str(label, HASH_STR_INIT) % CTX_LABEL_HASH_SIZE;
+}
+
+static unsigned int attest_ctx_data_digest_hash(const uint8_t *digest)
+{
+	return (digest[0] | (digest[1] << 8)) % DIGEST_HASH_SIZE;
+}
+
+/**
+ * Check that data of a data item can be accessed
+ * @param[in] item	data item
+ *
+ * Referenced files are mapped from their location, and accessing pages
+ * beyond the end of a file truncated meanwhile raises SIGBUS. Their size is
+ * checked again before the data is read.
+ *
+ * @returns 0 on success, -EAGAIN if the referenced file was truncated
+ */
+int attest_ctx_data_item_check(struct data_item *item)
+{
+	struct stat st;
+
+	if (!(item->flags & DATA_ITEM_REF))
+		return 0;
+
+	if (stat(item->mapped_file, &st) || (size_t)st.st_size < item->len)
+		return -EAGAIN;
+
+	return 0;
+}
+
+static int attest_ctx_data_index_add(struct digest_index *index,
+				     struct data_item *item)
+{
+	struct data_digest *d;
+	int rc, digest_len;
+
+	rc = attest_ctx_data_item_check(item);
+	if (rc)
+		return rc;
+
+	d = malloc(sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+
+	rc = attest_util_calc_digest(index->algo, &digest_len, d->digest,
+				     item->len, item->data);
+	if (rc) {
+		free(d);
+		return rc;
+	}
+
+	d->item = item;
+	list_add_tail(&d->list, &item->digests);
+	list_add_tail(&d->hash_list,
+		      &index->buckets[attest_ctx_data_digest_hash(d->digest)]);
+	return 0;
+}
+
+/* add a new aux data item to the indexes created so far */
+static int attest_ctx_data_index_item(attest_ctx_data *ctx,
+				      struct data_item *item)
+{
+	struct digest_index *index;
+	int rc;
+
+	list_for_each_entry(index, &ctx->digest_indexes, list) {
+		rc = attest_ctx_data_index_add(index, item);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void attest_ctx_data_free_digests(struct data_item *item)
+{
+	struct data_digest *d, *temp_d;
+
+	list_for_each_entry_safe(d, temp_d, &item->digests, list) {
+		list_del(&d->list);
+		list_del(&d->hash_list);
+		free(d);
+	}
+}
+
+/* items received or read from a file, as opposed to generated ones */
+static int attest_ctx_data_item_is_file(struct data_item *item)
+{
+	return item->mapped_file || (item->flags & DATA_ITEM_IN_MEMORY);
+}
+
+static void attest_ctx_data_free_index(struct digest_index *index)
+{
+	struct data_digest *d, *temp_d;
+	int i;
+
+	for (i = 0; i < DIGEST_HASH_SIZE; i++) {
+		list_for_each_entry_safe(d, temp_d, &index->buckets[i],
+					 hash_list) {
+			list_del(&d->list);
+			list_del(&d->hash_list);
+			free(d);
+		}
+	}
+
+	free(index->algo);
+	free(index);
+}
+
+static struct digest_index *attest_ctx_data_get_index(attest_ctx_data *ctx,
+						      const char *algo)
+{
+	struct digest_index *index;
+	struct data_item *item;
+	uint8_t digest[MAX_DIGEST_SIZE];
+	int rc, i;
+
+	list_for_each_entry(index, &ctx->digest_indexes, list) {
+		if (!strcmp(index->algo, algo))
+			return index;
+	}
+
+	index = malloc(sizeof(*index));
+	if (!index)
+		return NULL;
+
+	/* get digest length and reject unknown algorithms */
+	rc = attest_util_calc_digest(algo, &index->digest_len, digest, 0, "");
+	if (rc)
+		goto out;
+
+	index->algo = strdup(algo);
+	if (!index->algo) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < DIGEST_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&index->buckets[i]);
+
+	list_for_each_entry(item, &ctx->ctx_data[CTX_AUX_DATA], list) {
+		if (!attest_ctx_data_item_is_file(item))
+			continue;
+
+		rc = attest_ctx_data_index_add(index, item);
+		if (rc)
+			break;
+	}
+
+	if (rc) {
+		attest_ctx_data_free_index(index);
+		index = NULL;
+		goto out;
+	}
+
+	list_add_tail(&index->list, &ctx->digest_indexes);
+out:
+	if (rc) {
+		free(index);
+		index = NULL;
+	}
+
+	return index;
+}
+
+/* the size is checked again after mapping, to detect a truncation */
+static int attest_ctx_data_map_ref(const char *path, size_t *len,
+				   unsigned char **data)
+{
+	struct stat st;
+	int rc = 0, fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return errno == ENOENT ? -ENOENT : -EACCES;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	*len = st.st_size;
+
+	*data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (*data == MAP_FAILED) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	if (fstat(fd, &st) || (size_t)st.st_size < *len) {
+		munmap(*data, *len);
+		rc = -EAGAIN;
+	}
+out:
+	close(fd);
+	return rc;
+}
+
 static int attest_ctx_data_add_common(attest_ctx_data *ctx,
 				      enum ctx_fields field, char *path,
 				      size_t len, unsigned char *data,
-				      const char *label)
+				      const char *label, uint16_t item_flags)
 {
 	struct data_item *new_item = NULL;
 	char path_dest[MAX_PATH_LENGTH], *path_ptr = path;
-	char *filename;
+	char *filename, *data_dir;
 	int rc = -EINVAL;
 
 	if (!ctx)
 		return -EINVAL;
 
-	if (path) {
+	/* references are mapped from the original location */
+	if (path && !(item_flags & DATA_ITEM_REF)) {
+		data_dir = attest_ctx_data_get_dir(ctx);
+		if (!data_dir)
+			return -EACCES;
+
 		filename = strrchr(path, '/');
 		if (filename)
 			filename++;
 		else
 			filename = path;
 
-		if (strncmp(path, ctx->data_dir, strlen(ctx->data_dir))) {
+		if (strncmp(path, data_dir, strlen(data_dir))) {
 			snprintf(path_dest, sizeof(path_dest), "%s/%s",
-				 ctx->data_dir, filename);
+				 data_dir, filename);
 			rc = attest_util_copy_file(path, path_dest);
 			if (rc)
 				goto out;
 
 			path_ptr = path_dest;
 		}
+	}
 
-		rc = attest_util_read_file(path_ptr, &len, &data);
+	if (path) {
+		if (item_flags & DATA_ITEM_REF)
+			rc = attest_ctx_data_map_ref(path_ptr, &len, &data);
+		else
+			rc = attest_util_read_file(path_ptr, &len, &data);
 		if (rc)
 			goto out;
 
@@ -213,9 +466,12 @@ static int attest_ctx_data_add_common(attest_ctx_data *ctx,
 		goto out;
 	}
 
+	INIT_LIST_HEAD(&new_item->digests);
+
 	new_item->data = data;
 	new_item->len = len;
 	new_item->mapped_file = path_ptr;
+	new_item->flags = item_flags;
 
 	if (label) {
 		new_item->label = strdup(label);
@@ -225,13 +481,26 @@ static int attest_ctx_data_add_common(attest_ctx_data *ctx,
 		}
 	}
 
+	if (field == CTX_AUX_DATA && attest_ctx_data_item_is_file(new_item)) {
+		rc = attest_ctx_data_index_item(ctx, new_item);
+		if (rc)
+			goto out;
+	}
+
 	list_add_tail(&new_item->list, &ctx->ctx_data[field]);
+
+	if (field == CTX_AUX_DATA && new_item->label)
+		list_add_tail(&new_item->label_list,
+			&ctx->label_index[attest_ctx_data_label_hash(label)]);
 	rc = 0;
 out:
 	if (rc) {
 		if (path)
 			munmap(data, len);
 
+		if (new_item)
+			attest_ctx_data_free_digests(new_item);
+
 		if (new_item) {
 			free(new_item->label);
 			free(new_item);
@@ -254,7 +523,8 @@ out:
 int attest_ctx_data_add(attest_ctx_data *ctx, enum ctx_fields field,
 			size_t len, unsigned char *data, const char *label)
 {
-	return attest_ctx_data_add_common(ctx, field, NULL, len, data, label);
+	return attest_ctx_data_add_common(ctx, field, NULL, len, data, label,
+					  0);
 }
 
 /**
@@ -279,7 +549,33 @@ int attest_ctx_data_add_copy(attest_ctx_data *ctx, enum ctx_fields field,
 
 	memcpy(copy, data, len);
 
-	return attest_ctx_data_add_common(ctx, field, NULL, len, copy, label);
+	return attest_ctx_data_add_common(ctx, field, NULL, len, copy, label,
+					  0);
+}
+
+/**
+ * Add a reference to a file to data context
+ * @param[in] ctx	data context
+ * @param[in] field	field identifier
+ * @param[in] path	file path
+ * @param[in] label	data label
+ *
+ * The file is mapped from its location, without copying it to the
+ * directory of the data context. Its digest is calculated only when the
+ * data item is looked up by digest.
+ *
+ * The file size is checked after mapping, and again by
+ * attest_ctx_data_item_check() before the data is read. A file truncated
+ * between the last check and the access still raises SIGBUS, references
+ * should be used only for files that are replaced, not rewritten.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_add_ref(attest_ctx_data *ctx, enum ctx_fields field,
+			    char *path, const char *label)
+{
+	return attest_ctx_data_add_common(ctx, field, path, 0, NULL, label,
+					  DATA_ITEM_REF);
 }
 
 /**
@@ -294,7 +590,8 @@ int attest_ctx_data_add_copy(attest_ctx_data *ctx, enum ctx_fields field,
 int attest_ctx_data_add_file(attest_ctx_data *ctx, enum ctx_fields field,
 			     char *path, const char *label)
 {
-	return attest_ctx_data_add_common(ctx, field, path, 0, NULL, label);
+	return attest_ctx_data_add_common(ctx, field, path, 0, NULL, label,
+					  0);
 }
 
 /**
@@ -327,7 +624,7 @@ int attest_ctx_data_add_dir(attest_ctx_data *ctx, enum ctx_fields field,
 			 d_entry->d_name);
 
 		rc = attest_ctx_data_add_common(ctx, field, file_path, 0, NULL,
-						label);
+						label, 0);
 		if (rc)
 			break;
 	}
@@ -336,6 +633,416 @@ int attest_ctx_data_add_dir(attest_ctx_data *ctx, enum ctx_fields field,
 	return 0;
 }
 
+static int attest_ctx_data_create_file(attest_ctx_data *ctx,
+				       enum ctx_fields field, const char *label,
+				       char *path)
+{
+	char *data_dir;
+	int fd;
+
+	data_dir = attest_ctx_data_get_dir(ctx);
+	if (!data_dir)
+		return -EACCES;
+
+	snprintf(path, MAX_PATH_LENGTH, "%s/%s", data_dir,
+		 (label && field == CTX_AUX_DATA) ? label : TEMP_FILE_TEMPLATE);
+
+	if (label && field == CTX_AUX_DATA)
+		fd = open(path, O_WRONLY | O_CREAT, 0600);
+	else
+		fd = mkstemp(path);
+
+	if (fd < 0)
+		return -EACCES;
+
+	return fd;
+}
+
+static int attest_ctx_data_add_buf(attest_ctx_data *ctx, enum ctx_fields field,
+				   size_t len, unsigned char *data,
+				   const char *label, int borrowed)
+{
+	char data_path_template[MAX_PATH_LENGTH];
+	int rc, fd;
+
+	if (!ctx)
+		return -EINVAL;
+
+	/* keep data in memory, a file is written only if requested */
+	if (ctx->flags & CTX_IN_MEMORY)
+		return attest_ctx_data_add_common(ctx, field, NULL, len, data,
+						  label, DATA_ITEM_IN_MEMORY |
+						  (borrowed ?
+						   DATA_ITEM_BORROWED : 0));
+
+	fd = attest_ctx_data_create_file(ctx, field, label, data_path_template);
+	if (fd < 0)
+		return fd;
+
+	rc = attest_util_write_buf(fd, data, len);
+	close(fd);
+
+	if (rc)
+		return rc;
+
+	rc = attest_ctx_data_add_common(ctx, field, data_path_template,
+					0, NULL, label, 0);
+	if (!rc && !borrowed)
+		free(data);
+
+	return rc;
+}
+
+/* memory is released when the data context is deinitialized */
+static int attest_ctx_data_memory_get(void *priv, size_t len)
+{
+	attest_ctx_data *ctx = (attest_ctx_data *)priv;
+	int rc;
+
+	if (data_memory_get) {
+		rc = data_memory_get(data_memory_priv, len);
+		if (rc)
+			return rc;
+	}
+
+	ctx->memory_used += len;
+	return 0;
+}
+
+/* memory of data is already reserved */
+static int attest_ctx_data_add_reserved(attest_ctx_data *ctx,
+					enum ctx_fields field, size_t len,
+					unsigned char *data, const char *label)
+{
+	attest_metrics_inc(METRIC_DECODED_BYTES, len, NULL);
+	return attest_ctx_data_add_buf(ctx, field, len, data, label, 0);
+}
+
+/**
+ * Add decoded data of a string \<fmt\>:\<data\> to data context
+ * @param[in] ctx	data context
+ * @param[in] field	field identifier
+ * @param[in] len	data length
+ * @param[in] data	decoded data (allocated with malloc())
+ * @param[in] label	data label
+ *
+ * Contexts initialized with CTX_IN_MEMORY keep the data, others write it
+ * to a file. On success, data is owned by the data context. Memory is
+ * reserved for the data until the data context is deinitialized.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_add_decoded(attest_ctx_data *ctx, enum ctx_fields field,
+				size_t len, unsigned char *data,
+				const char *label)
+{
+	int rc;
+
+	if (!ctx)
+		return -EINVAL;
+
+	rc = attest_ctx_data_memory_get(ctx, len);
+	if (rc)
+		return rc;
+
+	return attest_ctx_data_add_reserved(ctx, field, len, data, label);
+}
+
+/**
+ * Add data owned by the caller to data context
+ * @param[in] ctx	data context
+ * @param[in] field	field identifier
+ * @param[in] len	data length
+ * @param[in] data	data
+ * @param[in] label	data label
+ *
+ * Contexts initialized with CTX_IN_MEMORY refer to the data without
+ * copying it, and the caller must not release it before the data context
+ * is deinitialized. Others write it to a file. The data is not zeroed when
+ * the data context is deinitialized, the caller has to zero it if needed.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_add_borrowed(attest_ctx_data *ctx, enum ctx_fields field,
+				 size_t len, unsigned char *data,
+				 const char *label)
+{
+	attest_metrics_inc(METRIC_DECODED_BYTES, len, NULL);
+	return attest_ctx_data_add_buf(ctx, field, len, data, label, 1);
+}
+
+/* URI item waiting for attest_ctx_data_download_end() */
+struct pending_download {
+	struct list_head list;
+	struct data_item *item;
+	enum ctx_fields field;
+	char *url;
+};
+
+/* add an empty item now, to preserve the order of the items of a field */
+static int attest_ctx_data_queue_download(attest_ctx_data *ctx,
+					  enum ctx_fields field,
+					  const char *url, const char *label)
+{
+	struct pending_download *download;
+	struct data_item *item;
+
+	download = calloc(1, sizeof(*download));
+	if (!download)
+		return -ENOMEM;
+
+	item = calloc(1, sizeof(*item));
+	if (!item)
+		goto err;
+
+	INIT_LIST_HEAD(&item->digests);
+	item->flags = DATA_ITEM_PENDING;
+
+	download->url = strdup(url);
+	if (!download->url)
+		goto err;
+
+	if (label) {
+		item->label = strdup(label);
+		if (!item->label)
+			goto err;
+	}
+
+	download->item = item;
+	download->field = field;
+	list_add_tail(&download->list, &ctx->downloads);
+
+	list_add_tail(&item->list, &ctx->ctx_data[field]);
+
+	if (field == CTX_AUX_DATA && item->label)
+		list_add_tail(&item->label_list,
+			&ctx->label_index[attest_ctx_data_label_hash(label)]);
+	return 0;
+err:
+	if (item)
+		free(item->label);
+
+	free(item);
+	free(download->url);
+	free(download);
+	return -ENOMEM;
+}
+
+static int attest_ctx_data_fill_item(attest_ctx_data *ctx,
+				     enum ctx_fields field,
+				     struct data_item *item, size_t len,
+				     unsigned char *data)
+{
+	char data_path_template[MAX_PATH_LENGTH];
+	int rc, fd;
+
+	if (!len)
+		return -EINVAL;
+
+	if (ctx->flags & CTX_IN_MEMORY) {
+		item->data = data;
+		item->len = len;
+		item->flags = DATA_ITEM_IN_MEMORY;
+		goto out;
+	}
+
+	fd = attest_ctx_data_create_file(ctx, field, item->label,
+					 data_path_template);
+	if (fd < 0)
+		return fd;
+
+	rc = attest_util_write_buf(fd, data, len);
+	close(fd);
+
+	if (!rc)
+		rc = attest_util_read_file(data_path_template, &item->len,
+					   &item->data);
+
+	if (!rc) {
+		item->mapped_file = strdup(data_path_template);
+		if (!item->mapped_file) {
+			munmap(item->data, item->len);
+			item->data = NULL;
+			rc = -ENOMEM;
+		}
+	}
+
+	if (rc) {
+		unlink(data_path_template);
+		return rc;
+	}
+
+	free(data);
+	item->flags = 0;
+out:
+	if (field == CTX_AUX_DATA)
+		return attest_ctx_data_index_item(ctx, item);
+
+	return 0;
+}
+
+static void attest_ctx_data_free_downloads(attest_ctx_data *ctx)
+{
+	struct pending_download *download, *temp_download;
+	struct data_item *item;
+
+	list_for_each_entry_safe(download, temp_download, &ctx->downloads,
+				 list) {
+		item = download->item;
+
+		/* remove items whose data could not be obtained */
+		if (item->flags & DATA_ITEM_PENDING) {
+			list_del(&item->list);
+
+			if (download->field == CTX_AUX_DATA && item->label)
+				list_del(&item->label_list);
+
+			free(item->label);
+			free(item);
+		}
+
+		list_del(&download->list);
+		free(download->url);
+		free(download);
+	}
+}
+
+/**
+ * Start queueing URI items of a data context
+ * @param[in] ctx	data context
+ *
+ * URI items added with attest_ctx_data_add_string() are not downloaded
+ * until attest_ctx_data_download_end() is called.
+ */
+void attest_ctx_data_download_begin(attest_ctx_data *ctx)
+{
+	ctx->flags |= CTX_DOWNLOAD_BATCH;
+}
+
+/**
+ * Download queued URI items of a data context concurrently
+ * @param[in] ctx	data context
+ *
+ * On error, the items that could not be downloaded are removed.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_download_end(attest_ctx_data *ctx)
+{
+	struct pending_download *download;
+	struct download_item *items;
+	int rc = 0, ret, i = 0, num_items = 0;
+
+	ctx->flags &= ~CTX_DOWNLOAD_BATCH;
+
+	list_for_each_entry(download, &ctx->downloads, list)
+		num_items++;
+
+	if (!num_items)
+		return 0;
+
+	items = calloc(num_items, sizeof(*items));
+	if (!items) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	list_for_each_entry(download, &ctx->downloads, list) {
+		items[i].url = download->url;
+		items[i++].fd = -1;
+	}
+
+	rc = attest_util_download_items(num_items, items);
+
+	i = 0;
+	list_for_each_entry(download, &ctx->downloads, list) {
+		if (items[i].rc) {
+			i++;
+			continue;
+		}
+
+		ret = attest_ctx_data_memory_get(ctx, items[i].len);
+		if (!ret)
+			ret = attest_ctx_data_fill_item(ctx, download->field,
+							download->item,
+							items[i].len,
+							items[i].data);
+		if (ret && (download->item->flags & DATA_ITEM_PENDING))
+			free(items[i].data);
+		if (ret && !rc)
+			rc = ret;
+
+		i++;
+	}
+
+	free(items);
+out:
+	attest_ctx_data_free_downloads(ctx);
+	return rc;
+}
+
+static int attest_ctx_data_uri_allowed(attest_ctx_data *ctx, const char *url)
+{
+	int i;
+
+	if (!(ctx->flags & CTX_RESTRICT_URI))
+		return 1;
+
+	for (i = 0; i < uri_allowlist_len; i++)
+		if (!strncmp(url, uri_allowlist[i], strlen(uri_allowlist[i])))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * format: <decompressed length>:<base64 of the zlib stream>
+ *
+ * The length is not trusted to allocate memory, the stream must only match
+ * it.
+ */
+static int attest_ctx_data_decode_compressed(attest_ctx_data *ctx,
+					     const char *string,
+					     size_t *output_len,
+					     unsigned char **output)
+{
+	unsigned char *compressed;
+	size_t compressed_len;
+	unsigned long len;
+	char *len_end;
+	int rc;
+
+	errno = 0;
+	len = strtoul(string, &len_end, 10);
+	if (len_end == string || *len_end != ':' || errno)
+		return -EINVAL;
+
+	if (len > MAX_DECOMPRESSED_LEN - ctx->decompressed_len)
+		return -E2BIG;
+
+	rc = attest_util_decode_data(strlen(len_end), len_end, 1,
+				     &compressed_len, &compressed);
+	if (rc)
+		return rc;
+
+	rc = attest_util_decompress_data(compressed_len, compressed, len,
+					 attest_ctx_data_memory_get, ctx,
+					 output_len, output);
+	if (rc)
+		goto out;
+
+	if (*output_len != len) {
+		free(*output);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	ctx->decompressed_len += len;
+out:
+	free(compressed);
+	return rc;
+}
+
 /**
  * Add string \<fmt\>:\<data\> to data context
  * @param[in] ctx	data context
@@ -349,9 +1056,11 @@ int attest_ctx_data_add_string(attest_ctx_data *ctx, enum ctx_fields field,
 			       const char *string, const char *label)
 {
 	char data_path_template[MAX_PATH_LENGTH], *data_sep;
+	struct download_item item = { .fd = -1 };
 	unsigned char *output;
 	enum data_formats fmt;
 	size_t output_len;
+	off_t len;
 	int rc = 0, fd;
 
 	if (!ctx)
@@ -362,46 +1071,88 @@ int attest_ctx_data_add_string(attest_ctx_data *ctx, enum ctx_fields field,
 		return -EINVAL;
 
 	fmt = attest_ctx_data_lookup_format(string, data_sep - string);
-	if (fmt == DATA_FMT__LAST)
-		return -EINVAL;
-
-	snprintf(data_path_template, sizeof(data_path_template), "%s/%s",
-		 ctx->data_dir, (label && field == CTX_AUX_DATA) ?
-		 label : TEMP_FILE_TEMPLATE);
-
-	if (label && field == CTX_AUX_DATA)
-		fd = open(data_path_template, O_WRONLY | O_CREAT, 0600);
-	else
-		fd = mkstemp(data_path_template);
-
-	if (fd < 0)
-		return -EACCES;
 
 	switch (fmt) {
 	case DATA_FMT_BASE64:
 		rc = attest_util_decode_data(strlen(string), string,
 					     data_sep - string + 1,
 					     &output_len, &output);
-		if (!rc) {
-			rc = attest_util_write_buf(fd, output, output_len);
+		if (rc)
+			return rc;
+
+		rc = attest_ctx_data_add_decoded(ctx, field, output_len,
+						 output, label);
+		if (rc)
 			free(output);
-		}
 
-		break;
+		return rc;
+	case DATA_FMT_ZLIB_BASE64:
+		rc = attest_ctx_data_decode_compressed(ctx, data_sep + 1,
+						       &output_len, &output);
+		if (rc)
+			return rc;
+
+		rc = attest_ctx_data_add_reserved(ctx, field, output_len,
+						  output, label);
+		if (rc)
+			free(output);
+
+		return rc;
 	case DATA_FMT_URI:
+		if (!attest_ctx_data_uri_allowed(ctx, data_sep + 1))
+			return -EPERM;
+
+		if (ctx->num_downloads == MAX_DOWNLOADS)
+			return -E2BIG;
+
+		ctx->num_downloads++;
+
+		if (ctx->flags & CTX_DOWNLOAD_BATCH)
+			return attest_ctx_data_queue_download(ctx, field,
+							      data_sep + 1,
+							      label);
+
+		/* download directly to the buffer of the new item */
+		if (ctx->flags & CTX_IN_MEMORY) {
+			item.url = data_sep + 1;
+
+			rc = attest_util_download_items(1, &item);
+			if (rc)
+				return rc;
+
+			rc = attest_ctx_data_add_decoded(ctx, field, item.len,
+							 item.data, label);
+			if (rc)
+				free(item.data);
+
+			return rc;
+		}
+
+		fd = attest_ctx_data_create_file(ctx, field, label,
+						 data_path_template);
+		if (fd < 0)
+			return fd;
+
 		rc = attest_util_download_data(data_sep + 1, fd);
-		break;
-	default:
-		break;
-	}
+		if (!rc) {
+			len = lseek(fd, 0, SEEK_CUR);
+			rc = len < 0 ? -EIO :
+			     attest_ctx_data_memory_get(ctx, len);
+		}
 
-	close(fd);
+		close(fd);
 
-	if (rc)
-		return rc;
+		if (rc) {
+			unlink(data_path_template);
+			return rc;
+		}
 
-	return attest_ctx_data_add_common(ctx, field, data_path_template,
-					  0, NULL, label);
+		return attest_ctx_data_add_common(ctx, field,
+						  data_path_template, 0, NULL,
+						  label, 0);
+	default:
+		return -EINVAL;
+	}
 }
 
 /**
@@ -417,8 +1168,10 @@ int attest_ctx_data_new_string(enum data_formats fmt, size_t data_len,
 			       unsigned char *data, char **string)
 {
 	const char *format_str = data_formats_str[fmt];
-	size_t string_len;
-	int rc = 0;
+	unsigned char *compressed;
+	size_t string_len, compressed_len;
+	char len_str[32];
+	int rc = 0, len_str_len;
 
 	switch (fmt) {
 	case DATA_FMT_BASE64:
@@ -436,6 +1189,24 @@ int attest_ctx_data_new_string(enum data_formats fmt, size_t data_len,
 
 		memcpy(*string + strlen(format_str) + 1, data, data_len);
 		break;
+	case DATA_FMT_ZLIB_BASE64:
+		rc = attest_util_compress_data(data_len, data, &compressed_len,
+					       &compressed);
+		if (rc)
+			return rc;
+
+		len_str_len = snprintf(len_str, sizeof(len_str), "%zu:",
+				       data_len);
+
+		rc = attest_util_encode_data(compressed_len, compressed,
+					     strlen(format_str) + 1 +
+					     len_str_len, &string_len, string);
+		free(compressed);
+		if (rc)
+			return rc;
+
+		memcpy(*string + strlen(format_str) + 1, len_str, len_str_len);
+		break;
 	default:
 		break;
 	}
@@ -456,12 +1227,15 @@ struct data_item *attest_ctx_data_lookup_by_label(attest_ctx_data *ctx,
 						  const char *label)
 {
 	struct data_item *item;
+	unsigned int hash;
 
-	if (!ctx)
+	if (!ctx || !label)
 		return NULL;
 
-	list_for_each_entry(item, &ctx->ctx_data[CTX_AUX_DATA], list) {
-		if (label && !strcmp(item->label, label))
+	hash = attest_ctx_data_label_hash(label);
+
+	list_for_each_entry(item, &ctx->label_index[hash], label_list) {
+		if (!strcmp(item->label, label))
 			return item;
 	}
 
@@ -471,35 +1245,230 @@ struct data_item *attest_ctx_data_lookup_by_label(attest_ctx_data *ctx,
 /**
  * Lookup data item by digest
  * @param[in] ctx	data context
- * @param[in] algo	digest algorithm
- * @param[in] digest	digest
+ * @param[in] algo	digest algorithm
+ * @param[in] digest	digest
+ *
+ * If a content-addressed store has been set, data items found in the data
+ * context are added to the store, and data not found in the data context is
+ * taken from the store.
+ *
+ * @returns data_item pointer on success, NULL if not found
+ */
+struct data_item *attest_ctx_data_lookup_by_digest(attest_ctx_data *ctx,
+				const char *algo, const uint8_t *digest)
+{
+	struct digest_index *index;
+	struct data_digest *d;
+	struct data_item *item;
+	unsigned char *data;
+	unsigned int hash;
+	size_t len;
+	int rc;
+
+	if (!ctx)
+		return NULL;
+
+	index = attest_ctx_data_get_index(ctx, algo);
+	if (!index)
+		return NULL;
+
+	hash = attest_ctx_data_digest_hash(digest);
+
+	list_for_each_entry(d, &index->buckets[hash], hash_list) {
+		if (memcmp(d->digest, digest, index->digest_len))
+			continue;
+
+		/* the digest was calculated from the data item content */
+		if (ctx->store_put && !(d->item->flags & DATA_ITEM_STORED)) {
+			ctx->store_put(algo, index->digest_len, digest,
+				       d->item->len, d->item->data);
+			d->item->flags |= DATA_ITEM_STORED;
+		}
+
+		return d->item;
+	}
+
+	if (!ctx->store_get)
+		return NULL;
+
+	rc = ctx->store_get(algo, index->digest_len, digest, &len, &data);
+	if (rc)
+		return NULL;
+
+	rc = attest_ctx_data_add_common(ctx, CTX_AUX_DATA, NULL, len, data,
+					NULL, DATA_ITEM_IN_MEMORY |
+					DATA_ITEM_STORED);
+	if (rc) {
+		free(data);
+		return NULL;
+	}
+
+	item = list_last_entry(&ctx->ctx_data[CTX_AUX_DATA], struct data_item,
+			       list);
+
+	/* the data item stays in the data context, even if it does not match */
+	list_for_each_entry(d, &item->digests, list) {
+		if (!memcmp(d->digest, digest, index->digest_len))
+			return item;
+	}
+
+	return NULL;
+}
+
+/**
+ * Set content-addressed store of data items
+ * @param[in] ctx	data context
+ * @param[in] get	function to get data from the store
+ * @param[in] put	function to add data to the store
+ */
+void attest_ctx_data_set_store(attest_ctx_data *ctx, data_store_get_func get,
+			       data_store_put_func put)
+{
+	ctx->store_get = get;
+	ctx->store_put = put;
+}
+
+/**
+ * Set functions to account memory of data contexts
+ * @param[in] get	function to reserve memory
+ * @param[in] put	function to release memory
+ * @param[in] priv	data passed to the functions
+ *
+ * Memory for decompressed data is reserved with get() before allocation,
+ * memory for decoded and downloaded data after it is obtained. Memory is
+ * released with put() when the data context is deinitialized. Must be called
+ * before data contexts are initialized.
+ */
+void attest_ctx_data_set_memory_funcs(data_memory_get_func get,
+				      data_memory_put_func put, void *priv)
+{
+	data_memory_get = get;
+	data_memory_put = put;
+	data_memory_priv = priv;
+}
+
+/**
+ * Load URL prefixes of URI items resolved for restricted data contexts
+ * @param[in] path	file with a URL prefix per line
+ *
+ * URI items of data contexts initialized with CTX_RESTRICT_URI are
+ * resolved only if the URL starts with one of the prefixes, and rejected
+ * if no prefix was loaded. Prefixes should end with the '/' after the host
+ * name. Lines starting with '#' are ignored. Must be called before data
+ * contexts are initialized.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_load_uri_allowlist(const char *path)
+{
+	char *line = NULL, **new_list;
+	size_t line_size = 0;
+	ssize_t len;
+	int rc = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -ENOENT;
+
+	while ((len = getline(&line, &line_size, fp)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (!len || line[0] == '#')
+			continue;
+
+		new_list = realloc(uri_allowlist, (uri_allowlist_len + 1) *
+				   sizeof(*uri_allowlist));
+		if (!new_list) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		uri_allowlist = new_list;
+		uri_allowlist[uri_allowlist_len] = strdup(line);
+		if (!uri_allowlist[uri_allowlist_len]) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		uri_allowlist_len++;
+	}
+
+	free(line);
+	fclose(fp);
+	return rc;
+}
+
+/**
+ * Get directory where data context files are stored
+ * @param[in] ctx	data context
+ *
+ * The directory of contexts initialized with CTX_IN_MEMORY is created at
+ * the first request.
+ *
+ * @returns directory path on success, NULL on error
+ */
+char *attest_ctx_data_get_dir(attest_ctx_data *ctx)
+{
+	char *data_dir;
+
+	if (ctx->data_dir)
+		return ctx->data_dir;
+
+	data_dir = strdup(TEMP_DIR_TEMPLATE);
+	if (!data_dir)
+		return NULL;
+
+	ctx->data_dir = mkdtemp(data_dir);
+	if (!ctx->data_dir)
+		free(data_dir);
+
+	return ctx->data_dir;
+}
+
+/**
+ * Get path of the file containing a data item
+ * @param[in] ctx	data context
+ * @param[in] item	data item
  *
- * @returns data_item pointer on success, NULL if not found
+ * Data items kept in memory are written to a file at the first request.
+ *
+ * @returns file path on success, NULL if the data item has no file
  */
-struct data_item *attest_ctx_data_lookup_by_digest(attest_ctx_data *ctx,
-				const char *algo, const uint8_t *digest)
+char *attest_ctx_data_get_path(attest_ctx_data *ctx, struct data_item *item)
 {
-	struct data_item *item;
-	uint8_t data_digest[MAX_DIGEST_SIZE];
-	int rc, digest_len;
+	char path[MAX_PATH_LENGTH], *data_dir;
+	int rc, fd;
 
-	if (!ctx)
+	if (item->mapped_file || !(item->flags & DATA_ITEM_IN_MEMORY))
+		return item->mapped_file;
+
+	data_dir = attest_ctx_data_get_dir(ctx);
+	if (!data_dir)
 		return NULL;
 
-	list_for_each_entry(item, &ctx->ctx_data[CTX_AUX_DATA], list) {
-		if (!item->mapped_file)
-			continue;
+	snprintf(path, sizeof(path), "%s/%s", data_dir,
+		 item->label ?: TEMP_FILE_TEMPLATE);
 
-		rc = attest_util_calc_digest(algo, &digest_len, data_digest,
-					     item->len, item->data);
-		if (rc)
-			return NULL;
+	if (item->label)
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	else
+		fd = mkstemp(path);
 
-		if (!memcmp(data_digest, digest, digest_len))
-			return item;
-	}
+	if (fd < 0)
+		return NULL;
 
-	return NULL;
+	rc = attest_util_write_buf(fd, item->data, item->len);
+	close(fd);
+
+	if (!rc)
+		item->mapped_file = strdup(path);
+
+	if (!item->mapped_file)
+		unlink(path);
+
+	return item->mapped_file;
 }
 
 /**
@@ -519,6 +1488,19 @@ attest_ctx_data *attest_ctx_data_get_global(void)
  * @returns 0 on success, a negative value on error
  */
 int attest_ctx_data_init(attest_ctx_data **ctx)
+{
+	return attest_ctx_data_init_flags(ctx, 0);
+}
+
+/**
+ * Obtain and initialize new data context with flags
+ * @param[in,out] ctx	data context
+ * @param[in] flags	data context flags (CTX_IN_MEMORY, CTX_COMPRESS,
+ *			CTX_RESTRICT_URI)
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_init_flags(attest_ctx_data **ctx, uint16_t flags)
 {
 	attest_ctx_data *new_ctx = &global_ctx_data;
 	int rc = 0, i;
@@ -532,19 +1514,28 @@ int attest_ctx_data_init(attest_ctx_data **ctx)
 	for (i = 0; i < CTX__LAST; i++)
 		INIT_LIST_HEAD(&new_ctx->ctx_data[i]);
 
-	new_ctx->data_dir = strdup(TEMP_DIR_TEMPLATE);
-	if (!new_ctx->data_dir) {
-		rc = -ENOMEM;
-		goto out;
-	}
+	INIT_LIST_HEAD(&new_ctx->digest_indexes);
+	INIT_LIST_HEAD(&new_ctx->downloads);
 
-	new_ctx->data_dir = mkdtemp(new_ctx->data_dir);
-	if (!new_ctx->data_dir) {
-		rc = -EACCES;
-		goto out;
+	for (i = 0; i < CTX_LABEL_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&new_ctx->label_index[i]);
+
+	if (!(flags & CTX_IN_MEMORY)) {
+		new_ctx->data_dir = strdup(TEMP_DIR_TEMPLATE);
+		if (!new_ctx->data_dir) {
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		new_ctx->data_dir = mkdtemp(new_ctx->data_dir);
+		if (!new_ctx->data_dir) {
+			rc = -EACCES;
+			goto out;
+		}
 	}
 
-	new_ctx->flags = CTX_INIT;
+	new_ctx->flags = CTX_INIT | (flags & (CTX_IN_MEMORY | CTX_COMPRESS |
+						 CTX_RESTRICT_URI));
 
 	if (ctx)
 		*ctx = new_ctx;
@@ -567,6 +1558,7 @@ out:
 void attest_ctx_data_cleanup(attest_ctx_data *ctx)
 {
 	struct data_item *item, *temp_item;
+	struct digest_index *index, *temp_index;
 	struct list_head *head;
 	int i;
 
@@ -576,15 +1568,42 @@ void attest_ctx_data_cleanup(attest_ctx_data *ctx)
 	if (!(ctx->flags & CTX_INIT))
 		return;
 
+	attest_ctx_data_free_downloads(ctx);
+
+	list_for_each_entry_safe(index, temp_index, &ctx->digest_indexes,
+				 list) {
+		list_del(&index->list);
+		attest_ctx_data_free_index(index);
+	}
+
 	for (i = 0; i < CTX__LAST; i++) {
 		head = ctx->ctx_data + i;
 
 		list_for_each_entry_safe(item, temp_item, head, list) {
 			list_del(&item->list);
 
+			/* do not write to pages of referenced files */
+			if (item->flags & DATA_ITEM_REF) {
+				munmap(item->data, item->len);
+				goto free_item;
+			}
+
+			/* borrowed data is zeroed and released by its owner */
+			if (item->flags & DATA_ITEM_BORROWED) {
+				if (item->mapped_file)
+					unlink(item->mapped_file);
+
+				goto free_item;
+			}
+
 			memset(item->data, 0, item->len);
 
-			if (item->mapped_file &&
+			if (item->flags & DATA_ITEM_IN_MEMORY) {
+				if (item->mapped_file)
+					unlink(item->mapped_file);
+
+				free(item->data);
+			} else if (item->mapped_file &&
 			    !strncmp(item->mapped_file, ctx->data_dir,
 				     strlen(ctx->data_dir))) {
 				munmap(item->data, item->len);
@@ -592,7 +1611,7 @@ void attest_ctx_data_cleanup(attest_ctx_data *ctx)
 			} else if (!item->mapped_file) {
 				free(item->data);
 			}
-
+free_item:
 			free(item->label);
 			free(item->mapped_file);
 			free(item);
@@ -605,6 +1624,9 @@ void attest_ctx_data_cleanup(attest_ctx_data *ctx)
 		ctx->data_dir = NULL;
 	}
 
+	if (ctx->memory_used && data_memory_put)
+		data_memory_put(data_memory_priv, ctx->memory_used);
+
 	memset(ctx, 0, sizeof(*ctx));
 
 	if (ctx != &global_ctx_data)
@@ -613,6 +1635,135 @@ void attest_ctx_data_cleanup(attest_ctx_data *ctx)
 
 /** @} */
 
+/**
+ * @name Plugin Registry API
+ *  @{
+ */
+
+struct plugin_sym {
+	struct list_head list;
+	char *library_name;
+	char *sym_name;
+	void *handle;
+	void *sym;
+};
+
+/* plugins are loaded once and kept until attest_ctx_plugin_cleanup() */
+static struct list_head plugin_syms[PLUGIN_HASH_SIZE];
+static pthread_mutex_t plugin_syms_lock = PTHREAD_MUTEX_INITIALIZER;
+static int plugin_syms_init;
+
+static unsigned int attest_ctx_plugin_hash(const char *library_name,
+					   const char *sym_name)
+{
+	unsigned int hash;
+
+	hash = attest_util_hash_str(library_name, HASH_STR_INIT);
+	hash = attest_util_hash_str(sym_name, hash);
+
+	return hash % PLUGIN_HASH_SIZE;
+}
+
+/**
+ * Get a symbol from a plugin
+ * @param[in] library_name	plugin library name
+ * @param[in] sym_name	symbol name
+ *
+ * The library is loaded with dlopen() and the symbol resolved with dlsym()
+ * only at the first request. Following requests are served from a hash
+ * table, and library handles are released by attest_ctx_plugin_cleanup().
+ *
+ * @returns symbol address on success, NULL if not found
+ */
+void *attest_ctx_plugin_get_sym(const char *library_name, const char *sym_name)
+{
+	struct plugin_sym *plugin_sym;
+	unsigned int hash, i;
+	void *handle, *sym = NULL;
+
+	hash = attest_ctx_plugin_hash(library_name, sym_name);
+
+	pthread_mutex_lock(&plugin_syms_lock);
+
+	if (!plugin_syms_init) {
+		for (i = 0; i < PLUGIN_HASH_SIZE; i++)
+			INIT_LIST_HEAD(&plugin_syms[i]);
+
+		plugin_syms_init = 1;
+	}
+
+	list_for_each_entry(plugin_sym, &plugin_syms[hash], list) {
+		if (!strcmp(plugin_sym->library_name, library_name) &&
+		    !strcmp(plugin_sym->sym_name, sym_name)) {
+			sym = plugin_sym->sym;
+			attest_metrics_cache("plugin", 1);
+			goto out;
+		}
+	}
+
+	attest_metrics_cache("plugin", 0);
+
+	/* dlopen() of an already loaded library only increments refcount */
+	handle = dlopen(library_name, RTLD_LAZY);
+	if (!handle)
+		goto out;
+
+	sym = dlsym(handle, sym_name);
+	if (!sym) {
+		dlclose(handle);
+		goto out;
+	}
+
+	plugin_sym = malloc(sizeof(*plugin_sym));
+	if (!plugin_sym)
+		goto out;
+
+	plugin_sym->library_name = strdup(library_name);
+	plugin_sym->sym_name = strdup(sym_name);
+	if (!plugin_sym->library_name || !plugin_sym->sym_name) {
+		free(plugin_sym->library_name);
+		free(plugin_sym->sym_name);
+		free(plugin_sym);
+		goto out;
+	}
+
+	plugin_sym->handle = handle;
+	plugin_sym->sym = sym;
+	list_add(&plugin_sym->list, &plugin_syms[hash]);
+out:
+	pthread_mutex_unlock(&plugin_syms_lock);
+	return sym;
+}
+
+/**
+ * Release plugins loaded by attest_ctx_plugin_get_sym()
+ *
+ * Must be called only when no verifier context refers to plugin functions.
+ * Plugins are loaded again, possibly in a new version, at the next request.
+ */
+void attest_ctx_plugin_cleanup(void)
+{
+	struct plugin_sym *plugin_sym, *tmp;
+	int i;
+
+	pthread_mutex_lock(&plugin_syms_lock);
+
+	for (i = 0; plugin_syms_init && i < PLUGIN_HASH_SIZE; i++) {
+		list_for_each_entry_safe(plugin_sym, tmp, &plugin_syms[i],
+					 list) {
+			list_del(&plugin_sym->list);
+			dlclose(plugin_sym->handle);
+			free(plugin_sym->library_name);
+			free(plugin_sym->sym_name);
+			free(plugin_sym);
+		}
+	}
+
+	pthread_mutex_unlock(&plugin_syms_lock);
+}
+
+/** @} */
+
 /**
  * @name Verifier Context API
  *  @{
@@ -641,35 +1792,70 @@ struct verifier_struct *attest_ctx_verifier_lookup(attest_ctx_verifier *ctx,
 	return NULL;
 }
 
+static void attest_ctx_verifier_free_func(struct verifier_struct *verifier)
+{
+	if (!(verifier->flags & VERIFIER_REQ_SHARED)) {
+		if (verifier->priv && verifier->cleanup)
+			verifier->cleanup(verifier->priv);
+
+		free(verifier->req);
+	}
+
+	free(verifier);
+}
+
 static int attest_ctx_verifier_add_func(attest_ctx_verifier *ctx,
-					const char *id, void *handle,
-					verifier_func func, const char *req)
+					struct verifier_struct *src,
+					const char *req)
 {
 	struct verifier_struct *verifier;
+	struct verification_log *log;
 	int rc = 0;
 
-	if (attest_ctx_verifier_lookup(ctx, id))
+	if (attest_ctx_verifier_lookup(ctx, src->id))
 		return 0;
 
-	verifier = malloc(sizeof(*verifier));
+	verifier = calloc(1, sizeof(*verifier));
 	if (!verifier)
 		return -ENOMEM;
 
-	verifier->id = id;
-	verifier->handle = handle;
-	verifier->func = func;
-	verifier->req = req ? strdup(req) : NULL;
-	if (req && !verifier->req) {
+	verifier->id = src->id;
+	verifier->handle = src->handle;
+	verifier->func = src->func;
+	verifier->init = src->init;
+	verifier->cleanup = src->cleanup;
+	verifier->begin = src->begin;
+	verifier->on_entry = src->on_entry;
+	verifier->end = src->end;
+	verifier->flags = src->flags & VERIFIER_PARALLEL;
+
+	/* parsed once, used by the copies of the verifier context */
+	if (!req) {
+		verifier->req = src->req;
+		verifier->priv = src->priv;
+		verifier->flags |= VERIFIER_REQ_SHARED;
+		goto out;
+	}
+
+	verifier->req = strdup(req);
+	if (!verifier->req) {
 		rc = -ENOMEM;
 		goto out;
 	}
 
-	list_add_tail(&verifier->list, &ctx->verifiers);
+	if (verifier->init) {
+		log = attest_ctx_verifier_add_log(ctx, "parse requirement");
+		rc = verifier->init(ctx, verifier->req, &verifier->priv);
+		attest_ctx_verifier_end_log(ctx, log, rc);
+	}
 out:
-	if (rc)
-		free(verifier);
+	if (rc) {
+		attest_ctx_verifier_free_func(verifier);
+		return rc;
+	}
 
-	return rc;
+	list_add_tail(&verifier->list, &ctx->verifiers);
+	return 0;
 }
 
 /**
@@ -684,10 +1870,11 @@ int attest_ctx_verifier_req_add(attest_ctx_verifier *ctx,
 				const char *verifier_str, const char *req)
 {
 	const char *separator;
-	struct verifier_struct *func_array;
+	struct verifier_struct func = { 0 }, *cur_func;
+	unsigned char *func_array;
 	char library_name[MAX_PATH_LENGTH];
-	void *handle;
-	int rc = 0, i = 0, *num_func;
+	size_t *func_size, size = VERIFIER_STRUCT_SIZE_V0;
+	int i = 0, *num_func;
 
 	if (!ctx)
 		return -EINVAL;
@@ -702,39 +1889,88 @@ int attest_ctx_verifier_req_add(attest_ctx_verifier *ctx,
 	snprintf(library_name, sizeof(library_name), "libverifier_%.*s.so",
 		 (int)(separator - verifier_str), verifier_str);
 
-	handle = dlopen(library_name, RTLD_LAZY);
-	if (!handle)
+	num_func = attest_ctx_plugin_get_sym(library_name, "num_func");
+	if (!num_func)
 		return -ENOENT;
 
-	num_func = dlsym(handle, "num_func");
-	if (!num_func) {
-		rc = -ENOENT;
-		goto out;
-	}
+	func_array = attest_ctx_plugin_get_sym(library_name, "func_array");
+	if (!func_array)
+		return -ENOENT;
 
-	func_array = dlsym(handle, "func_array");
-	if (!func_array) {
-		rc = -ENOENT;
-		goto out;
-	}
+	/* members unknown to the plugin are not set */
+	func_size = attest_ctx_plugin_get_sym(library_name, "func_size");
+	if (func_size)
+		size = *func_size;
+
+	if (size < VERIFIER_STRUCT_SIZE_V0)
+		return -EINVAL;
 
 	for (i = 0; i < *num_func; i++) {
-		if (!strcmp(func_array[i].id, verifier_str))
+		cur_func = (struct verifier_struct *)(func_array + i * size);
+		if (!strcmp(cur_func->id, verifier_str))
 			break;
 	}
 
-	if (i == *num_func) {
-		rc = -ENOENT;
-		goto out;
+	if (i == *num_func)
+		return -ENOENT;
+
+	memcpy(&func, cur_func, size < sizeof(func) ? size : sizeof(func));
+	return attest_ctx_verifier_add_func(ctx, &func, req);
+}
+
+/**
+ * Copy verification requirements from another verifier context
+ * @param[in] ctx	verifier context
+ * @param[in] src	verifier context containing the requirements
+ *
+ * Requirements and their parsed form are shared, not duplicated: src must
+ * not be modified or freed until ctx is cleaned up.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_verifier_req_copy(attest_ctx_verifier *ctx,
+				 attest_ctx_verifier *src)
+{
+	struct verifier_struct *verifier;
+	int rc;
+
+	if (!ctx || !src)
+		return -EINVAL;
+
+	list_for_each_entry(verifier, &src->verifiers, list) {
+		rc = attest_ctx_verifier_add_func(ctx, verifier, NULL);
+		if (rc)
+			return rc;
 	}
 
-	rc = attest_ctx_verifier_add_func(ctx, func_array[i].id, handle,
-					  func_array[i].func, req);
-out:
-	if (rc)
-		dlclose(handle);
+	return 0;
+}
 
-	return rc;
+static int attest_ctx_verifier_log_in_arena(attest_ctx_verifier *ctx,
+					    struct verification_log *log)
+{
+	return log >= ctx->log_arena &&
+	       log < ctx->log_arena + CTX_LOG_ARENA_SIZE;
+}
+
+static void attest_ctx_verifier_thread_logs_key_init(void)
+{
+	pthread_key_create(&thread_logs_key, NULL);
+}
+
+/* list of logs of the current thread for the context */
+static struct list_head *attest_ctx_verifier_logs(attest_ctx_verifier *ctx)
+{
+	struct verification_thread_logs *thread_logs;
+
+	pthread_once(&thread_logs_once,
+		     attest_ctx_verifier_thread_logs_key_init);
+
+	thread_logs = pthread_getspecific(thread_logs_key);
+	if (thread_logs && thread_logs->ctx == ctx)
+		return &thread_logs->logs;
+
+	return &ctx->logs;
 }
 
 static void attest_ctx_verifier_free_logs(attest_ctx_verifier *ctx)
@@ -746,11 +1982,14 @@ static void attest_ctx_verifier_free_logs(attest_ctx_verifier *ctx)
 		if (log == &unknown_log)
 			break;
 
-		if (strlen(log->reason))
+		if (log->reason[0] && log->reason != unknown_log.reason)
 			free(log->reason);
 
-		free(log);
+		if (!attest_ctx_verifier_log_in_arena(ctx, log))
+			free(log);
 	}
+
+	ctx->log_arena_used = 0;
 }
 
 /**
@@ -758,32 +1997,48 @@ static void attest_ctx_verifier_free_logs(attest_ctx_verifier *ctx)
  * @param[in] ctx	verifier context
  * @param[in] operation	operation being performed during verification
  *
+ * Operation must be a static string, it is not copied. The first logs of a
+ * context are taken from an array in the context and are not allocated.
+ *
  * @returns log on success, NULL on error
  */
 struct verification_log *attest_ctx_verifier_add_log(attest_ctx_verifier *ctx,
 						     const char *operation)
 {
 	struct verification_log *new_log, *last_log;
+	struct list_head *logs;
 
 	if (!ctx)
 		return NULL;
 
+	logs = attest_ctx_verifier_logs(ctx);
+
+	pthread_mutex_lock(&ctx->logs_lock);
 	last_log = list_last_entry(&ctx->logs, struct verification_log, list);
-	if (last_log == &unknown_log)
-		return NULL;
+	if (last_log == &unknown_log) {
+		new_log = NULL;
+		goto out;
+	}
 
-	new_log = calloc(1, sizeof(*new_log));
-	if (!new_log) {
-		attest_ctx_verifier_free_logs(ctx);
-		new_log = &unknown_log;
-		return NULL;
+	if (ctx->log_arena_used < CTX_LOG_ARENA_SIZE) {
+		new_log = &ctx->log_arena[ctx->log_arena_used++];
+		memset(new_log, 0, sizeof(*new_log));
+	} else {
+		new_log = calloc(1, sizeof(*new_log));
+		if (!new_log) {
+			attest_ctx_verifier_free_logs(ctx);
+			goto out;
+		}
 	}
 
 	new_log->operation = operation;
 	new_log->result = "in progress";
 	new_log->reason = "";
+	clock_gettime(CLOCK_MONOTONIC, &new_log->start);
 
-	list_add(&new_log->list, &ctx->logs);
+	list_add(&new_log->list, logs);
+out:
+	pthread_mutex_unlock(&ctx->logs_lock);
 	return new_log;
 }
 
@@ -791,24 +2046,30 @@ struct verification_log *attest_ctx_verifier_add_log(attest_ctx_verifier *ctx,
  * Get current log
  * @param[in] ctx	verifier context
  *
+ * Only logs created by the current thread are returned.
+ *
  * @returns log on success, NULL on error
  */
 struct verification_log *attest_ctx_verifier_get_log(attest_ctx_verifier *ctx)
 {
 	struct verification_log *log;
+	struct list_head *logs;
 
 	if (!ctx)
 		return NULL;
 
-	if (list_empty(&ctx->logs))
-		return NULL;
+	logs = attest_ctx_verifier_logs(ctx);
 
-	list_for_each_entry(log, &ctx->logs, list) {
+	pthread_mutex_lock(&ctx->logs_lock);
+	list_for_each_entry(log, logs, list) {
 		if (!strcmp(log->result, "in progress"))
-			return log;
+			goto out;
 	}
 
-	return NULL;
+	log = NULL;
+out:
+	pthread_mutex_unlock(&ctx->logs_lock);
+	return log;
 }
 
 /**
@@ -816,6 +2077,8 @@ struct verification_log *attest_ctx_verifier_get_log(attest_ctx_verifier *ctx)
  * @param[in] log	log
  * @param[in] fmt	message format
  * @param[in] ...	data to be added to the message
+ *
+ * Only the thread performing the operation should set the message.
  */
 void attest_ctx_verifier_set_log(struct verification_log *log,
 				 const char *fmt, ...)
@@ -826,12 +2089,14 @@ void attest_ctx_verifier_set_log(struct verification_log *log,
 	if (!log)
 		return;
 
-	if (strlen(log->reason))
+	/* only the first reason is kept, do not format the others */
+	if (log->reason[0])
 		return;
 
 	va_start(list, fmt);
-
 	vsnprintf(buf, sizeof(buf), fmt, list);
+	va_end(list);
+
 	reason = strdup(buf);
 	if (!reason)
 		reason = unknown_log.reason;
@@ -845,37 +2110,113 @@ void attest_ctx_verifier_set_log(struct verification_log *log,
  * @param[in] ctx	verifier context
  * @param[in] log	log
  * @param[in] result	result of the operation performed
+ *
+ * If the operation failed, and an operation started after it has a
+ * reason, the reason becomes "<operation> failed". It is formatted only
+ * when logs are printed.
  */
 void attest_ctx_verifier_end_log(attest_ctx_verifier *ctx,
 				 struct verification_log *log, int result)
 {
 	struct verification_log *previous_log;
-	char buf[MAX_LOG_LENGTH];
+	struct list_head *logs;
 
 	if (!ctx)
 		return;
 
+	logs = attest_ctx_verifier_logs(ctx);
+
+	pthread_mutex_lock(&ctx->logs_lock);
 	log->result = !result ? "ok" : "failed";
+	clock_gettime(CLOCK_MONOTONIC, &log->end);
 
 	if (!result)
-		return;
+		goto out;
 
 	list_for_each_entry_reverse(previous_log, &log->list, list) {
-		if ((struct list_head *)previous_log == &ctx->logs)
+		if ((struct list_head *)previous_log == logs)
 			break;
 
-		if (strlen(previous_log->reason)) {
-			snprintf(buf, sizeof(buf), "%s failed",
-				 previous_log->operation);
-			if (strlen(log->reason))
+		if (previous_log->reason[0] || previous_log->cause) {
+			if (log->reason[0] && log->reason != unknown_log.reason)
 				free(log->reason);
-			log->reason = strdup(buf);
-			if (!log->reason)
-				log->reason = unknown_log.reason;
-
+			log->reason = "";
+			log->cause = previous_log;
 			break;
 		}
 	}
+out:
+	pthread_mutex_unlock(&ctx->logs_lock);
+
+	attest_metrics_observe(METRIC_STAGE_DURATION,
+			(log->end.tv_sec - log->start.tv_sec) * 1000000 +
+			(log->end.tv_nsec - log->start.tv_nsec) / 1000,
+			"stage=\"%s\"", log->operation);
+}
+
+/**
+ * Account data processed by the operation of a log
+ * @param[in] log	log
+ * @param[in] entries	number of entries processed
+ * @param[in] bytes	number of bytes processed
+ *
+ * Only the thread performing the operation should update its log.
+ */
+void attest_ctx_verifier_log_account(struct verification_log *log,
+				     size_t entries, size_t bytes)
+{
+	if (!log || log == &unknown_log)
+		return;
+
+	log->entries += entries;
+	log->bytes += bytes;
+}
+
+/**
+ * Add the logs of the current thread to a separate list
+ * @param[in] ctx		verifier context
+ * @param[in] thread_logs	list of logs of the thread
+ *
+ * Verifiers running concurrently with the same verifier context see only
+ * their logs, so that reasons and causes are not set in the logs of another
+ * thread.
+ */
+void attest_ctx_verifier_thread_logs_start(attest_ctx_verifier *ctx,
+				struct verification_thread_logs *thread_logs)
+{
+	thread_logs->ctx = ctx;
+	INIT_LIST_HEAD(&thread_logs->logs);
+
+	pthread_once(&thread_logs_once,
+		     attest_ctx_verifier_thread_logs_key_init);
+	pthread_setspecific(thread_logs_key, thread_logs);
+}
+
+/**
+ * Add the logs of the current thread to the verifier context again
+ */
+void attest_ctx_verifier_thread_logs_stop(void)
+{
+	pthread_once(&thread_logs_once,
+		     attest_ctx_verifier_thread_logs_key_init);
+	pthread_setspecific(thread_logs_key, NULL);
+}
+
+/**
+ * Move the logs of a thread to its verifier context
+ * @param[in] thread_logs	list of logs of the thread
+ *
+ * Must be called after the thread terminated. Logs of threads are moved in
+ * the order the verifiers were started.
+ */
+void attest_ctx_verifier_thread_logs_splice(
+				struct verification_thread_logs *thread_logs)
+{
+	attest_ctx_verifier *ctx = thread_logs->ctx;
+
+	pthread_mutex_lock(&ctx->logs_lock);
+	list_splice_init(&thread_logs->logs, &ctx->logs);
+	pthread_mutex_unlock(&ctx->logs_lock);
 }
 
 /**
@@ -907,6 +2248,7 @@ int attest_ctx_verifier_init(attest_ctx_verifier **ctx)
 	INIT_LIST_HEAD(&new_ctx->event_logs);
 	INIT_LIST_HEAD(&new_ctx->verifiers);
 	INIT_LIST_HEAD(&new_ctx->logs);
+	pthread_mutex_init(&new_ctx->logs_lock, NULL);
 
 	new_ctx->flags = CTX_INIT;
 
@@ -962,6 +2304,50 @@ void attest_ctx_verifier_set_flags(attest_ctx_verifier *ctx, uint16_t flags)
 	ctx->flags |= flags;
 }
 
+/**
+ * Set the number of threads a verification can use
+ * @param[in] ctx		verifier context
+ * @param[in] num_threads	number of threads (0: online CPUs)
+ *
+ * Event log parsers and verifiers use up to num_threads threads to process
+ * data in parallel. Callers verifying multiple requests concurrently should
+ * set it to 1, so that the total number of threads is bound by the callers.
+ */
+void attest_ctx_verifier_set_num_threads(attest_ctx_verifier *ctx,
+					 int num_threads)
+{
+	ctx->num_threads = num_threads;
+}
+
+/**
+ * Get the number of threads a verification can use
+ * @param[in] ctx		verifier context
+ *
+ * @returns number of threads, at least 1
+ */
+int attest_ctx_verifier_get_num_threads(attest_ctx_verifier *ctx)
+{
+	int num_threads = ctx->num_threads;
+
+	if (num_threads <= 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return num_threads > 0 ? num_threads : 1;
+}
+
+/**
+ * Set PCR banks to calculate when parsing event logs
+ * @param[in] ctx		verifier context
+ * @param[in] pcr_bank_mask	mask of banks (bit position from enum pcr_banks)
+ *
+ * If the mask is not set, banks are selected from the verified quote.
+ */
+void attest_ctx_verifier_set_pcr_banks(attest_ctx_verifier *ctx,
+				       uint8_t pcr_bank_mask)
+{
+	ctx->pcr_bank_mask = pcr_bank_mask;
+}
+
 /**
  * Deinitialize verifier context
  * @param[in] ctx	verifier context
@@ -978,11 +2364,12 @@ void attest_ctx_verifier_cleanup(attest_ctx_verifier *ctx)
 
 	list_for_each_entry_safe(v, temp_v, &ctx->verifiers, list) {
 		list_del(&v->list);
-		free(v->req);
-		free(v);
+		attest_ctx_verifier_free_func(v);
 	}
 
 	attest_ctx_verifier_free_logs(ctx);
+	attest_event_log_checkpoint_free(ctx->new_checkpoint);
+	pthread_mutex_destroy(&ctx->logs_lock);
 
 	memset(ctx, 0, sizeof(*ctx));
 
@@ -25,8 +25,10 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stdarg.h>
 #include <sys/mman.h>
 
 #include "ctx_json.h"
@@ -37,70 +39,379 @@
  *  @{
  */
 
-static int attest_ctx_data_add_json(attest_ctx_data *ctx, json_object *obj,
-				    enum ctx_fields field,
-				    const char *data_label)
+/* nesting of arrays and objects accepted in data contexts */
+#define JSON_STREAM_MAX_DEPTH 8
+/* smaller items are not compressed, even if requested */
+#define JSON_COMPRESS_MIN_LEN 1024
+
+/*
+ * Data contexts are parsed in one pass over the input buffer, without
+ * building a tree of JSON objects. Base64 strings are decoded directly
+ * into the buffer of the new data item.
+ */
+struct json_stream {
+	const char *ptr;
+	const char *end;
+};
+
+static void json_stream_skip_ws(struct json_stream *s)
 {
-	struct json_object_iterator v_it, v_itEnd;
-	json_object *data_obj;
-	enum json_type obj_type;
-	const char *key, *label;
-	int rc = 0, lookup_field = 0, i;
-
-	obj_type = json_object_get_type(obj);
-
-	switch (obj_type) {
-	case json_type_string:
-		rc = attest_ctx_data_add_string(ctx, field,
-						json_object_get_string(obj),
-						data_label);
-		break;
-	case json_type_array:
-		for (i = 0; i < json_object_array_length(obj); i++) {
-			data_obj = json_object_array_get_idx(obj, i);
-			rc = attest_ctx_data_add_json(ctx, data_obj, field,
-						      data_label);
-			if (rc)
-				return rc;
+	while (s->ptr < s->end && (*s->ptr == ' ' || *s->ptr == '\t' ||
+	       *s->ptr == '\n' || *s->ptr == '\r'))
+		s->ptr++;
+}
+
+static int json_stream_peek(struct json_stream *s, char c)
+{
+	json_stream_skip_ws(s);
+	return s->ptr < s->end && *s->ptr == c;
+}
+
+static int json_stream_expect(struct json_stream *s, char c)
+{
+	if (!json_stream_peek(s, c))
+		return -EINVAL;
+
+	s->ptr++;
+	return 0;
+}
+
+/* get the content of a string, escape sequences are not processed */
+static int json_stream_string(struct json_stream *s, const char **str,
+			      size_t *len)
+{
+	const char *p;
+
+	if (json_stream_expect(s, '"'))
+		return -EINVAL;
+
+	for (p = s->ptr; p < s->end && *p != '"'; p++) {
+		if (*p == '\\' && ++p == s->end)
+			return -EINVAL;
+	}
+
+	if (p == s->end)
+		return -EINVAL;
+
+	*str = s->ptr;
+	*len = p - s->ptr;
+	s->ptr = p + 1;
+	return 0;
+}
+
+static int json_hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/* unescape a string, characters outside the BMP are not supported */
+static char *json_unescape(const char *str, size_t len)
+{
+	const char *end = str + len;
+	char *out, *out_ptr;
+	int i, v, c;
+
+	out_ptr = out = malloc(len + 1);
+	if (!out)
+		return NULL;
+
+	while (str < end) {
+		if (*str != '\\') {
+			*out_ptr++ = *str++;
+			continue;
+		}
+
+		str++;
+
+		switch (*str++) {
+		case '"':
+			*out_ptr++ = '"';
+			break;
+		case '\\':
+			*out_ptr++ = '\\';
+			break;
+		case '/':
+			*out_ptr++ = '/';
+			break;
+		case 'b':
+			*out_ptr++ = '\b';
+			break;
+		case 'f':
+			*out_ptr++ = '\f';
+			break;
+		case 'n':
+			*out_ptr++ = '\n';
+			break;
+		case 'r':
+			*out_ptr++ = '\r';
+			break;
+		case 't':
+			*out_ptr++ = '\t';
+			break;
+		case 'u':
+			if (end - str < 4)
+				goto err;
+
+			for (i = 0, c = 0; i < 4; i++) {
+				v = json_hex_value(*str++);
+				if (v < 0)
+					goto err;
+
+				c = (c << 4) | v;
+			}
+
+			if (!c || (c >= 0xd800 && c <= 0xdfff))
+				goto err;
+
+			if (c < 0x80) {
+				*out_ptr++ = c;
+			} else if (c < 0x800) {
+				*out_ptr++ = 0xc0 | (c >> 6);
+				*out_ptr++ = 0x80 | (c & 0x3f);
+			} else {
+				*out_ptr++ = 0xe0 | (c >> 12);
+				*out_ptr++ = 0x80 | ((c >> 6) & 0x3f);
+				*out_ptr++ = 0x80 | (c & 0x3f);
+			}
+			break;
+		default:
+			goto err;
+		}
+	}
+
+	*out_ptr = '\0';
+	return out;
+err:
+	free(out);
+	return NULL;
+}
+
+/* decode base64 data of a string, containing escaped slashes and newlines */
+static int json_base64_decode(const char *str, size_t len,
+			      unsigned char **data, size_t *data_len)
+{
+	const char *ptr = str, *end = str + len, *esc;
+	char *buf = NULL, *buf_ptr;
+	int rc = -EINVAL;
+
+	/* unescaped data is decoded by the shared (SIMD) decoder */
+	if (memchr(str, '\\', len)) {
+		buf_ptr = buf = malloc(len);
+		if (!buf)
+			return -ENOMEM;
+
+		while ((esc = memchr(ptr, '\\', end - ptr))) {
+			memcpy(buf_ptr, ptr, esc - ptr);
+			buf_ptr += esc - ptr;
+
+			if (esc + 1 == end)
+				goto out;
+
+			if (esc[1] == '/')
+				*buf_ptr++ = '/';
+			else if (esc[1] != 'n' && esc[1] != 'r')
+				goto out;
+
+			ptr = esc + 2;
 		}
 
-		break;
-	case json_type_object:
-		v_it = json_object_iter_begin(obj);
-		v_itEnd = json_object_iter_end(obj);
-		lookup_field = (field == CTX__LAST);
+		memcpy(buf_ptr, ptr, end - ptr);
+		buf_ptr += end - ptr;
+
+		str = buf;
+		len = buf_ptr - buf;
+	}
+
+	rc = attest_util_decode_data(len, str, 0, data_len, data);
+out:
+	free(buf);
+	return rc;
+}
+
+static int json_stream_add_string(attest_ctx_data *ctx, enum ctx_fields field,
+				  const char *str, size_t len,
+				  const char *label)
+{
+	const char *data_sep;
+	unsigned char *data;
+	size_t data_len;
+	char *string;
+	int rc;
+
+	if (field == CTX__LAST)
+		return -EINVAL;
+
+	data_sep = memchr(str, ':', len);
+	if (!data_sep)
+		return -EINVAL;
+
+	if (attest_ctx_data_lookup_format(str, data_sep - str) ==
+	    DATA_FMT_BASE64) {
+		rc = json_base64_decode(data_sep + 1, len - (data_sep + 1 - str),
+					&data, &data_len);
+		if (rc)
+			return rc;
+
+		rc = attest_ctx_data_add_decoded(ctx, field, data_len, data,
+						 label);
+		if (rc)
+			free(data);
+
+		return rc;
+	}
+
+	string = json_unescape(str, len);
+	if (!string)
+		return -EINVAL;
+
+	rc = attest_ctx_data_add_string(ctx, field, string, label);
+	free(string);
+	return rc;
+}
+
+static int json_stream_add_value(attest_ctx_data *ctx, struct json_stream *s,
+				 enum ctx_fields field, const char *label,
+				 int depth);
+
+static int json_stream_add_object(attest_ctx_data *ctx, struct json_stream *s,
+				  enum ctx_fields field, const char *data_label,
+				  int depth)
+{
+	const char *key_ptr, *label;
+	int rc, lookup_field = (field == CTX__LAST);
+	size_t key_len;
+	char *key;
 
-		while (!json_object_iter_equal(&v_it, &v_itEnd)) {
-			label = data_label;
-			key = json_object_iter_peek_name(&v_it);
+	if (json_stream_expect(s, '{'))
+		return -EINVAL;
+
+	if (json_stream_peek(s, '}')) {
+		s->ptr++;
+		return 0;
+	}
+
+	while (1) {
+		rc = json_stream_string(s, &key_ptr, &key_len);
+		if (rc)
+			return rc;
+
+		key = json_unescape(key_ptr, key_len);
+		if (!key)
+			return -EINVAL;
+
+		label = data_label;
 
-			if (lookup_field) {
-				field = attest_ctx_data_lookup_field(key);
+		if (lookup_field) {
+			field = attest_ctx_data_lookup_field(key);
 
-				if (field == CTX__LAST)
-					return -EINVAL;
+			if (field == CTX__LAST) {
+				free(key);
+				return -EINVAL;
 			}
+		}
+
+		if (CTX_FIELD_LABELED(field))
+			label = key;
+
+		rc = json_stream_expect(s, ':');
+		if (!rc)
+			rc = json_stream_add_value(ctx, s, field, label, depth);
+
+		free(key);
+
+		if (rc)
+			return rc;
+
+		if (json_stream_peek(s, ',')) {
+			s->ptr++;
+			continue;
+		}
+
+		return json_stream_expect(s, '}');
+	}
+}
+
+static int json_stream_add_value(attest_ctx_data *ctx, struct json_stream *s,
+				 enum ctx_fields field, const char *label,
+				 int depth)
+{
+	const char *str;
+	size_t len;
+	int rc;
+
+	if (depth > JSON_STREAM_MAX_DEPTH)
+		return -EINVAL;
+
+	json_stream_skip_ws(s);
+	if (s->ptr == s->end)
+		return -EINVAL;
+
+	switch (*s->ptr) {
+	case '"':
+		rc = json_stream_string(s, &str, &len);
+		if (rc)
+			return rc;
 
-			if (field == CTX_EVENT_LOG || field == CTX_AUX_DATA)
-				label = key;
+		return json_stream_add_string(ctx, field, str, len, label);
+	case '[':
+		s->ptr++;
 
-			json_object_object_get_ex(obj, key, &data_obj);
+		if (json_stream_peek(s, ']')) {
+			s->ptr++;
+			return 0;
+		}
 
-			rc = attest_ctx_data_add_json(ctx, data_obj, field,
-						      label);
+		while (1) {
+			rc = json_stream_add_value(ctx, s, field, label,
+						   depth + 1);
 			if (rc)
 				return rc;
 
-			json_object_iter_next(&v_it);
-		}
+			if (json_stream_peek(s, ',')) {
+				s->ptr++;
+				continue;
+			}
 
-		break;
+			return json_stream_expect(s, ']');
+		}
+	case '{':
+		return json_stream_add_object(ctx, s, field, label, depth + 1);
 	default:
-		rc = -EINVAL;
-		break;
+		return -EINVAL;
 	}
+}
 
-	return rc;
+static int json_stream_add_data(attest_ctx_data *ctx, const char *data,
+				size_t len)
+{
+	struct json_stream s = { .ptr = data, .end = data + len };
+	int rc, ret;
+
+	/* URIs are downloaded concurrently after parsing */
+	attest_ctx_data_download_begin(ctx);
+
+	rc = json_stream_add_object(ctx, &s, CTX__LAST, NULL, 0);
+	if (rc)
+		goto out;
+
+	json_stream_skip_ws(&s);
+
+	/* accept the terminator of the string */
+	if (s.ptr < s.end && !*s.ptr)
+		s.ptr++;
+
+	if (s.ptr != s.end)
+		rc = -EINVAL;
+out:
+	ret = attest_ctx_data_download_end(ctx);
+	return rc ?: ret;
 }
 
 /**
@@ -160,19 +471,10 @@ struct json_object *attest_ctx_parse_json_file(const char *path)
 int attest_ctx_data_add_json_data(attest_ctx_data *ctx, const char *data,
 				  size_t len)
 {
-	json_object *root;
-	int rc;
-
 	if (!ctx)
 		return -EINVAL;
 
-	root = attest_ctx_parse_json_data(data, len);
-	if (!root)
-		return -EINVAL;
-
-	rc = attest_ctx_data_add_json(ctx, root, CTX__LAST, NULL);
-	json_object_put(root);
-	return rc;
+	return json_stream_add_data(ctx, data, len);
 }
 
 /**
@@ -184,18 +486,19 @@ int attest_ctx_data_add_json_data(attest_ctx_data *ctx, const char *data,
  */
 int attest_ctx_data_add_json_file(attest_ctx_data *ctx, const char *path)
 {
-	json_object *root;
+	unsigned char *data;
+	size_t len;
 	int rc;
 
 	if (!ctx)
 		return -EINVAL;
 
-	root = attest_ctx_parse_json_file(path);
-	if (!root)
-		return -EINVAL;
+	rc = attest_util_read_file(path, &len, &data);
+	if (rc)
+		return rc;
 
-	rc = attest_ctx_data_add_json(ctx, root, CTX__LAST, NULL);
-	json_object_put(root);
+	rc = json_stream_add_data(ctx, (char *)data, len);
+	munmap(data, len);
 	return rc;
 }
 
@@ -205,6 +508,7 @@ static int attest_ctx_data_print_json_common(attest_ctx_data *ctx,
 	struct data_item *item;
 	json_object *root, *obj, *jstr;
 	enum ctx_fields field;
+	enum data_formats fmt;
 	char *str;
 	int rc, j;
 
@@ -219,7 +523,7 @@ static int attest_ctx_data_print_json_common(attest_ctx_data *ctx,
 		if (list_empty(&ctx->ctx_data[field]))
 			continue;
 
-		if (field == CTX_EVENT_LOG || field == CTX_AUX_DATA)
+		if (CTX_FIELD_LABELED(field))
 			obj = json_object_new_object();
 		else
 			obj = json_object_new_array();
@@ -228,7 +532,15 @@ static int attest_ctx_data_print_json_common(attest_ctx_data *ctx,
 
 		list_for_each_entry(item, &ctx->ctx_data[field], list) {
 			if (display_value) {
-				rc = attest_ctx_data_new_string(DATA_FMT_BASE64,
+				if (attest_ctx_data_item_check(item))
+					continue;
+
+				fmt = DATA_FMT_BASE64;
+				if ((ctx->flags & CTX_COMPRESS) &&
+				    item->len >= JSON_COMPRESS_MIN_LEN)
+					fmt = DATA_FMT_ZLIB_BASE64;
+
+				rc = attest_ctx_data_new_string(fmt,
 						item->len, item->data, &str);
 				if (rc)
 					continue;
@@ -377,82 +689,216 @@ out:
 	return rc;
 }
 
-typedef void (*get_func)(struct list_head *pos, json_object **a,
-			 json_object **b, json_object **c);
+/*
+ * Requirements and logs are written directly into a buffer owned by the
+ * caller, without building a tree of JSON objects. The buffer is grown if
+ * necessary, and can be reused for the next verifier context.
+ */
+struct json_buf {
+	char **buf;
+	size_t *size;
+	size_t len;
+	int rc;
+};
+
+#define JSON_BUF_MIN_SIZE 1024
 
-static void get_verifier(struct list_head *pos, json_object **a,
-			 json_object **b, json_object **c)
+static void json_buf_printf(struct json_buf *b, const char *fmt, ...)
 {
-	struct verifier_struct *verifier;
+	size_t new_size;
+	char *new_buf;
+	va_list ap;
+	int len;
+
+	if (b->rc)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(*b->buf ? *b->buf + b->len : NULL,
+			*b->size - b->len, fmt, ap);
+	va_end(ap);
+
+	if (len < 0) {
+		b->rc = -EINVAL;
+		return;
+	}
+
+	if (len < *b->size - b->len) {
+		b->len += len;
+		return;
+	}
+
+	new_size = *b->size * 2;
+	if (new_size < b->len + len + JSON_BUF_MIN_SIZE)
+		new_size = b->len + len + JSON_BUF_MIN_SIZE;
+
+	new_buf = realloc(*b->buf, new_size);
+	if (!new_buf) {
+		b->rc = -ENOMEM;
+		return;
+	}
 
-	verifier = list_entry(pos, struct verifier_struct, list);
+	*b->buf = new_buf;
+	*b->size = new_size;
 
-	*a = json_object_new_string(verifier->id);
-	*b = json_object_new_string(verifier->req);
-	*c = NULL;
+	va_start(ap, fmt);
+	b->len += vsnprintf(*b->buf + b->len, *b->size - b->len, fmt, ap);
+	va_end(ap);
 }
 
-static void get_result(struct list_head *pos, json_object **a, json_object **b,
-		       json_object **c)
+/* suffix is not escaped */
+static void json_buf_string(struct json_buf *b, const char *str,
+			    const char *suffix)
 {
-	struct verification_log *log;
+	const char *run = str;
+
+	json_buf_printf(b, "\"");
+
+	for (; *str; str++) {
+		if (*str != '"' && *str != '\\' && (unsigned char)*str >= 0x20)
+			continue;
+
+		json_buf_printf(b, "%.*s", (int)(str - run), run);
 
-	log = list_entry(pos, struct verification_log, list);
+		if (*str == '"' || *str == '\\')
+			json_buf_printf(b, "\\%c", *str);
+		else
+			json_buf_printf(b, "\\u%04x", (unsigned char)*str);
 
-	*a = json_object_new_string(log->operation);
-	*b = json_object_new_string(log->result);
-	*c = json_object_new_string(log->reason);
+		run = str + 1;
+	}
+
+	json_buf_printf(b, "%s%s\"", run, suffix);
 }
 
-static char *attest_ctx_verifier_print_json(struct list_head *head,
-					    get_func func)
+static int64_t timespec_us(struct timespec *ts)
 {
-	struct list_head *pos;
-	json_object *root, *parent, *obj;
-	json_object *a, *b, *c;
-	char *output = "";
+	return (int64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
 
-	root = json_object_new_object();
-	if (!root)
-		return NULL;
+/* start is relative to the first operation, zero counters are omitted */
+static void json_buf_timing(struct json_buf *b, struct verification_log *log,
+			    int64_t origin)
+{
+	if (!timespec_us(&log->start))
+		return;
+
+	json_buf_printf(b, ",\"start_us\":%lld",
+			(long long)(timespec_us(&log->start) - origin));
+
+	if (timespec_us(&log->end))
+		json_buf_printf(b, ",\"duration_us\":%lld",
+				(long long)(timespec_us(&log->end) -
+					    timespec_us(&log->start)));
+	if (log->entries)
+		json_buf_printf(b, ",\"entries\":%zu", log->entries);
+	if (log->bytes)
+		json_buf_printf(b, ",\"bytes\":%zu", log->bytes);
+}
 
-	if (func == &get_verifier)
-		parent = json_object_new_object();
-	else
-		parent = json_object_new_array();
+static int64_t first_start(struct list_head *head)
+{
+	struct verification_log *log;
+	int64_t start, origin = 0;
 
-	if (!parent)
-		goto out;
+	list_for_each_entry(log, head, list) {
+		start = timespec_us(&log->start);
+		if (start && (!origin || start < origin))
+			origin = start;
+	}
 
-	list_for_each(pos, head) {
-		func(pos, &a, &b, &c);
+	return origin;
+}
 
-		if (func == &get_verifier) {
-			json_object_object_add(parent,
-					       json_object_get_string(a), b);
-			json_object_put(a);
-			continue;
+/**
+ * Write loaded requirements in JSON format
+ * @param[in] ctx	verifier context
+ * @param[in,out] buf	buffer (can be NULL)
+ * @param[in,out] size	buffer size (0 if buf is NULL)
+ *
+ * The buffer is reallocated if it is too small, and must be freed by the
+ * caller, also on error.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_verifier_req_write_json(attest_ctx_verifier *ctx, char **buf,
+				       size_t *size)
+{
+	struct json_buf b = { .buf = buf, .size = size };
+	struct verifier_struct *verifier;
+	char *sep = "";
+
+	json_buf_printf(&b, "{\"" JSON_REQS_OBJECT_KEY "\":{");
+
+	if (ctx) {
+		list_for_each_entry(verifier, &ctx->verifiers, list) {
+			json_buf_printf(&b, "%s", sep);
+			json_buf_string(&b, verifier->id, "");
+			json_buf_printf(&b, ":");
+			/* a missing requirement is null, as with json-c */
+			if (verifier->req)
+				json_buf_string(&b, verifier->req, "");
+			else
+				json_buf_printf(&b, "null");
+			sep = ",";
 		}
+	}
 
-		obj = json_object_new_object();
-		if (!obj)
-			return "";
+	json_buf_printf(&b, "}}");
+	return b.rc;
+}
 
-		json_object_object_add(obj, "operation", a);
-		json_object_object_add(obj, "result", b);
-		json_object_object_add(obj, "reason", c);
-		json_object_array_add(parent, obj);
-	}
+/**
+ * Write verification logs in JSON format
+ * @param[in] ctx	verifier context
+ * @param[in,out] buf	buffer (can be NULL)
+ * @param[in,out] size	buffer size (0 if buf is NULL)
+ *
+ * If CTX_LOG_TIMING is set, logs also include the start time and duration
+ * of each operation in microseconds, and the entries and bytes processed.
+ *
+ * The buffer is reallocated if it is too small, and must be freed by the
+ * caller, also on error.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_verifier_result_write_json(attest_ctx_verifier *ctx, char **buf,
+					  size_t *size)
+{
+	struct json_buf b = { .buf = buf, .size = size };
+	struct verification_log *log;
+	int64_t origin = 0;
+	char *sep = "";
 
-	json_object_object_add(root, func == &get_verifier ?
-			       JSON_REQS_OBJECT_KEY : JSON_LOGS_OBJECT_KEY,
-			       parent);
+	json_buf_printf(&b, "{\"" JSON_LOGS_OBJECT_KEY "\":[");
 
-	output = strdup(json_object_to_json_string_ext(root,
-						JSON_C_TO_STRING_PRETTY));
-out:
-	json_object_put(root);
-	return output;
+	if (ctx && (ctx->flags & CTX_LOG_TIMING))
+		origin = first_start(&ctx->logs);
+
+	if (ctx) {
+		list_for_each_entry(log, &ctx->logs, list) {
+			json_buf_printf(&b, "%s{\"operation\":", sep);
+			json_buf_string(&b, log->operation, "");
+			json_buf_printf(&b, ",\"result\":");
+			json_buf_string(&b, log->result, "");
+			json_buf_printf(&b, ",\"reason\":");
+
+			if (!log->reason[0] && log->cause)
+				json_buf_string(&b, log->cause->operation,
+						" failed");
+			else
+				json_buf_string(&b, log->reason, "");
+
+			if (ctx->flags & CTX_LOG_TIMING)
+				json_buf_timing(&b, log, origin);
+
+			json_buf_printf(&b, "}");
+			sep = ",";
+		}
+	}
+
+	json_buf_printf(&b, "]}");
+	return b.rc;
 }
 
 /**
@@ -466,10 +912,15 @@ out:
  */
 char *attest_ctx_verifier_req_print_json(attest_ctx_verifier *ctx)
 {
-	LIST_HEAD(head);
+	char *output = NULL;
+	size_t size = 0;
+
+	if (attest_ctx_verifier_req_write_json(ctx, &output, &size)) {
+		free(output);
+		return NULL;
+	}
 
-	return attest_ctx_verifier_print_json(ctx ? &ctx->verifiers : &head,
-					      get_verifier);
+	return output;
 }
 
 /**
@@ -483,10 +934,15 @@ char *attest_ctx_verifier_req_print_json(attest_ctx_verifier *ctx)
  */
 char *attest_ctx_verifier_result_print_json(attest_ctx_verifier *ctx)
 {
-	LIST_HEAD(head);
+	char *output = NULL;
+	size_t size = 0;
 
-	return attest_ctx_verifier_print_json(ctx ? &ctx->logs : &head,
-					      get_result);
+	if (attest_ctx_verifier_result_write_json(ctx, &output, &size)) {
+		free(output);
+		return NULL;
+	}
+
+	return output;
 }
 /** @}*/
 /** @}*/
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: ctx_tlv.c
+ *      TLV specific context functions.
+ */
+
+/**
+ * @defgroup context-api-tlv Context API (TLV)
+ * @ingroup context-api
+ * @brief
+ * Binary encoding of data contexts, and messages in JSON or TLV format
+ */
+
+/**
+ * @addtogroup context-api-tlv
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "ctx_tlv.h"
+#include "ctx_json.h"
+
+/**
+ * @name Data Context API
+ *  @{
+ */
+
+/*
+ * A TLV message starts with struct tlv_msg_hdr, followed by one record
+ * for each data item: struct tlv_hdr with the ctx_fields identifier, the
+ * label (only for labeled fields) and the binary data. Data is not
+ * encoded, so that data items can refer to the message buffer.
+ */
+
+/**
+ * Add TLV data to data context
+ * @param[in] ctx	data context
+ * @param[in] len	length of data to parse
+ * @param[in] data	data to parse
+ *
+ * Data contexts initialized with CTX_IN_MEMORY refer to the binary data in
+ * the buffer, which must not be released before the data context is
+ * deinitialized.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_add_tlv(attest_ctx_data *ctx, size_t len,
+			    unsigned char *data)
+{
+	unsigned char *ptr = data + sizeof(struct tlv_msg_hdr);
+	unsigned char *end = data + len;
+	struct tlv_msg_hdr msg_hdr;
+	struct tlv_hdr hdr;
+	enum ctx_fields field;
+	size_t label_len, data_len;
+	char *label;
+	int rc;
+
+	if (!ctx || len < sizeof(msg_hdr))
+		return -EINVAL;
+
+	memcpy(&msg_hdr, data, sizeof(msg_hdr));
+
+	if (memcmp(msg_hdr.magic, TLV_MAGIC, TLV_MAGIC_LEN) ||
+	    ntohl(msg_hdr.len) != len)
+		return -EINVAL;
+
+	while (ptr < end) {
+		if (end - ptr < sizeof(hdr))
+			return -EINVAL;
+
+		memcpy(&hdr, ptr, sizeof(hdr));
+		ptr += sizeof(hdr);
+
+		field = ntohs(hdr.field);
+		label_len = ntohs(hdr.label_len);
+		data_len = ntohl(hdr.len);
+
+		if (field >= CTX__LAST ||
+		    !CTX_FIELD_LABELED(field) != !label_len)
+			return -EINVAL;
+
+		if (end - ptr < label_len || end - ptr - label_len < data_len)
+			return -EINVAL;
+
+		label = NULL;
+
+		if (label_len) {
+			label = strndup((char *)ptr, label_len);
+			if (!label)
+				return -ENOMEM;
+
+			if (strlen(label) != label_len) {
+				free(label);
+				return -EINVAL;
+			}
+
+			ptr += label_len;
+		}
+
+		rc = attest_ctx_data_add_borrowed(ctx, field, data_len, ptr,
+						  label);
+		free(label);
+
+		if (rc)
+			return rc;
+
+		ptr += data_len;
+	}
+
+	return 0;
+}
+
+/**
+ * Print data context in TLV format
+ * @param[in] ctx	data context
+ * @param[in,out] len	length of TLV data
+ * @param[in,out] data	TLV data, followed by a terminator
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_print_tlv(attest_ctx_data *ctx, size_t *len,
+			      unsigned char **data)
+{
+	struct tlv_msg_hdr msg_hdr;
+	struct tlv_hdr hdr;
+	struct data_item *item;
+	enum ctx_fields field;
+	size_t total_len = sizeof(msg_hdr), label_len;
+	unsigned char *ptr;
+	int rc;
+
+	if (!ctx)
+		return -EINVAL;
+
+	for (field = 0; field < CTX__LAST; field++) {
+		list_for_each_entry(item, &ctx->ctx_data[field], list) {
+			label_len = 0;
+
+			if (CTX_FIELD_LABELED(field)) {
+				if (!item->label || !*item->label)
+					continue;
+
+				label_len = strlen(item->label);
+			}
+
+			if (label_len > UINT16_MAX || item->len > UINT32_MAX)
+				return -E2BIG;
+
+			/* items are copied below, without checking again */
+			rc = attest_ctx_data_item_check(item);
+			if (rc)
+				return rc;
+
+			total_len += sizeof(hdr) + label_len + item->len;
+		}
+	}
+
+	if (total_len > UINT32_MAX)
+		return -E2BIG;
+
+	*data = malloc(total_len + 1);
+	if (!*data)
+		return -ENOMEM;
+
+	memcpy(msg_hdr.magic, TLV_MAGIC, TLV_MAGIC_LEN);
+	msg_hdr.len = htonl(total_len);
+
+	memcpy(*data, &msg_hdr, sizeof(msg_hdr));
+	ptr = *data + sizeof(msg_hdr);
+
+	for (field = 0; field < CTX__LAST; field++) {
+		list_for_each_entry(item, &ctx->ctx_data[field], list) {
+			label_len = 0;
+
+			if (CTX_FIELD_LABELED(field)) {
+				if (!item->label || !*item->label)
+					continue;
+
+				label_len = strlen(item->label);
+			}
+
+			hdr.field = htons(field);
+			hdr.label_len = htons(label_len);
+			hdr.len = htonl(item->len);
+
+			memcpy(ptr, &hdr, sizeof(hdr));
+			ptr += sizeof(hdr);
+
+			if (label_len) {
+				memcpy(ptr, item->label, label_len);
+				ptr += label_len;
+			}
+
+			memcpy(ptr, item->data, item->len);
+			ptr += item->len;
+		}
+	}
+
+	*ptr = '\0';
+	*len = total_len;
+	return 0;
+}
+/** @}*/
+
+/**
+ * @name Message API
+ *  @{
+ */
+
+/**
+ * Get format of a message
+ * @param[in] msg	message
+ *
+ * @returns message format
+ */
+enum ctx_msg_formats attest_ctx_msg_get_format(const char *msg)
+{
+	/* strncmp() does not read past the terminator of JSON messages */
+	if (!strncmp(msg, TLV_MAGIC, TLV_MAGIC_LEN))
+		return CTX_MSG_TLV;
+
+	return CTX_MSG_JSON;
+}
+
+/**
+ * Get length of a message
+ * @param[in] msg	message
+ *
+ * @returns message length, without the terminator
+ */
+size_t attest_ctx_msg_len(const char *msg)
+{
+	struct tlv_msg_hdr msg_hdr;
+
+	if (attest_ctx_msg_get_format(msg) == CTX_MSG_JSON)
+		return strlen(msg);
+
+	memcpy(&msg_hdr, msg, sizeof(msg_hdr));
+	return ntohl(msg_hdr.len);
+}
+
+/**
+ * Check that a received message is complete
+ * @param[in] msg	message, followed by a terminator
+ * @param[in] len	number of bytes received
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_msg_check(const char *msg, size_t len)
+{
+	if (attest_ctx_msg_get_format(msg) == CTX_MSG_JSON)
+		return 0;
+
+	if (len < sizeof(struct tlv_msg_hdr) || attest_ctx_msg_len(msg) > len)
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * Add message in JSON or TLV format to data context
+ * @param[in] ctx	data context
+ * @param[in] msg	message
+ *
+ * TLV messages must be checked with attest_ctx_msg_check() when received.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_add_msg(attest_ctx_data *ctx, char *msg)
+{
+	if (attest_ctx_msg_get_format(msg) == CTX_MSG_TLV)
+		return attest_ctx_data_add_tlv(ctx, attest_ctx_msg_len(msg),
+					       (unsigned char *)msg);
+
+	return attest_ctx_data_add_json_data(ctx, msg, strlen(msg));
+}
+
+/**
+ * Print data context as message in JSON or TLV format
+ * @param[in] ctx	data context
+ * @param[in] fmt	message format
+ * @param[in,out] msg	message, to be passed to attest_ctx_msg_len()
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ctx_data_print_msg(attest_ctx_data *ctx, enum ctx_msg_formats fmt,
+			      char **msg)
+{
+	size_t len;
+
+	if (fmt == CTX_MSG_TLV)
+		return attest_ctx_data_print_tlv(ctx, &len,
+						 (unsigned char **)msg);
+
+	return attest_ctx_data_print_json(ctx, msg);
+}
+/** @}*/
+/** @}*/
@@ -45,6 +45,7 @@
 
 #include "enroll_client.h"
 #include "ctx_json.h"
+#include "ctx_tlv.h"
 #include "util.h"
 #include "tss.h"
 #include "skae.h"
@@ -370,18 +371,189 @@ out_flush_ek:
 #define BIOS_BINARY_MEASUREMENTS SECURITYFS_PATH "tpm0/" BIOS_FILENAME
 #define IMA_FILENAME "binary_runtime_measurements"
 #define IMA_BINARY_MEASUREMENTS SECURITYFS_PATH "ima/" IMA_FILENAME
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define BOOT_ID_LEN 36
+#define IMA_PCR 10
+
+/* position in the event logs sent with the last successful quote */
+struct ima_cursor {
+	int valid;
+	char boot_id[BOOT_ID_LEN + 1];
+	int bios_log;
+	uint32_t bios_entries;
+	uint32_t ima_entries;
+	size_t ima_offset;
+	uint8_t pcr[SHA_DIGEST_LENGTH];
+};
+
+static int ima_cursor_get_boot_id(char *boot_id)
+{
+	unsigned char *data;
+	size_t len;
+	int rc;
+
+	rc = attest_util_read_seq_file(BOOT_ID_PATH, &len, &data);
+	if (rc < 0)
+		return rc;
+
+	if (len < BOOT_ID_LEN) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	memcpy(boot_id, data, BOOT_ID_LEN);
+	boot_id[BOOT_ID_LEN] = '\0';
+out:
+	free(data);
+	return rc;
+}
+
+static void ima_cursor_read(struct ima_cursor *cursor)
+{
+	char boot_id[BOOT_ID_LEN + 1], pcr_str[SHA_DIGEST_LENGTH * 2 + 1];
+	FILE *fp;
+	int rc;
+
+	memset(cursor, 0, sizeof(*cursor));
+
+	fp = fopen(IMA_CURSOR_PATH, "r");
+	if (!fp)
+		return;
+
+	rc = fscanf(fp, "%36s %d %u %u %zu %40s", cursor->boot_id,
+		    &cursor->bios_log, &cursor->bios_entries,
+		    &cursor->ima_entries, &cursor->ima_offset, pcr_str);
+	fclose(fp);
+
+	if (rc != 6 || strlen(pcr_str) != sizeof(pcr_str) - 1)
+		goto out;
+
+	if (_hex2bin(cursor->pcr, pcr_str, sizeof(cursor->pcr)))
+		goto out;
+
+	/* logs are reset at boot */
+	if (ima_cursor_get_boot_id(boot_id) < 0 ||
+	    strcmp(boot_id, cursor->boot_id))
+		goto out;
+
+	cursor->valid = 1;
+out:
+	if (!cursor->valid)
+		memset(cursor, 0, sizeof(*cursor));
+}
+
+static int ima_cursor_update(struct ima_cursor *cursor,
+			     attest_ctx_verifier *v_ctx, size_t ima_len)
+{
+	struct event_log_checkpoint *checkpoint = v_ctx->new_checkpoint;
+	struct event_log_checkpoint_log *log;
+	char pcr_str[SHA_DIGEST_LENGTH * 2 + 1];
+	TPMT_HA *pcr;
+	FILE *fp;
+	int rc;
+
+	if (!checkpoint)
+		return -ENOENT;
+
+	list_for_each_entry(log, &checkpoint->logs, list) {
+		if (!strcmp(log->id, "bios")) {
+			cursor->bios_log = 1;
+			cursor->bios_entries = log->num_entries;
+		} else if (!strcmp(log->id, "ima")) {
+			cursor->ima_entries += log->num_entries;
+		}
+	}
+
+	cursor->ima_offset += ima_len;
+
+	pcr = attest_pcr_get(v_ctx, IMA_PCR, TPM_ALG_SHA1);
+	if (!pcr)
+		return -ENOENT;
+
+	memcpy(cursor->pcr, (uint8_t *)&pcr->digest, sizeof(cursor->pcr));
+
+	rc = ima_cursor_get_boot_id(cursor->boot_id);
+	if (rc < 0)
+		return rc;
+
+	*_bin2hex(pcr_str, cursor->pcr, sizeof(cursor->pcr)) = '\0';
+
+	/* committed when the verifier replies */
+	fp = fopen(IMA_CURSOR_NEW_PATH, "w");
+	if (!fp)
+		return -EACCES;
+
+	rc = fprintf(fp, "%s %d %u %u %zu %s\n", cursor->boot_id,
+		     cursor->bios_log, cursor->bios_entries,
+		     cursor->ima_entries, cursor->ima_offset, pcr_str);
+	if (fclose(fp) || rc < 0)
+		return -EIO;
+
+	return 0;
+}
+
+static int add_log_offset(attest_ctx_data *d_ctx, uint32_t offset,
+			  const char *label)
+{
+	char offset_str[16];
+	int len;
+
+	len = snprintf(offset_str, sizeof(offset_str), "%u", offset);
+
+	return attest_ctx_data_add_copy(d_ctx, CTX_EVENT_LOG_OFFSET, len,
+					(unsigned char *)offset_str, label);
+}
+
+static int add_ima_log(attest_ctx_data *d_ctx, int kernel_ima_log,
+		       struct ima_cursor *cursor, size_t *ima_len)
+{
+	unsigned char *data = NULL;
+	struct stat st;
+	size_t len;
+	int rc = 0;
+
+	*ima_len = 0;
+
+	if (kernel_ima_log) {
+		if (!stat(IMA_BINARY_MEASUREMENTS, &st)) {
+			rc = attest_util_read_seq_file_offset(
+						IMA_BINARY_MEASUREMENTS,
+						cursor ? cursor->ima_offset : 0,
+						&len, &data);
+			if (rc)
+				return rc;
+
+			*ima_len = len;
+
+			if (len)
+				rc = attest_ctx_data_add(d_ctx, CTX_EVENT_LOG,
+							 len, data, "ima");
+			else
+				free(data);
+		}
+	} else {
+		if (!stat(IMA_FILENAME, &st))
+			rc = attest_ctx_data_add_file(d_ctx, CTX_EVENT_LOG,
+						      IMA_FILENAME, "ima");
+	}
+
+	return rc;
+}
 
 static int collect_data(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
 			int kernel_bios_log, int kernel_ima_log,
-			int send_unsigned_files)
+			int send_unsigned_files, int aux_digests_sent,
+			struct ima_cursor *cursor)
 {
 	unsigned char *data = NULL;
 	const char *verifier_str = "dummy|verify";
 	struct stat st;
-	size_t len;
-	int rc = 0;
+	size_t len, ima_len = 0;
+	TPMT_HA *pcr;
+	int rc = 0, resume = cursor && cursor->valid;
 
-	if (kernel_bios_log) {
+	/* the BIOS event log does not change until next boot */
+	if (!resume && kernel_bios_log) {
 		if (!stat(BIOS_BINARY_MEASUREMENTS, &st)) {
 			rc = attest_util_read_seq_file(BIOS_BINARY_MEASUREMENTS,
 						       &len, &data);
@@ -391,7 +563,7 @@ static int collect_data(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
 			rc = attest_ctx_data_add(d_ctx, CTX_EVENT_LOG, len,
 						 data, "bios");
 		}
-	} else {
+	} else if (!resume) {
 		if (!stat(BIOS_FILENAME, &st))
 			rc = attest_ctx_data_add_file(d_ctx, CTX_EVENT_LOG,
 						      BIOS_FILENAME, "bios");
@@ -400,33 +572,50 @@ static int collect_data(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
 	if (rc)
 		goto out;
 
-	if (kernel_ima_log) {
-		if (!stat(IMA_BINARY_MEASUREMENTS, &st)) {
-			rc = attest_util_read_seq_file(IMA_BINARY_MEASUREMENTS,
-						       &len, &data);
-			if (rc)
-				goto out;
-
-			rc = attest_ctx_data_add(d_ctx, CTX_EVENT_LOG, len,
-						 data, "ima");
+	if (resume) {
+		pcr = attest_pcr_get(v_ctx, IMA_PCR, TPM_ALG_SHA1);
+		if (!pcr) {
+			rc = -ENOENT;
+			goto out;
 		}
-	} else {
-		if (!stat(IMA_FILENAME, &st))
-			rc = attest_ctx_data_add_file(d_ctx, CTX_EVENT_LOG,
-						      IMA_FILENAME, "ima");
+
+		memcpy((uint8_t *)&pcr->digest, cursor->pcr,
+		       sizeof(cursor->pcr));
 	}
 
+	rc = add_ima_log(d_ctx, kernel_ima_log, cursor, &ima_len);
 	if (rc)
 		goto out;
 
 	if (send_unsigned_files)
 		verifier_str = "ima_cp|verify";
 
-	rc = attest_ctx_verifier_req_add(v_ctx, verifier_str, "");
+	/* the verifier replied with the digests of files it does not have */
+	rc = attest_ctx_verifier_req_add(v_ctx, verifier_str,
+					 aux_digests_sent ? "missing" : "");
 	if (rc)
 		goto out;
 
 	rc = attest_event_log_parse_verify(d_ctx, v_ctx, 1);
+	if (rc)
+		goto out;
+
+	/*
+	 * Offsets are added after parsing, as they refer to the checkpoint of
+	 * the verifier. The client resumes from the PCR saved in the cursor.
+	 */
+	if (resume) {
+		if (cursor->bios_log)
+			rc = add_log_offset(d_ctx, cursor->bios_entries,
+					    "bios");
+		if (!rc)
+			rc = add_log_offset(d_ctx, cursor->ima_entries, "ima");
+		if (rc)
+			goto out;
+	}
+
+	if (cursor)
+		rc = ima_cursor_update(cursor, v_ctx, ima_len);
 out:
 	if (rc)
 		printf("Failed to collect data, rc: %d\n", rc);
@@ -434,6 +623,18 @@ out:
 	return rc;
 }
 
+static int set_pcr_value(void *priv, TPMI_DH_PCR pcr_num, TPMI_ALG_HASH halg,
+			 TPM2B_DIGEST *digest)
+{
+	TPMT_HA *pcr = attest_pcr_get(priv, pcr_num, halg);
+
+	if (!pcr || digest->t.size > sizeof(pcr->digest))
+		return -ENOENT;
+
+	memcpy((uint8_t *)&pcr->digest, digest->t.buffer, digest->t.size);
+	return 0;
+}
+
 static int build_key_policy(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
 			    void *tssContext, TPMI_ALG_HASH nalg,
 			    TPMI_ALG_HASH halg, int *pcr_list,
@@ -442,7 +643,7 @@ static int build_key_policy(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
 			    BYTE **policy_bin)
 {
 	TPML_PCR_SELECTION selection = { 0 };
-	TPMT_HA *pcr, digest_pcr, digest_event_log;
+	TPMT_HA digest_pcr, digest_event_log;
 	attest_ctx_verifier *v_ctx_pcr;
 	BYTE *policy_ptr;
 	char *policy_str;
@@ -481,16 +682,13 @@ static int build_key_policy(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
 
 		selection.pcrSelections[0].pcrSelect[pcr_list[i] / 8] |=
 							1 << (pcr_list[i] % 8);
+	}
 
-		if (!kernel_event_logs)
-			continue;
-
-		pcr = attest_pcr_get(v_ctx_pcr, pcr_list[i], halg);
-
-		rc = attest_tss_pcrread(tssContext, pcr_list[i], halg,
-					(uint8_t *)&pcr->digest);
+	if (kernel_event_logs) {
+		rc = attest_tss_pcrread_multi(tssContext, &selection,
+					      set_pcr_value, v_ctx_pcr);
 		if (rc < 0)
-			break;
+			goto out;
 	}
 
 	rc = attest_pcr_calc_digest(v_ctx, &digest_event_log, &selection);
@@ -720,6 +918,39 @@ out:
 	return rc;
 }
 
+/* quote with a loaded AK, and add quote and signature to the data context */
+static int add_quote_common(attest_ctx_data *d_ctx, TSS_CONTEXT *tssContext,
+			    TPM_HANDLE ak_handle, UINT16 ak_public_len,
+			    BYTE *ak_public, int nonce_len, uint8_t *nonce,
+			    TPML_PCR_SELECTION *pcr_selection)
+{
+	BYTE *tpms_attest = NULL, *tpms_attest_sig = NULL;
+	UINT16 tpms_attest_len = 0, tpms_attest_sig_len = 0;
+	int rc;
+
+	rc = attest_tss_quote(tssContext, ak_handle, ak_public_len, ak_public,
+			      nonce_len, nonce, pcr_selection, &tpms_attest_len,
+			      &tpms_attest, &tpms_attest_sig_len,
+			      &tpms_attest_sig);
+	if (rc)
+		return rc;
+
+	rc = attest_ctx_data_add(d_ctx, CTX_TPMS_ATTEST, tpms_attest_len,
+				 tpms_attest, NULL);
+	if (rc) {
+		free(tpms_attest);
+		free(tpms_attest_sig);
+		return rc;
+	}
+
+	rc = attest_ctx_data_add(d_ctx, CTX_TPMS_ATTEST_SIG,
+				 tpms_attest_sig_len, tpms_attest_sig, NULL);
+	if (rc)
+		free(tpms_attest_sig);
+
+	return rc;
+}
+
 /**
  * Add a quote
  * @param[in] d_ctx		Data context
@@ -730,23 +961,17 @@ out:
  * @param[in] nonce		nonce
  * @param[in] pcr_selection	Selected PCRs
  *
- * @returns data_item pointer on success, NULL if not found
+ * @returns 0 on success, a negative value on error
  */
 int attest_enroll_add_quote(attest_ctx_data *d_ctx, TSS_CONTEXT *tssContext,
 			    char *akPrivPath, char *akPubPath, int nonce_len,
 			    uint8_t *nonce, TPML_PCR_SELECTION *pcr_selection)
 {
-	BYTE *ak_private = NULL, *ak_public = NULL, *tpms_attest = NULL;
-	BYTE *tpms_attest_sig = NULL;
+	BYTE *ak_private = NULL, *ak_public = NULL;
 	size_t ak_private_len = 0, ak_public_len = 0;
-	UINT16 tpms_attest_len = 0, tpms_attest_sig_len = 0;
 	TPM_HANDLE ak_handle;
 	int rc;
 
-	rc = TSS_Create((TSS_CONTEXT **)&tssContext);
-	if (rc < 0)
-		return -EINVAL;
-
 	rc = attest_util_read_file(akPrivPath, &ak_private_len, &ak_private);
 	if (rc)
 		goto out;
@@ -760,21 +985,9 @@ int attest_enroll_add_quote(attest_ctx_data *d_ctx, TSS_CONTEXT *tssContext,
 	if (rc)
 		goto out;
 
-	rc = attest_tss_quote(tssContext, ak_handle, ak_public_len, ak_public,
-			      nonce_len, nonce, pcr_selection, &tpms_attest_len,
-			      &tpms_attest, &tpms_attest_sig_len,
-			      &tpms_attest_sig);
-	if (rc)
-		goto out_flush;
-
-	rc = attest_ctx_data_add(d_ctx, CTX_TPMS_ATTEST, tpms_attest_len,
-				 tpms_attest, NULL);
-	if (rc)
-		goto out_flush;
+	rc = add_quote_common(d_ctx, tssContext, ak_handle, ak_public_len,
+			      ak_public, nonce_len, nonce, pcr_selection);
 
-	rc = attest_ctx_data_add(d_ctx, CTX_TPMS_ATTEST_SIG,
-				 tpms_attest_sig_len, tpms_attest_sig, NULL);
-out_flush:
 	attest_tss_flushcontext(tssContext, ak_handle);
 out:
 	if (ak_private)
@@ -785,6 +998,177 @@ out:
 	return rc;
 }
 
+/* TSS context, AK and certificates kept by attest_enroll_session_open() */
+struct enroll_session {
+	TSS_CONTEXT *tssContext;
+	TPM_HANDLE ak_handle;
+	int ak_loaded;
+	size_t ak_public_len;
+	BYTE *ak_public;
+	attest_ctx_data *d_ctx;
+};
+
+static struct enroll_session *session;
+
+/**
+ * Open a session for sending multiple quotes
+ * @param[in] privacy_ca_dir		Directory containing Privacy CA certs
+ * @param[in] ak_persistent_handle	Persistent AK handle (0 if not used)
+ *
+ * Until attest_enroll_session_close() is called, quote requests are created
+ * with the same TSS context and AK, and with the AK and Privacy CA
+ * certificates read at session opening. If ak_persistent_handle is
+ * provided, the AK is made persistent at the first opening, and is not
+ * loaded again when the session is opened after a restart. If the public
+ * area of the persistent object is different from the AK public key (e.g.
+ * a new AK was created), the object is evicted and the AK is made
+ * persistent again.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_session_open(char *privacy_ca_dir,
+			       TPM_HANDLE ak_persistent_handle)
+{
+	BYTE *ak_private = NULL, *persistent_public;
+	size_t ak_private_len = 0;
+	UINT16 persistent_public_len;
+	TPM_HANDLE ak_handle;
+	int rc, persistent_found = 0, persistent_match = 0;
+
+	if (session)
+		return -EBUSY;
+
+	session = calloc(1, sizeof(*session));
+	if (!session)
+		return -ENOMEM;
+
+	rc = attest_ctx_data_init(&session->d_ctx);
+	if (rc < 0)
+		goto out;
+
+	rc = attest_ctx_data_add_dir(session->d_ctx, CTX_PRIVACY_CA_CERT,
+				     privacy_ca_dir, NULL);
+	if (rc < 0)
+		goto out;
+
+	rc = attest_ctx_data_add_file(session->d_ctx, CTX_AK_CERT,
+				      AK_CERT_PATH, NULL);
+	if (rc < 0)
+		goto out;
+
+	attest_ctx_data_add_file(session->d_ctx, CTX_SYM_KEY_POLICY,
+				 SYM_KEY_POLICY_PATH, NULL);
+
+	rc = attest_util_read_file(AK_PUB_PATH, &session->ak_public_len,
+				   &session->ak_public);
+	if (rc)
+		goto out;
+
+	rc = TSS_Create(&session->tssContext);
+	if (rc) {
+		session->tssContext = NULL;
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (ak_persistent_handle &&
+	    !attest_tss_readpublic(session->tssContext, ak_persistent_handle,
+				   &persistent_public_len,
+				   &persistent_public)) {
+		persistent_found = 1;
+		persistent_match =
+			persistent_public_len == session->ak_public_len &&
+			!memcmp(persistent_public, session->ak_public,
+				persistent_public_len);
+		free(persistent_public);
+	}
+
+	if (persistent_match) {
+		session->ak_handle = ak_persistent_handle;
+		goto out;
+	}
+
+	rc = attest_util_read_file(AK_PRIV_PATH, &ak_private_len, &ak_private);
+	if (rc)
+		goto out;
+
+	rc = attest_tss_load(session->tssContext, ak_private_len, ak_private,
+			     session->ak_public_len, session->ak_public,
+			     &ak_handle);
+	munmap(ak_private, ak_private_len);
+	if (rc)
+		goto out;
+
+	if (!ak_persistent_handle) {
+		session->ak_handle = ak_handle;
+		session->ak_loaded = 1;
+		goto out;
+	}
+
+	/* the persistent handle is reserved for the AK */
+	if (persistent_found) {
+		rc = attest_tss_evictcontrol(session->tssContext,
+					     ak_persistent_handle,
+					     ak_persistent_handle);
+		if (rc) {
+			attest_tss_flushcontext(session->tssContext,
+						ak_handle);
+			goto out;
+		}
+	}
+
+	rc = attest_tss_evictcontrol(session->tssContext, ak_handle,
+				     ak_persistent_handle);
+	attest_tss_flushcontext(session->tssContext, ak_handle);
+
+	session->ak_handle = ak_persistent_handle;
+out:
+	if (rc)
+		attest_enroll_session_close();
+
+	return rc;
+}
+
+/**
+ * Close the session opened with attest_enroll_session_open()
+ *
+ * A persistent AK is kept in the TPM.
+ */
+void attest_enroll_session_close(void)
+{
+	if (!session)
+		return;
+
+	if (session->ak_loaded)
+		attest_tss_flushcontext(session->tssContext,
+					session->ak_handle);
+	if (session->tssContext)
+		TSS_Delete(session->tssContext);
+	if (session->ak_public)
+		munmap(session->ak_public, session->ak_public_len);
+	if (session->d_ctx)
+		attest_ctx_data_cleanup(session->d_ctx);
+
+	free(session);
+	session = NULL;
+}
+
+/* the data context must stay valid until the session is closed */
+static int session_add_items(attest_ctx_data *d_ctx, enum ctx_fields field)
+{
+	struct data_item *item;
+	int rc;
+
+	list_for_each_entry(item, &session->d_ctx->ctx_data[field], list) {
+		rc = attest_ctx_data_add_borrowed(d_ctx, field, item->len,
+						  item->data, item->label);
+		if (rc < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
 static int write_trusted_key_blob(char *path, int append)
 {
 	uint8_t *bin_data;
@@ -859,7 +1243,8 @@ int attest_enroll_create_sym_key(int kernel_bios_log, int kernel_ima_log,
 	if (rc < 0)
 		goto out;
 
-	rc = collect_data(d_ctx, v_ctx, kernel_bios_log, kernel_ima_log, 0);
+	rc = collect_data(d_ctx, v_ctx, kernel_bios_log, kernel_ima_log, 0, 0,
+			  NULL);
 	if (rc < 0)
 		goto out;
 
@@ -945,6 +1330,21 @@ int attest_enroll_generate_ak(void)
  *  @{
  */
 
+/* format of the messages starting an exchange with the RA server */
+static enum ctx_msg_formats msg_format = CTX_MSG_JSON;
+
+/**
+ * Set format of the requests sent to the RA server
+ * @param[in] fmt	message format (JSON or TLV)
+ *
+ * The RA server replies in the format of the request, and the client
+ * continues the exchange in the format of the reply.
+ */
+void attest_enroll_msg_set_format(enum ctx_msg_formats fmt)
+{
+	msg_format = fmt;
+}
+
 /**
  * Create an AK challenge request
  * @param[in] ek_ca_dir	Directory containing EK CA certificates
@@ -984,7 +1384,7 @@ int attest_enroll_msg_ak_challenge_request(char *ek_ca_dir,
 	if (rc)
 		goto out_tss;
 
-	rc = attest_ctx_data_print_json(d_ctx, message_out);
+	rc = attest_ctx_data_print_msg(d_ctx, msg_format, message_out);
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx, &message_out_stripped);
 	printf("-> %s\n", message_out_stripped);
@@ -1023,8 +1423,7 @@ int attest_enroll_msg_ak_cert_request(char *message_in, char* hostname,
 	attest_ctx_data_init(&d_ctx);
 	attest_ctx_data_init(&d_ctx_cred);
 
-	rc = attest_ctx_data_add_json_data(d_ctx, message_in,
-					   strlen(message_in));
+	rc = attest_ctx_data_add_msg(d_ctx, message_in);
 	if (rc < 0)
 		goto out;
 #ifdef DEBUG
@@ -1043,7 +1442,9 @@ int attest_enroll_msg_ak_cert_request(char *message_in, char* hostname,
 	if (rc < 0)
 		goto out;
 
-	rc = attest_ctx_data_print_json(d_ctx_cred, message_out);
+	rc = attest_ctx_data_print_msg(d_ctx_cred,
+				       attest_ctx_msg_get_format(message_in),
+				       message_out);
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx_cred, &message_out_stripped);
 	printf("-> %s\n", message_out_stripped);
@@ -1074,8 +1475,7 @@ int attest_enroll_msg_ak_cert_response(char *message_in)
 
 	attest_ctx_data_init(&d_ctx);
 
-	rc = attest_ctx_data_add_json_data(d_ctx, message_in,
-					   strlen(message_in));
+	rc = attest_ctx_data_add_msg(d_ctx, message_in);
 	if (rc < 0)
 		goto out;
 #ifdef DEBUG
@@ -1161,7 +1561,7 @@ int attest_enroll_msg_key_cert_request(int kernel_bios_log, int kernel_ima_log,
 		goto out;
 
 	rc = collect_data(d_ctx, v_ctx, kernel_bios_log, kernel_ima_log,
-			  send_unsigned_files);
+			  send_unsigned_files, 0, NULL);
 	if (rc < 0)
 		goto out;
 
@@ -1218,7 +1618,7 @@ int attest_enroll_msg_key_cert_request(int kernel_bios_log, int kernel_ima_log,
 	if (rc < 0)
 		goto out;
 
-	rc = attest_ctx_data_print_json(d_ctx, message_out);
+	rc = attest_ctx_data_print_msg(d_ctx, msg_format, message_out);
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx, &message_out_stripped);
 	printf("-> %s\n", message_out_stripped);
@@ -1258,8 +1658,7 @@ int attest_enroll_msg_key_cert_response(char *message_in)
 
 	attest_ctx_data_init(&d_ctx);
 
-	rc = attest_ctx_data_add_json_data(d_ctx, message_in,
-					   strlen(message_in));
+	rc = attest_ctx_data_add_msg(d_ctx, message_in);
 	if (rc < 0)
 		goto out;
 #ifdef DEBUG
@@ -1288,13 +1687,66 @@ out:
 	return rc;
 }
 
+/* add digests of unsigned files in the IMA event log to be sent */
+static int add_aux_digests(attest_ctx_data *d_ctx, int kernel_ima_log)
+{
+	attest_ctx_data *d_ctx_ima;
+	attest_ctx_verifier *v_ctx;
+	struct ima_cursor cursor;
+	struct data_item *item;
+	size_t ima_len;
+	int rc;
+
+	attest_ctx_data_init(&d_ctx_ima);
+	attest_ctx_verifier_init(&v_ctx);
+
+	if (kernel_ima_log)
+		ima_cursor_read(&cursor);
+
+	rc = attest_pcr_init(v_ctx);
+	if (rc < 0)
+		goto out;
+
+	rc = add_ima_log(d_ctx_ima, kernel_ima_log,
+			 kernel_ima_log ? &cursor : NULL, &ima_len);
+	if (rc < 0 || list_empty(&d_ctx_ima->ctx_data[CTX_EVENT_LOG]))
+		goto out;
+
+	rc = attest_ctx_verifier_req_add(v_ctx, "ima_cp|verify", "digests");
+	if (rc < 0)
+		goto out;
+
+	rc = attest_event_log_parse_verify(d_ctx_ima, v_ctx, 1);
+	if (rc < 0)
+		goto out;
+
+	list_for_each_entry(item, &d_ctx_ima->ctx_data[CTX_AUX_DIGEST], list) {
+		rc = attest_ctx_data_add_copy(d_ctx, CTX_AUX_DIGEST, item->len,
+					      item->data, NULL);
+		if (rc < 0)
+			break;
+	}
+out:
+	attest_ctx_data_cleanup(d_ctx_ima);
+	attest_ctx_verifier_cleanup(v_ctx);
+	return rc;
+}
+
 /**
  * Generate a quote nonce request
+ * @param[in] kernel_ima_log	take or not the current IMA event log
+ * @param[in] send_unsigned_files	Send unsigned files to verifier
  * @param[in,out] message_out	Message containing quote nonce request
  *
+ * If unsigned files are sent to the verifier, the request includes their
+ * digests from the IMA event log, so that the verifier replies with the
+ * digests of the files it does not have.
+ *
  * @returns 0 on success, a negative value on error
  */
-int attest_enroll_msg_quote_nonce_request(char **message_out)
+int attest_enroll_msg_quote_nonce_request(int kernel_ima_log,
+					  int send_unsigned_files,
+					  char **message_out)
 {
 #ifdef DEBUG
 	char *message_out_stripped;
@@ -1303,14 +1755,24 @@ int attest_enroll_msg_quote_nonce_request(char **message_out)
 	attest_ctx_verifier *v_ctx;
 	int rc;
 
-	attest_ctx_data_init(&d_ctx);
+	attest_ctx_data_init_flags(&d_ctx, session ? CTX_IN_MEMORY : 0);
 	attest_ctx_verifier_init(&v_ctx);
 
-	rc = attest_ctx_data_add_file(d_ctx, CTX_AK_CERT, AK_CERT_PATH, NULL);
+	if (session)
+		rc = session_add_items(d_ctx, CTX_AK_CERT);
+	else
+		rc = attest_ctx_data_add_file(d_ctx, CTX_AK_CERT, AK_CERT_PATH,
+					      NULL);
 	if (rc < 0)
 		goto out;
 
-	rc = attest_ctx_data_print_json(d_ctx, message_out);
+	if (send_unsigned_files) {
+		rc = add_aux_digests(d_ctx, kernel_ima_log);
+		if (rc < 0)
+			goto out;
+	}
+
+	rc = attest_ctx_data_print_msg(d_ctx, msg_format, message_out);
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx, &message_out_stripped);
 	printf("-> %s\n", message_out_stripped);
@@ -1322,6 +1784,35 @@ out:
 	return rc;
 }
 
+/* certificates for quote verification, taken from the session if open */
+static int add_quote_certs(attest_ctx_data *d_ctx, char *privacy_ca_dir)
+{
+	int rc;
+
+	if (session) {
+		rc = session_add_items(d_ctx, CTX_PRIVACY_CA_CERT);
+		if (!rc)
+			rc = session_add_items(d_ctx, CTX_AK_CERT);
+		if (!rc)
+			rc = session_add_items(d_ctx, CTX_SYM_KEY_POLICY);
+
+		return rc;
+	}
+
+	rc = attest_ctx_data_add_dir(d_ctx, CTX_PRIVACY_CA_CERT, privacy_ca_dir,
+				     NULL);
+	if (rc < 0)
+		return rc;
+
+	rc = attest_ctx_data_add_file(d_ctx, CTX_AK_CERT, AK_CERT_PATH, NULL);
+	if (rc < 0)
+		return rc;
+
+	attest_ctx_data_add_file(d_ctx, CTX_SYM_KEY_POLICY, SYM_KEY_POLICY_PATH,
+				 NULL);
+	return 0;
+}
+
 /**
  * Parse a quote nonce response
  * @param[in] privacy_ca_dir	Directory containing Privacy CA certificates
@@ -1331,39 +1822,52 @@ out:
  * @param[in] pcr_list_str	String containing selected PCRs
  * @param[in] skip_sig_ver	skip signature verification
  * @param[in] send_unsigned_files	Send unsigned files to verifier
+ * @param[in] compress_data	Compress event logs and aux data (JSON only)
  * @param[in] message_in	Input message
  * @param[in,out] message_out	Output message
  *
+ * If the current IMA event log is taken and the last quote was verified,
+ * only the new measurements are sent, together with the number of entries
+ * already sent for each event log.
+ *
+ * If a session is open, privacy_ca_dir is ignored.
+ *
  * @returns 0 on success, a negative value on error
  */
 int attest_enroll_msg_quote_request(char *privacy_ca_dir, int kernel_bios_log,
 				    int kernel_ima_log, char *pcr_alg_name,
 				    char *pcr_list_str, int skip_sig_ver,
-				    int send_unsigned_files, char *message_in,
-				    char **message_out)
+				    int send_unsigned_files, int compress_data,
+				    char *message_in, char **message_out)
 {
 #ifdef DEBUG
 	char *message_in_stripped;
 	char *message_out_stripped;
 #endif
 	void *tssContext;
-	uint8_t *nonce;
+	struct data_item *nonce;
 	attest_ctx_data *d_ctx;
 	attest_ctx_verifier *v_ctx;
 	int pcr_list[IMPLEMENTATION_PCR];
 	TPML_PCR_SELECTION selection = { 0 };
 	TPM_ALG_ID pcr_alg = PCR_ALG;
-	int rc, i, nonce_len;
+	struct ima_cursor cursor;
+	int rc, i;
 
-	attest_ctx_data_init(&d_ctx);
+	attest_ctx_data_init_flags(&d_ctx, (compress_data ? CTX_COMPRESS : 0) |
+				   (session ? CTX_IN_MEMORY : 0));
 	attest_ctx_verifier_init(&v_ctx);
 
+	if (kernel_ima_log) {
+		ima_cursor_read(&cursor);
+		attest_ctx_verifier_set_flags(v_ctx, CTX_CHECKPOINT);
+	}
+
 	rc = attest_pcr_init(v_ctx);
 	if (rc < 0)
 		goto out;
 
-	rc = attest_ctx_data_add_json_data(d_ctx, message_in,
-					   strlen(message_in));
+	rc = attest_ctx_data_add_msg(d_ctx, message_in);
 	if (rc < 0)
 		goto out;
 #ifdef DEBUG
@@ -1371,26 +1875,21 @@ int attest_enroll_msg_quote_request(char *privacy_ca_dir, int kernel_bios_log,
 	printf("<- %s\n", message_in_stripped);
 	free(message_in_stripped);
 #endif
-	rc = attest_ctx_data_json_get_by_field(message_in, CTX_NONCE,
-					       &nonce_len, &nonce);
-	if (rc < 0)
-		goto out;
-
-	rc = attest_ctx_data_add_dir(d_ctx, CTX_PRIVACY_CA_CERT, privacy_ca_dir,
-				     NULL);
-	if (rc < 0)
+	nonce = attest_ctx_data_get(d_ctx, CTX_NONCE);
+	if (!nonce) {
+		rc = -ENOENT;
 		goto out;
+	}
 
-	rc = attest_ctx_data_add_file(d_ctx, CTX_AK_CERT, AK_CERT_PATH, NULL);
+	rc = add_quote_certs(d_ctx, privacy_ca_dir);
 	if (rc < 0)
 		goto out;
 
-	attest_ctx_data_add_file(d_ctx, CTX_SYM_KEY_POLICY, SYM_KEY_POLICY_PATH,
-				 NULL);
-
-	rc = TSS_Create((TSS_CONTEXT **)&tssContext);
-	if (rc < 0)
+	tssContext = session ? session->tssContext : NULL;
+	if (!session && TSS_Create((TSS_CONTEXT **)&tssContext)) {
+		rc = -EINVAL;
 		goto out;
+	}
 
 	for (i = 0; i < IMPLEMENTATION_PCR; i++)
 		pcr_list[i] = -1;
@@ -1418,28 +1917,64 @@ int attest_enroll_msg_quote_request(char *privacy_ca_dir, int kernel_bios_log,
 							1 << (pcr_list[i] % 8);
 	}
 
-	rc = attest_enroll_add_quote(d_ctx, tssContext, AK_PRIV_PATH,
-				     AK_PUB_PATH, nonce_len, nonce, &selection);
+	if (session)
+		rc = add_quote_common(d_ctx, tssContext, session->ak_handle,
+				      session->ak_public_len,
+				      session->ak_public, nonce->len,
+				      nonce->data, &selection);
+	else
+		rc = attest_enroll_add_quote(d_ctx, tssContext, AK_PRIV_PATH,
+					     AK_PUB_PATH, nonce->len,
+					     nonce->data, &selection);
 	if (rc < 0)
-		goto out;
+		goto out_ctx;
 
 	rc = collect_data(d_ctx, v_ctx, kernel_bios_log, kernel_ima_log,
-			  send_unsigned_files);
+			  send_unsigned_files, send_unsigned_files,
+			  kernel_ima_log ? &cursor : NULL);
 	if (rc < 0)
 		goto out_ctx;
 
-	rc = attest_ctx_data_print_json(d_ctx, message_out);
+	rc = attest_ctx_data_print_msg(d_ctx,
+				       attest_ctx_msg_get_format(message_in),
+				       message_out);
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx, &message_out_stripped);
 	printf("-> %s\n", message_out_stripped);
 	free(message_out_stripped);
 #endif
 out_ctx:
-	TSS_Delete(tssContext);
+	if (!session)
+		TSS_Delete(tssContext);
 out:
 	attest_ctx_data_cleanup(d_ctx);
 	attest_ctx_verifier_cleanup(v_ctx);
 	return rc;
 }
+
+/**
+ * Update the position in the IMA event log after quote verification
+ * @param[in] verified	quote successfully verified or not
+ *
+ * If the quote has been verified, the next quote request includes only
+ * the IMA measurements added after those sent with this quote. Otherwise,
+ * the next quote request includes the full event logs.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_update_ima_cursor(int verified)
+{
+	if (verified) {
+		if (rename(IMA_CURSOR_NEW_PATH, IMA_CURSOR_PATH) < 0 &&
+		    errno != ENOENT)
+			return -errno;
+
+		return 0;
+	}
+
+	unlink(IMA_CURSOR_NEW_PATH);
+	unlink(IMA_CURSOR_PATH);
+	return 0;
+}
 /** @}*/
 /** @}*/
@@ -27,24 +27,46 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <sys/wait.h>
+#include <pthread.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
 
 #include "ctx_json.h"
+#include "ctx_tlv.h"
 #include "crypto.h"
 #include "skae.h"
 #include "util.h"
 #include "tss.h"
 #include "verifier.h"
+#include "event_log.h"
 #include "enroll_server.h"
 
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <openssl/pem.h>
+#include <openssl/conf.h>
+#include <openssl/x509v3.h>
+#include <openssl/err.h>
 
 #include <ibmtss/ekutils.h>
 #include <ibmtss/cryptoutils.h>
 
 #define NONCE_LEN 32
+#define CHECKPOINT_HASH_SIZE 256
+#define CHECKPOINT_MAX_ENTRIES 4096
+#define AUX_STORE_HASH_SIZE 4096
+#define AUX_STORE_MAX_SIZE (64 * 1024 * 1024)
+#define AUX_STORE_ALGO_LEN 32
+#define HMAC_KEY_ID_LEN 4
+#define HMAC_KEY_MIN_LEN 16
+#define NONCE_TIME_LEN 8
+#define NONCE_TIMEOUT 300
+#define NONCE_MAX_CLOCK_SKEW 60
+#define NONCE_CACHE_HASH_SIZE 4096
+#define NONCE_CACHE_MAX_ENTRIES 65536
 
 int verbose;
 
@@ -92,16 +114,300 @@ out:
 	return rc;
 }
 
+/* HMAC keys shared by the server instances, the last one signs new HMACs */
+struct hmac_key {
+	uint32_t id;
+	BYTE key[64];
+};
+
+struct hmac_keyring {
+	int num_keys;
+	int refcount;
+	struct hmac_key keys[];
+};
+
+static pthread_mutex_t hmac_keys_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hmac_keyring *hmac_keys_current;
+/* keys of recorded nonces, which can be replayed by load tests */
+static struct hmac_keyring *hmac_keys_replay;
+
+static void attest_enroll_hmac_keys_put(struct hmac_keyring *k)
+{
+	int refcount;
+
+	if (!k)
+		return;
+
+	pthread_mutex_lock(&hmac_keys_lock);
+	refcount = --k->refcount;
+	pthread_mutex_unlock(&hmac_keys_lock);
+
+	if (!refcount) {
+		memset(k->keys, 0, k->num_keys * sizeof(*k->keys));
+		free(k);
+	}
+}
+
+static struct hmac_keyring *attest_enroll_hmac_keys_get(
+					struct hmac_keyring **keys)
+{
+	struct hmac_keyring *k;
+
+	pthread_mutex_lock(&hmac_keys_lock);
+	k = *keys;
+	if (k)
+		k->refcount++;
+	pthread_mutex_unlock(&hmac_keys_lock);
+
+	return k;
+}
+
+static int attest_enroll_hmac_keys_new(char *keysPath,
+				       struct hmac_keyring **keys)
+{
+	struct hmac_keyring *k = NULL, *new_k;
+	char line[256], *id_str, *key_str, *endptr;
+	unsigned long id;
+	size_t key_len;
+	FILE *fp;
+	int rc = -EINVAL;
+
+	fp = fopen(keysPath, "r");
+	if (!fp)
+		return -ENOENT;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#')
+			continue;
+
+		id_str = strtok(line, " \t\n");
+		if (!id_str)
+			continue;
+
+		key_str = strtok(NULL, " \t\n");
+		if (!key_str)
+			goto out;
+
+		id = strtoul(id_str, &endptr, 10);
+		if (*endptr || id > UINT32_MAX)
+			goto out;
+
+		key_len = strlen(key_str) / 2;
+		if (strlen(key_str) % 2 || key_len < HMAC_KEY_MIN_LEN ||
+		    key_len > sizeof(k->keys[0].key))
+			goto out;
+
+		new_k = realloc(k, sizeof(*k) + ((k ? k->num_keys : 0) + 1) *
+				sizeof(*k->keys));
+		if (!new_k) {
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		if (!k)
+			new_k->num_keys = 0;
+
+		k = new_k;
+
+		memset(&k->keys[k->num_keys], 0, sizeof(*k->keys));
+		k->keys[k->num_keys].id = id;
+
+		if (_hex2bin(k->keys[k->num_keys].key, key_str, key_len))
+			goto out;
+
+		k->num_keys++;
+	}
+
+	if (!k)
+		goto out;
+
+	k->refcount = 1;
+	*keys = k;
+	k = NULL;
+	rc = 0;
+out:
+	fclose(fp);
+	memset(line, 0, sizeof(line));
+
+	if (k) {
+		memset(k->keys, 0, k->num_keys * sizeof(*k->keys));
+		free(k);
+	}
+
+	return rc;
+}
+
+/**
+ * Load HMAC keys
+ * @param[in] keysPath		Path of the file containing the HMAC keys
+ *
+ * Each line of the file contains a key ID and a hex-encoded key (16-64
+ * bytes), separated by a space. Lines starting with '#' are ignored. The
+ * key in the last line is used for new HMACs, the others are accepted for
+ * verification. Server instances loading the same file can verify
+ * messages generated by each other, and keys can be rotated by appending
+ * a new key and reloading the file. Without keys, the key passed to each
+ * function is used, with ID 0.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_load_hmac_keys(char *keysPath)
+{
+	struct hmac_keyring *k, *old;
+	int rc;
+
+	rc = attest_enroll_hmac_keys_new(keysPath, &k);
+	if (rc < 0)
+		return rc;
+
+	pthread_mutex_lock(&hmac_keys_lock);
+	old = hmac_keys_current;
+	hmac_keys_current = k;
+	pthread_mutex_unlock(&hmac_keys_lock);
+
+	attest_enroll_hmac_keys_put(old);
+	return 0;
+}
+
+/**
+ * Load HMAC keys of replayed nonces
+ * @param[in] keysPath		Path of the file containing the HMAC keys
+ *
+ * Load keys with the same format of attest_enroll_load_hmac_keys(), which
+ * are used only to verify nonce HMACs. Quotes whose nonce HMAC was generated
+ * with one of these keys are accepted even if the nonce expired or was
+ * already used, so that load tests can replay recorded quotes.
+ *
+ * The keys must be dedicated to testing, and their IDs must be different
+ * from those of the keys loaded with attest_enroll_load_hmac_keys(), which
+ * are looked up first. Nonces of the other keys are still checked.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_load_replay_hmac_keys(char *keysPath)
+{
+	struct hmac_keyring *k, *old;
+	int rc;
+
+	rc = attest_enroll_hmac_keys_new(keysPath, &k);
+	if (rc < 0)
+		return rc;
+
+	pthread_mutex_lock(&hmac_keys_lock);
+	old = hmac_keys_replay;
+	hmac_keys_replay = k;
+	pthread_mutex_unlock(&hmac_keys_lock);
+
+	attest_enroll_hmac_keys_put(old);
+	return 0;
+}
+
+static int attest_enroll_hmac_key_find(struct hmac_keyring *k, uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < k->num_keys; i++)
+		if (k->keys[i].id == id)
+			break;
+
+	return i;
+}
+
+/*
+ * Set the key to sign a new HMAC (*id is set), or to verify one with *id.
+ * If replay is not NULL, the replay keys are also looked up for verification,
+ * and *replay is set if the key was found there.
+ */
+static int attest_enroll_set_hmac_key(attest_ctx_verifier *v_ctx,
+				      int new_hmac, uint32_t *id, int *replay)
+{
+	struct hmac_keyring *k, *k_replay;
+	int rc = 0, i;
+
+	k = attest_enroll_hmac_keys_get(&hmac_keys_current);
+
+	if (replay && !new_hmac &&
+	    (!k || attest_enroll_hmac_key_find(k, *id) == k->num_keys)) {
+		k_replay = attest_enroll_hmac_keys_get(&hmac_keys_replay);
+		if (k_replay &&
+		    attest_enroll_hmac_key_find(k_replay, *id) <
+		    k_replay->num_keys) {
+			attest_enroll_hmac_keys_put(k);
+			k = k_replay;
+			*replay = 1;
+		} else {
+			attest_enroll_hmac_keys_put(k_replay);
+		}
+	}
+
+	if (!k) {
+		/* use the key set by the caller */
+		if (new_hmac)
+			*id = 0;
+
+		return *id ? -ENOKEY : 0;
+	}
+
+	i = attest_enroll_hmac_key_find(k, *id);
+
+	if (new_hmac)
+		i = k->num_keys - 1;
+
+	if (i == k->num_keys) {
+		rc = -ENOKEY;
+		goto out;
+	}
+
+	*id = k->keys[i].id;
+	attest_ctx_verifier_set_key(v_ctx, sizeof(k->keys[i].key),
+				    k->keys[i].key);
+out:
+	attest_enroll_hmac_keys_put(k);
+	return rc;
+}
+
+/* the HMAC is prefixed with the ID of the key, in network byte order */
+static int attest_enroll_add_hmac(attest_ctx_data *d_ctx_out,
+				  attest_ctx_verifier *v_ctx,
+				  struct data_item *ak, int data_len,
+				  BYTE *data, enum ctx_fields field_hmac)
+{
+	BYTE hmac[HMAC_KEY_ID_LEN + EVP_MAX_MD_SIZE];
+	unsigned int hmac_len = EVP_MAX_MD_SIZE;
+	uint32_t id, id_be;
+	int rc;
+
+	current_log(v_ctx);
+
+	rc = attest_enroll_set_hmac_key(v_ctx, 1, &id, NULL);
+	check_goto(rc, rc, out, v_ctx, "HMAC key not available");
+
+	id_be = htonl(id);
+	memcpy(hmac, &id_be, HMAC_KEY_ID_LEN);
+
+	rc = attest_enroll_hmac(v_ctx, ak->len, ak->data, data_len, data,
+				&hmac_len, hmac + HMAC_KEY_ID_LEN);
+	check_goto(rc, rc, out, v_ctx, "attest_enroll_hmac() error");
+
+	rc = attest_ctx_data_add_copy(d_ctx_out, field_hmac,
+				      HMAC_KEY_ID_LEN + hmac_len, hmac, NULL);
+	check_goto(rc, rc, out, v_ctx, "attest_ctx_data_add_copy() error");
+out:
+	return rc;
+}
+
+/* *replay is set if the HMAC was verified with a replay key */
 static int attest_enroll_verify_hmac(attest_ctx_data *d_ctx_in,
 				     attest_ctx_verifier *v_ctx,
 				     struct data_item *item,
 				     struct data_item *ak,
-				     enum ctx_fields field_hmac)
+				     enum ctx_fields field_hmac, int *replay)
 {
 	struct data_item *item_hmac;
 	BYTE hmac[EVP_MAX_MD_SIZE];
 	unsigned int hmac_len = sizeof(hmac);
 	struct verification_log *log;
+	uint32_t id;
 	int rc;
 
 	log = attest_ctx_verifier_add_log(v_ctx, "verify HMAC");
@@ -109,15 +415,25 @@ static int attest_enroll_verify_hmac(attest_ctx_data *d_ctx_in,
 	item_hmac = attest_ctx_data_get(d_ctx_in, field_hmac);
 	check_goto(!item_hmac, -ENOENT, out, v_ctx, "HMAC not provided");
 
+	check_goto(item_hmac->len <= HMAC_KEY_ID_LEN, -EINVAL, out, v_ctx,
+		   "HMAC key ID not provided");
+
+	memcpy(&id, item_hmac->data, HMAC_KEY_ID_LEN);
+	id = ntohl(id);
+
+	rc = attest_enroll_set_hmac_key(v_ctx, 0, &id, replay);
+	check_goto(rc, rc, out, v_ctx, "HMAC key %u not found", id);
+
 	rc = attest_enroll_hmac(v_ctx, ak->len, ak->data, item->len, item->data,
 				&hmac_len, hmac);
 	check_goto(rc, -EINVAL, out, v_ctx, "attest_enroll_hmac() error");
 
-	check_goto((item_hmac->len != hmac_len), -EINVAL, out, v_ctx,
-		   "credential HMAC length mismatch");
+	check_goto((item_hmac->len - HMAC_KEY_ID_LEN != hmac_len), -EINVAL,
+		   out, v_ctx, "credential HMAC length mismatch");
 
-	check_goto(memcmp(hmac, item_hmac->data, item_hmac->len), -EINVAL, out,
-		   v_ctx, "HMAC mismatch");
+	check_goto(CRYPTO_memcmp(hmac, item_hmac->data + HMAC_KEY_ID_LEN,
+				 hmac_len), -EINVAL, out, v_ctx,
+		   "HMAC mismatch");
 out:
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 	return rc;
@@ -218,7 +534,7 @@ int attest_enroll_make_cert(attest_ctx_data *d_ctx_in, attest_ctx_data *d_ctx_ou
 	check_goto(!cred, -ENOENT, out, v_ctx, "Credential not provided");
 
 	rc = attest_enroll_verify_hmac(d_ctx_in, v_ctx, cred, ak,
-				       CTX_CRED_HMAC);
+				       CTX_CRED_HMAC, NULL);
 	check_goto(rc, rc, out, v_ctx,
 		   "attest_enroll_verify_hmac() error: %d", rc);
 
@@ -289,11 +605,7 @@ int attest_enroll_make_credential(attest_ctx_data *d_ctx_in,
 	TPM2B_DIGEST cred;
 	UINT16 cred_blob_len, secret_len = 0;
 	BYTE *cred_blob = NULL, *secret = NULL;
-	BYTE hmac[EVP_MAX_MD_SIZE];
-	TPM_HANDLE ek_handle;
 	TPM_ALG_ID nameAlg;
-	void *tssContext;
-	unsigned int hmac_len = sizeof(hmac);
 	struct data_item *ak;
 	UINT32 req_mask = (TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT |
 			   TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_SIGN |
@@ -302,73 +614,203 @@ int attest_enroll_make_credential(attest_ctx_data *d_ctx_in,
 
 	log = attest_ctx_verifier_add_log(v_ctx, "make credential");
 
-	rc = TSS_Create((TSS_CONTEXT **)&tssContext);
-	check_goto(rc, -EACCES, out, v_ctx, "TSS_Create() error: %d", rc);
-
 	ak = attest_ctx_data_get(d_ctx_in, CTX_TPM_AK_KEY);
-	check_goto(!ak, -ENOENT, out_tpm, v_ctx,
+	check_goto(!ak, -ENOENT, out, v_ctx,
 		   "TPM attestation key not provided");
 
 	rc = attest_verifier_check_tpm2b_public(d_ctx_in, v_ctx, ak->len,
 						ak->data, 0, req_mask,
 						CTX__LAST, &nameAlg, &name);
-	check_goto(rc, rc, out_tpm, v_ctx,
+	check_goto(rc, rc, out, v_ctx,
 		   "attest_verifier_check_tpm2b_public() error: %d", rc);
 
 	rc = attest_crypto_verify_cert(d_ctx_in, v_ctx, CTX_EK_CERT,
 				       CTX_EK_CA_CERT, &cert);
-	check_goto(rc, rc, out_tpm, v_ctx,
+	check_goto(rc, rc, out, v_ctx,
 		   "attest_crypto_verify_cert() error: %d", rc);
 
 	evpPkey = X509_get0_pubkey(cert);
 	check_goto(!evpPkey, -ENOENT, out_cert, v_ctx,
 		   "X509_get_pubkey() error");
 
-	check_goto(rc, -EINVAL, out_cert, v_ctx, "convert key to public error");
-
 	cred.t.size = EVP_MD_size(EVP_sha256());
 
 	rc = RAND_bytes(cred.t.buffer, cred.t.size);
 	check_goto(!rc, -EIO, out_cert, v_ctx, "RAND_bytes() error");
 
-	rc = attest_tss_loadexternal(tssContext, evpPkey, &ek_handle);
-	check_goto(rc, rc, out_cert, v_ctx, "attest_tss_load_external() error");
-
-	rc = attest_tss_makecredential(tssContext, ek_handle, &cred, &name,
-				       &cred_blob, &cred_blob_len, &secret,
-				       &secret_len);
+	/* no TPM needed, the EK public key is sufficient */
+	rc = attest_crypto_make_credential(evpPkey, &cred, &name, &cred_blob,
+					   &cred_blob_len, &secret,
+					   &secret_len);
 	check_goto(rc, rc, out_cert, v_ctx,
-		   "attest_tss_make_credential() error");
+		   "attest_crypto_make_credential() error: %d", rc);
 
 	rc = attest_ctx_data_add(d_ctx_out, CTX_CREDBLOB, cred_blob_len,
 				 cred_blob, NULL);
-	check_goto(rc, rc, out_flush, v_ctx,
+	check_goto(rc, rc, out_cert, v_ctx,
 		   "attest_ctx_data_add_copy() error");
 
 	rc = attest_ctx_data_add(d_ctx_out, CTX_SECRET, secret_len, secret,
 				 NULL);
-	check_goto(rc, rc, out_flush, v_ctx,
+	check_goto(rc, rc, out_cert, v_ctx,
 		   "attest_ctx_data_add_copy() error");
 
-	rc = attest_enroll_hmac(v_ctx, ak->len, ak->data, cred.t.size,
-				cred.t.buffer, &hmac_len, hmac);
-	check_goto(rc, rc, out_flush, v_ctx, "attest_enroll_hmac() error");
-
-	rc = attest_ctx_data_add_copy(d_ctx_out, CTX_CRED_HMAC, hmac_len,
-				      hmac, NULL);
-	check_goto(rc, rc, out_flush, v_ctx,
-		   "attest_ctx_data_add_copy() error");
-out_flush:
-	attest_tss_flushcontext(tssContext, ek_handle);
+	rc = attest_enroll_add_hmac(d_ctx_out, v_ctx, ak, cred.t.size,
+				    cred.t.buffer, CTX_CRED_HMAC);
+	check_goto(rc, rc, out_cert, v_ctx, "attest_enroll_add_hmac() error");
 out_cert:
 	X509_free(cert);
-out_tpm:
-	TSS_Delete(tssContext);
 out:
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 	return rc;
 }
 
+/* requirements parsed once, replaced atomically when reloaded */
+struct reqs_template {
+	attest_ctx_verifier *v_ctx;
+	char *path;
+	char *reqs;
+	int refcount;
+};
+
+static pthread_mutex_t reqs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct reqs_template *reqs_current;
+
+/* set by attest_enroll_log_errors_only() */
+static int log_errors_only;
+
+static void attest_enroll_reqs_free(struct reqs_template *t)
+{
+	if (t->v_ctx)
+		attest_ctx_verifier_cleanup(t->v_ctx);
+
+	free(t->path);
+	free(t->reqs);
+	free(t);
+}
+
+static struct reqs_template *attest_enroll_reqs_new(char *reqPath)
+{
+	struct reqs_template *t;
+	char *logs;
+	int rc;
+
+	if (!reqPath)
+		return NULL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->refcount = 1;
+
+	t->path = strdup(reqPath);
+	if (!t->path)
+		goto err;
+
+	rc = attest_ctx_verifier_init(&t->v_ctx);
+	if (rc < 0)
+		goto err;
+
+	rc = attest_ctx_verifier_req_add_json_file(t->v_ctx, reqPath);
+	if (rc < 0) {
+		/* reasons are in the logs of the parsed requirements */
+		logs = attest_ctx_verifier_result_print_json(t->v_ctx);
+		if (logs)
+			printf("%s\n", logs);
+
+		free(logs);
+		goto err;
+	}
+
+	t->reqs = attest_ctx_verifier_req_print_json(t->v_ctx);
+	if (!t->reqs)
+		goto err;
+
+	return t;
+err:
+	attest_enroll_reqs_free(t);
+	return NULL;
+}
+
+static void attest_enroll_reqs_put(struct reqs_template *t)
+{
+	int refcount;
+
+	if (!t)
+		return;
+
+	pthread_mutex_lock(&reqs_lock);
+	refcount = --t->refcount;
+	pthread_mutex_unlock(&reqs_lock);
+
+	if (!refcount)
+		attest_enroll_reqs_free(t);
+}
+
+/* get requirements loaded at startup, or parse them if not loaded */
+static struct reqs_template *attest_enroll_reqs_get(char *reqPath)
+{
+	struct reqs_template *t = NULL;
+
+	pthread_mutex_lock(&reqs_lock);
+	if (reqs_current && reqPath && !strcmp(reqs_current->path, reqPath)) {
+		t = reqs_current;
+		t->refcount++;
+	}
+	pthread_mutex_unlock(&reqs_lock);
+
+	if (t)
+		return t;
+
+	return attest_enroll_reqs_new(reqPath);
+}
+
+/**
+ * Load verifier requirements
+ * @param[in] reqPath		Path of requirements for TPM key policy check
+ *
+ * Requirements are parsed once and shared by the following requests
+ * with the same path. Requests being processed keep using the previous
+ * requirements.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_load_reqs(char *reqPath)
+{
+	struct reqs_template *t, *old;
+
+	t = attest_enroll_reqs_new(reqPath);
+	if (!t)
+		return -EINVAL;
+
+	pthread_mutex_lock(&reqs_lock);
+	old = reqs_current;
+	reqs_current = t;
+	pthread_mutex_unlock(&reqs_lock);
+
+	attest_enroll_reqs_put(old);
+	return 0;
+}
+
+/**
+ * Release verifier requirements loaded with attest_enroll_load_reqs()
+ *
+ * Requests being processed keep using the requirements until they
+ * complete.
+ */
+void attest_enroll_unload_reqs(void)
+{
+	struct reqs_template *old;
+
+	pthread_mutex_lock(&reqs_lock);
+	old = reqs_current;
+	reqs_current = NULL;
+	pthread_mutex_unlock(&reqs_lock);
+
+	attest_enroll_reqs_put(old);
+}
+
 /**
  * Process a CSR for a TPM key
  * @param[in] d_ctx_in		input data context
@@ -376,6 +818,8 @@ out:
  * @param[in] reqPath		Path of requirements for TPM key policy check
  * @param[in,out] csr_str	CSR in PEM format
  *
+ * If v_ctx already contains requirements, reqPath is not read.
+ *
  * @returns 0 on success, a negative value on error
  */
 int attest_enroll_process_csr(attest_ctx_data *d_ctx_in,
@@ -422,16 +866,23 @@ int attest_enroll_process_csr(attest_ctx_data *d_ctx_in,
 		goto out;
 	}
 
-	rc = attest_ctx_verifier_req_add_json_file(v_ctx, reqPath);
+	if (list_empty(&v_ctx->verifiers))
+		rc = attest_ctx_verifier_req_add_json_file(v_ctx, reqPath);
+	else
+		rc = 0;
 	if (rc < 0) {
 		printf("Verifier's requirements not provided\n");
 		goto out;
 	}
 
-	printf("Processing SKAE with the following requirements:\n");
-	reqs = attest_ctx_verifier_req_print_json(v_ctx);
-	printf("%s\n", reqs);
-	free(reqs);
+	if (!log_errors_only) {
+		printf("Processing SKAE with the following requirements:\n");
+		reqs = attest_ctx_verifier_req_print_json(v_ctx);
+		if (reqs)
+			printf("%s\n", reqs);
+
+		free(reqs);
+	}
 
 	rc = skae_verify_x509_req(d_ctx_in, v_ctx, req);
 	if (rc != 1) {
@@ -477,37 +928,168 @@ out:
 	return rc;
 }
 
-static int attest_enroll_merge_subject(char *reqPath, char *caCertPath,
-				       int buf_len, char *buf)
+enum ca_copy_ext { CA_COPY_EXT_NONE, CA_COPY_EXT_COPY, CA_COPY_EXT_ALL };
+
+/* CA loaded once, to sign CSRs as openssl ca does, without running it */
+struct enroll_ca {
+	EVP_PKEY *key;
+	X509 *cert;
+	CONF *conf;
+	char *ext_section;
+	char *policy;
+	char *serial_path;
+	char *database_path;
+	char *new_certs_dir;
+	const EVP_MD *md;
+	long days;
+	int preserve;
+	enum ca_copy_ext copy_extensions;
+	int refcount;
+};
+
+/* protects the CA loading and refcount, the serial file and the database */
+static pthread_mutex_t ca_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct enroll_ca *ca_current;
+
+static void attest_enroll_ca_free(struct enroll_ca *ca)
+{
+	EVP_PKEY_free(ca->key);
+	X509_free(ca->cert);
+	NCONF_free(ca->conf);
+	free(ca);
+}
+
+static int attest_enroll_ca_new(char *caKeyPath, char *caKeyPassword,
+				char *caCertPath, char *openssl_ca_section,
+				struct enroll_ca **ca_out)
 {
-	X509_REQ *req = NULL;
-	X509 *issuer_cert = NULL;
-	X509_NAME *issuer_name = NULL, *req_name = NULL;
-	FILE *fp = NULL;
-	int rc, i, lastpos = -1;
+	struct enroll_ca *ca;
+	char *config_file, *value;
+	FILE *fp;
+	int rc = -EINVAL;
 
-	fp = fopen(reqPath, "r");
-	if (!fp)
-	return -EACCES;
+	ca = calloc(1, sizeof(*ca));
+	if (!ca)
+		return -ENOMEM;
 
-	req = PEM_read_X509_REQ(fp, NULL, NULL, NULL);
-	if (!req)
-		goto out;
+	ca->refcount = 1;
+
+	fp = fopen(caKeyPath, "r");
+	if (!fp) {
+		rc = -EACCES;
+		goto err;
+	}
 
+	ca->key = PEM_read_PrivateKey(fp, NULL, NULL, caKeyPassword ?: "");
 	fclose(fp);
 
+	if (!ca->key) {
+		printf("Cannot read CA private key %s\n", caKeyPath);
+		goto err;
+	}
+
 	fp = fopen(caCertPath, "r");
 	if (!fp) {
 		rc = -EACCES;
-		goto out;
+		goto err;
 	}
 
-	issuer_cert = PEM_read_X509(fp, NULL, NULL, NULL);
-	if (!issuer_cert)
-		goto out;
+	ca->cert = PEM_read_X509(fp, NULL, NULL, NULL);
+	fclose(fp);
 
-	issuer_name = X509_get_subject_name(issuer_cert);
-	req_name =  X509_REQ_get_subject_name(req);
+	if (!ca->cert || X509_check_private_key(ca->cert, ca->key) != 1) {
+		printf("Cannot read CA certificate %s\n", caCertPath);
+		goto err;
+	}
+
+	ca->conf = NCONF_new(NCONF_default());
+	if (!ca->conf) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	config_file = CONF_get1_default_config_file();
+	rc = NCONF_load(ca->conf, config_file, NULL);
+	OPENSSL_free(config_file);
+
+	if (rc != 1) {
+		rc = -ENOENT;
+		goto err;
+	}
+
+	rc = -ENOENT;
+
+	ca->serial_path = NCONF_get_string(ca->conf, openssl_ca_section,
+					   "serial");
+	if (!ca->serial_path) {
+		printf("Serial file not found in section %s\n",
+		       openssl_ca_section);
+		goto err;
+	}
+
+	ca->database_path = NCONF_get_string(ca->conf, openssl_ca_section,
+					     "database");
+	ca->new_certs_dir = NCONF_get_string(ca->conf, openssl_ca_section,
+					     "new_certs_dir");
+	ca->ext_section = NCONF_get_string(ca->conf, openssl_ca_section,
+					   "x509_extensions");
+	ca->policy = NCONF_get_string(ca->conf, openssl_ca_section, "policy");
+
+	value = NCONF_get_string(ca->conf, openssl_ca_section, "preserve");
+	ca->preserve = (value && !strcasecmp(value, "yes"));
+
+	value = NCONF_get_string(ca->conf, openssl_ca_section,
+				 "copy_extensions");
+	if (value && !strcasecmp(value, "copy"))
+		ca->copy_extensions = CA_COPY_EXT_COPY;
+	else if (value && !strcasecmp(value, "copyall"))
+		ca->copy_extensions = CA_COPY_EXT_ALL;
+
+	value = NCONF_get_string(ca->conf, openssl_ca_section, "default_days");
+	ca->days = value ? strtol(value, NULL, 10) : 365;
+
+	value = NCONF_get_string(ca->conf, openssl_ca_section, "default_md");
+	if (!value || !strcmp(value, "default"))
+		ca->md = EVP_sha256();
+	else
+		ca->md = EVP_get_digestbyname(value);
+
+	if (!ca->md || ca->days <= 0) {
+		printf("Invalid default_md or default_days in section %s\n",
+		       openssl_ca_section);
+		rc = -EINVAL;
+		goto err;
+	}
+
+	/* missing optional settings leave errors in the queue */
+	ERR_clear_error();
+
+	*ca_out = ca;
+	return 0;
+err:
+	attest_enroll_ca_free(ca);
+	return rc;
+}
+
+static void attest_enroll_ca_put(struct enroll_ca *ca)
+{
+	int refcount;
+
+	if (!ca)
+		return;
+
+	pthread_mutex_lock(&ca_lock);
+	refcount = --ca->refcount;
+	pthread_mutex_unlock(&ca_lock);
+
+	if (!refcount)
+		attest_enroll_ca_free(ca);
+}
+
+static void attest_enroll_ca_merge_subject(X509_NAME *issuer_name,
+					   X509_NAME *req_name)
+{
+	int i, lastpos = -1;
 
 	for (i = 0; i < 5; i++) {
 		int idx_issuer, idx_req;
@@ -529,76 +1111,549 @@ static int attest_enroll_merge_subject(char *reqPath, char *caCertPath,
 		entry = X509_NAME_get_entry(issuer_name, idx_issuer);
 		X509_NAME_add_entry(req_name, entry, idx_req, 0);
 	}
+}
 
-	X509_NAME_oneline(req_name, buf, buf_len);
-out:
-	if (fp)
-		fclose(fp);
+/* apply the policy of the CA section: match, supplied or optional fields */
+static int attest_enroll_ca_subject(struct enroll_ca *ca, X509_NAME *req_name,
+				    X509_NAME **subject)
+{
+	X509_NAME *issuer_name = X509_get_subject_name(ca->cert);
+	X509_NAME *merged, *name = NULL;
+	X509_NAME_ENTRY *entry, *issuer_entry;
+	STACK_OF(CONF_VALUE) *policy;
+	CONF_VALUE *cv;
+	int rc = -EINVAL, i, nid, idx, idx_issuer, found;
+
+	merged = X509_NAME_dup(req_name);
+	if (!merged)
+		return -ENOMEM;
+
+	attest_enroll_ca_merge_subject(issuer_name, merged);
+
+	if (!ca->policy) {
+		*subject = merged;
+		return 0;
+	}
 
-	X509_REQ_free(req);
-	X509_free(issuer_cert);
-	return rc;
-}
+	policy = NCONF_get_section(ca->conf, ca->policy);
+	if (!policy) {
+		printf("Policy section %s not found\n", ca->policy);
+		rc = -ENOENT;
+		goto out;
+	}
 
-/**
- * Sign a CSR
- * @param[in] caKeyPath	CA private key path
- * @param[in] caKeyPassword	CA private key password
- * @param[in] caCertPath	CA certificate path
- * @param[in] openssl_ca_section	openssl CA section to use
- * @param[in] csr_str	CSR to sign
- * @param[in,out] cert_str	Signed certificate
+	name = X509_NAME_new();
+	if (!name) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < sk_CONF_VALUE_num(policy); i++) {
+		cv = sk_CONF_VALUE_value(policy, i);
+
+		nid = OBJ_txt2nid(cv->name);
+		if (nid == NID_undef) {
+			printf("Unknown policy field %s\n", cv->name);
+			goto out;
+		}
+
+		found = 0;
+		idx = -1;
+
+		while ((idx = X509_NAME_get_index_by_NID(merged, nid,
+							 idx)) >= 0) {
+			found = 1;
+			entry = X509_NAME_get_entry(merged, idx);
+
+			if (!strcmp(cv->value, "match")) {
+				idx_issuer = X509_NAME_get_index_by_NID(
+							issuer_name, nid, -1);
+				if (idx_issuer < 0)
+					goto out;
+
+				issuer_entry = X509_NAME_get_entry(issuer_name,
+								   idx_issuer);
+				if (ASN1_STRING_cmp(
+					X509_NAME_ENTRY_get_data(entry),
+					X509_NAME_ENTRY_get_data(issuer_entry))) {
+					printf("Field %s does not match\n",
+					       cv->name);
+					goto out;
+				}
+			}
+
+			if (!ca->preserve &&
+			    !X509_NAME_add_entry(name, entry, -1, 0)) {
+				rc = -ENOMEM;
+				goto out;
+			}
+		}
+
+		if (!found && strcmp(cv->value, "optional")) {
+			printf("Mandatory field %s missing\n", cv->name);
+			goto out;
+		}
+	}
+
+	if (ca->preserve) {
+		*subject = merged;
+		merged = NULL;
+	} else {
+		*subject = name;
+		name = NULL;
+	}
+
+	rc = 0;
+out:
+	X509_NAME_free(merged);
+	X509_NAME_free(name);
+	return rc;
+}
+
+static int attest_enroll_ca_copy_extensions(struct enroll_ca *ca,
+					    X509_REQ *req, X509 *cert)
+{
+	STACK_OF(X509_EXTENSION) *exts;
+	X509_EXTENSION *ext;
+	ASN1_OBJECT *obj;
+	int rc = 0, i, idx;
+
+	if (ca->copy_extensions == CA_COPY_EXT_NONE)
+		return 0;
+
+	exts = X509_REQ_get_extensions(req);
+
+	for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
+		ext = sk_X509_EXTENSION_value(exts, i);
+		obj = X509_EXTENSION_get_object(ext);
+
+		idx = X509_get_ext_by_OBJ(cert, obj, -1);
+		if (idx != -1) {
+			if (ca->copy_extensions == CA_COPY_EXT_COPY)
+				continue;
+
+			do {
+				X509_EXTENSION_free(X509_delete_ext(cert, idx));
+				idx = X509_get_ext_by_OBJ(cert, obj, -1);
+			} while (idx != -1);
+		}
+
+		if (!X509_add_ext(cert, ext, -1)) {
+			rc = -ENOMEM;
+			break;
+		}
+	}
+
+	sk_X509_EXTENSION_pop_free(exts, X509_EXTENSION_free);
+	return rc;
+}
+
+/* read the serial file and store the next serial, with ca_lock held */
+static int attest_enroll_ca_next_serial(struct enroll_ca *ca,
+					ASN1_INTEGER *serial)
+{
+	char buf[256], path_new[PATH_MAX], *hex = NULL;
+	BIGNUM *bn = NULL;
+	FILE *fp;
+	int rc = -EINVAL;
+
+	fp = fopen(ca->serial_path, "r");
+	if (!fp)
+		return -EACCES;
+
+	if (!fgets(buf, sizeof(buf), fp)) {
+		fclose(fp);
+		return -EINVAL;
+	}
+
+	fclose(fp);
+	buf[strcspn(buf, "\r\n")] = '\0';
+
+	if (!BN_hex2bn(&bn, buf) || !BN_to_ASN1_INTEGER(bn, serial))
+		goto out;
+
+	if (!BN_add_word(bn, 1))
+		goto out;
+
+	hex = BN_bn2hex(bn);
+	if (!hex) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	snprintf(path_new, sizeof(path_new), "%s.new", ca->serial_path);
+
+	fp = fopen(path_new, "w");
+	if (!fp) {
+		rc = -EACCES;
+		goto out;
+	}
+
+	rc = (fprintf(fp, "%s\n", hex) < 0) ? -EIO : 0;
+	if (fclose(fp) && !rc)
+		rc = -EIO;
+
+	if (!rc && rename(path_new, ca->serial_path) < 0)
+		rc = -errno;
+
+	if (rc)
+		unlink(path_new);
+out:
+	OPENSSL_free(hex);
+	BN_free(bn);
+	return rc;
+}
+
+/* record the certificate in the database and new_certs_dir, with ca_lock held */
+static int attest_enroll_ca_record(struct enroll_ca *ca, X509 *cert)
+{
+	const ASN1_TIME *not_after = X509_get0_notAfter(cert);
+	char path[PATH_MAX], *hex = NULL, *subject = NULL;
+	BIGNUM *bn = NULL;
+	FILE *fp;
+	int rc = -ENOMEM;
+
+	bn = ASN1_INTEGER_to_BN(X509_get_serialNumber(cert), NULL);
+	if (bn)
+		hex = BN_is_zero(bn) ? OPENSSL_strdup("00") : BN_bn2hex(bn);
+
+	subject = X509_NAME_oneline(X509_get_subject_name(cert), NULL, 0);
+	if (!hex || !subject)
+		goto out;
+
+	if (ca->new_certs_dir) {
+		snprintf(path, sizeof(path), "%s/%s.pem", ca->new_certs_dir,
+			 hex);
+
+		fp = fopen(path, "w");
+		if (!fp) {
+			rc = -EACCES;
+			goto out;
+		}
+
+		rc = (PEM_write_X509(fp, cert) == 1) ? 0 : -EIO;
+		fclose(fp);
+
+		if (rc < 0)
+			goto out;
+	}
+
+	rc = 0;
+
+	if (!ca->database_path)
+		goto out;
+
+	fp = fopen(ca->database_path, "a");
+	if (!fp) {
+		rc = -EACCES;
+		goto out;
+	}
+
+	if (fprintf(fp, "V\t%.*s\t\t%s\tunknown\t%s\n",
+		    ASN1_STRING_length(not_after),
+		    (const char *)ASN1_STRING_get0_data(not_after),
+		    hex, subject) < 0)
+		rc = -EIO;
+
+	fclose(fp);
+out:
+	OPENSSL_free(subject);
+	OPENSSL_free(hex);
+	BN_free(bn);
+	return rc;
+}
+
+static int attest_enroll_ca_sign(struct enroll_ca *ca, X509_REQ *req,
+				 X509 **cert_out)
+{
+	X509V3_CTX ext_ctx;
+	X509_NAME *subject = NULL;
+	EVP_PKEY *pkey;
+	X509 *cert;
+	int rc;
+
+	pkey = X509_REQ_get0_pubkey(req);
+	if (!pkey || X509_REQ_verify(req, pkey) != 1)
+		return -EINVAL;
+
+	rc = attest_enroll_ca_subject(ca, X509_REQ_get_subject_name(req),
+				      &subject);
+	if (rc < 0)
+		return rc;
+
+	cert = X509_new();
+	if (!cert) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = -EINVAL;
+
+	if (!X509_set_version(cert, 2) ||
+	    !X509_set_issuer_name(cert, X509_get_subject_name(ca->cert)) ||
+	    !X509_set_subject_name(cert, subject) ||
+	    !X509_gmtime_adj(X509_getm_notBefore(cert), 0) ||
+	    !X509_time_adj_ex(X509_getm_notAfter(cert), ca->days, 0, NULL) ||
+	    !X509_set_pubkey(cert, pkey))
+		goto out;
+
+	if (ca->ext_section) {
+		X509V3_set_ctx(&ext_ctx, ca->cert, cert, req, NULL, 0);
+		X509V3_set_nconf(&ext_ctx, ca->conf);
+
+		if (!X509V3_EXT_add_nconf(ca->conf, &ext_ctx, ca->ext_section,
+					  cert)) {
+			printf("Cannot add extensions from section %s\n",
+			       ca->ext_section);
+			goto out;
+		}
+	}
+
+	rc = attest_enroll_ca_copy_extensions(ca, req, cert);
+	if (rc < 0)
+		goto out;
+
+	pthread_mutex_lock(&ca_lock);
+	rc = attest_enroll_ca_next_serial(ca, X509_get_serialNumber(cert));
+	pthread_mutex_unlock(&ca_lock);
+
+	if (rc < 0)
+		goto out;
+
+	if (!X509_sign(cert, ca->key, ca->md)) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	pthread_mutex_lock(&ca_lock);
+	rc = attest_enroll_ca_record(ca, cert);
+	pthread_mutex_unlock(&ca_lock);
+out:
+	if (!rc)
+		*cert_out = cert;
+	else
+		X509_free(cert);
+
+	X509_NAME_free(subject);
+	return rc;
+}
+
+/**
+ * Load the CA used to sign CSRs
+ * @param[in] caKeyPath	CA private key path
+ * @param[in] caKeyPassword	CA private key password
+ * @param[in] caCertPath	CA certificate path
+ * @param[in] openssl_ca_section	openssl CA section to use
+ *
+ * The CA is loaded only by the first call. Policy, extensions, validity,
+ * serial file and database are taken from the openssl CA section, as
+ * openssl ca does.
  *
  * @returns 0 on success, a negative value on error
  */
-int attest_enroll_sign_csr(char *caKeyPath, char *caKeyPassword,
-			   char *caCertPath, char *openssl_ca_section,
-			   char *csr_str, char **cert_str)
+int attest_enroll_load_ca(char *caKeyPath, char *caKeyPassword,
+			  char *caCertPath, char *openssl_ca_section)
 {
-	attest_ctx_data *d_ctx_in = NULL;
-	char path_csr[PATH_MAX];
-	char path_cert[PATH_MAX];
-	char pass_arg[64];
-	char subj_arg[128];
-	size_t len;
-	int rc = -EINVAL, status;
+	int rc = 0;
 
-	attest_ctx_data_init(&d_ctx_in);
+	pthread_mutex_lock(&ca_lock);
+	if (!ca_current)
+		rc = attest_enroll_ca_new(caKeyPath, caKeyPassword, caCertPath,
+					  openssl_ca_section, &ca_current);
+	pthread_mutex_unlock(&ca_lock);
 
-	snprintf(path_csr, sizeof(path_csr), "%s/csr.pem", d_ctx_in->data_dir);
-	snprintf(path_cert, sizeof(path_cert),
-		 "%s/cert.pem", d_ctx_in->data_dir);
+	return rc;
+}
 
-	snprintf(pass_arg, sizeof(pass_arg), "pass:%s", caKeyPassword ?: "");
+/**
+ * Reload the CA used to sign CSRs
+ * @param[in] caKeyPath	CA private key path
+ * @param[in] caKeyPassword	CA private key password
+ * @param[in] caCertPath	CA certificate path
+ * @param[in] openssl_ca_section	openssl CA section to use
+ *
+ * CSRs being signed keep using the previous CA. If the new CA cannot be
+ * loaded, the previous one is kept.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_reload_ca(char *caKeyPath, char *caKeyPassword,
+			    char *caCertPath, char *openssl_ca_section)
+{
+	struct enroll_ca *ca, *old;
+	int rc;
 
-	rc = attest_util_write_file(path_csr, strlen(csr_str),
-				    (uint8_t *)csr_str, 0);
+	rc = attest_enroll_ca_new(caKeyPath, caKeyPassword, caCertPath,
+				  openssl_ca_section, &ca);
 	if (rc < 0)
 		return rc;
 
-	attest_enroll_merge_subject(path_csr, caCertPath, sizeof(subj_arg), subj_arg);
+	pthread_mutex_lock(&ca_lock);
+	old = ca_current;
+	ca_current = ca;
+	pthread_mutex_unlock(&ca_lock);
+
+	attest_enroll_ca_put(old);
+	return 0;
+}
 
-	if (!fork())
-		return execlp("openssl", "openssl", "ca", "-cert", caCertPath,
-			      "-keyfile", caKeyPath, "-passin", pass_arg,
-			      "-in", path_csr, "-out", path_cert, "-batch",
-			      "-subj", subj_arg, "-name", openssl_ca_section,
-			      NULL);
+/**
+ * Reload requirements, HMAC keys and CA
+ * @param[in] reqPath		Path of requirements (NULL if not used)
+ * @param[in] keysPath		Path of HMAC keys (NULL if not used)
+ * @param[in] caKeyPath	CA private key path
+ * @param[in] caKeyPassword	CA private key password
+ * @param[in] caCertPath	CA certificate path
+ * @param[in] openssl_ca_section	openssl CA section to use
+ * @param[in] reload_plugins	load plugins again with the requirements
+ *
+ * The current requirements, HMAC keys and CA are replaced only if all the
+ * new ones can be loaded. With reload_plugins, the current requirements
+ * are released before the plugins they refer to, and are not restored if
+ * the new ones cannot be loaded; the configuration should be checked
+ * first, e.g. by a child process. reload_plugins must be set only when no
+ * request is being processed.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_reload(char *reqPath, char *keysPath, char *caKeyPath,
+			 char *caKeyPassword, char *caCertPath,
+			 char *openssl_ca_section, int reload_plugins)
+{
+	struct hmac_keyring *k = NULL, *old_k = NULL;
+	struct reqs_template *t = NULL, *old_t = NULL;
+	struct enroll_ca *ca = NULL, *old_ca;
+	int rc;
 
-	wait(&status);
+	if (keysPath) {
+		rc = attest_enroll_hmac_keys_new(keysPath, &k);
+		if (rc < 0)
+			return rc;
+	}
 
-	if (status){
-		rc = -EINVAL;
+	rc = attest_enroll_ca_new(caKeyPath, caKeyPassword, caCertPath,
+				  openssl_ca_section, &ca);
+	if (rc < 0)
 		goto out;
+
+	if (reqPath && reload_plugins) {
+		attest_enroll_unload_reqs();
+		attest_ctx_plugin_cleanup();
+	}
+
+	if (reqPath) {
+		t = attest_enroll_reqs_new(reqPath);
+		if (!t) {
+			rc = -EINVAL;
+			goto out;
+		}
+
+		pthread_mutex_lock(&reqs_lock);
+		old_t = reqs_current;
+		reqs_current = t;
+		pthread_mutex_unlock(&reqs_lock);
+	}
+
+	if (k) {
+		pthread_mutex_lock(&hmac_keys_lock);
+		old_k = hmac_keys_current;
+		hmac_keys_current = k;
+		pthread_mutex_unlock(&hmac_keys_lock);
 	}
 
-	rc = attest_util_read_seq_file(path_cert, &len, (uint8_t **)cert_str);
+	pthread_mutex_lock(&ca_lock);
+	old_ca = ca_current;
+	ca_current = ca;
+	pthread_mutex_unlock(&ca_lock);
+
+	attest_enroll_reqs_put(old_t);
+	k = old_k;
+	ca = old_ca;
 out:
-	unlink(path_cert);
-	unlink(path_csr);
+	attest_enroll_hmac_keys_put(k);
+	attest_enroll_ca_put(ca);
+	return rc;
+}
 
-	attest_ctx_data_cleanup(d_ctx_in);
+/**
+ * Sign a CSR
+ * @param[in] caKeyPath	CA private key path
+ * @param[in] caKeyPassword	CA private key password
+ * @param[in] caCertPath	CA certificate path
+ * @param[in] openssl_ca_section	openssl CA section to use
+ * @param[in] csr_str	CSR to sign
+ * @param[in,out] cert_str	Signed certificate
+ *
+ * The CA is loaded at the first call, if attest_enroll_load_ca() was not
+ * called before.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_sign_csr(char *caKeyPath, char *caKeyPassword,
+			   char *caCertPath, char *openssl_ca_section,
+			   char *csr_str, char **cert_str)
+{
+	struct enroll_ca *ca;
+	X509_REQ *req = NULL;
+	X509 *cert = NULL;
+	BIO *bio = NULL;
+	char *data;
+	long len;
+	int rc;
+
+	rc = attest_enroll_load_ca(caKeyPath, caKeyPassword, caCertPath,
+				   openssl_ca_section);
+	if (rc < 0)
+		return rc;
+
+	/* the CA can be replaced by attest_enroll_reload_ca() meanwhile */
+	pthread_mutex_lock(&ca_lock);
+	ca = ca_current;
+	ca->refcount++;
+	pthread_mutex_unlock(&ca_lock);
+
+	rc = -ENOMEM;
+
+	bio = BIO_new_mem_buf(csr_str, -1);
+	if (!bio)
+		goto out;
+
+	req = PEM_read_bio_X509_REQ(bio, NULL, NULL, NULL);
+	BIO_free(bio);
+	bio = NULL;
+
+	rc = -EINVAL;
+
+	if (!req)
+		goto out;
+
+	rc = attest_enroll_ca_sign(ca, req, &cert);
+	if (rc < 0)
+		goto out;
+
+	rc = -ENOMEM;
+
+	bio = BIO_new(BIO_s_mem());
+	if (!bio)
+		goto out;
+
+	if (PEM_write_bio_X509(bio, cert) != 1)
+		goto out;
+
+	len = BIO_get_mem_data(bio, &data);
 
+	*cert_str = malloc(len + 1);
+	if (!*cert_str)
+		goto out;
+
+	memcpy(*cert_str, data, len);
+	(*cert_str)[len] = '\0';
+	rc = 0;
+out:
+	BIO_free(bio);
+	X509_free(cert);
+	X509_REQ_free(req);
+	attest_enroll_ca_put(ca);
 	return rc;
 }
 
@@ -607,6 +1662,64 @@ out:
  *  @{
  */
 
+/* logs are written in a buffer of the thread, reused for every request */
+struct logs_buf {
+	char *buf;
+	size_t size;
+};
+
+static pthread_once_t logs_buf_once = PTHREAD_ONCE_INIT;
+static pthread_key_t logs_buf_key;
+
+static void attest_enroll_logs_buf_free(void *arg)
+{
+	struct logs_buf *b = (struct logs_buf *)arg;
+
+	free(b->buf);
+	free(b);
+}
+
+static void attest_enroll_logs_buf_init(void)
+{
+	pthread_key_create(&logs_buf_key, attest_enroll_logs_buf_free);
+}
+
+static void attest_enroll_print_logs(attest_ctx_verifier *v_ctx, int rc)
+{
+	struct logs_buf *b;
+
+	if (!rc && log_errors_only)
+		return;
+
+	pthread_once(&logs_buf_once, attest_enroll_logs_buf_init);
+
+	b = pthread_getspecific(logs_buf_key);
+	if (!b) {
+		b = calloc(1, sizeof(*b));
+		if (!b)
+			return;
+
+		if (pthread_setspecific(logs_buf_key, b)) {
+			free(b);
+			return;
+		}
+	}
+
+	if (!attest_ctx_verifier_result_write_json(v_ctx, &b->buf, &b->size))
+		printf("%s\n", b->buf);
+}
+
+/**
+ * Print verification logs only for failed requests
+ *
+ * Requirements and logs of successful requests are not printed. Must be
+ * called before the threads processing requests are created.
+ */
+void attest_enroll_log_errors_only(void)
+{
+	log_errors_only = 1;
+}
+
 /**
  * Make a credential blob message
  * @param[in] hmac_key		HMAC key to correlate client requests
@@ -629,16 +1742,15 @@ int attest_enroll_msg_make_credential(uint8_t *hmac_key, int hmac_key_len,
 #ifdef DEBUG
 	char *message_in_stripped, *message_out_stripped;
 #endif
-	char *logs;
 	int rc;
 
-	attest_ctx_data_init(&d_ctx_in);
-	attest_ctx_data_init(&d_ctx_out);
+	attest_ctx_data_init_flags(&d_ctx_in,
+				   CTX_IN_MEMORY | CTX_RESTRICT_URI);
+	attest_ctx_data_init_flags(&d_ctx_out, CTX_IN_MEMORY);
 	attest_ctx_verifier_init(&v_ctx);
 	attest_ctx_verifier_set_key(v_ctx, hmac_key_len, hmac_key);
 
-	rc = attest_ctx_data_add_json_data(d_ctx_in, message_in,
-					   strlen(message_in));
+	rc = attest_ctx_data_add_msg(d_ctx_in, message_in);
 	if (rc < 0)
 		goto out;
 #ifdef DEBUG
@@ -648,14 +1760,14 @@ int attest_enroll_msg_make_credential(uint8_t *hmac_key, int hmac_key_len,
 #endif
 	rc = attest_enroll_make_credential(d_ctx_in, d_ctx_out, v_ctx);
 
-	logs = attest_ctx_verifier_result_print_json(v_ctx);
-	printf("%s\n", logs);
-	free(logs);
+	attest_enroll_print_logs(v_ctx, rc);
 
 	if (rc < 0)
 		goto out;
 
-	rc = attest_ctx_data_print_json(d_ctx_out, message_out);
+	rc = attest_ctx_data_print_msg(d_ctx_out,
+				attest_ctx_msg_get_format(message_in),
+				message_out);
 	if (rc)
 		goto out;
 #ifdef DEBUG
@@ -696,16 +1808,15 @@ int attest_enroll_msg_make_cert(uint8_t *hmac_key, int hmac_key_len,
 #ifdef DEBUG
 	char *message_in_stripped, *message_out_stripped;
 #endif
-	char *logs;
 	int rc;
 
-	attest_ctx_data_init(&d_ctx_in);
-	attest_ctx_data_init(&d_ctx_out);
+	attest_ctx_data_init_flags(&d_ctx_in,
+				   CTX_IN_MEMORY | CTX_RESTRICT_URI);
+	attest_ctx_data_init_flags(&d_ctx_out, CTX_IN_MEMORY);
 	attest_ctx_verifier_init(&v_ctx);
 	attest_ctx_verifier_set_key(v_ctx, hmac_key_len, hmac_key);
 
-	rc = attest_ctx_data_add_json_data(d_ctx_in, message_in,
-					   strlen(message_in));
+	rc = attest_ctx_data_add_msg(d_ctx_in, message_in);
 	if (rc < 0)
 		goto out;
 #ifdef DEBUG
@@ -720,14 +1831,14 @@ int attest_enroll_msg_make_cert(uint8_t *hmac_key, int hmac_key_len,
 	if (rc < 0)
 		goto out;
 
-	logs = attest_ctx_verifier_result_print_json(v_ctx);
-	printf("%s\n", logs);
-	free(logs);
+	attest_enroll_print_logs(v_ctx, rc);
 
 	if (rc < 0)
 		goto out;
 
-	rc = attest_ctx_data_print_json(d_ctx_out, message_out);
+	rc = attest_ctx_data_print_msg(d_ctx_out,
+				attest_ctx_msg_get_format(message_in),
+				message_out);
 	if (rc)
 		goto out;
 #ifdef DEBUG
@@ -759,19 +1870,26 @@ int attest_enroll_msg_process_csr(int pcr_mask_len, uint8_t *pcr_mask,
 {
 	attest_ctx_data *d_ctx_in = NULL;
 	attest_ctx_verifier *v_ctx = NULL;
+	struct reqs_template *t;
 #ifdef DEBUG
 	char *message_in_stripped;
 #endif
-	char *logs;
 	int rc;
 
-	attest_ctx_data_init(&d_ctx_in);
+	attest_ctx_data_init_flags(&d_ctx_in,
+				   CTX_IN_MEMORY | CTX_RESTRICT_URI);
 	attest_ctx_verifier_init(&v_ctx);
 	attest_ctx_verifier_set_pcr_mask(v_ctx, pcr_mask_len, pcr_mask);
 	attest_ctx_verifier_set_flags(v_ctx, verifier_flags);
 
-	rc = attest_ctx_data_add_json_data(d_ctx_in, message_in,
-					   strlen(message_in));
+	t = attest_enroll_reqs_get(reqPath);
+	if (t) {
+		rc = attest_ctx_verifier_req_copy(v_ctx, t->v_ctx);
+		if (rc < 0)
+			goto out;
+	}
+
+	rc = attest_ctx_data_add_msg(d_ctx_in, message_in);
 	if (rc < 0)
 		goto out;
 #ifdef DEBUG
@@ -781,12 +1899,11 @@ int attest_enroll_msg_process_csr(int pcr_mask_len, uint8_t *pcr_mask,
 #endif
 	rc = attest_enroll_process_csr(d_ctx_in, v_ctx, reqPath, csr_str);
 
-	logs = attest_ctx_verifier_result_print_json(v_ctx);
-	printf("%s\n", logs);
-	free(logs);
+	attest_enroll_print_logs(v_ctx, rc);
 out:
 	attest_ctx_data_cleanup(d_ctx_in);
 	attest_ctx_verifier_cleanup(v_ctx);
+	attest_enroll_reqs_put(t);
 	return rc;
 }
 
@@ -808,7 +1925,7 @@ int attest_enroll_msg_return_cert(char *cert_str, char *ca_cert_str,
 #endif
 	int rc;
 
-	attest_ctx_data_init(&d_ctx_out);
+	attest_ctx_data_init_flags(&d_ctx_out, CTX_IN_MEMORY);
 
 	rc = attest_ctx_data_add_copy(d_ctx_out, CTX_KEY_CERT, strlen(cert_str),
 				      (uint8_t*)cert_str, NULL);
@@ -831,40 +1948,201 @@ out:
 	return rc;
 }
 
-/**
- * Generate a quote nonce response
- * @param[in] hmac_key_len	HMAC key length
- * @param[in] hmac_key		HMAC key to correlate client requests
- * @param[in,out] message_out	Message containing quote nonce response
- *
- * @returns 0 on success, a negative value on error
- */
-int attest_enroll_msg_gen_quote_nonce(int hmac_key_len, uint8_t *hmac_key,
-				      char *message_in, char **message_out)
+/* aux data verified by digest, shared by all clients */
+struct aux_store_entry {
+	struct list_head list;
+	struct list_head hash_list;
+	char algo[AUX_STORE_ALGO_LEN];
+	int digest_len;
+	uint8_t digest[EVP_MAX_MD_SIZE];
+	size_t len;
+	unsigned char *data;
+};
+
+static pthread_mutex_t aux_store_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head aux_store_hash[AUX_STORE_HASH_SIZE];
+static LIST_HEAD(aux_store_list);
+static int aux_store_hash_init;
+static size_t aux_store_size;
+
+static struct aux_store_entry *attest_enroll_aux_store_lookup(
+			const char *algo, int digest_len, const uint8_t *digest)
 {
-#ifdef DEBUG
-	char *message_in_stripped;
-	char *message_out_stripped;
-#endif
+	struct aux_store_entry *entry;
+	unsigned int hash;
+	int i;
+
+	if (!aux_store_hash_init) {
+		for (i = 0; i < AUX_STORE_HASH_SIZE; i++)
+			INIT_LIST_HEAD(&aux_store_hash[i]);
+
+		aux_store_hash_init = 1;
+	}
+
+	hash = (digest[0] | (digest[1] << 8)) % AUX_STORE_HASH_SIZE;
+
+	list_for_each_entry(entry, &aux_store_hash[hash], hash_list) {
+		if (entry->digest_len == digest_len &&
+		    !memcmp(entry->digest, digest, digest_len) &&
+		    !strcmp(entry->algo, algo))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static int attest_enroll_aux_store_get(const char *algo, int digest_len,
+				       const uint8_t *digest, size_t *len,
+				       unsigned char **data)
+{
+	struct aux_store_entry *entry;
+	int rc = 0;
+
+	pthread_mutex_lock(&aux_store_lock);
+	entry = attest_enroll_aux_store_lookup(algo, digest_len, digest);
+	if (!entry) {
+		rc = -ENOENT;
+		goto out;
+	}
+
+	*data = malloc(entry->len);
+	if (!*data) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(*data, entry->data, entry->len);
+	*len = entry->len;
+
+	list_move_tail(&entry->list, &aux_store_list);
+out:
+	pthread_mutex_unlock(&aux_store_lock);
+	return rc;
+}
+
+static void attest_enroll_aux_store_put(const char *algo, int digest_len,
+					const uint8_t *digest, size_t len,
+					const unsigned char *data)
+{
+	struct aux_store_entry *entry;
+	unsigned int hash;
+
+	if (strlen(algo) >= AUX_STORE_ALGO_LEN || digest_len > EVP_MAX_MD_SIZE ||
+	    len > AUX_STORE_MAX_SIZE / 16)
+		return;
+
+	pthread_mutex_lock(&aux_store_lock);
+	entry = attest_enroll_aux_store_lookup(algo, digest_len, digest);
+	if (entry) {
+		list_move_tail(&entry->list, &aux_store_list);
+		goto out;
+	}
+
+	/* evict least recently used data */
+	while (aux_store_size + len > AUX_STORE_MAX_SIZE) {
+		entry = list_first_entry(&aux_store_list,
+					 struct aux_store_entry, list);
+		list_del(&entry->list);
+		list_del(&entry->hash_list);
+		aux_store_size -= entry->len;
+		free(entry->data);
+		free(entry);
+	}
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		goto out;
+
+	entry->data = malloc(len);
+	if (!entry->data) {
+		free(entry);
+		goto out;
+	}
+
+	strcpy(entry->algo, algo);
+	entry->digest_len = digest_len;
+	memcpy(entry->digest, digest, digest_len);
+	entry->len = len;
+	memcpy(entry->data, data, len);
+
+	hash = (digest[0] | (digest[1] << 8)) % AUX_STORE_HASH_SIZE;
+
+	list_add_tail(&entry->list, &aux_store_list);
+	list_add(&entry->hash_list, &aux_store_hash[hash]);
+	aux_store_size += len;
+out:
+	pthread_mutex_unlock(&aux_store_lock);
+}
+
+/*
+ * Check if aux data identified by \<algo\>:\<hex digest\> is already in the
+ * store.
+ */
+static int attest_enroll_aux_store_has(struct data_item *item)
+{
+	char algo[AUX_STORE_ALGO_LEN], *sep;
+	uint8_t digest[EVP_MAX_MD_SIZE];
+	int digest_len, found;
+
+	sep = memchr(item->data, ':', item->len);
+	if (!sep || sep - (char *)item->data >= sizeof(algo))
+		return 0;
+
+	digest_len = (item->len - (sep + 1 - (char *)item->data)) / 2;
+	if (digest_len < SHA_DIGEST_LENGTH || digest_len > sizeof(digest))
+		return 0;
+
+	memcpy(algo, item->data, sep - (char *)item->data);
+	algo[sep - (char *)item->data] = '\0';
+
+	if (_hex2bin(digest, sep + 1, digest_len))
+		return 0;
+
+	pthread_mutex_lock(&aux_store_lock);
+	found = !!attest_enroll_aux_store_lookup(algo, digest_len, digest);
+	pthread_mutex_unlock(&aux_store_lock);
+
+	return found;
+}
+
+/**
+ * Generate a quote nonce response
+ * @param[in] hmac_key_len	HMAC key length
+ * @param[in] hmac_key		HMAC key to correlate client requests
+ * @param[in] message_in	Message containing quote nonce request
+ * @param[in,out] message_out	Message containing quote nonce response
+ *
+ * The response includes the digests of aux data, among those sent by the
+ * client, not found in the store. Only that aux data must be sent with the
+ * quote. The response is in the same format (JSON or TLV) of the request.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_msg_gen_quote_nonce(int hmac_key_len, uint8_t *hmac_key,
+				      char *message_in, char **message_out)
+{
+#ifdef DEBUG
+	char *message_in_stripped;
+	char *message_out_stripped;
+#endif
 	attest_ctx_data *d_ctx_in, *d_ctx_out;
 	attest_ctx_verifier *v_ctx;
 	struct verification_log *log;
-	uint8_t nonce[NONCE_LEN], hmac[EVP_MAX_MD_SIZE];
-	unsigned int hmac_len = sizeof(hmac);
-	struct data_item *ak_cert;
-	char *logs;
+	uint8_t nonce[NONCE_LEN];
+	uint64_t issued;
+	struct data_item *ak_cert, *item;
 	int rc;
 
-	attest_ctx_data_init(&d_ctx_in);
-	attest_ctx_data_init(&d_ctx_out);
+	attest_ctx_data_init_flags(&d_ctx_in,
+				   CTX_IN_MEMORY | CTX_RESTRICT_URI);
+	attest_ctx_data_init_flags(&d_ctx_out, CTX_IN_MEMORY);
 	attest_ctx_verifier_init(&v_ctx);
 	attest_ctx_verifier_set_key(v_ctx, hmac_key_len, hmac_key);
 
 	log = attest_ctx_verifier_add_log(v_ctx, "generate quote nonce");
 
-	rc = attest_ctx_data_add_json_data(d_ctx_in, message_in,
-					   strlen(message_in));
-	check_goto(rc, rc, out, v_ctx, "attest_ctx_data_add_json_data() error");
+	rc = attest_ctx_data_add_msg(d_ctx_in, message_in);
+	check_goto(rc, rc, out, v_ctx, "attest_ctx_data_add_msg() error");
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx_in, &message_in_stripped);
 	printf("<- %s\n", message_in_stripped);
@@ -874,19 +2152,29 @@ int attest_enroll_msg_gen_quote_nonce(int hmac_key_len, uint8_t *hmac_key,
 	check_goto(!ak_cert, -ENOENT, out, v_ctx,
 		   "AK certificate not provided");
 
-	rc = RAND_bytes(nonce, sizeof(nonce));
+	/* the issue time lets any server instance reject expired nonces */
+	issued = htobe64(time(NULL));
+	memcpy(nonce, &issued, NONCE_TIME_LEN);
+
+	rc = RAND_bytes(nonce + NONCE_TIME_LEN, sizeof(nonce) - NONCE_TIME_LEN);
 	check_goto(!rc, -EIO, out, v_ctx, "RAND_bytes() error");
 
 	rc = attest_ctx_data_add_copy(d_ctx_out, CTX_NONCE, sizeof(nonce),
 				      nonce, NULL);
 	check_goto(rc, rc, out, v_ctx, "attest_ctx_data_add() error");
 
-	rc = attest_enroll_hmac(v_ctx, ak_cert->len, ak_cert->data,
-				sizeof(nonce), nonce, &hmac_len, hmac);
-	check_goto(rc, rc, out, v_ctx, "attest_enroll_hmac() error");
+	rc = attest_enroll_add_hmac(d_ctx_out, v_ctx, ak_cert, sizeof(nonce),
+				    nonce, CTX_NONCE_HMAC);
+	check_goto(rc, rc, out, v_ctx, "attest_enroll_add_hmac() error");
 
-	rc = attest_ctx_data_add_copy(d_ctx_out, CTX_NONCE_HMAC, hmac_len,
-				      hmac, NULL);
+	list_for_each_entry(item, &d_ctx_in->ctx_data[CTX_AUX_DIGEST], list) {
+		if (attest_enroll_aux_store_has(item))
+			continue;
+
+		rc = attest_ctx_data_add_copy(d_ctx_out, CTX_AUX_DIGEST,
+					      item->len, item->data, NULL);
+		check_goto(rc, rc, out, v_ctx, "attest_ctx_data_add() error");
+	}
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx_out, &message_out_stripped);
 	printf("<- %s\n", message_out_stripped);
@@ -895,13 +2183,13 @@ int attest_enroll_msg_gen_quote_nonce(int hmac_key_len, uint8_t *hmac_key,
 	if (rc < 0)
 		goto out;
 
-	rc = attest_ctx_data_print_json(d_ctx_out, message_out);
+	rc = attest_ctx_data_print_msg(d_ctx_out,
+				attest_ctx_msg_get_format(message_in),
+				message_out);
 out:
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 
-	logs = attest_ctx_verifier_result_print_json(v_ctx);
-	printf("%s\n", logs);
-	free(logs);
+	attest_enroll_print_logs(v_ctx, rc);
 
 	attest_ctx_data_cleanup(d_ctx_in);
 	attest_ctx_data_cleanup(d_ctx_out);
@@ -909,23 +2197,234 @@ out:
 	return rc;
 }
 
-/**
- * Process a quote message
- * @param[in] hmac_key_len	HMAC key length
- * @param[in] hmac_key		HMAC key to correlate client requests
- * @param[in] pcr_mask_len	Length of required PCR mask
- * @param[in] pcr_mask		Mask of PCR to check
- * @param[in] reqPath		Path of requirements for TPM key policy check
- * @param[in] verifier_flags	verifier flags
- * @param[in] message_in	input message
- * @param[in,out] message_out	output message
- *
- * @returns 0 on success, a negative value on error
+/* checkpoints of verified event logs, by AK certificate and requirements */
+struct checkpoint_entry {
+	struct list_head list;
+	struct list_head hash_list;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	struct event_log_checkpoint *checkpoint;
+};
+
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head checkpoint_hash[CHECKPOINT_HASH_SIZE];
+static LIST_HEAD(checkpoint_list);
+static int checkpoint_hash_init;
+static int checkpoint_num;
+
+static int attest_enroll_checkpoint_key(struct data_item *ak_cert,
+					char *reqs, uint8_t *key)
+{
+	EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+	int rc = -EINVAL;
+
+	if (!mdctx)
+		return -ENOMEM;
+
+	if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1)
+		goto out;
+
+	if (EVP_DigestUpdate(mdctx, ak_cert->data, ak_cert->len) != 1)
+		goto out;
+
+	if (EVP_DigestUpdate(mdctx, reqs, strlen(reqs)) != 1)
+		goto out;
+
+	if (EVP_DigestFinal_ex(mdctx, key, NULL) != 1)
+		goto out;
+
+	rc = 0;
+out:
+	EVP_MD_CTX_destroy(mdctx);
+	return rc;
+}
+
+static struct checkpoint_entry *attest_enroll_checkpoint_lookup(uint8_t *key)
+{
+	struct checkpoint_entry *entry;
+	int i;
+
+	if (!checkpoint_hash_init) {
+		for (i = 0; i < CHECKPOINT_HASH_SIZE; i++)
+			INIT_LIST_HEAD(&checkpoint_hash[i]);
+
+		checkpoint_hash_init = 1;
+	}
+
+	list_for_each_entry(entry, &checkpoint_hash[key[0]], hash_list) {
+		if (!memcmp(entry->key, key, SHA256_DIGEST_LENGTH))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static struct event_log_checkpoint *attest_enroll_checkpoint_get(uint8_t *key)
+{
+	struct event_log_checkpoint *checkpoint = NULL;
+	struct checkpoint_entry *entry;
+
+	pthread_mutex_lock(&checkpoint_lock);
+	entry = attest_enroll_checkpoint_lookup(key);
+	if (entry)
+		checkpoint = attest_event_log_checkpoint_dup(entry->checkpoint);
+	pthread_mutex_unlock(&checkpoint_lock);
+
+	return checkpoint;
+}
+
+static int attest_enroll_checkpoint_put(uint8_t *key,
+					struct event_log_checkpoint *checkpoint)
+{
+	struct checkpoint_entry *entry;
+	int rc = 0;
+
+	pthread_mutex_lock(&checkpoint_lock);
+	entry = attest_enroll_checkpoint_lookup(key);
+	if (entry) {
+		attest_event_log_checkpoint_free(entry->checkpoint);
+		entry->checkpoint = checkpoint;
+		goto out;
+	}
+
+	if (checkpoint_num == CHECKPOINT_MAX_ENTRIES) {
+		entry = list_first_entry(&checkpoint_list,
+					 struct checkpoint_entry, list);
+		list_del(&entry->list);
+		list_del(&entry->hash_list);
+		attest_event_log_checkpoint_free(entry->checkpoint);
+		checkpoint_num--;
+	} else {
+		entry = malloc(sizeof(*entry));
+		if (!entry) {
+			attest_event_log_checkpoint_free(checkpoint);
+			rc = -ENOMEM;
+			goto out;
+		}
+	}
+
+	memcpy(entry->key, key, SHA256_DIGEST_LENGTH);
+	entry->checkpoint = checkpoint;
+	list_add_tail(&entry->list, &checkpoint_list);
+	list_add(&entry->hash_list, &checkpoint_hash[key[0]]);
+	checkpoint_num++;
+out:
+	pthread_mutex_unlock(&checkpoint_lock);
+	return rc;
+}
+
+/* nonces of verified quotes, rejected if received again before expiring */
+struct nonce_entry {
+	struct list_head list;
+	struct list_head hash_list;
+	uint8_t nonce[NONCE_LEN];
+	time_t issued;
+};
+
+static pthread_mutex_t nonce_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head nonce_cache_hash[NONCE_CACHE_HASH_SIZE];
+static LIST_HEAD(nonce_cache_list);
+static int nonce_cache_hash_init;
+static int nonce_cache_num;
+
+static void attest_enroll_nonce_del(struct nonce_entry *entry)
+{
+	list_del(&entry->list);
+	list_del(&entry->hash_list);
+	free(entry);
+	nonce_cache_num--;
+}
+
+/*
+ * Nonces are checked before the quote is verified, and recorded only after
+ * verification succeeds. If the cache is full of unexpired nonces, new ones
+ * are rejected until some expire.
  */
-int attest_enroll_msg_process_quote(int hmac_key_len, uint8_t *hmac_key,
-				    int pcr_mask_len, uint8_t *pcr_mask,
-				    char *reqPath, uint16_t verifier_flags,
-				    char *message_in, char **message_out)
+static int attest_enroll_nonce_check(struct data_item *nonce, int record)
+{
+	struct nonce_entry *entry, *temp_entry;
+	struct list_head *head;
+	time_t now = time(NULL);
+	uint64_t issued;
+	uint32_t hash;
+	int rc = 0, i;
+
+	if (nonce->len != NONCE_LEN)
+		return -EINVAL;
+
+	memcpy(&issued, nonce->data, NONCE_TIME_LEN);
+	issued = be64toh(issued);
+
+	/* server instances could have slightly different clocks */
+	if (issued > now + NONCE_MAX_CLOCK_SKEW ||
+	    now - (time_t)issued > NONCE_TIMEOUT)
+		return -ETIMEDOUT;
+
+	memcpy(&hash, nonce->data + NONCE_TIME_LEN, sizeof(hash));
+	hash %= NONCE_CACHE_HASH_SIZE;
+
+	pthread_mutex_lock(&nonce_cache_lock);
+	if (!nonce_cache_hash_init) {
+		for (i = 0; i < NONCE_CACHE_HASH_SIZE; i++)
+			INIT_LIST_HEAD(&nonce_cache_hash[i]);
+
+		nonce_cache_hash_init = 1;
+	}
+
+	/* expired nonces are rejected without looking at the cache */
+	list_for_each_entry_safe(entry, temp_entry, &nonce_cache_list, list) {
+		if (now - entry->issued <= NONCE_TIMEOUT)
+			break;
+
+		attest_enroll_nonce_del(entry);
+	}
+
+	/* nonces are not recorded in issue order */
+	if (nonce_cache_num == NONCE_CACHE_MAX_ENTRIES) {
+		list_for_each_entry_safe(entry, temp_entry, &nonce_cache_list,
+					 list) {
+			if (now - entry->issued > NONCE_TIMEOUT)
+				attest_enroll_nonce_del(entry);
+		}
+	}
+
+	head = &nonce_cache_hash[hash];
+
+	list_for_each_entry(entry, head, hash_list) {
+		if (!memcmp(entry->nonce, nonce->data, NONCE_LEN)) {
+			rc = -EALREADY;
+			goto out;
+		}
+	}
+
+	if (!record)
+		goto out;
+
+	if (nonce_cache_num == NONCE_CACHE_MAX_ENTRIES) {
+		rc = -EBUSY;
+		goto out;
+	}
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(entry->nonce, nonce->data, NONCE_LEN);
+	entry->issued = issued;
+	list_add_tail(&entry->list, &nonce_cache_list);
+	list_add_tail(&entry->hash_list, head);
+	nonce_cache_num++;
+out:
+	pthread_mutex_unlock(&nonce_cache_lock);
+	return rc;
+}
+
+/* checkpoints are used only if CTX_CHECKPOINT is set in verifier_flags */
+static int attest_enroll_process_quote_common(int hmac_key_len,
+			uint8_t *hmac_key, int pcr_mask_len, uint8_t *pcr_mask,
+			struct reqs_template *t, uint16_t verifier_flags,
+			char *message_in, char **message_out, char **logs_out)
 {
 	attest_ctx_data *d_ctx = NULL;
 	attest_ctx_verifier *v_ctx = NULL;
@@ -934,21 +2433,23 @@ int attest_enroll_msg_process_quote(int hmac_key_len, uint8_t *hmac_key,
 #ifdef DEBUG
 	char *message_in_stripped;
 #endif
-	char *logs, *reqs;
-	int rc;
+	uint8_t checkpoint_key[SHA256_DIGEST_LENGTH];
+	int rc, replay = 0;
 
-	attest_ctx_data_init(&d_ctx);
+	attest_ctx_data_init_flags(&d_ctx, CTX_IN_MEMORY | CTX_RESTRICT_URI);
+	attest_ctx_data_set_store(d_ctx, attest_enroll_aux_store_get,
+				  attest_enroll_aux_store_put);
 	attest_ctx_verifier_init(&v_ctx);
 	attest_ctx_verifier_set_pcr_mask(v_ctx, pcr_mask_len, pcr_mask);
 	attest_ctx_verifier_set_key(v_ctx, hmac_key_len, hmac_key);
 	attest_ctx_verifier_set_flags(v_ctx, verifier_flags);
+	/* requests are processed in parallel by the caller */
+	attest_ctx_verifier_set_num_threads(v_ctx, 1);
 
 	log = attest_ctx_verifier_add_log(v_ctx, "verify quote");
 
-	rc = attest_ctx_data_add_json_data(d_ctx, message_in,
-					   strlen(message_in));
-	check_goto(rc, rc, out, v_ctx,
-		   "attest_ctx_data_add_json_data() error");
+	rc = attest_ctx_data_add_msg(d_ctx, message_in);
+	check_goto(rc, rc, out, v_ctx, "attest_ctx_data_add_msg() error");
 #ifdef DEBUG
 	attest_ctx_data_print_json_no_value(d_ctx, &message_in_stripped);
 	printf("<- %s\n", message_in_stripped);
@@ -961,19 +2462,41 @@ int attest_enroll_msg_process_quote(int hmac_key_len, uint8_t *hmac_key,
 	nonce = attest_ctx_data_get(d_ctx, CTX_NONCE);
 	check_goto(!nonce, -ENOENT, out, v_ctx, "Nonce not provided");
 
-	rc = attest_enroll_verify_hmac(d_ctx, v_ctx, nonce, ak_cert,
-				       CTX_NONCE_HMAC);
-	check_goto(rc, rc, out, v_ctx,
-		   "attest_enroll_verify_hmac() error: %d", rc);
+	/* archived quotes are verified without the keys of the server */
+	if (!(verifier_flags & CTX_SKIP_NONCE_HMAC)) {
+		rc = attest_enroll_verify_hmac(d_ctx, v_ctx, nonce, ak_cert,
+					       CTX_NONCE_HMAC, &replay);
+		check_goto(rc, rc, out, v_ctx,
+			   "attest_enroll_verify_hmac() error: %d", rc);
+	}
 
-	rc = attest_ctx_verifier_req_add_json_file(v_ctx, reqPath);
-	check_goto(rc, rc, out, v_ctx,
+	/* only nonces of the replay keys can be reused by load tests */
+	if (!(verifier_flags & CTX_ALLOW_NONCE_REUSE) && !replay) {
+		rc = attest_enroll_nonce_check(nonce, 0);
+		check_goto(rc, rc, out, v_ctx, "nonce %s", rc == -EALREADY ?
+			   "already used" : "expired or invalid");
+	}
+
+	check_goto(!t, -ENOENT, out, v_ctx,
 		   "verifier's requirements not provided\n");
 
-	printf("Processing quote with the following requirements:\n");
-	reqs = attest_ctx_verifier_req_print_json(v_ctx);
-	printf("%s\n", reqs);
-	free(reqs);
+	rc = attest_ctx_verifier_req_copy(v_ctx, t->v_ctx);
+	check_goto(rc, rc, out, v_ctx, "cannot copy verifier's requirements");
+
+	if (!logs_out && !log_errors_only) {
+		printf("Processing quote with the following requirements:\n");
+		printf("%s\n", t->reqs);
+	}
+
+	if (verifier_flags & CTX_CHECKPOINT) {
+		rc = attest_enroll_checkpoint_key(ak_cert, t->reqs,
+						  checkpoint_key);
+		check_goto(rc, rc, out, v_ctx,
+			   "cannot calculate checkpoint key");
+
+		v_ctx->checkpoint =
+			attest_enroll_checkpoint_get(checkpoint_key);
+	}
 
 	tpms_attest = attest_ctx_data_get(d_ctx, CTX_TPMS_ATTEST);
 	check_goto(!tpms_attest, -ENOENT, out, v_ctx,
@@ -991,6 +2514,22 @@ int attest_enroll_msg_process_quote(int hmac_key_len, uint8_t *hmac_key,
 	check_goto(rc, rc, out, v_ctx,
 		   "attest_verifier_check_tpms_attest() error");
 
+	if (v_ctx->new_checkpoint) {
+		rc = attest_enroll_checkpoint_put(checkpoint_key,
+						  v_ctx->new_checkpoint);
+		v_ctx->new_checkpoint = NULL;
+		check_goto(rc, rc, out, v_ctx, "cannot save checkpoint");
+	}
+
+	/* the same nonce could have been verified concurrently */
+	if (!(verifier_flags & CTX_ALLOW_NONCE_REUSE) && !replay) {
+		rc = attest_enroll_nonce_check(nonce, 1);
+		check_goto(rc, rc, out, v_ctx, "nonce %s",
+			   rc == -EALREADY ? "already used" :
+			   rc == -EBUSY ? "not recorded, too many in use" :
+			   "expired or invalid");
+	}
+
 	*message_out = calloc(1, sizeof(char));
 	if (!*message_out)
 		rc = -ENOMEM;
@@ -998,13 +2537,334 @@ int attest_enroll_msg_process_quote(int hmac_key_len, uint8_t *hmac_key,
 out:
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 
-	logs = attest_ctx_verifier_result_print_json(v_ctx);
-	printf("%s\n", logs);
-	free(logs);
+	if (logs_out) {
+		/* the caller expects logs, also for failed verifications */
+		*logs_out = attest_ctx_verifier_result_print_json(v_ctx);
+		if (!*logs_out && !rc)
+			rc = -ENOMEM;
+	} else {
+		attest_enroll_print_logs(v_ctx, rc);
+	}
+
+	if (v_ctx)
+		attest_event_log_checkpoint_free(v_ctx->checkpoint);
 
 	attest_ctx_data_cleanup(d_ctx);
 	attest_ctx_verifier_cleanup(v_ctx);
 	return rc;
 }
+/**
+ * Process a quote message
+ * @param[in] hmac_key_len	HMAC key length
+ * @param[in] hmac_key		HMAC key to correlate client requests
+ * @param[in] pcr_mask_len	Length of required PCR mask
+ * @param[in] pcr_mask		Mask of PCR to check
+ * @param[in] reqPath		Path of requirements for TPM key policy check
+ * @param[in] verifier_flags	verifier flags
+ * @param[in] message_in	input message
+ * @param[in,out] message_out	output message
+ *
+ * Event logs successfully verified are saved in a checkpoint, so that
+ * the client can send only new entries in the next quote message. Aux data
+ * found by digest is kept in a store shared by all clients, and is used
+ * when clients do not send it again.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_msg_process_quote(int hmac_key_len, uint8_t *hmac_key,
+				    int pcr_mask_len, uint8_t *pcr_mask,
+				    char *reqPath, uint16_t verifier_flags,
+				    char *message_in, char **message_out)
+{
+	struct reqs_template *t;
+	int rc;
+
+	t = attest_enroll_reqs_get(reqPath);
+	rc = attest_enroll_process_quote_common(hmac_key_len, hmac_key,
+						pcr_mask_len, pcr_mask, t,
+						verifier_flags | CTX_CHECKPOINT,
+						message_in, message_out, NULL);
+	attest_enroll_reqs_put(t);
+	return rc;
+}
+
+/**
+ * Verify an archived quote message
+ * @param[in] hmac_key_len	HMAC key length
+ * @param[in] hmac_key		HMAC key to correlate client requests
+ * @param[in] pcr_mask_len	Length of required PCR mask
+ * @param[in] pcr_mask		Mask of PCR to check
+ * @param[in] reqPath		Path of requirements for TPM key policy check
+ * @param[in] verifier_flags	verifier flags
+ * @param[in] message_in	input message
+ * @param[in,out] logs		verification logs in JSON format
+ *
+ * Same as attest_enroll_msg_process_quote(), but verification logs are
+ * returned instead of printed, so that the caller can report them for
+ * each message. Nonces of archived quotes are usually expired, and
+ * CTX_ALLOW_NONCE_REUSE should be set. CTX_SKIP_NONCE_HMAC must be set if
+ * the HMAC keys of the server that issued the nonces are not available.
+ *
+ * Logs must be freed by the caller, also on error. They are NULL if they
+ * could not be printed, and -ENOMEM is returned if verification succeeded.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_verify_quote(int hmac_key_len, uint8_t *hmac_key,
+			       int pcr_mask_len, uint8_t *pcr_mask,
+			       char *reqPath, uint16_t verifier_flags,
+			       char *message_in, char **logs)
+{
+	struct reqs_template *t;
+	char *message_out = NULL;
+	int rc;
+
+	*logs = NULL;
+
+	verifier_flags &= ~CTX_CHECKPOINT;
+
+	t = attest_enroll_reqs_get(reqPath);
+	rc = attest_enroll_process_quote_common(hmac_key_len, hmac_key,
+						pcr_mask_len, pcr_mask, t,
+						verifier_flags, message_in,
+						&message_out, logs);
+	attest_enroll_reqs_put(t);
+	free(message_out);
+	return rc;
+}
+
+/* quotes of a batch are verified by the caller and by the helper threads */
+struct quote_batch {
+	struct list_head list;
+	int hmac_key_len;
+	uint8_t *hmac_key;
+	int pcr_mask_len;
+	uint8_t *pcr_mask;
+	struct reqs_template *reqs;
+	uint16_t verifier_flags;
+	const char **quotes;
+	int *results;
+	char **logs;
+	int num_quotes;
+	int next;
+	int done;
+	pthread_cond_t completed;
+};
+
+static pthread_mutex_t quote_batches_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(quote_batches);
+static quote_batch_notify_func quote_batch_notify;
+
+/* take the next quote of a batch, the batch is removed when all are taken */
+static int quote_batch_next(struct quote_batch *batch)
+{
+	int i = batch->next++;
+
+	if (batch->next == batch->num_quotes)
+		list_del_init(&batch->list);
+
+	return i;
+}
+
+static void quote_batch_process(struct quote_batch *batch, int i)
+{
+	char *message_out = NULL;
+
+	if (!batch->quotes[i]) {
+		batch->results[i] = -ENOMEM;
+	} else {
+		batch->results[i] = attest_enroll_process_quote_common(
+				batch->hmac_key_len, batch->hmac_key,
+				batch->pcr_mask_len, batch->pcr_mask,
+				batch->reqs, batch->verifier_flags,
+				(char *)batch->quotes[i], &message_out,
+				&batch->logs[i]);
+		free(message_out);
+	}
+
+	pthread_mutex_lock(&quote_batches_lock);
+	if (++batch->done == batch->num_quotes)
+		pthread_cond_signal(&batch->completed);
+	pthread_mutex_unlock(&quote_batches_lock);
+}
+
+/**
+ * Set the function notifying that quotes of a batch can be verified
+ * @param[in] notify	function called when a batch is started
+ *
+ * When attest_enroll_msg_process_quote_batch() is called, notify() is called
+ * so that idle threads of the caller call attest_enroll_quote_batch_help().
+ * Without it, quotes are verified by the thread processing the batch.
+ */
+void attest_enroll_set_quote_batch_notify(quote_batch_notify_func notify)
+{
+	quote_batch_notify = notify;
+}
+
+/**
+ * Verify a quote of a batch being processed by another thread
+ *
+ * @returns 1 if a quote was verified, 0 if there are no quotes to verify
+ */
+int attest_enroll_quote_batch_help(void)
+{
+	struct quote_batch *batch;
+	int i;
+
+	pthread_mutex_lock(&quote_batches_lock);
+	if (list_empty(&quote_batches)) {
+		pthread_mutex_unlock(&quote_batches_lock);
+		return 0;
+	}
+
+	batch = list_first_entry(&quote_batches, struct quote_batch, list);
+	i = quote_batch_next(batch);
+	pthread_mutex_unlock(&quote_batches_lock);
+
+	quote_batch_process(batch, i);
+	return 1;
+}
+
+/**
+ * Process a batch of quote messages
+ * @param[in] hmac_key_len	HMAC key length
+ * @param[in] hmac_key		HMAC key to correlate client requests
+ * @param[in] pcr_mask_len	Length of required PCR mask
+ * @param[in] pcr_mask		Mask of PCR to check
+ * @param[in] reqPath		Path of requirements for TPM key policy check
+ * @param[in] verifier_flags	verifier flags
+ * @param[in] message_in	input message (JSON array of quote messages)
+ * @param[in,out] message_out	output message
+ *
+ * Requirements are shared by the whole batch. Quotes are verified by the
+ * calling thread, and in parallel by the threads of the caller calling
+ * attest_enroll_quote_batch_help() (see
+ * attest_enroll_set_quote_batch_notify()), so that no thread is created.
+ *
+ * The output message is a JSON array with, for each quote in the same
+ * order, an object with the result of attest_enroll_msg_process_quote()
+ * ("result") and the verification logs ("log"). Logs are returned instead
+ * of being printed.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_enroll_msg_process_quote_batch(int hmac_key_len, uint8_t *hmac_key,
+					  int pcr_mask_len, uint8_t *pcr_mask,
+					  char *reqPath,
+					  uint16_t verifier_flags,
+					  char *message_in, char **message_out)
+{
+	struct quote_batch batch = { 0 };
+	json_object *root = NULL, *results = NULL, *result, *log;
+	const char *results_str;
+	int rc = -EINVAL, i;
+
+	INIT_LIST_HEAD(&batch.list);
+	batch.hmac_key_len = hmac_key_len;
+	batch.hmac_key = hmac_key;
+	batch.pcr_mask_len = pcr_mask_len;
+	batch.pcr_mask = pcr_mask;
+	batch.verifier_flags = verifier_flags | CTX_CHECKPOINT;
+	pthread_cond_init(&batch.completed, NULL);
+
+	root = attest_ctx_parse_json_data(message_in, strlen(message_in));
+	if (!root || !json_object_is_type(root, json_type_array))
+		goto out;
+
+	batch.num_quotes = json_object_array_length(root);
+
+	batch.reqs = attest_enroll_reqs_get(reqPath);
+	if (!batch.reqs)
+		goto out;
+
+	batch.quotes = calloc(batch.num_quotes, sizeof(*batch.quotes));
+	batch.results = calloc(batch.num_quotes, sizeof(*batch.results));
+	batch.logs = calloc(batch.num_quotes, sizeof(*batch.logs));
+	if (batch.num_quotes &&
+	    (!batch.quotes || !batch.results || !batch.logs)) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* strings are owned by the JSON objects */
+	for (i = 0; i < batch.num_quotes; i++)
+		batch.quotes[i] = json_object_to_json_string_ext(
+				json_object_array_get_idx(root, i),
+				JSON_C_TO_STRING_PLAIN);
+
+	if (batch.num_quotes > 1) {
+		pthread_mutex_lock(&quote_batches_lock);
+		list_add_tail(&batch.list, &quote_batches);
+		pthread_mutex_unlock(&quote_batches_lock);
+
+		if (quote_batch_notify)
+			quote_batch_notify();
+	}
+
+	while (1) {
+		pthread_mutex_lock(&quote_batches_lock);
+		i = batch.next < batch.num_quotes ?
+		    quote_batch_next(&batch) : -1;
+		pthread_mutex_unlock(&quote_batches_lock);
+
+		if (i < 0)
+			break;
+
+		quote_batch_process(&batch, i);
+	}
+
+	/* wait for the quotes taken by the helper threads */
+	pthread_mutex_lock(&quote_batches_lock);
+	while (batch.done < batch.num_quotes)
+		pthread_cond_wait(&batch.completed, &quote_batches_lock);
+	pthread_mutex_unlock(&quote_batches_lock);
+
+	results = json_object_new_array();
+	if (!results) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < batch.num_quotes; i++) {
+		result = json_object_new_object();
+		if (!result) {
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		json_object_array_add(results, result);
+
+		log = NULL;
+		if (batch.logs[i])
+			log = attest_ctx_parse_json_data(batch.logs[i],
+							 strlen(batch.logs[i]));
+
+		json_object_object_add(result, "result",
+				       json_object_new_int(batch.results[i]));
+		json_object_object_add(result, "log", log);
+	}
+
+	results_str = json_object_to_json_string_ext(results,
+						     JSON_C_TO_STRING_PLAIN);
+	*message_out = results_str ? strdup(results_str) : NULL;
+	rc = *message_out ? 0 : -ENOMEM;
+out:
+	if (results)
+		json_object_put(results);
+	if (root)
+		json_object_put(root);
+
+	attest_enroll_reqs_put(batch.reqs);
+
+	pthread_cond_destroy(&batch.completed);
+
+	for (i = 0; batch.logs && i < batch.num_quotes; i++)
+		free(batch.logs[i]);
+
+	free(batch.quotes);
+	free(batch.results);
+	free(batch.logs);
+	return rc;
+}
 /** @}*/
 /** @}*/
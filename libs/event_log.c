@@ -26,11 +26,15 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <dlfcn.h>
+#include <pthread.h>
 
 #include "event_log.h"
+#include "hash.h"
+#include "util.h"
+#include "metrics.h"
 
 /**
  * Get an event log with a given label
@@ -48,7 +52,8 @@ struct event_log *attest_event_log_get(attest_ctx_verifier *v_ctx,
 		if (strcmp(log->id, id))
 			continue;
 
-		if (list_empty(&log->logs))
+		/* entries before offset have been verified previously */
+		if (list_empty(&log->logs) && !log->offset)
 			return NULL;
 
 		return log;
@@ -57,6 +62,270 @@ struct event_log *attest_event_log_get(attest_ctx_verifier *v_ctx,
 	return NULL;
 }
 
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	uint8_t data[0] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/**
+ * Allocate memory for parsed event log entries
+ * @param[in] v_ctx	verifier context
+ * @param[in] size	size of memory to allocate
+ *
+ * Memory is zeroed and released at once with the parsed event logs, it
+ * must not be freed by the caller.
+ *
+ * @returns pointer to memory on success, NULL on error
+ */
+void *attest_event_log_alloc(attest_ctx_verifier *v_ctx, size_t size)
+{
+	struct arena_chunk *chunk = v_ctx->arena, *new_chunk;
+	size_t chunk_size = ARENA_CHUNK_SIZE;
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		if (size > chunk_size)
+			chunk_size = size;
+
+		new_chunk = malloc(sizeof(*new_chunk) + chunk_size);
+		if (!new_chunk)
+			return NULL;
+
+		new_chunk->size = chunk_size;
+		new_chunk->used = 0;
+
+		/* keep allocating from the current chunk if it has space */
+		if (chunk && chunk_size > ARENA_CHUNK_SIZE) {
+			new_chunk->next = chunk->next;
+			chunk->next = new_chunk;
+		} else {
+			new_chunk->next = chunk;
+			v_ctx->arena = new_chunk;
+		}
+
+		chunk = new_chunk;
+	}
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static void attest_event_log_free_arena(attest_ctx_verifier *v_ctx)
+{
+	struct arena_chunk *chunk = v_ctx->arena, *next;
+
+	while (chunk) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	v_ctx->arena = NULL;
+}
+
+static int attest_event_log_ref_add(struct list_head *head, const char *name,
+				    const char *algo, uint32_t digest_len,
+				    const uint8_t *digest)
+{
+	struct event_log_ref *ref;
+
+	list_for_each_entry(ref, head, list) {
+		if (!strcmp(ref->name, name) && !strcmp(ref->algo, algo) &&
+		    ref->digest_len == digest_len &&
+		    !memcmp(ref->digest, digest, digest_len))
+			return 0;
+	}
+
+	ref = calloc(1, sizeof(*ref) + digest_len);
+	if (!ref)
+		return -ENOMEM;
+
+	ref->name = strdup(name);
+	ref->algo = strdup(algo);
+	if (!ref->name || !ref->algo) {
+		free(ref->name);
+		free(ref->algo);
+		free(ref);
+		return -ENOMEM;
+	}
+
+	ref->digest_len = digest_len;
+	memcpy(ref->digest, digest, digest_len);
+
+	list_add_tail(&ref->list, head);
+	return 0;
+}
+
+static int attest_event_log_copy_refs(struct list_head *dest,
+				      struct list_head *src)
+{
+	struct event_log_ref *ref;
+	int rc;
+
+	list_for_each_entry(ref, src, list) {
+		rc = attest_event_log_ref_add(dest, ref->name, ref->algo,
+					      ref->digest_len, ref->digest);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void attest_event_log_free_refs(struct list_head *head)
+{
+	struct event_log_ref *ref, *temp_ref;
+
+	list_for_each_entry_safe(ref, temp_ref, head, list) {
+		list_del(&ref->list);
+		free(ref->name);
+		free(ref->algo);
+		free(ref);
+	}
+}
+
+/**
+ * Remember the digest of a data item found in an event log by name
+ * @param[in] log	event log
+ * @param[in] name	entry name
+ * @param[in] algo	digest algorithm
+ * @param[in] digest_len	digest length
+ * @param[in] digest	digest
+ *
+ * References are saved in checkpoints, so that data items can be still
+ * found when verification is resumed and the entry is not sent again.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_event_log_add_ref(struct event_log *log, const char *name,
+			     const char *algo, uint32_t digest_len,
+			     const uint8_t *digest)
+{
+	return attest_event_log_ref_add(&log->refs, name, algo, digest_len,
+					digest);
+}
+
+/**
+ * Duplicate an event log checkpoint
+ * @param[in] checkpoint	checkpoint
+ *
+ * @returns new checkpoint on success, NULL on error
+ */
+struct event_log_checkpoint *attest_event_log_checkpoint_dup(
+				struct event_log_checkpoint *checkpoint)
+{
+	struct event_log_checkpoint *new_checkpoint;
+	struct event_log_checkpoint_log *log, *new_log;
+	int rc = -ENOMEM;
+
+	new_checkpoint = calloc(1, sizeof(*new_checkpoint));
+	if (!new_checkpoint)
+		return NULL;
+
+	INIT_LIST_HEAD(&new_checkpoint->logs);
+	new_checkpoint->pcr_bank_mask = checkpoint->pcr_bank_mask;
+
+	if (checkpoint->pcr) {
+		new_checkpoint->pcr = malloc(PCR_ARRAY_SIZE);
+		if (!new_checkpoint->pcr)
+			goto out;
+
+		memcpy(new_checkpoint->pcr, checkpoint->pcr, PCR_ARRAY_SIZE);
+	}
+
+	list_for_each_entry(log, &checkpoint->logs, list) {
+		new_log = calloc(1, sizeof(*new_log));
+		if (!new_log)
+			goto out;
+
+		INIT_LIST_HEAD(&new_log->refs);
+		list_add_tail(&new_log->list, &new_checkpoint->logs);
+
+		new_log->num_entries = log->num_entries;
+		new_log->id = strdup(log->id);
+		if (!new_log->id)
+			goto out;
+
+		if (attest_event_log_copy_refs(&new_log->refs, &log->refs))
+			goto out;
+	}
+
+	rc = 0;
+out:
+	if (rc) {
+		attest_event_log_checkpoint_free(new_checkpoint);
+		new_checkpoint = NULL;
+	}
+
+	return new_checkpoint;
+}
+
+/**
+ * Free an event log checkpoint
+ * @param[in] checkpoint	checkpoint
+ */
+void attest_event_log_checkpoint_free(struct event_log_checkpoint *checkpoint)
+{
+	struct event_log_checkpoint_log *log, *temp_log;
+
+	if (!checkpoint)
+		return;
+
+	list_for_each_entry_safe(log, temp_log, &checkpoint->logs, list) {
+		list_del(&log->list);
+		attest_event_log_free_refs(&log->refs);
+		free(log->id);
+		free(log);
+	}
+
+	free(checkpoint->pcr);
+	free(checkpoint);
+}
+
+/**
+ * Get the next entry of an event log with a given name
+ * @param[in] log	event log
+ * @param[in] name	entry name
+ * @param[in] prev	previous entry found, NULL to get the first entry
+ *
+ * Entries are found in constant time if the event log parser provides
+ * names, otherwise the event log is not indexed and NULL is returned.
+ *
+ * @returns event log entry on success, NULL if not found
+ */
+struct event_log_entry *attest_event_log_lookup_by_name(struct event_log *log,
+			const char *name, struct event_log_entry *prev)
+{
+	struct event_log_entry *entry = prev;
+	struct list_head *head;
+
+	if (!log->name_index)
+		return NULL;
+
+	head = log->name_index + attest_util_hash_str(name, HASH_STR_INIT) %
+	       EVENT_LOG_NAME_HASH_SIZE;
+
+	if (!entry)
+		entry = list_entry(head, struct event_log_entry, name_list);
+
+	list_for_each_entry_continue(entry, head, name_list) {
+		if (!strcmp(entry->name, name))
+			return entry;
+	}
+
+	return NULL;
+}
+
 /**
  * Verify event log data
  * @param[in] v_ctx	verifier context
@@ -81,10 +350,8 @@ int attest_event_log_verify_digest(attest_ctx_verifier *v_ctx,
 	check_goto(digest_len != TSS_GetDigestSize(algID), -EINVAL, out, v_ctx,
 		   "digest length mismatch");
 
-	d.hashAlg = algID;
-
-	rc = TSS_Hash_Generate(&d, data_len, data, 0, NULL); 
-	check_goto(rc, -EINVAL, out, v_ctx, "TSS_Hash_Generate() error: %d");
+	rc = attest_hash_data(algID, data_len, data, (uint8_t *)&d.digest);
+	check_goto(rc, rc, out, v_ctx, "attest_hash_data() error: %d", rc);
 	rc = memcmp((uint8_t *)&d.digest, digest, digest_len);
 	/* FIXME: uncomment when BIOS log is verified correctly */
 	//check_goto(rc, rc, out, v_ctx, "digest mismatch");
@@ -93,98 +360,533 @@ out:
 }
 
 static int attest_event_log_parse(attest_ctx_verifier *v_ctx,
-				  parse_log_func parse_func, const char *log_id,
+				  parse_log_func parse_func,
+				  log_entry_name_func name_func,
 				  int len, unsigned char *data,
-				  struct list_head *head)
+				  struct event_log *event_log)
 {
 	struct event_log_entry *new_log_entry;
 	unsigned char *data_ptr = data;
 	uint32_t data_len = len;
 	void *first_parsed_log = NULL;
+	unsigned int hash;
 	int rc = 0, i = 0;
 
 	current_log(v_ctx);
 
 	while (data_len > 0) {
-		new_log_entry = calloc(1, sizeof(*new_log_entry));
+		new_log_entry = attest_event_log_alloc(v_ctx,
+						       sizeof(*new_log_entry));
 		check_goto(!new_log_entry, -ENOMEM, out, v_ctx,
 			   "out of memory");
 
 		rc = parse_func(v_ctx, &data_len, &data_ptr,
 				&new_log_entry->log, &first_parsed_log);
-		if (rc)
-			free(new_log_entry);
-
 		check_goto(rc, rc, out, v_ctx,
-			   "error parsing entry #%d of log %s", i++, log_id);
+			   "error parsing entry #%d of log %s", i,
+			   event_log->id);
+
+		list_add_tail(&new_log_entry->list, &event_log->logs);
+		i++;
 
-		list_add_tail(&new_log_entry->list, head);
+		if (!event_log->name_index)
+			continue;
+
+		new_log_entry->name = name_func(new_log_entry->log);
+		if (!new_log_entry->name)
+			continue;
+
+		hash = attest_util_hash_str(new_log_entry->name,
+				HASH_STR_INIT) % EVENT_LOG_NAME_HASH_SIZE;
+		list_add_tail(&new_log_entry->name_list,
+			      &event_log->name_index[hash]);
 	}
 out:
-	free(first_parsed_log);
+	attest_ctx_verifier_log_account(log, i, len - data_len);
+	attest_metrics_inc(METRIC_EVENT_LOG_ENTRIES, i, "log=\"%s\"",
+			   event_log->id);
 	return rc;
 }
 
 static void attest_event_log_free_event_logs(attest_ctx_verifier *v_ctx)
 {
 	struct event_log *log, *temp_log;
-	struct event_log_entry *e, *temp_e;
 
 	list_for_each_entry_safe(log, temp_log, &v_ctx->event_logs, list) {
-		list_for_each_entry_safe(e, temp_e, &log->logs, list) {
-			list_del(&e->list);
-			free(e->log);
-			free(e);
-		}
-
+		/* entries are allocated from the arena */
 		list_del(&log->list);
+		attest_event_log_free_refs(&log->refs);
+		free(log->name_index);
 		free(log);
 	}
+
+	attest_event_log_free_arena(v_ctx);
+}
+
+static struct event_log *attest_event_log_new(attest_ctx_verifier *v_ctx,
+					      const char *id)
+{
+	struct event_log *new_log;
+
+	list_for_each_entry(new_log, &v_ctx->event_logs, list) {
+		if (!strcmp(new_log->id, id))
+			return new_log;
+	}
+
+	new_log = calloc(1, sizeof(*new_log));
+	if (!new_log)
+		return NULL;
+
+	INIT_LIST_HEAD(&new_log->logs);
+	INIT_LIST_HEAD(&new_log->refs);
+
+	new_log->id = id;
+	list_add_tail(&new_log->list, &v_ctx->event_logs);
+	return new_log;
+}
+
+static int attest_event_log_parse_offset(struct data_item *item,
+					 uint32_t *offset)
+{
+	char offset_str[16], *endptr;
+	unsigned long value;
+
+	if (item->len >= sizeof(offset_str))
+		return -EINVAL;
+
+	memcpy(offset_str, item->data, item->len);
+	offset_str[item->len] = '\0';
+
+	errno = 0;
+	value = strtoul(offset_str, &endptr, 10);
+	if (errno || endptr == offset_str || *endptr || value > UINT32_MAX)
+		return -EINVAL;
+
+	*offset = value;
+	return 0;
+}
+
+static int attest_event_log_restore(attest_ctx_data *d_ctx,
+				    attest_ctx_verifier *v_ctx)
+{
+	struct event_log_checkpoint *checkpoint = v_ctx->checkpoint;
+	struct event_log_checkpoint_log *checkpoint_log;
+	struct event_log *new_log;
+	struct data_item *item;
+	uint32_t offset;
+	int rc = 0;
+
+	current_log(v_ctx);
+
+	if (list_empty(&d_ctx->ctx_data[CTX_EVENT_LOG_OFFSET]))
+		return 0;
+
+	check_goto(!checkpoint, -ESTALE, out, v_ctx, "checkpoint not found");
+
+	/* banks not calculated for the checkpoint cannot be resumed */
+	check_goto((checkpoint->pcr_bank_mask & attest_pcr_bank_mask(v_ctx)) !=
+		   attest_pcr_bank_mask(v_ctx), -ESTALE, out, v_ctx,
+		   "PCR banks not found in checkpoint");
+
+	list_for_each_entry(item, &d_ctx->ctx_data[CTX_EVENT_LOG_OFFSET],
+			    list) {
+		check_goto(!item->label, -EINVAL, out, v_ctx,
+			   "missing log type");
+
+		rc = attest_event_log_parse_offset(item, &offset);
+		check_goto(rc, rc, out, v_ctx, "invalid offset of log %s",
+			   item->label);
+
+		list_for_each_entry(checkpoint_log, &checkpoint->logs, list) {
+			if (!strcmp(checkpoint_log->id, item->label))
+				break;
+		}
+
+		check_goto(&checkpoint_log->list == &checkpoint->logs ||
+			   checkpoint_log->num_entries != offset, -ESTALE, out,
+			   v_ctx, "offset of log %s does not match checkpoint",
+			   item->label);
+	}
+
+	list_for_each_entry(checkpoint_log, &checkpoint->logs, list) {
+		/* PCRs are restored, all logs must be resumed */
+		list_for_each_entry(item,
+				&d_ctx->ctx_data[CTX_EVENT_LOG_OFFSET], list) {
+			if (!strcmp(item->label, checkpoint_log->id))
+				break;
+		}
+
+		check_goto(&item->list == &d_ctx->ctx_data[CTX_EVENT_LOG_OFFSET],
+			   -ESTALE, out, v_ctx, "offset of log %s not provided",
+			   checkpoint_log->id);
+
+		new_log = attest_event_log_new(v_ctx, checkpoint_log->id);
+		check_goto(!new_log, -ENOMEM, out, v_ctx, "out of memory");
+
+		new_log->offset = checkpoint_log->num_entries;
+
+		rc = attest_event_log_copy_refs(&new_log->refs,
+						&checkpoint_log->refs);
+		check_goto(rc, rc, out, v_ctx, "out of memory");
+	}
+
+	rc = attest_pcr_restore(v_ctx, checkpoint->pcr);
+	check_goto(rc, rc, out, v_ctx, "cannot restore PCRs from checkpoint");
+out:
+	return rc;
+}
+
+static int attest_event_log_checkpoint_new(attest_ctx_verifier *v_ctx)
+{
+	struct event_log_checkpoint *checkpoint;
+	struct event_log_checkpoint_log *checkpoint_log;
+	struct event_log *event_log;
+	struct event_log_entry *log_entry;
+	int rc = -ENOMEM;
+
+	checkpoint = calloc(1, sizeof(*checkpoint));
+	if (!checkpoint)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&checkpoint->logs);
+
+	list_for_each_entry(event_log, &v_ctx->event_logs, list) {
+		checkpoint_log = calloc(1, sizeof(*checkpoint_log));
+		if (!checkpoint_log)
+			goto out;
+
+		INIT_LIST_HEAD(&checkpoint_log->refs);
+		list_add_tail(&checkpoint_log->list, &checkpoint->logs);
+
+		checkpoint_log->id = strdup(event_log->id);
+		if (!checkpoint_log->id)
+			goto out;
+
+		checkpoint_log->num_entries = event_log->offset;
+		list_for_each_entry(log_entry, &event_log->logs, list)
+			checkpoint_log->num_entries++;
+
+		if (attest_event_log_copy_refs(&checkpoint_log->refs,
+					       &event_log->refs))
+			goto out;
+	}
+
+	attest_event_log_checkpoint_free(v_ctx->new_checkpoint);
+	v_ctx->new_checkpoint = checkpoint;
+	rc = 0;
+out:
+	if (rc)
+		attest_event_log_checkpoint_free(checkpoint);
+
+	return rc;
+}
+
+/* all data items of an event log, possibly parsed in a separate thread */
+struct event_log_parse_job {
+	pthread_t thread;
+	attest_ctx_data *d_ctx;
+	attest_ctx_verifier v_ctx;
+	struct verification_log log;
+	struct event_log *event_log;
+	parse_log_func parse_func;
+	log_entry_name_func name_func;
+	int started;
+	int rc;
+};
+
+static int attest_event_log_parse_item(attest_ctx_verifier *v_ctx,
+				       struct event_log_parse_job *job,
+				       struct data_item *item)
+{
+	int rc;
+
+	current_log(v_ctx);
+
+	rc = attest_event_log_parse(v_ctx, job->parse_func, job->name_func,
+				    item->len, item->data, job->event_log);
+	check_goto(rc, rc, out, v_ctx,
+		   "%s parser returned an error", item->label);
+out:
+	return rc;
+}
+
+static void *attest_event_log_parse_thread(void *arg)
+{
+	struct event_log_parse_job *job = (struct event_log_parse_job *)arg;
+	struct data_item *item;
+
+	list_for_each_entry(item, &job->d_ctx->ctx_data[CTX_EVENT_LOG], list) {
+		if (strcmp(item->label, job->event_log->id))
+			continue;
+
+		job->rc = attest_event_log_parse_item(&job->v_ctx, job, item);
+		if (job->rc)
+			break;
+	}
+
+	return NULL;
+}
+
+/* chunks allocated by a job are released with those of the context */
+static void attest_event_log_merge_arena(attest_ctx_verifier *v_ctx,
+					 attest_ctx_verifier *src)
+{
+	struct arena_chunk *head = v_ctx->arena, *tail = src->arena;
+
+	if (!tail)
+		return;
+
+	while (tail->next)
+		tail = tail->next;
+
+	if (!head) {
+		v_ctx->arena = src->arena;
+	} else {
+		tail->next = head->next;
+		head->next = src->arena;
+	}
+
+	src->arena = NULL;
+}
+
+/* returns -EAGAIN if PCRs were extended by more than one event log */
+static int attest_event_log_merge_pcrs(attest_ctx_verifier *v_ctx,
+				       TPMT_HA *initial,
+				       struct event_log_parse_job *jobs,
+				       int num_jobs)
+{
+	TPMT_HA *pcr = v_ctx->pcr, *job_pcr;
+	int i, j, owner;
+
+	for (i = 0; i < PCR_ARRAY_SIZE / sizeof(TPMT_HA); i++) {
+		owner = -1;
+
+		for (j = 0; j < num_jobs; j++) {
+			job_pcr = jobs[j].v_ctx.pcr;
+			if (!memcmp(&job_pcr[i], &initial[i], sizeof(TPMT_HA)))
+				continue;
+
+			if (owner >= 0)
+				return -EAGAIN;
+
+			owner = j;
+		}
+	}
+
+	for (i = 0; i < PCR_ARRAY_SIZE / sizeof(TPMT_HA); i++) {
+		for (j = 0; j < num_jobs; j++) {
+			job_pcr = jobs[j].v_ctx.pcr;
+			if (memcmp(&job_pcr[i], &initial[i], sizeof(TPMT_HA)))
+				memcpy(&pcr[i], &job_pcr[i], sizeof(TPMT_HA));
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Each job parses with a copy of the verifier context, with its own PCRs,
+ * arena and verification log. PCRs are merged if event logs extended
+ * distinct PCRs, and errors are reported in the order of the event logs.
+ */
+static int attest_event_log_parse_concurrent(attest_ctx_data *d_ctx,
+					     attest_ctx_verifier *v_ctx,
+					     struct event_log_parse_job *jobs,
+					     int num_jobs)
+{
+	struct event_log_parse_job *job;
+	void *initial = NULL;
+	int rc = 0, i;
+
+	current_log(v_ctx);
+
+	if (v_ctx->pcr) {
+		initial = attest_pcr_snapshot(v_ctx);
+		check_goto(!initial, -ENOMEM, out, v_ctx, "out of memory");
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		job = &jobs[i];
+
+		job->d_ctx = d_ctx;
+		job->v_ctx = *v_ctx;
+		job->v_ctx.arena = NULL;
+		INIT_LIST_HEAD(&job->v_ctx.event_logs);
+		INIT_LIST_HEAD(&job->v_ctx.verifiers);
+		INIT_LIST_HEAD(&job->v_ctx.logs);
+		pthread_mutex_init(&job->v_ctx.logs_lock, NULL);
+
+		job->log.operation = "parse event log";
+		job->log.result = "in progress";
+		job->log.reason = "";
+		list_add(&job->log.list, &job->v_ctx.logs);
+
+		if (!initial)
+			continue;
+
+		job->v_ctx.pcr = attest_pcr_snapshot(v_ctx);
+		check_goto(!job->v_ctx.pcr, -ENOMEM, out, v_ctx,
+			   "out of memory");
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		job = &jobs[i];
+
+		job->started = !pthread_create(&job->thread, NULL,
+					       attest_event_log_parse_thread,
+					       job);
+		if (!job->started)
+			attest_event_log_parse_thread(job);
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		job = &jobs[i];
+
+		if (job->started)
+			pthread_join(job->thread, NULL);
+
+		attest_event_log_merge_arena(v_ctx, &job->v_ctx);
+
+		if (!rc && job->rc) {
+			attest_ctx_verifier_set_log(log, "%s",
+						    job->log.reason);
+			rc = job->rc;
+		}
+	}
+
+	if (!rc && initial)
+		rc = attest_event_log_merge_pcrs(v_ctx, initial, jobs,
+						 num_jobs);
+
+	/* event logs parsed again are accounted by the caller */
+	for (i = 0; !rc && i < num_jobs; i++)
+		attest_ctx_verifier_log_account(log, jobs[i].log.entries,
+						jobs[i].log.bytes);
+out:
+	for (i = 0; i < num_jobs; i++) {
+		job = &jobs[i];
+
+		if (job->log.reason && strlen(job->log.reason) &&
+		    job->log.reason != unknown_log.reason)
+			free(job->log.reason);
+
+		if (job->v_ctx.pcr != v_ctx->pcr)
+			free(job->v_ctx.pcr);
+
+		pthread_mutex_destroy(&job->v_ctx.logs_lock);
+	}
+
+	free(initial);
+	return rc;
 }
 
 static int attest_event_log_parse_data(attest_ctx_data *d_ctx,
 				       attest_ctx_verifier *v_ctx)
 {
+	struct event_log_parse_job *jobs = NULL, *job;
 	struct event_log *new_log = NULL;
 	struct verification_log *log;
 	char library_name[MAX_PATH_LENGTH];
 	parse_log_func parse_func;
+	log_entry_name_func name_func;
 	struct data_item *item;
-	void *handle = NULL;
-	int rc = 0;
+	int rc = 0, i, j, num_items = 0, num_jobs = 0;
 
 	log = attest_ctx_verifier_add_log(v_ctx, "parse event log");
 
+	rc = attest_event_log_restore(d_ctx, v_ctx);
+	if (rc)
+		goto out;
+
+	list_for_each_entry(item, &d_ctx->ctx_data[CTX_EVENT_LOG], list)
+		num_items++;
+
+	if (!num_items)
+		goto out;
+
+	jobs = calloc(num_items, sizeof(*jobs));
+	check_goto(!jobs, -ENOMEM, out, v_ctx, "out of memory");
+
 	list_for_each_entry(item, &d_ctx->ctx_data[CTX_EVENT_LOG], list) {
 		check_goto(!item->label, -EINVAL, out, v_ctx,
 			   "missing log type");
 
 		snprintf(library_name, sizeof(library_name),
 			 "libeventlog_%s.so", item->label);
-		handle = dlopen(library_name, RTLD_LAZY);
-		check_goto(!handle, -ENOENT, out, v_ctx,
-			   "event log library not found");
-
-		parse_func = dlsym(handle, "attest_event_log_parse");
+		parse_func = attest_ctx_plugin_get_sym(library_name,
+						       "attest_event_log_parse");
 		check_goto(!parse_func, -ENOENT, out, v_ctx,
 			   "event log parser not found");
 
-		new_log = malloc(sizeof(*new_log));
+		name_func = attest_ctx_plugin_get_sym(library_name,
+						"attest_event_log_entry_name");
+
+		new_log = attest_event_log_new(v_ctx, item->label);
 		check_goto(!new_log, -ENOMEM, out, v_ctx,
 			   "out of memory");
 
-		INIT_LIST_HEAD(&new_log->logs);
+		if (name_func && !new_log->name_index) {
+			new_log->name_index = malloc(EVENT_LOG_NAME_HASH_SIZE *
+						sizeof(*new_log->name_index));
+			check_goto(!new_log->name_index, -ENOMEM, out, v_ctx,
+				   "out of memory");
 
-		new_log->id = item->label;
-		list_add_tail(&new_log->list, &v_ctx->event_logs);
+			for (i = 0; i < EVENT_LOG_NAME_HASH_SIZE; i++)
+				INIT_LIST_HEAD(&new_log->name_index[i]);
+		}
 
-		rc = attest_event_log_parse(v_ctx, parse_func, item->label,
-					    item->len, item->data,
-					    &new_log->logs);
-		check_goto(rc, rc, out, v_ctx,
-			   "%s parser returned an error", item->label);
+		/* data items of the same event log are parsed in order */
+		for (i = 0; i < num_jobs; i++) {
+			if (jobs[i].event_log == new_log)
+				break;
+		}
+
+		if (i < num_jobs)
+			continue;
+
+		jobs[num_jobs].event_log = new_log;
+		jobs[num_jobs].parse_func = parse_func;
+		jobs[num_jobs].name_func = name_func;
+		num_jobs++;
+	}
+
+	if (num_jobs > 1) {
+		rc = attest_event_log_parse_concurrent(d_ctx, v_ctx, jobs,
+						       num_jobs);
+		if (rc != -EAGAIN)
+			goto out;
+
+		/* the same PCR was extended by two event logs, parse again */
+		for (i = 0; i < num_jobs; i++) {
+			new_log = jobs[i].event_log;
+
+			INIT_LIST_HEAD(&new_log->logs);
+
+			if (!new_log->name_index)
+				continue;
+
+			for (j = 0; j < EVENT_LOG_NAME_HASH_SIZE; j++)
+				INIT_LIST_HEAD(&new_log->name_index[j]);
+		}
+
+		rc = 0;
+	}
+
+	list_for_each_entry(item, &d_ctx->ctx_data[CTX_EVENT_LOG], list) {
+		for (i = 0; i < num_jobs; i++) {
+			if (!strcmp(item->label, jobs[i].event_log->id))
+				break;
+		}
+
+		job = &jobs[i];
+
+		rc = attest_event_log_parse_item(v_ctx, job, item);
+		if (rc)
+			goto out;
 	}
 out:
+	free(jobs);
+
 	if (rc)
 		attest_event_log_free_event_logs(v_ctx);
 
@@ -192,28 +894,190 @@ out:
 	return rc;
 }
 
+struct verifier_thread {
+	pthread_t thread;
+	struct verifier_struct *verifier;
+	attest_ctx_data *d_ctx;
+	attest_ctx_verifier *v_ctx;
+	struct verification_thread_logs logs;
+	int started;
+	int rc;
+};
+
+static void *attest_event_log_verifier_thread(void *arg)
+{
+	struct verifier_thread *t = (struct verifier_thread *)arg;
+
+	attest_ctx_verifier_thread_logs_start(t->v_ctx, &t->logs);
+	t->rc = t->verifier->func(t->d_ctx, t->v_ctx);
+	attest_ctx_verifier_thread_logs_stop();
+	return NULL;
+}
+
 static int attest_event_log_verify_entries(attest_ctx_data *d_ctx,
 					   attest_ctx_verifier *v_ctx)
 {
 	struct verifier_struct *verifier;
-	struct event_log *event_log;
-	struct event_log_entry *log_entry;
+	struct verifier_thread *threads = NULL, *t;
+	struct event_log *event_log, *first_log = NULL;
+	struct event_log_entry *log_entry, *first_entry = NULL;
 	struct verification_log *log;
-	int rc = 0, i = 0;
+	int num_verifiers = 0, num_threads = 0;
+	int rc = 0, end_rc, i = 0, first_i = 0;
 
 	log = attest_ctx_verifier_add_log(v_ctx, "verify event logs");
 
 	list_for_each_entry(verifier, &v_ctx->verifiers, list) {
+		num_verifiers++;
+
+		if (!verifier->on_entry && (verifier->flags & VERIFIER_PARALLEL))
+			num_threads++;
+	}
+
+	/* the last one runs in this thread, if there is nothing else to do */
+	if (num_threads == num_verifiers)
+		num_threads--;
+
+	if (num_threads) {
+		threads = calloc(num_threads, sizeof(*threads));
+		check_goto(!threads, -ENOMEM, out, v_ctx, "out of memory");
+	}
+
+	i = 0;
+	list_for_each_entry(verifier, &v_ctx->verifiers, list) {
+		if (i == num_threads)
+			break;
+
+		if (verifier->on_entry || !(verifier->flags & VERIFIER_PARALLEL))
+			continue;
+
+		t = &threads[i++];
+		t->verifier = verifier;
+		t->d_ctx = d_ctx;
+		t->v_ctx = v_ctx;
+		t->started = !pthread_create(&t->thread, NULL,
+					     attest_event_log_verifier_thread,
+					     t);
+		if (!t->started)
+			attest_event_log_verifier_thread(t);
+	}
+
+	/* the others run in list order, while those above are running */
+	i = 0;
+	list_for_each_entry(verifier, &v_ctx->verifiers, list) {
+		if (verifier->on_entry)
+			continue;
+
+		if (i < num_threads && threads[i].verifier == verifier) {
+			i++;
+			continue;
+		}
+
 		rc = verifier->func(d_ctx, v_ctx);
-		check_goto(rc, rc, out, v_ctx,
+		check_goto(rc, rc, out_end, v_ctx,
 			   "verifier %s returned an error\n", verifier->id);
 	}
 
+	list_for_each_entry(verifier, &v_ctx->verifiers, list) {
+		if (!verifier->on_entry)
+			continue;
+
+		verifier->state = NULL;
+
+		if (verifier->begin) {
+			rc = verifier->begin(d_ctx, v_ctx, &verifier->state);
+			check_goto(rc, rc, out_end, v_ctx,
+				   "verifier %s returned an error\n",
+				   verifier->id);
+		}
+
+		verifier->flags |= VERIFIER_STARTED;
+	}
+
+	/* walk event logs once, for all verifiers */
 	list_for_each_entry(event_log, &v_ctx->event_logs, list) {
 		i = 0;
 
 		list_for_each_entry(log_entry, &event_log->logs, list) {
-			check_goto(!(log_entry->flags & LOG_ENTRY_PROCESSED),
+			list_for_each_entry(verifier, &v_ctx->verifiers, list) {
+				if (!(verifier->flags & VERIFIER_STARTED))
+					continue;
+
+				rc = verifier->on_entry(d_ctx, v_ctx, event_log,
+							log_entry,
+							verifier->state);
+				check_goto(rc, rc, out_end, v_ctx,
+					   "verifier %s returned an error\n",
+					   verifier->id);
+			}
+
+			/* the entry could be still processed by end() */
+			if (!first_entry &&
+			    !attest_event_log_entry_processed(log_entry)) {
+				first_log = event_log;
+				first_entry = log_entry;
+				first_i = i;
+			}
+
+			i++;
+		}
+	}
+out_end:
+	list_for_each_entry_reverse(verifier, &v_ctx->verifiers, list) {
+		if (!(verifier->flags & VERIFIER_STARTED))
+			continue;
+
+		verifier->flags &= ~VERIFIER_STARTED;
+
+		end_rc = rc;
+		if (verifier->end)
+			end_rc = verifier->end(d_ctx, v_ctx, verifier->state,
+					       rc);
+
+		verifier->state = NULL;
+
+		if (!rc && end_rc) {
+			attest_ctx_verifier_set_log(log,
+				"verifier %s returned an error\n",
+				verifier->id);
+			rc = end_rc;
+		}
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		t = &threads[i];
+
+		if (t->started)
+			pthread_join(t->thread, NULL);
+
+		attest_ctx_verifier_thread_logs_splice(&t->logs);
+
+		if (!rc && t->rc) {
+			attest_ctx_verifier_set_log(log,
+				"verifier %s returned an error\n",
+				t->verifier->id);
+			rc = t->rc;
+		}
+	}
+
+	if (rc || !first_entry)
+		goto out;
+
+	/* check only entries after the first not processed during the walk */
+	event_log = first_log;
+	log_entry = first_entry;
+	i = first_i;
+
+	list_for_each_entry_from(event_log, &v_ctx->event_logs, list) {
+		if (event_log != first_log) {
+			log_entry = list_first_entry(&event_log->logs,
+						     struct event_log_entry,
+						     list);
+			i = 0;
+		}
+
+		list_for_each_entry_from(log_entry, &event_log->logs, list) {
+			check_goto(!attest_event_log_entry_processed(log_entry),
 				   -ENOENT, out, v_ctx,
 				   "event log %s: log entry #%d not processed",
 				   event_log->id, i);
@@ -221,6 +1085,7 @@ static int attest_event_log_verify_entries(attest_ctx_data *d_ctx,
 		}
 	}
 out:
+	free(threads);
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 	return rc;
 }
@@ -239,6 +1104,9 @@ int attest_event_log_parse_verify(attest_ctx_data *d_ctx,
 		rc = attest_event_log_verify_entries(d_ctx, v_ctx);
 		if (rc)
 			goto out;
+
+		if (v_ctx->flags & CTX_CHECKPOINT)
+			rc = attest_event_log_checkpoint_new(v_ctx);
 	}
 out:
 	attest_event_log_free_event_logs(v_ctx);
@@ -28,16 +28,142 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+
+#include <openssl/evp.h>
 
 #include "event_log/bios.h"
+#include "metrics.h"
+
+#define REPLAY_CACHE_SIZE 256
+
+/*
+ * PCRs after the replay of a BIOS event log. Identical machines send the same
+ * log, and the result depends only on the log, the selected banks and the
+ * PCRs before the replay.
+ */
+struct replay_entry {
+	struct list_head list;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	void *pcr;
+};
+
+static pthread_mutex_t replay_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(replay_cache);
+static int replay_cache_num;
+
+/* parsing state, stored as first parsed log */
+struct bios_log_state {
+	struct bios_log_entry header;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	int cacheable;
+	int replayed;
+};
+
+static int attest_event_log_replay_key(attest_ctx_verifier *v_ctx,
+				       uint32_t len, unsigned char *data,
+				       uint8_t *key)
+{
+	uint8_t bank_mask = attest_pcr_bank_mask(v_ctx);
+	EVP_MD_CTX *mdctx;
+	int rc = -EINVAL;
+
+	if (!v_ctx->pcr)
+		return -ENOENT;
+
+	mdctx = EVP_MD_CTX_create();
+	if (!mdctx)
+		return -ENOMEM;
+
+	if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) == 1 &&
+	    EVP_DigestUpdate(mdctx, &bank_mask, sizeof(bank_mask)) == 1 &&
+	    EVP_DigestUpdate(mdctx, v_ctx->pcr, PCR_ARRAY_SIZE) == 1 &&
+	    EVP_DigestUpdate(mdctx, data, len) == 1 &&
+	    EVP_DigestFinal_ex(mdctx, key, NULL) == 1)
+		rc = 0;
+
+	EVP_MD_CTX_destroy(mdctx);
+	return rc;
+}
+
+static int attest_event_log_replay_lookup(attest_ctx_verifier *v_ctx,
+					  uint8_t *key)
+{
+	struct replay_entry *entry;
+	int rc = -ENOENT;
+
+	pthread_mutex_lock(&replay_cache_lock);
+	list_for_each_entry(entry, &replay_cache, list) {
+		if (memcmp(entry->key, key, SHA256_DIGEST_LENGTH))
+			continue;
+
+		list_del(&entry->list);
+		list_add(&entry->list, &replay_cache);
+		rc = attest_pcr_restore(v_ctx, entry->pcr);
+		break;
+	}
+	pthread_mutex_unlock(&replay_cache_lock);
+
+	attest_metrics_cache("bios_replay", !rc);
+	return rc;
+}
+
+static void attest_event_log_replay_add(attest_ctx_verifier *v_ctx,
+					uint8_t *key)
+{
+	struct replay_entry *entry;
+	void *pcr;
+
+	pcr = attest_pcr_snapshot(v_ctx);
+	if (!pcr)
+		return;
+
+	pthread_mutex_lock(&replay_cache_lock);
+	list_for_each_entry(entry, &replay_cache, list) {
+		if (!memcmp(entry->key, key, SHA256_DIGEST_LENGTH)) {
+			free(pcr);
+			goto out;
+		}
+	}
+
+	if (replay_cache_num == REPLAY_CACHE_SIZE) {
+		entry = list_last_entry(&replay_cache, struct replay_entry,
+					list);
+		list_del(&entry->list);
+		free(entry->pcr);
+		replay_cache_num--;
+	} else {
+		entry = malloc(sizeof(*entry));
+		if (!entry) {
+			free(pcr);
+			goto out;
+		}
+	}
+
+	memcpy(entry->key, key, SHA256_DIGEST_LENGTH);
+	entry->pcr = pcr;
+	list_add(&entry->list, &replay_cache);
+	replay_cache_num++;
+out:
+	pthread_mutex_unlock(&replay_cache_lock);
+}
 
 static int attest_event_log_check_extend(attest_ctx_verifier *v_ctx,
+					 struct bios_log_state *state,
 					 int pcr, TPM_ALG_ID algID,
 					 u32 digest_size, u8 *digest,
 					 u32 event_size, u8 *event)
 {
+	/* PCRs already restored from the replay cache */
+	if (state->replayed)
+		return 0;
+
+	if (!attest_pcr_bank_selected(v_ctx, algID))
+		return 0;
+
 	/* FIXME: for some log entries, data should be normalized */
 	attest_event_log_verify_digest(v_ctx, digest_size, digest, 
 				       event_size, event, algID);
@@ -46,6 +172,7 @@ static int attest_event_log_check_extend(attest_ctx_verifier *v_ctx,
 }
 
 static int attest_event_log_parse_v2(attest_ctx_verifier *v_ctx,
+				     struct bios_log_state *state,
 				     uint32_t *remaining_len,
 				     unsigned char **data,
 				     struct tcg_pcr_event2_head *event,
@@ -74,7 +201,8 @@ static int attest_event_log_parse_v2(attest_ctx_verifier *v_ctx,
 	if (event->count > efispecid->num_algs)
 		return 0;
 
-	digest_array = calloc(event->count, sizeof(*digest_array));
+	digest_array = attest_event_log_alloc(v_ctx, event->count *
+					      sizeof(*digest_array));
 	if (!digest_array)
 		return -ENOMEM;
 
@@ -106,7 +234,8 @@ static int attest_event_log_parse_v2(attest_ctx_verifier *v_ctx,
 	size = marker - marker_start;
 
 	for (i = 0; i < event->count; i++) {
-		rc = attest_event_log_check_extend(v_ctx, event->pcr_idx,
+		rc = attest_event_log_check_extend(v_ctx, state,
+						   event->pcr_idx,
 						   digest_array[i].alg_id,
 						   digest_array[i].digest_size,
 						   digest_array[i].digest_ptr,
@@ -122,11 +251,11 @@ static int attest_event_log_parse_v2(attest_ctx_verifier *v_ctx,
 	*data += size;
 	*remaining_len -= size;
 out:
-	free(digest_array);
 	return rc;
 }
 
 static int attest_event_log_parse_v1(attest_ctx_verifier *v_ctx,
+				     struct bios_log_state *state,
 				     uint32_t *remaining_len,
 				     unsigned char **data,
 				     struct tcg_pcr_event **event_header)
@@ -145,7 +274,7 @@ static int attest_event_log_parse_v1(attest_ctx_verifier *v_ctx,
 		return 0;
 	}
 
-	return attest_event_log_check_extend(v_ctx, bios_entry->pcr_idx,
+	return attest_event_log_check_extend(v_ctx, state, bios_entry->pcr_idx,
 					     TPM_ALG_SHA1, SHA_DIGEST_LENGTH,
 					     bios_entry->digest,
 				             bios_entry->event_size,
@@ -157,41 +286,54 @@ int attest_event_log_parse(attest_ctx_verifier *v_ctx,
 			   uint32_t *remaining_len, unsigned char **data,
 			   void **parsed_log, void **first_parsed_log)
 {
-	struct bios_log_entry *log_entry, *first_log_entry;
+	struct bios_log_entry *log_entry;
 	struct tcg_pcr_event *event_header = NULL;
+	struct bios_log_state *state = *first_parsed_log;
 	int rc;
 
-	log_entry = malloc(sizeof(*log_entry));
+	/* first entry, the whole log is still to be parsed */
+	if (!state) {
+		state = attest_event_log_alloc(v_ctx, sizeof(*state));
+		if (!state)
+			return -ENOMEM;
+
+		state->header.entry = NULL;
+		state->replayed = 0;
+
+		/* without a key, the log is parsed as usual */
+		state->cacheable = !attest_event_log_replay_key(v_ctx,
+						*remaining_len, *data,
+						state->key);
+		if (state->cacheable)
+			state->replayed = !attest_event_log_replay_lookup(v_ctx,
+								state->key);
+		*first_parsed_log = state;
+	}
+
+	log_entry = attest_event_log_alloc(v_ctx, sizeof(*log_entry));
 	if (!log_entry)
 		return -ENOMEM;
 
 	log_entry->entry = *data;
 
-	if (*first_parsed_log) {
-		first_log_entry = (struct bios_log_entry *)*first_parsed_log;
-
-		rc = attest_event_log_parse_v2(v_ctx, remaining_len, data,
-				log_entry->entry, first_log_entry->entry);
+	if (state->header.entry) {
+		rc = attest_event_log_parse_v2(v_ctx, state, remaining_len,
+					       data, log_entry->entry,
+					       state->header.entry);
 	} else {
-		rc = attest_event_log_parse_v1(v_ctx, remaining_len, data,
-					       &event_header);
-		if (!rc && event_header) {
-			first_log_entry = malloc(sizeof(*first_log_entry));
-			if (!first_log_entry) {
-				rc = -ENOMEM;
-				goto out;
-			}
-
-			first_log_entry->entry = event_header;
-			*first_parsed_log = first_log_entry;
-		}
+		rc = attest_event_log_parse_v1(v_ctx, state, remaining_len,
+					       data, &event_header);
+		if (!rc && event_header)
+			state->header.entry = event_header;
 	}
-out:
-	if (!rc)
-		*parsed_log = log_entry;
-	else
-		free(log_entry);
 
-	return rc;
+	if (rc)
+		return rc;
+
+	if (!*remaining_len && state->cacheable && !state->replayed)
+		attest_event_log_replay_add(v_ctx, state->key);
+
+	*parsed_log = log_entry;
+	return 0;
 }
 /** @}*/
@@ -27,8 +27,20 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "event_log/ima.h"
+#include "hash.h"
+
+/* logs smaller than this are parsed one entry at a time */
+#define IMA_PARSE_MIN_LEN 65536
+/* entries parsed and hashed before they are extended */
+#define IMA_PARSE_WINDOW 8192
+/* entries hashed by a thread at a time */
+#define IMA_PARSE_BATCH 64
+#define IMA_PARSE_MAX_THREADS 64
+/* header, template name and d-ng/n-ng fields with a SHA1 digest */
+#define IMA_ENTRY_MIN_LEN 64
 
 static struct ima_template_desc supported_templates[] = {
 	{.name = "ima", .num_fields = 2, .fields = {FIELD_DIGEST, FIELD_NAME}},
@@ -78,11 +90,22 @@ int ima_template_get_field(struct ima_log_entry *log_entry,
 {
 	int index;
 
+	if (field == FIELD_SIG) {
+		if (!log_entry->fields.sig)
+			return -ENOENT;
+
+		*data_len = log_entry->fields.sig_len;
+		*data_ptr = log_entry->fields.sig;
+		return 0;
+	}
+
 	index = ima_template_field_index(log_entry->desc, field);
 	if (index < 0)
 		return -ENOENT;
 
-	*data_len = *log_entry->template_data[index].len;
+	/* the digest of the ima template has a fixed length */
+	*data_len = log_entry->template_data[index].len ?
+		    *log_entry->template_data[index].len : SHA_DIGEST_LENGTH;
 	*data_ptr = log_entry->template_data[index].data;
 	return 0;
 }
@@ -95,39 +118,24 @@ int ima_template_get_field(struct ima_log_entry *log_entry,
  * @param[in,out] digest_len	length of file digest
  * @param[in,out] digest_ptr	pointer to file digest
  *
+ * The algorithm is NULL for the ima template (SHA1), and it is terminated by
+ * '\0' otherwise.
+ *
  * @returns 0 on success, a negative value on error
  */
 int ima_template_get_digest(struct ima_log_entry *log_entry, uint32_t *algo_len,
 			    const char **algo_ptr, uint32_t *digest_len,
 			    const unsigned char **digest_ptr)
 {
-	enum template_fields field;
-	const unsigned char *digest;
-	uint32_t ima_digest_len;
-	int rc;
-
-	field = FIELD_DIGEST_NG;
-	if (!strcmp(log_entry->desc->name, "ima"))
-		field = FIELD_DIGEST;
-
-	rc = ima_template_get_field(log_entry, field, &ima_digest_len, &digest);
-	if (rc)
-		return rc;
-
-	*algo_len = 0;
-	*algo_ptr = NULL;
+	struct ima_entry_fields *f = &log_entry->fields;
 
-	if (field == FIELD_DIGEST_NG) {
-		*algo_len = strchr((char *)digest, ':') - (char *)digest;
-		*algo_ptr = (char *)digest;
-
-		*digest_len = ima_digest_len - *algo_len - 2;
-		*digest_ptr = digest + *algo_len + 2;
-	} else {
-		*digest_len = SHA_DIGEST_LENGTH;
-		*digest_ptr = digest;
-	}
+	if (!f->digest)
+		return -ENOENT;
 
+	*algo_len = f->algo_len;
+	*algo_ptr = f->algo;
+	*digest_len = f->digest_len;
+	*digest_ptr = f->digest;
 	return 0;
 }
 
@@ -142,46 +150,140 @@ int ima_template_get_digest(struct ima_log_entry *log_entry, uint32_t *algo_len,
 int ima_template_get_eventname(struct ima_log_entry *log_entry,
 			uint32_t *eventname_len, const char **eventname_ptr)
 {
-	enum template_fields field;
+	struct ima_entry_fields *f = &log_entry->fields;
 
-	field = FIELD_NAME_NG;
-	if (!strcmp(log_entry->desc->name, "ima"))
-		field = FIELD_NAME;
+	if (!f->name)
+		return -ENOENT;
 
-	return ima_template_get_field(log_entry, field,
-		      eventname_len, (const unsigned char **)eventname_ptr);
+	*eventname_len = f->name_len;
+	*eventname_ptr = f->name;
+	return 0;
 }
 
-/**
- * Get data item to verify an IMA log entry
- * @param[in] ctx	data context
- * @param[in] ima_log	IMA event_log
- * @param[in] label	data label
- * @param[in,out] log_entry	IMA log entry reporting data item read
- *
- * @returns data item on success, NULL if not found
- */
-struct data_item *ima_lookup_data_item(attest_ctx_data *ctx,
+/* fill the fields of an entry, so that accessors don't parse them again */
+static int ima_template_resolve_fields(attest_ctx_verifier *v_ctx,
+				       struct ima_log_entry *log_entry)
+{
+	struct ima_entry_fields *f = &log_entry->fields;
+	struct ima_template_desc *desc = log_entry->desc;
+	const unsigned char *sep;
+	char *algo;
+	uint32_t len;
+	int i;
+
+	for (i = 0; i < desc->num_fields; i++) {
+		struct ima_field_data *t = log_entry->template_data + i;
+
+		len = t->len ? *t->len : SHA_DIGEST_LENGTH;
+
+		switch (desc->fields[i]) {
+		case FIELD_DIGEST:
+			f->digest = t->data;
+			f->digest_len = len;
+			break;
+		case FIELD_DIGEST_NG:
+			/* format: <algo>:\0<digest> */
+			sep = memchr(t->data, ':', len);
+			if (!sep || sep - t->data + 2 > len)
+				return -EINVAL;
+
+			f->algo_len = sep - t->data;
+
+			algo = attest_event_log_alloc(v_ctx, f->algo_len + 1);
+			if (!algo)
+				return -ENOMEM;
+
+			memcpy(algo, t->data, f->algo_len);
+			algo[f->algo_len] = '\0';
+
+			f->algo = algo;
+			f->digest = sep + 2;
+			f->digest_len = len - f->algo_len - 2;
+			break;
+		case FIELD_NAME:
+		case FIELD_NAME_NG:
+			f->name = (const char *)t->data;
+			f->name_len = len;
+			break;
+		case FIELD_SIG:
+			f->sig = t->data;
+			f->sig_len = len;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static struct data_item *ima_lookup_entry_data_item(attest_ctx_data *ctx,
+					struct event_log *ima_log,
+					const char *label,
+					struct event_log_entry *log_entry,
+					int *err)
+{
+	struct ima_log_entry *ima_log_entry;
+	struct data_item *item;
+	const char *algo_ptr;
+	const unsigned char *digest_ptr;
+	uint32_t algo_len, digest_len;
+
+	ima_log_entry = (struct ima_log_entry *)log_entry->log;
+
+	*err = ima_template_get_digest(ima_log_entry, &algo_len, &algo_ptr,
+				       &digest_len, &digest_ptr);
+	if (*err)
+		return NULL;
+
+	/* the algorithm is already terminated */
+	if (!algo_ptr)
+		algo_ptr = "";
+
+	item = attest_ctx_data_lookup_by_digest(ctx, algo_ptr, digest_ptr);
+	if (!item)
+		return NULL;
+
+	*err = attest_event_log_add_ref(ima_log, label, algo_ptr, digest_len,
+					digest_ptr);
+	if (*err)
+		return NULL;
+
+	return item;
+}
+
+static struct data_item *ima_lookup_log_data_item(attest_ctx_data *ctx,
 			struct event_log *ima_log, const char *label,
 			struct event_log_entry **log_entry)
 {
-	struct event_log_entry *cur_log_entry;
+	struct event_log_entry *cur_log_entry = NULL;
 	struct ima_log_entry *ima_log_entry;
-	const char *algo_ptr, *eventname_ptr;
-	const unsigned char *digest_ptr;
-	char algo[CRYPTO_MAX_ALG_NAME + 1];
-	uint32_t algo_len, digest_len, eventname_len;
+	const char *eventname_ptr;
+	uint32_t eventname_len;
 	struct data_item *item;
 	int rc;
 
+	if (ima_log->name_index) {
+		while ((cur_log_entry = attest_event_log_lookup_by_name(ima_log,
+							label, cur_log_entry))) {
+			item = ima_lookup_entry_data_item(ctx, ima_log, label,
+							  cur_log_entry, &rc);
+			if (rc)
+				return NULL;
+
+			if (!item)
+				continue;
+
+			*log_entry = cur_log_entry;
+			return item;
+		}
+
+		return NULL;
+	}
+
 	list_for_each_entry(cur_log_entry, &ima_log->logs, list) {
 		ima_log_entry = (struct ima_log_entry *)cur_log_entry->log;
 
-		rc = ima_template_get_digest(ima_log_entry, &algo_len,
-					&algo_ptr, &digest_len, &digest_ptr);
-		if (rc)
-			return NULL;
-
 		rc = ima_template_get_eventname(ima_log_entry,
 						&eventname_len, &eventname_ptr);
 		if (rc)
@@ -190,10 +292,11 @@ struct data_item *ima_lookup_data_item(attest_ctx_data *ctx,
 		if (strcmp(basename(eventname_ptr), label))
 			continue;
 
-		memcpy(algo, algo_ptr, algo_len);
-		algo[algo_len] = '\0';
+		item = ima_lookup_entry_data_item(ctx, ima_log, label,
+						  cur_log_entry, &rc);
+		if (rc)
+			return NULL;
 
-		item = attest_ctx_data_lookup_by_digest(ctx, algo, digest_ptr);
 		if (!item)
 			continue;
 
@@ -205,10 +308,137 @@ struct data_item *ima_lookup_data_item(attest_ctx_data *ctx,
 	return NULL;
 }
 
+/**
+ * Get data item to verify an IMA log entry
+ * @param[in] ctx	data context
+ * @param[in] ima_log	IMA event_log
+ * @param[in] label	data label
+ * @param[in,out] log_entry	IMA log entry reporting data item read
+ *
+ * If verification was resumed from a checkpoint, the entry could have been
+ * verified previously. In this case, the data item is found from the digest
+ * saved in the checkpoint and log_entry is set to NULL.
+ *
+ * @returns data item on success, NULL if not found
+ */
+struct data_item *ima_lookup_data_item(attest_ctx_data *ctx,
+			struct event_log *ima_log, const char *label,
+			struct event_log_entry **log_entry)
+{
+	struct event_log_ref *ref;
+	struct data_item *item;
+
+	item = ima_lookup_log_data_item(ctx, ima_log, label, log_entry);
+	if (item || !ima_log->offset)
+		return item;
+
+	list_for_each_entry(ref, &ima_log->refs, list) {
+		if (strcmp(ref->name, label))
+			continue;
+
+		item = attest_ctx_data_lookup_by_digest(ctx, ref->algo,
+							ref->digest);
+		if (!item)
+			continue;
+
+		*log_entry = NULL;
+		return item;
+	}
+
+	return NULL;
+}
+
 /// @private
-int attest_event_log_parse(attest_ctx_verifier *v_ctx, uint32_t *remaining_len,
-			   unsigned char **data, void **parsed_log,
-			   void **first_parsed_log)
+const char *attest_event_log_entry_name(void *parsed_log)
+{
+	const char *eventname_ptr;
+	uint32_t eventname_len;
+	int rc;
+
+	rc = ima_template_get_eventname((struct ima_log_entry *)parsed_log,
+					&eventname_len, &eventname_ptr);
+	if (rc)
+		return NULL;
+
+	return basename(eventname_ptr);
+}
+
+/* digests calculated for an entry: SHA1 template digest and other banks */
+struct ima_parse_layout {
+	TPM_ALG_ID algs[PCR_BANK__LAST];
+	uint32_t offsets[PCR_BANK__LAST];
+	int num_algs;
+	uint32_t stride;
+};
+
+/* entry parsed and hashed, still to be extended */
+struct ima_pending {
+	struct ima_log_entry *log_entry;
+	struct ima_template_entry *ima_entry;
+	const uint8_t *hash_data;
+	uint32_t hash_len;
+	int violation;
+	uint8_t *digests;
+	unsigned char *next_data;
+	uint32_t next_len;
+	int rc;
+};
+
+/* parsing state, stored as first parsed log (without window if small) */
+struct ima_log_state {
+	struct ima_parse_layout layout;
+	struct ima_pending *window;
+	uint8_t *digests;
+	int window_size;
+	int num_pending;
+	int next;
+	int num_threads;
+	int num_extended;
+};
+
+struct ima_hash_pool {
+	struct ima_parse_layout *layout;
+	struct ima_pending *entries;
+	int num_entries;
+	int next_entry;
+	pthread_mutex_t lock;
+};
+
+struct ima_template_data {
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	unsigned char eventname[TCG_EVENT_NAME_LEN_MAX + 1];
+} __attribute__((packed));
+
+static void ima_parse_layout(attest_ctx_verifier *v_ctx,
+			     struct ima_parse_layout *layout)
+{
+	TPM_ALG_ID alg;
+	int i;
+
+	layout->algs[0] = TPM_ALG_SHA1;
+	layout->offsets[0] = 0;
+	layout->stride = SHA_DIGEST_LENGTH;
+	layout->num_algs = 1;
+
+	for (i = 0; i < PCR_BANK__LAST; i++) {
+		alg = attest_pcr_bank_alg(i);
+		if (alg == TPM_ALG_SHA1)
+			continue;
+
+		if (!attest_pcr_bank_selected(v_ctx, alg))
+			continue;
+
+		layout->algs[layout->num_algs] = alg;
+		layout->offsets[layout->num_algs] = layout->stride;
+		layout->stride += TSS_GetDigestSize(alg);
+		layout->num_algs++;
+	}
+}
+
+/* an entry is parsed, template_data is allocated if not provided */
+static int ima_parse_entry(attest_ctx_verifier *v_ctx, uint32_t *remaining_len,
+			   unsigned char **data, struct ima_pending *p,
+			   struct ima_template_data *template_data)
 {
 	struct ima_template_desc *desc;
 	struct ima_log_entry *log_entry;
@@ -216,36 +446,29 @@ int attest_event_log_parse(attest_ctx_verifier *v_ctx, uint32_t *remaining_len,
 	unsigned char *ima_data, *saved_ima_data;
 	uint32_t *ima_data_len, saved_ima_data_len;
 	char *template;
-	TPMT_HA digest;
-	int rc = -ENOMEM, i, violation = 0;
 	uint8_t zero[SHA_DIGEST_LENGTH] = { 0 };
-	uint8_t one[SHA512_DIGEST_LENGTH];
-
-	struct {
-		unsigned char digest[SHA_DIGEST_LENGTH];
-		unsigned char eventname[TCG_EVENT_NAME_LEN_MAX + 1];
-	} __attribute__((packed)) ima_template_data;
+	int rc, i;
 
 	check_set_ptr(*remaining_len, *data,
 		      sizeof(ima_entry->header), typeof(*ima_entry), ima_entry);
 	check_set_ptr(*remaining_len, *data,
 		      ima_entry->header.name_len, char, template);
 
-	if (!memcmp(ima_entry->header.digest, zero, SHA_DIGEST_LENGTH)) {
-		memset(one, 0xff, sizeof(one));
-		violation = 1;
-	}
+	if (ima_entry->header.pcr >= IMPLEMENTATION_PCR)
+		return -EINVAL;
+
+	p->ima_entry = ima_entry;
+	p->violation = !memcmp(ima_entry->header.digest, zero,
+			       SHA_DIGEST_LENGTH);
 
 	desc = lookup_template_desc(ima_entry->header.name_len, template);
 	if (!desc)
 		return -ENOTSUP;
 
-	log_entry = malloc(sizeof(*log_entry) +
+	log_entry = attest_event_log_alloc(v_ctx, sizeof(*log_entry) +
 			   desc->num_fields * sizeof(*log_entry->template_data));
-	if (!log_entry) {
-		rc = -ENOMEM;
-		goto out;
-	}
+	if (!log_entry)
+		return -ENOMEM;
 
 	log_entry->desc = desc;
 
@@ -274,59 +497,262 @@ int attest_event_log_parse(attest_ctx_verifier *v_ctx, uint32_t *remaining_len,
 
 		check_set_ptr(saved_ima_data_len, saved_ima_data,
 			      len, typeof(*t->data), t->data);
-
-		if (desc->fields[i] == FIELD_DIGEST ||
-		    desc->fields[i] == FIELD_NAME)
-			memcpy(ima_template_data.digest, t->data, len);
 	}
 
-	if (!strcmp(desc->name, "ima")) {
-		*ima_data_len = sizeof(ima_template_data);
-		ima_data = (unsigned char *)&ima_template_data;
+	rc = ima_template_resolve_fields(v_ctx, log_entry);
+	if (rc)
+		return rc;
+
+	p->log_entry = log_entry;
+	p->hash_data = ima_data;
+	p->hash_len = *ima_data_len;
+
+	if (strcmp(desc->name, "ima"))
+		return 0;
+
+	/* fields of the ima template are not preceded by the data length */
+	*remaining_len = saved_ima_data_len;
+	*data = saved_ima_data;
+
+	if (log_entry->fields.name_len > TCG_EVENT_NAME_LEN_MAX)
+		return -EINVAL;
+
+	if (!template_data) {
+		template_data = attest_event_log_alloc(v_ctx,
+						       sizeof(*template_data));
+		if (!template_data)
+			return -ENOMEM;
+	} else {
+		memset(template_data, 0, sizeof(*template_data));
 	}
 
-	if (!violation) {
-		rc = attest_event_log_verify_digest(v_ctx, SHA_DIGEST_LENGTH,
-					ima_entry->header.digest, *ima_data_len,
-					ima_data, TPM_ALG_SHA1);
-		if (rc)
-			goto out;
+	memcpy(template_data->digest, log_entry->fields.digest,
+	       SHA_DIGEST_LENGTH);
+	memcpy(template_data->eventname, log_entry->fields.name,
+	       log_entry->fields.name_len);
+
+	p->hash_data = (uint8_t *)template_data;
+	p->hash_len = sizeof(*template_data);
+	return 0;
+}
+
+/* template digest and digests for the other banks in one batch */
+static void ima_hash_entry(struct ima_parse_layout *layout,
+			   struct ima_pending *p)
+{
+	struct hash_req reqs[PCR_BANK__LAST];
+	int i, num_reqs = 0;
+
+	for (i = p->violation ? 1 : 0; i < layout->num_algs; i++) {
+		reqs[num_reqs].alg = layout->algs[i];
+		reqs[num_reqs].len = p->hash_len;
+		reqs[num_reqs].data = p->hash_data;
+		reqs[num_reqs].digest = p->digests + layout->offsets[i];
+		num_reqs++;
 	}
 
+	p->rc = attest_hash_batch(num_reqs, reqs);
+}
+
+static int ima_extend_entry(attest_ctx_verifier *v_ctx,
+			    struct ima_log_state *state,
+			    struct ima_pending *p)
+{
+	struct ima_parse_layout *layout = &state->layout;
+	struct ima_template_entry *ima_entry = p->ima_entry;
+	uint8_t one[SHA512_DIGEST_LENGTH];
+	int rc, i, use_one, index = state->num_extended++;
+
+	current_log(v_ctx);
+
+	check_goto(p->rc, p->rc, out, v_ctx,
+		   "cannot calculate digests of entry #%d", index);
+
+	check_goto(!p->violation &&
+		   memcmp(p->digests, ima_entry->header.digest,
+			  SHA_DIGEST_LENGTH), -EINVAL, out, v_ctx,
+		   "template digest mismatch of entry #%d", index);
+
+	use_one = p->violation && (v_ctx->flags & CTX_ALLOW_IMA_VIOLATIONS);
+	if (use_one)
+		memset(one, 0xff, sizeof(one));
+
 	rc = attest_pcr_extend(v_ctx, ima_entry->header.pcr, TPM_ALG_SHA1,
-			(violation &&
-			(v_ctx->flags & CTX_ALLOW_IMA_VIOLATIONS) ?
-			one : ima_entry->header.digest));
+			       use_one ? one : ima_entry->header.digest);
 	if (rc)
 		goto out;
 
-	for (i = 0; i < PCR_BANK__LAST; i++) {
-		if (attest_pcr_bank_alg(i) == TPM_ALG_SHA1)
-			continue;
+	for (i = 1; i < layout->num_algs; i++) {
+		rc = attest_pcr_extend(v_ctx, ima_entry->header.pcr,
+				       layout->algs[i], use_one ? one :
+				       p->digests + layout->offsets[i]);
+		if (rc < 0)
+			break;
+	}
+out:
+	return rc;
+}
+
+static void *ima_hash_worker(void *arg)
+{
+	struct ima_hash_pool *pool = (struct ima_hash_pool *)arg;
+	int i, start, end;
 
-		digest.hashAlg = attest_pcr_bank_alg(i);
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		start = pool->next_entry;
+		pool->next_entry += IMA_PARSE_BATCH;
+		pthread_mutex_unlock(&pool->lock);
 
-		rc = TSS_Hash_Generate(&digest, *ima_data_len, ima_data, 0,
-				       NULL);
-		if (rc) {
-			rc = -EINVAL;
+		if (start >= pool->num_entries)
 			break;
-		}
 
-		rc = attest_pcr_extend(v_ctx, ima_entry->header.pcr,
-				digest.hashAlg,
-				(violation &&
-				(v_ctx->flags & CTX_ALLOW_IMA_VIOLATIONS)) ?
-				one : (uint8_t *)&digest.digest);
-		if (rc < 0)
+		end = start + IMA_PARSE_BATCH;
+		if (end > pool->num_entries)
+			end = pool->num_entries;
+
+		for (i = start; i < end; i++)
+			ima_hash_entry(pool->layout, pool->entries + i);
+	}
+
+	return NULL;
+}
+
+/* entries of a window are hashed in parallel, and extended in order later */
+static int ima_parse_window(attest_ctx_verifier *v_ctx,
+			    struct ima_log_state *state,
+			    uint32_t remaining_len, unsigned char *data)
+{
+	struct ima_hash_pool pool = { .layout = &state->layout,
+				      .entries = state->window };
+	pthread_t threads[IMA_PARSE_MAX_THREADS];
+	struct ima_pending *p;
+	int rc = 0, i, started = 0;
+
+	for (i = 0; i < state->window_size && remaining_len > 0; i++) {
+		p = state->window + i;
+		memset(p, 0, sizeof(*p));
+
+		rc = ima_parse_entry(v_ctx, &remaining_len, &data, p, NULL);
+		if (rc)
 			break;
+
+		p->digests = state->digests + i * state->layout.stride;
+		p->next_data = data;
+		p->next_len = remaining_len;
 	}
-out:
-	if (!rc)
-		*parsed_log = log_entry;
-	else
-		free(log_entry);
 
-	return rc;
+	/* an invalid entry is reported when the previous ones are extended */
+	if (!i)
+		return rc;
+
+	pool.num_entries = i;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (i = 1; i < state->num_threads &&
+	     i * IMA_PARSE_BATCH < pool.num_entries; i++) {
+		if (pthread_create(&threads[started], NULL, ima_hash_worker,
+				   &pool))
+			break;
+
+		started++;
+	}
+
+	ima_hash_worker(&pool);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&pool.lock);
+
+	state->num_pending = pool.num_entries;
+	state->next = 0;
+	return 0;
+}
+
+static struct ima_log_state *ima_log_state_new(attest_ctx_verifier *v_ctx,
+					       uint32_t remaining_len)
+{
+	struct ima_log_state *state;
+
+	state = attest_event_log_alloc(v_ctx, sizeof(*state));
+	if (!state)
+		return NULL;
+
+	ima_parse_layout(v_ctx, &state->layout);
+
+	/* small logs are parsed one entry at a time */
+	if (remaining_len < IMA_PARSE_MIN_LEN)
+		return state;
+
+	state->window_size = remaining_len / IMA_ENTRY_MIN_LEN + 1;
+	if (state->window_size > IMA_PARSE_WINDOW)
+		state->window_size = IMA_PARSE_WINDOW;
+
+	state->window = attest_event_log_alloc(v_ctx, state->window_size *
+					       sizeof(*state->window));
+	state->digests = attest_event_log_alloc(v_ctx, state->window_size *
+						state->layout.stride);
+	if (!state->window || !state->digests)
+		return NULL;
+
+	state->num_threads = attest_ctx_verifier_get_num_threads(v_ctx);
+	if (state->num_threads > IMA_PARSE_MAX_THREADS)
+		state->num_threads = IMA_PARSE_MAX_THREADS;
+
+	return state;
+}
+
+/// @private
+int attest_event_log_parse(attest_ctx_verifier *v_ctx, uint32_t *remaining_len,
+			   unsigned char **data, void **parsed_log,
+			   void **first_parsed_log)
+{
+	struct ima_log_state *state = *first_parsed_log;
+	struct ima_template_data template_data;
+	struct ima_pending *p, pending = { 0 };
+	uint8_t digests[PCR_BANK__LAST * SHA512_DIGEST_LENGTH];
+	int rc;
+
+	if (!state) {
+		state = ima_log_state_new(v_ctx, *remaining_len);
+		if (!state)
+			return -ENOMEM;
+
+		*first_parsed_log = state;
+	}
+
+	if (!state->window_size) {
+		rc = ima_parse_entry(v_ctx, remaining_len, data, &pending,
+				     &template_data);
+		if (rc)
+			return rc;
+
+		pending.digests = digests;
+		ima_hash_entry(&state->layout, &pending);
+
+		rc = ima_extend_entry(v_ctx, state, &pending);
+		if (!rc)
+			*parsed_log = pending.log_entry;
+
+		return rc;
+	}
+
+	if (state->next == state->num_pending) {
+		rc = ima_parse_window(v_ctx, state, *remaining_len, *data);
+		if (rc)
+			return rc;
+	}
+
+	p = state->window + state->next++;
+
+	rc = ima_extend_entry(v_ctx, state, p);
+	if (rc)
+		return rc;
+
+	*data = p->next_data;
+	*remaining_len = p->next_len;
+	*parsed_log = p->log_entry;
+	return 0;
 }
 /** @}*/
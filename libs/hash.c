@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: hash.c
+ *      Hash functions for event log replay.
+ */
+
+/**
+ * @defgroup hash-api Hash API
+ * @ingroup developer-api
+ * @brief
+ * Functions to calculate digests of event log data and to extend PCRs
+ *
+ * Digests are calculated with a per-thread OpenSSL context, reused for
+ * every request, so that the optimized implementation selected by
+ * OpenSSL for the CPU is used without allocating a context for each
+ * event log entry.
+ */
+
+/**
+ * \addtogroup hash-api
+ *  @{
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <openssl/evp.h>
+
+#include "hash.h"
+
+static pthread_once_t hash_ctx_once = PTHREAD_ONCE_INIT;
+static pthread_key_t hash_ctx_key;
+
+static void attest_hash_ctx_free(void *mdctx)
+{
+	EVP_MD_CTX_destroy(mdctx);
+}
+
+static void attest_hash_ctx_key_init(void)
+{
+	pthread_key_create(&hash_ctx_key, attest_hash_ctx_free);
+}
+
+static EVP_MD_CTX *attest_hash_ctx(void)
+{
+	EVP_MD_CTX *mdctx;
+
+	pthread_once(&hash_ctx_once, attest_hash_ctx_key_init);
+
+	mdctx = pthread_getspecific(hash_ctx_key);
+	if (mdctx)
+		return mdctx;
+
+	mdctx = EVP_MD_CTX_create();
+	if (!mdctx)
+		return NULL;
+
+	if (pthread_setspecific(hash_ctx_key, mdctx)) {
+		EVP_MD_CTX_destroy(mdctx);
+		return NULL;
+	}
+
+	return mdctx;
+}
+
+static const EVP_MD *attest_hash_md(TPM_ALG_ID alg)
+{
+	switch (alg) {
+	case TPM_ALG_SHA1:
+		return EVP_sha1();
+	case TPM_ALG_SHA256:
+		return EVP_sha256();
+	case TPM_ALG_SHA384:
+		return EVP_sha384();
+	case TPM_ALG_SHA512:
+		return EVP_sha512();
+	default:
+		return NULL;
+	}
+}
+
+static int attest_hash_calc(EVP_MD_CTX *mdctx, TPM_ALG_ID alg,
+			    uint32_t len1, const uint8_t *data1,
+			    uint32_t len2, const uint8_t *data2,
+			    uint8_t *digest)
+{
+	const EVP_MD *md = attest_hash_md(alg);
+
+	if (!md)
+		return -ENOENT;
+
+	if (EVP_DigestInit_ex(mdctx, md, NULL) != 1)
+		return -EINVAL;
+
+	if (EVP_DigestUpdate(mdctx, data1, len1) != 1)
+		return -EINVAL;
+
+	if (len2 && EVP_DigestUpdate(mdctx, data2, len2) != 1)
+		return -EINVAL;
+
+	if (EVP_DigestFinal_ex(mdctx, digest, NULL) != 1)
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * Calculate the digest of data
+ * @param[in] alg	digest algorithm
+ * @param[in] len	data length
+ * @param[in] data	data
+ * @param[in,out] digest	calculated digest
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_hash_data(TPM_ALG_ID alg, uint32_t len, const uint8_t *data,
+		     uint8_t *digest)
+{
+	EVP_MD_CTX *mdctx = attest_hash_ctx();
+
+	if (!mdctx)
+		return -ENOMEM;
+
+	return attest_hash_calc(mdctx, alg, len, data, 0, NULL, digest);
+}
+
+/**
+ * Calculate independent digests
+ * @param[in] num_reqs	number of requests
+ * @param[in,out] reqs	requests
+ *
+ * Requests are currently processed one after another, OpenSSL has no public
+ * multi-buffer API.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_hash_batch(int num_reqs, struct hash_req *reqs)
+{
+	EVP_MD_CTX *mdctx = attest_hash_ctx();
+	int rc, i;
+
+	if (!mdctx)
+		return -ENOMEM;
+
+	for (i = 0; i < num_reqs; i++) {
+		rc = attest_hash_calc(mdctx, reqs[i].alg, reqs[i].len,
+				      reqs[i].data, 0, NULL, reqs[i].digest);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Extend a PCR value
+ * @param[in] alg	PCR bank
+ * @param[in,out] pcr	PCR value
+ * @param[in] digest	digest to extend the PCR
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_hash_extend(TPM_ALG_ID alg, uint8_t *pcr, const uint8_t *digest)
+{
+	EVP_MD_CTX *mdctx = attest_hash_ctx();
+	const EVP_MD *md = attest_hash_md(alg);
+
+	if (!mdctx)
+		return -ENOMEM;
+
+	if (!md)
+		return -ENOENT;
+
+	return attest_hash_calc(mdctx, alg, EVP_MD_size(md), pcr,
+				EVP_MD_size(md), digest, pcr);
+}
+/** @}*/
@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: metrics.c
+ *      Counters and histograms exported in the Prometheus text format.
+ */
+
+/**
+ * @defgroup metrics-api Metrics API
+ * @ingroup developer-api
+ * @brief
+ * Functions to record and export operational metrics of the servers
+ *
+ * Metrics are identified by name and by a label string (for example
+ * op="quote"), and are recorded only after attest_metrics_enable() is
+ * called, so that clients and tools do not pay for them. Durations are
+ * recorded in histograms with fixed buckets.
+ */
+
+/**
+ * \addtogroup metrics-api
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "list.h"
+#include "metrics.h"
+
+#define METRICS_MAX_LABELS_LEN 256
+#define METRICS_READ_TIMEOUT 1000
+
+/* upper bounds of histogram buckets, in microseconds */
+static const uint64_t duration_buckets[] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+	250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+#define NUM_BUCKETS (sizeof(duration_buckets) / sizeof(*duration_buckets))
+
+enum metric_types { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM,
+		    METRIC__LAST };
+
+static const char *metric_types_str[METRIC__LAST] = {
+	[METRIC_COUNTER] = "counter",
+	[METRIC_GAUGE] = "gauge",
+	[METRIC_HISTOGRAM] = "histogram",
+};
+
+struct metric_series {
+	struct list_head list;
+	char *labels;
+	int64_t value;
+	uint64_t sum;
+	uint64_t buckets[NUM_BUCKETS];
+};
+
+struct metric_family {
+	struct list_head list;
+	struct list_head series;
+	char *name;
+	enum metric_types type;
+};
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(metric_families);
+static int metrics_enabled;
+
+/**
+ * Start recording metrics
+ *
+ * Must be called before the threads recording metrics are created.
+ */
+void attest_metrics_enable(void)
+{
+	metrics_enabled = 1;
+}
+
+/**
+ * Return time from a monotonic clock
+ *
+ * @returns time in microseconds
+ */
+uint64_t attest_metrics_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct metric_family *attest_metrics_get_family(const char *name,
+						enum metric_types type)
+{
+	struct metric_family *family;
+
+	list_for_each_entry(family, &metric_families, list) {
+		if (!strcmp(family->name, name))
+			return family->type == type ? family : NULL;
+	}
+
+	family = calloc(1, sizeof(*family));
+	if (!family)
+		return NULL;
+
+	family->name = strdup(name);
+	if (!family->name) {
+		free(family);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&family->series);
+	family->type = type;
+
+	list_add_tail(&family->list, &metric_families);
+	return family;
+}
+
+static struct metric_series *attest_metrics_get_series(const char *name,
+						enum metric_types type,
+						const char *labels)
+{
+	struct metric_family *family;
+	struct metric_series *series;
+
+	family = attest_metrics_get_family(name, type);
+	if (!family)
+		return NULL;
+
+	list_for_each_entry(series, &family->series, list) {
+		if (!strcmp(series->labels, labels))
+			return series;
+	}
+
+	series = calloc(1, sizeof(*series));
+	if (!series)
+		return NULL;
+
+	series->labels = strdup(labels);
+	if (!series->labels) {
+		free(series);
+		return NULL;
+	}
+
+	list_add_tail(&series->list, &family->series);
+	return series;
+}
+
+/* values are dropped if there is no memory for a new series */
+static void attest_metrics_update(const char *name, enum metric_types type,
+				  int64_t value, const char *labels_fmt,
+				  va_list ap)
+{
+	char labels[METRICS_MAX_LABELS_LEN] = "";
+	struct metric_series *series;
+	int i;
+
+	if (labels_fmt)
+		vsnprintf(labels, sizeof(labels), labels_fmt, ap);
+
+	pthread_mutex_lock(&metrics_lock);
+	series = attest_metrics_get_series(name, type, labels);
+	if (!series)
+		goto out;
+
+	series->value += (type == METRIC_HISTOGRAM) ? 1 : value;
+
+	if (type != METRIC_HISTOGRAM)
+		goto out;
+
+	series->sum += value;
+
+	for (i = 0; i < NUM_BUCKETS; i++)
+		if (value <= duration_buckets[i])
+			series->buckets[i]++;
+out:
+	pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * Increment counter
+ * @param[in] name		metric name
+ * @param[in] value		value to add
+ * @param[in] labels_fmt	format of the labels (can be NULL)
+ * @param[in] ...		data to be added to the labels
+ */
+void attest_metrics_inc(const char *name, uint64_t value,
+			const char *labels_fmt, ...)
+{
+	va_list ap;
+
+	if (!metrics_enabled)
+		return;
+
+	va_start(ap, labels_fmt);
+	attest_metrics_update(name, METRIC_COUNTER, value, labels_fmt, ap);
+	va_end(ap);
+}
+
+/**
+ * Add value to gauge
+ * @param[in] name		metric name
+ * @param[in] delta		value to add (can be negative)
+ * @param[in] labels_fmt	format of the labels (can be NULL)
+ * @param[in] ...		data to be added to the labels
+ */
+void attest_metrics_gauge_add(const char *name, int64_t delta,
+			      const char *labels_fmt, ...)
+{
+	va_list ap;
+
+	if (!metrics_enabled)
+		return;
+
+	va_start(ap, labels_fmt);
+	attest_metrics_update(name, METRIC_GAUGE, delta, labels_fmt, ap);
+	va_end(ap);
+}
+
+/**
+ * Add duration to histogram
+ * @param[in] name		metric name
+ * @param[in] usec		duration in microseconds
+ * @param[in] labels_fmt	format of the labels (can be NULL)
+ * @param[in] ...		data to be added to the labels
+ */
+void attest_metrics_observe(const char *name, uint64_t usec,
+			    const char *labels_fmt, ...)
+{
+	va_list ap;
+
+	if (!metrics_enabled)
+		return;
+
+	va_start(ap, labels_fmt);
+	attest_metrics_update(name, METRIC_HISTOGRAM, usec, labels_fmt, ap);
+	va_end(ap);
+}
+
+/**
+ * Record cache lookup
+ * @param[in] cache	cache name
+ * @param[in] hit	whether the lookup found the entry
+ */
+void attest_metrics_cache(const char *cache, int hit)
+{
+	attest_metrics_inc(METRIC_CACHE_LOOKUPS, 1,
+			   "cache=\"%s\",result=\"%s\"", cache,
+			   hit ? "hit" : "miss");
+}
+
+static void attest_metrics_print_histogram(FILE *fp,
+					   struct metric_family *family,
+					   struct metric_series *series)
+{
+	const char *sep = strlen(series->labels) ? "," : "";
+	int i;
+
+	for (i = 0; i < NUM_BUCKETS; i++)
+		fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %llu\n", family->name,
+			series->labels, sep, duration_buckets[i] / 1000000.0,
+			(unsigned long long)series->buckets[i]);
+
+	fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %lld\n", family->name,
+		series->labels, sep, (long long)series->value);
+
+	sep = strlen(series->labels) ? "{" : "";
+	fprintf(fp, "%s_sum%s%s%s %.6f\n", family->name, sep, series->labels,
+		*sep ? "}" : "", series->sum / 1000000.0);
+	fprintf(fp, "%s_count%s%s%s %lld\n", family->name, sep,
+		series->labels, *sep ? "}" : "", (long long)series->value);
+}
+
+/**
+ * Print metrics in the Prometheus text format
+ *
+ * Returned string must be freed by the caller.
+ *
+ * @returns metrics on success, NULL on error
+ */
+char *attest_metrics_print(void)
+{
+	struct metric_family *family;
+	struct metric_series *series;
+	char *output = NULL;
+	size_t len;
+	FILE *fp;
+
+	fp = open_memstream(&output, &len);
+	if (!fp)
+		return NULL;
+
+	pthread_mutex_lock(&metrics_lock);
+	list_for_each_entry(family, &metric_families, list) {
+		fprintf(fp, "# TYPE %s %s\n", family->name,
+			metric_types_str[family->type]);
+
+		list_for_each_entry(series, &family->series, list) {
+			if (family->type == METRIC_HISTOGRAM) {
+				attest_metrics_print_histogram(fp, family,
+							       series);
+				continue;
+			}
+
+			if (strlen(series->labels))
+				fprintf(fp, "%s{%s} %lld\n", family->name,
+					series->labels,
+					(long long)series->value);
+			else
+				fprintf(fp, "%s %lld\n", family->name,
+					(long long)series->value);
+		}
+	}
+	pthread_mutex_unlock(&metrics_lock);
+
+	if (fclose(fp)) {
+		free(output);
+		return NULL;
+	}
+
+	return output;
+}
+
+/* a scraper closing the connection must not kill the process with SIGPIPE */
+static int attest_metrics_send(int fd, const char *buf, size_t len)
+{
+	ssize_t cur_len;
+
+	while (len) {
+		cur_len = send(fd, buf, len, MSG_NOSIGNAL);
+		if (cur_len < 0 && errno == EINTR)
+			continue;
+		if (cur_len <= 0)
+			return -EIO;
+
+		buf += cur_len;
+		len -= cur_len;
+	}
+
+	return 0;
+}
+
+/* the request is not parsed, every request returns the metrics */
+static void attest_metrics_handle_connection(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char buf[1024], header[256];
+	char *output;
+	int len;
+
+	if (poll(&pfd, 1, METRICS_READ_TIMEOUT) == 1)
+		if (read(fd, buf, sizeof(buf)) < 0)
+			return;
+
+	output = attest_metrics_print();
+	if (!output) {
+		len = snprintf(header, sizeof(header),
+			       "HTTP/1.0 500 Internal Server Error\r\n"
+			       "Content-Length: 0\r\n\r\n");
+		attest_metrics_send(fd, header, len);
+		return;
+	}
+
+	len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+		       "Content-Type: text/plain; version=0.0.4\r\n"
+		       "Content-Length: %zu\r\n\r\n", strlen(output));
+
+	if (!attest_metrics_send(fd, header, len))
+		attest_metrics_send(fd, output, strlen(output));
+	free(output);
+}
+
+static void *attest_metrics_thread(void *arg)
+{
+	struct timeval timeout = { .tv_sec = METRICS_READ_TIMEOUT / 1000 };
+	int fd_socket = (long)arg, fd;
+
+	while (1) {
+		fd = accept(fd_socket, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		/* a stalled scraper must not block the others forever */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+			   sizeof(timeout));
+
+		attest_metrics_handle_connection(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/**
+ * Enable metrics and export them over HTTP
+ * @param[in] bind_addr	IPv4 address to listen on (NULL for loopback)
+ * @param[in] port	TCP port
+ *
+ * Metrics are returned by a separate thread for any request. They are
+ * exported only on the loopback interface, unless an address is given.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_metrics_serve(const char *bind_addr, int port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	int fd_socket, reuse_addr = 1, rc;
+	pthread_t thread;
+
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if (bind_addr && inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1)
+		return -EINVAL;
+
+	fd_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd_socket < 0)
+		return -errno;
+
+	setsockopt(fd_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_addr,
+		   sizeof(reuse_addr));
+
+	if (bind(fd_socket, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd_socket, SOMAXCONN)) {
+		rc = -errno;
+		goto out;
+	}
+
+	attest_metrics_enable();
+
+	rc = pthread_create(&thread, NULL, attest_metrics_thread,
+			    (void *)(long)fd_socket);
+	if (rc) {
+		rc = -rc;
+		goto out;
+	}
+
+	pthread_detach(thread);
+out:
+	if (rc)
+		close(fd_socket);
+
+	return rc;
+}
+/** @}*/
@@ -29,6 +29,7 @@
 #include <errno.h>
 
 #include "pcr.h"
+#include "hash.h"
 
 static TPMI_ALG_HASH supported_algorithms[PCR_BANK__LAST] = {
 	[PCR_BANK_SHA1] = TPM_ALG_SHA1,
@@ -84,7 +85,7 @@ int attest_pcr_init(attest_ctx_verifier *v_ctx)
 
 	current_log(v_ctx);
 
-	pcr = malloc(sizeof(TPMT_HA) * PCR_BANK__LAST * IMPLEMENTATION_PCR);
+	pcr = malloc(PCR_ARRAY_SIZE);
 	check_goto(!pcr, -ENOMEM, out, ctx, "out of memory");
 
 	for (i = 0; i < PCR_BANK__LAST; i++) {
@@ -108,12 +109,110 @@ void attest_pcr_cleanup(attest_ctx_verifier *v_ctx)
 	free(v_ctx->pcr);
 }
 
+/**
+ * Get the PCR banks calculated when parsing event logs
+ * @param[in] v_ctx	verifier context
+ *
+ * @returns mask of banks (all if not selected)
+ */
+uint8_t attest_pcr_bank_mask(attest_ctx_verifier *v_ctx)
+{
+	return v_ctx->pcr_bank_mask ? v_ctx->pcr_bank_mask : PCR_BANK_MASK_ALL;
+}
+
+/**
+ * Check if a PCR bank is calculated when parsing event logs
+ * @param[in] v_ctx	verifier context
+ * @param[in] alg	PCR bank
+ *
+ * @returns 0 if the bank is supported and not selected, 1 otherwise
+ */
+int attest_pcr_bank_selected(attest_ctx_verifier *v_ctx, TPMI_ALG_HASH alg)
+{
+	enum pcr_banks pcr_bank;
+
+	/* let the caller report unsupported banks */
+	pcr_bank = attest_pcr_lookup_bank(alg);
+	if (pcr_bank == PCR_BANK__LAST)
+		return 1;
+
+	return !!(attest_pcr_bank_mask(v_ctx) & (1 << pcr_bank));
+}
+
+/**
+ * Calculate only the PCR banks in a PCR selection
+ * @param[in] v_ctx	verifier context
+ * @param[in] pcrs	PCR selection
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_pcr_select_banks(attest_ctx_verifier *v_ctx,
+			    TPML_PCR_SELECTION *pcrs)
+{
+	enum pcr_banks pcr_bank;
+	uint8_t mask = 0;
+	int i;
+
+	for (i = 0; i < pcrs->count; i++) {
+		pcr_bank = attest_pcr_lookup_bank(pcrs->pcrSelections[i].hash);
+		if (pcr_bank == PCR_BANK__LAST)
+			return -ENOENT;
+
+		mask |= (1 << pcr_bank);
+	}
+
+	if (!mask)
+		return -ENOENT;
+
+	v_ctx->pcr_bank_mask = mask;
+	return 0;
+}
+
+/**
+ * Take a snapshot of the current PCR values
+ * @param[in] v_ctx	verifier context
+ *
+ * @returns snapshot on success, NULL on error
+ */
+void *attest_pcr_snapshot(attest_ctx_verifier *v_ctx)
+{
+	void *snapshot;
+
+	if (!v_ctx->pcr)
+		return NULL;
+
+	snapshot = malloc(PCR_ARRAY_SIZE);
+	if (!snapshot)
+		return NULL;
+
+	memcpy(snapshot, v_ctx->pcr, PCR_ARRAY_SIZE);
+	return snapshot;
+}
+
+/**
+ * Restore PCR values from a snapshot
+ * @param[in] v_ctx	verifier context
+ * @param[in] snapshot	snapshot taken with attest_pcr_snapshot()
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_pcr_restore(attest_ctx_verifier *v_ctx, void *snapshot)
+{
+	if (!v_ctx->pcr || !snapshot)
+		return -EINVAL;
+
+	memcpy(v_ctx->pcr, snapshot, PCR_ARRAY_SIZE);
+	return 0;
+}
+
 /**
  * Retrieve current value of a PCR
  * @param[in] v_ctx	verifier context
  * @param[in] pcr_num	PCR number
  * @param[in] alg	PCR bank
  *
+ * PCRs of banks not selected are not calculated and are not returned.
+ *
  * @returns TPMT_HA structure on success, NULL if not found
  */
 TPMT_HA *attest_pcr_get(attest_ctx_verifier *v_ctx, int pcr_num,
@@ -125,6 +224,9 @@ TPMT_HA *attest_pcr_get(attest_ctx_verifier *v_ctx, int pcr_num,
 	if (pcr_bank == PCR_BANK__LAST)
 		return NULL;
 
+	if (!(attest_pcr_bank_mask(v_ctx) & (1 << pcr_bank)))
+		return NULL;
+
 	return v_ctx->pcr + sizeof(TPMT_HA) *
 	       (pcr_bank * IMPLEMENTATION_PCR + pcr_num);
 }
@@ -136,23 +238,26 @@ TPMT_HA *attest_pcr_get(attest_ctx_verifier *v_ctx, int pcr_num,
  * @param[in] alg	PCR bank
  * @param[in] digest	digest to extend the PCR
  *
+ * PCRs of banks not selected are not extended.
+ *
  * @returns 0 on success, a negative value on error
  */
 int attest_pcr_extend(attest_ctx_verifier *v_ctx, unsigned int pcr_num,
 		      TPMI_ALG_HASH alg, unsigned char *digest)
 {
 	TPMT_HA *selected_pcr;
-	int rc, digest_len = TSS_GetDigestSize(alg);
+	int rc;
 
 	current_log(v_ctx);
 
+	if (!attest_pcr_bank_selected(v_ctx, alg))
+		return 0;
+
 	selected_pcr = attest_pcr_get(v_ctx, pcr_num, alg);
 	check_goto(!selected_pcr, -ENOENT, out, v_ctx, "PCR not found");
 
-	rc = TSS_Hash_Generate(selected_pcr, digest_len, &selected_pcr->digest,
-			       digest_len, digest, 0, NULL);
-	check_goto(rc, -EINVAL, out, v_ctx, "TSS_Hash_Generate() error: %d",
-		   rc);
+	rc = attest_hash_extend(alg, (uint8_t *)&selected_pcr->digest, digest);
+	check_goto(rc, rc, out, v_ctx, "attest_hash_extend() error: %d", rc);
 out:
 	return rc;
 }
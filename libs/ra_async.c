@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: ra_async.c
+ *      Asynchronous client for the RA protocol.
+ */
+
+/**
+ * @defgroup ra-async-api Asynchronous RA Client API
+ * @ingroup enroll-api
+ * @brief
+ * Functions to send requests to many RA servers concurrently, from a single
+ * thread driven by epoll.
+ * @addtogroup ra-async-api
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "ra_async.h"
+#include "ctx_tlv.h"
+
+#define RA_ASYNC_MAX_EVENTS 256
+
+/**
+ * Initialize an asynchronous RA client
+ * @param[in,out] a		asynchronous RA client
+ * @param[in] max_in_flight	maximum number of concurrent requests
+ * @param[in] timeout_ms	timeout of each request (0: no timeout)
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ra_async_init(struct ra_async **a, int max_in_flight,
+			 int timeout_ms)
+{
+	struct ra_async *new_a;
+
+	if (max_in_flight <= 0 || timeout_ms < 0)
+		return -EINVAL;
+
+	new_a = calloc(1, sizeof(*new_a));
+	if (!new_a)
+		return -ENOMEM;
+
+	new_a->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (new_a->epfd < 0) {
+		free(new_a);
+		return -errno;
+	}
+
+	new_a->max_in_flight = max_in_flight;
+	new_a->timeout_ms = timeout_ms;
+	INIT_LIST_HEAD(&new_a->pending);
+	INIT_LIST_HEAD(&new_a->in_flight);
+
+	*a = new_a;
+	return 0;
+}
+
+static void ra_async_free_req(struct ra_async_req *r)
+{
+	if (r->fd >= 0)
+		close(r->fd);
+
+	free(r->resp);
+	free(r->host);
+	free(r->port);
+	free(r);
+}
+
+/**
+ * Deinitialize an asynchronous RA client
+ * @param[in] a		asynchronous RA client
+ *
+ * Requests not completed are discarded, without calling their callback.
+ */
+void attest_ra_async_cleanup(struct ra_async *a)
+{
+	struct ra_async_req *r, *temp_r;
+
+	if (!a)
+		return;
+
+	list_for_each_entry_safe(r, temp_r, &a->pending, list)
+		ra_async_free_req(r);
+
+	list_for_each_entry_safe(r, temp_r, &a->in_flight, list)
+		ra_async_free_req(r);
+
+	close(a->epfd);
+	free(a);
+}
+
+/**
+ * Add a request to an asynchronous RA client
+ * @param[in] a		asynchronous RA client
+ * @param[in] host	RA server host name or address
+ * @param[in] port	RA server port
+ * @param[in] op	RA protocol operation
+ * @param[in] len	message length
+ * @param[in] message	message (JSON or TLV)
+ * @param[in] done	function called when the request completes
+ * @param[in] priv	private data of the caller
+ *
+ * The message is not copied, and must be valid until done() is called.
+ * Requests are sent by attest_ra_async_run().
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ra_async_add(struct ra_async *a, const char *host,
+			const char *port, int op, size_t len,
+			const char *message, ra_async_done_func done,
+			void *priv)
+{
+	return attest_ra_async_add_at(a, host, port, op, len, message, done,
+				      priv, NULL);
+}
+
+/**
+ * Add a request to an asynchronous RA client, to be sent at a given time
+ * @param[in] a		asynchronous RA client
+ * @param[in] host	RA server host name or address
+ * @param[in] port	RA server port
+ * @param[in] op	RA protocol operation
+ * @param[in] len	message length
+ * @param[in] message	message (JSON or TLV)
+ * @param[in] done	function called when the request completes
+ * @param[in] priv	private data of the caller
+ * @param[in] start	CLOCK_MONOTONIC time the request is sent at
+ *			(NULL: as soon as possible)
+ *
+ * Requests must be added in order of start time. If max_in_flight requests
+ * are in flight at that time, the request is sent later, but its start
+ * (used for the timeout and reported to done()) remains the scheduled one.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ra_async_add_at(struct ra_async *a, const char *host,
+			   const char *port, int op, size_t len,
+			   const char *message, ra_async_done_func done,
+			   void *priv, const struct timespec *start)
+{
+	struct ra_async_req *r;
+	size_t frame_len = len + 2 * sizeof(size_t);
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
+	r->fd = -1;
+	r->host = strdup(host);
+	r->port = strdup(port);
+
+	if (!r->host || !r->port) {
+		ra_async_free_req(r);
+		return -ENOMEM;
+	}
+
+	r->op = op;
+	r->len = len;
+	r->message = message;
+	r->done = done;
+	r->priv = priv;
+
+	if (start) {
+		r->start = *start;
+		r->scheduled = 1;
+	}
+
+	/* same framing of attest_ra_client */
+	memcpy(r->hdr, &frame_len, sizeof(frame_len));
+	memcpy(r->hdr + sizeof(frame_len), &op, sizeof(op));
+
+	list_add_tail(&r->list, &a->pending);
+	return 0;
+}
+
+static void ra_async_complete(struct ra_async *a, struct ra_async_req *r,
+			      int rc)
+{
+	if (r->fd >= 0)
+		epoll_ctl(a->epfd, EPOLL_CTL_DEL, r->fd, NULL);
+
+	list_del(&r->list);
+	a->num_in_flight--;
+
+	r->done(r, rc, rc ? NULL : r->resp);
+	ra_async_free_req(r);
+}
+
+static int ra_async_start(struct ra_async *a, struct ra_async_req *r)
+{
+	struct addrinfo hints, *result = NULL;
+	struct epoll_event ev;
+	int rc;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	/* name resolution is synchronous, host lists should use addresses */
+	rc = getaddrinfo(r->host, r->port, &hints, &result);
+	if (rc)
+		return -EHOSTUNREACH;
+
+	r->fd = socket(result->ai_family,
+		       result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		       result->ai_protocol);
+	if (r->fd < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	rc = connect(r->fd, result->ai_addr, result->ai_addrlen);
+	if (rc < 0 && errno != EINPROGRESS) {
+		rc = -errno;
+		goto out;
+	}
+
+	r->state = RA_ASYNC_CONNECT;
+
+	ev.events = EPOLLOUT;
+	ev.data.ptr = r;
+
+	rc = epoll_ctl(a->epfd, EPOLL_CTL_ADD, r->fd, &ev);
+	if (rc < 0)
+		rc = -errno;
+out:
+	freeaddrinfo(result);
+	return rc;
+}
+
+/* returns 1 when done, 0 if the socket would block, a negative value on error */
+static int ra_async_send(struct ra_async_req *r)
+{
+	size_t hdr_len = sizeof(r->hdr);
+	ssize_t n;
+
+	while (r->off < hdr_len + r->len) {
+		if (r->off < hdr_len)
+			n = send(r->fd, r->hdr + r->off, hdr_len - r->off,
+				 MSG_NOSIGNAL | MSG_MORE);
+		else
+			n = send(r->fd, r->message + r->off - hdr_len,
+				 r->len - (r->off - hdr_len), MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -EIO;
+
+		r->off += n;
+	}
+
+	return 1;
+}
+
+static int ra_async_recv(struct ra_async_req *r, unsigned char *buf,
+			 size_t len)
+{
+	ssize_t n;
+
+	while (r->off < len) {
+		n = recv(r->fd, buf + r->off, len - r->off, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -EIO;
+
+		r->off += n;
+	}
+
+	return 1;
+}
+
+static int ra_async_process(struct ra_async *a, struct ra_async_req *r)
+{
+	struct epoll_event ev;
+	socklen_t err_len = sizeof(int);
+	int rc, err;
+
+	switch (r->state) {
+	case RA_ASYNC_CONNECT:
+		if (getsockopt(r->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0)
+			return -errno;
+		if (err)
+			return -err;
+
+		r->state = RA_ASYNC_SEND;
+		/* fall through */
+	case RA_ASYNC_SEND:
+		rc = ra_async_send(r);
+		if (rc <= 0)
+			return rc;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = r;
+
+		if (epoll_ctl(a->epfd, EPOLL_CTL_MOD, r->fd, &ev) < 0)
+			return -errno;
+
+		r->state = RA_ASYNC_RECV_LEN;
+		r->off = 0;
+		/* fall through */
+	case RA_ASYNC_RECV_LEN:
+		rc = ra_async_recv(r, (unsigned char *)&r->resp_len,
+				   sizeof(r->resp_len));
+		if (rc <= 0)
+			return rc;
+
+		/* a zero length is sent by the server on error */
+		if (r->resp_len <= sizeof(r->resp_len) ||
+		    r->resp_len > RA_ASYNC_MAX_MSG_LEN)
+			return -EINVAL;
+
+		r->resp = malloc(r->resp_len);
+		if (!r->resp)
+			return -ENOMEM;
+
+		r->state = RA_ASYNC_RECV;
+		r->off = 0;
+		/* fall through */
+	case RA_ASYNC_RECV:
+		rc = ra_async_recv(r, (unsigned char *)r->resp,
+				   r->resp_len - sizeof(r->resp_len));
+		if (rc <= 0)
+			return rc;
+
+		r->resp[r->off] = '\0';
+
+		rc = attest_ctx_msg_check(r->resp, r->off);
+		return rc ?: 1;
+	}
+
+	return -EINVAL;
+}
+
+static long ra_async_elapsed_ms(struct timespec *start, struct timespec *now)
+{
+	return (now->tv_sec - start->tv_sec) * 1000 +
+	       (now->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* rounded up, so that a request is not started before its time */
+static long ra_async_wait_ms(struct timespec *start, struct timespec *now)
+{
+	long wait_us = (start->tv_sec - now->tv_sec) * 1000000 +
+		       (start->tv_nsec - now->tv_nsec) / 1000;
+
+	return wait_us > 0 ? (wait_us + 999) / 1000 : 0;
+}
+
+/**
+ * Send requests added to an asynchronous RA client
+ * @param[in] a		asynchronous RA client
+ *
+ * At most max_in_flight requests are processed at the same time, and
+ * scheduled requests are not sent before their start time. The done()
+ * callback of each request is called when the response is received, or on
+ * error. The function returns when all requests completed.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_ra_async_run(struct ra_async *a)
+{
+	struct epoll_event events[RA_ASYNC_MAX_EVENTS];
+	struct ra_async_req *r, *temp_r;
+	struct timespec now;
+	long elapsed, wait;
+	int rc, i, n, timeout;
+
+	while (!list_empty(&a->pending) || !list_empty(&a->in_flight)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		while (a->num_in_flight < a->max_in_flight &&
+		       !list_empty(&a->pending)) {
+			r = list_first_entry(&a->pending, struct ra_async_req,
+					     list);
+			if (r->scheduled && ra_async_wait_ms(&r->start, &now))
+				break;
+
+			list_move_tail(&r->list, &a->in_flight);
+			a->num_in_flight++;
+
+			if (!r->scheduled)
+				r->start = now;
+
+			rc = ra_async_start(a, r);
+			if (rc < 0)
+				ra_async_complete(a, r, rc);
+		}
+
+		/* requests are in start order, the first expires first */
+		timeout = -1;
+
+		if (a->timeout_ms && !list_empty(&a->in_flight)) {
+			r = list_first_entry(&a->in_flight, struct ra_async_req,
+					     list);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			elapsed = ra_async_elapsed_ms(&r->start, &now);
+			timeout = elapsed < a->timeout_ms ?
+				  a->timeout_ms - elapsed : 0;
+		}
+
+		/* wake up when the next scheduled request must be sent */
+		if (a->num_in_flight < a->max_in_flight &&
+		    !list_empty(&a->pending)) {
+			r = list_first_entry(&a->pending, struct ra_async_req,
+					     list);
+			wait = ra_async_wait_ms(&r->start, &now);
+			if (timeout < 0 || wait < timeout)
+				timeout = wait;
+		}
+
+		n = epoll_wait(a->epfd, events, RA_ASYNC_MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR)
+			return -errno;
+
+		for (i = 0; i < n; i++) {
+			r = events[i].data.ptr;
+
+			rc = ra_async_process(a, r);
+			if (rc)
+				ra_async_complete(a, r, rc < 0 ? rc : 0);
+		}
+
+		if (!a->timeout_ms)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		list_for_each_entry_safe(r, temp_r, &a->in_flight, list) {
+			if (ra_async_elapsed_ms(&r->start, &now) < a->timeout_ms)
+				break;
+
+			ra_async_complete(a, r, -ETIMEDOUT);
+		}
+	}
+
+	return 0;
+}
+/** @}*/
@@ -29,11 +29,14 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "skae.h"
 #include "util.h"
 #include "ctx_json.h"
 #include "verifier.h"
+#include "metrics.h"
 
 static int skae_check_ext(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
 			  ASN1_OCTET_STRING *data, EVP_PKEY *key)
@@ -77,7 +80,7 @@ static int skae_download_data(attest_ctx_data *d_ctx,
 {
 	SUBJECTKEYATTESTATIONEVIDENCE_DATA_URL *skae_data_url = NULL;
 	const unsigned char *data_ptr = data->data;
-	char data_path_template[MAX_PATH_LENGTH];
+	char data_path_template[MAX_PATH_LENGTH], *data_dir;
 	const char *url;
 	int rc, fd;
 
@@ -89,8 +92,12 @@ static int skae_download_data(attest_ctx_data *d_ctx,
 		   "SKAE DATA URL der -> internal conversion failed");
 
 	url = (const char *)ASN1_STRING_get0_data(skae_data_url->url);
+	data_dir = attest_ctx_data_get_dir(d_ctx);
+	check_goto(!data_dir, -EACCES, out, v_ctx,
+		   "cannot create data directory");
+
 	snprintf(data_path_template, sizeof(data_path_template),
-		 "%s/skae-temp-file-XXXXXX", d_ctx->data_dir);
+		 "%s/skae-temp-file-XXXXXX", data_dir);
 
 	fd = mkstemp(data_path_template);
 	check_goto(fd < 0, -EACCES, out, v_ctx,
@@ -153,15 +160,133 @@ out:
 	return ext;
 }
 
+#define SKAE_CACHE_SIZE 1024
+#define SKAE_CACHE_TIMEOUT 300
+
+/* certificates with a SKAE successfully verified with given requirements */
+struct skae_cache_entry {
+	struct list_head list;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	time_t verified;
+};
+
+static pthread_mutex_t skae_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(skae_cache);
+static int skae_cache_num;
+
+/* key: certificate fingerprint, PCR selection, flags and requirements */
+static int skae_cache_calc_key(attest_ctx_verifier *v_ctx, X509 *cert,
+			       uint8_t *key)
+{
+	uint8_t fingerprint[SHA256_DIGEST_LENGTH];
+	struct verifier_struct *verifier;
+	unsigned int fingerprint_len;
+	EVP_MD_CTX *mdctx;
+	const char *req;
+	int rc = -EINVAL;
+
+	if (!X509_digest(cert, EVP_sha256(), fingerprint, &fingerprint_len))
+		return -EINVAL;
+
+	mdctx = EVP_MD_CTX_create();
+	if (!mdctx)
+		return -ENOMEM;
+
+	if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1 ||
+	    EVP_DigestUpdate(mdctx, fingerprint, fingerprint_len) != 1 ||
+	    EVP_DigestUpdate(mdctx, v_ctx->pcr_mask,
+			     sizeof(v_ctx->pcr_mask)) != 1 ||
+	    EVP_DigestUpdate(mdctx, &v_ctx->pcr_bank_mask,
+			     sizeof(v_ctx->pcr_bank_mask)) != 1 ||
+	    EVP_DigestUpdate(mdctx, &v_ctx->flags,
+			     sizeof(v_ctx->flags)) != 1)
+		goto out;
+
+	list_for_each_entry(verifier, &v_ctx->verifiers, list) {
+		req = verifier->req ?: "";
+
+		if (EVP_DigestUpdate(mdctx, verifier->id,
+				     strlen(verifier->id) + 1) != 1 ||
+		    EVP_DigestUpdate(mdctx, req, strlen(req) + 1) != 1)
+			goto out;
+	}
+
+	if (EVP_DigestFinal_ex(mdctx, key, NULL) != 1)
+		goto out;
+
+	rc = 0;
+out:
+	EVP_MD_CTX_destroy(mdctx);
+	return rc;
+}
+
+static int skae_cache_lookup(uint8_t *key)
+{
+	struct skae_cache_entry *entry;
+	int found = 0;
+
+	pthread_mutex_lock(&skae_cache_lock);
+	list_for_each_entry(entry, &skae_cache, list) {
+		if (memcmp(entry->key, key, SHA256_DIGEST_LENGTH))
+			continue;
+
+		/* verify again, the TPM key could have been revoked */
+		if (time(NULL) - entry->verified > SKAE_CACHE_TIMEOUT)
+			break;
+
+		list_del(&entry->list);
+		list_add(&entry->list, &skae_cache);
+		found = 1;
+		break;
+	}
+	pthread_mutex_unlock(&skae_cache_lock);
+
+	attest_metrics_cache("skae", found);
+	return found;
+}
+
+static void skae_cache_add(uint8_t *key)
+{
+	struct skae_cache_entry *entry;
+
+	pthread_mutex_lock(&skae_cache_lock);
+	list_for_each_entry(entry, &skae_cache, list) {
+		if (!memcmp(entry->key, key, SHA256_DIGEST_LENGTH)) {
+			list_del(&entry->list);
+			skae_cache_num--;
+			goto add;
+		}
+	}
+
+	if (skae_cache_num == SKAE_CACHE_SIZE) {
+		entry = list_last_entry(&skae_cache, struct skae_cache_entry,
+					list);
+		list_del(&entry->list);
+		skae_cache_num--;
+	} else {
+		entry = malloc(sizeof(*entry));
+		if (!entry)
+			goto out;
+	}
+add:
+	memcpy(entry->key, key, SHA256_DIGEST_LENGTH);
+	entry->verified = time(NULL);
+	list_add(&entry->list, &skae_cache);
+	skae_cache_num++;
+out:
+	pthread_mutex_unlock(&skae_cache_lock);
+}
+
 static int skae_verify_common(attest_ctx_data *d_ctx,
 			      attest_ctx_verifier *v_ctx, X509 *cert,
 			      X509_REQ *req)
 {
 	X509_EXTENSION *skae_ext = NULL, *skae_url_ext = NULL;
 	ASN1_OCTET_STRING *skae_data = NULL, *skae_url_data = NULL;
-	struct verification_log *log;
+	struct verification_log *log, *cache_log;
+	uint8_t cache_key[SHA256_DIGEST_LENGTH];
 	EVP_PKEY *pk = NULL;
-	int rc = 0;
+	int rc = 0, use_cache = 0;
 
 	log = attest_ctx_verifier_add_log(v_ctx, "verify SKAE extension");
 
@@ -170,7 +295,19 @@ static int skae_verify_common(attest_ctx_data *d_ctx,
 
 	check_goto(!cert && !req, -EINVAL, err, v_ctx,
 		   "certificate not provided");
- 
+
+	/* CSRs are verified once, only cache certificates */
+	if (cert)
+		use_cache = !skae_cache_calc_key(v_ctx, cert, cache_key);
+
+	if (use_cache && skae_cache_lookup(cache_key)) {
+		cache_log = attest_ctx_verifier_add_log(v_ctx,
+						"lookup SKAE cache");
+		attest_ctx_verifier_end_log(v_ctx, cache_log, 0);
+		rc = 1;
+		goto out;
+	}
+
 	skae_ext = skae_get_ext(cert, req, OID_SKAE);
 	check_goto(!skae_ext, -ENOENT, err, v_ctx, "SKAE extension not found");
 
@@ -197,6 +334,9 @@ static int skae_verify_common(attest_ctx_data *d_ctx,
 	if (rc)
 		goto err;
 
+	if (use_cache)
+		skae_cache_add(cache_key);
+
 	rc = 1;
 out:
 	EVP_PKEY_free(pk);
@@ -238,6 +378,37 @@ int skae_verify_x509_req(attest_ctx_data *d_ctx,
 	return skae_verify_common(d_ctx, v_ctx, NULL, req);
 }
 
+static pthread_once_t skae_ex_data_once = PTHREAD_ONCE_INIT;
+static int skae_ex_data_index = -1;
+
+static void skae_ex_data_init(void)
+{
+	skae_ex_data_index = SSL_get_ex_new_index(0, "skae", NULL, NULL, NULL);
+}
+
+/**
+ * Set the contexts used by skae_callback() for a SSL connection
+ * @param[in] ssl	SSL connection
+ * @param[in] ctx	data and verifier contexts
+ *
+ * ctx must be valid until the handshake completes. Connections without
+ * contexts are verified with the global contexts.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int skae_callback_set_ctx(SSL *ssl, struct skae_callback_ctx *ctx)
+{
+	pthread_once(&skae_ex_data_once, skae_ex_data_init);
+
+	if (skae_ex_data_index < 0)
+		return -ENOMEM;
+
+	if (!SSL_set_ex_data(ssl, skae_ex_data_index, ctx))
+		return -ENOMEM;
+
+	return 0;
+}
+
 /**
  * Callback function to be passed to SSL_CTX_set_verify()
  * @param[in] preverify	result of X509 verification
@@ -249,12 +420,24 @@ int skae_callback(int preverify, X509_STORE_CTX* x509_ctx)
 {
 	X509* cert = X509_STORE_CTX_get_current_cert(x509_ctx);
 	STACK_OF(X509) *certs = X509_STORE_CTX_get_chain(x509_ctx);
+	struct skae_callback_ctx *ctx = NULL;
+	SSL *ssl;
 
 	if (cert != sk_X509_value(certs, 0))
 		return 1;
 
-	return skae_verify_x509(attest_ctx_data_get_global(),
-				attest_ctx_verifier_get_global(), cert);
+	pthread_once(&skae_ex_data_once, skae_ex_data_init);
+
+	ssl = X509_STORE_CTX_get_ex_data(x509_ctx,
+					 SSL_get_ex_data_X509_STORE_CTX_idx());
+	if (ssl && skae_ex_data_index >= 0)
+		ctx = SSL_get_ex_data(ssl, skae_ex_data_index);
+
+	if (!ctx)
+		return skae_verify_x509(attest_ctx_data_get_global(),
+					attest_ctx_verifier_get_global(), cert);
+
+	return skae_verify_x509(ctx->d_ctx, ctx->v_ctx, cert);
 }
 
 /**
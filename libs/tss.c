@@ -802,6 +802,116 @@ int attest_tss_pcrread(TSS_CONTEXT *tssContext, TPMI_DH_PCR pcr,
 	return 0;
 }
 
+/* restarts of attest_tss_pcrread_multi() if PCRs are extended meanwhile */
+#define PCRREAD_MAX_RESTARTS 3
+
+static int tss_pcr_selection_empty(TPML_PCR_SELECTION *selection)
+{
+	int i, j;
+
+	for (i = 0; i < selection->count; i++)
+		for (j = 0; j < selection->pcrSelections[i].sizeofSelect; j++)
+			if (selection->pcrSelections[i].pcrSelect[j])
+				return 0;
+
+	return 1;
+}
+
+static TPMS_PCR_SELECTION *tss_pcr_selection_bank(TPML_PCR_SELECTION *sel,
+						  TPMI_ALG_HASH halg)
+{
+	int i;
+
+	for (i = 0; i < sel->count; i++)
+		if (sel->pcrSelections[i].hash == halg)
+			return &sel->pcrSelections[i];
+
+	return NULL;
+}
+
+/**
+ * Read multiple PCRs from multiple banks
+ * @param[in] tssContext		TSS context
+ * @param[in] selection			PCRs to read
+ * @param[in] func			function called for each PCR read
+ * @param[in] priv			data passed to func
+ *
+ * A TPM returns at most eight digests per PCR_Read, which is repeated with
+ * the PCRs not returned by the previous command, until all are read. If a
+ * PCR is extended in the meantime (pcrUpdateCounter changed), reading starts
+ * again, so that func receives values from the same state of PCRs.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_tss_pcrread_multi(TSS_CONTEXT *tssContext,
+			     const TPML_PCR_SELECTION *selection,
+			     pcrread_func func, void *priv)
+{
+	TPMS_PCR_SELECTION *sel_in, *sel_out;
+	PCR_Read_In in;
+	PCR_Read_Out out;
+	UINT32 update_counter = 0;
+	int rc, i, pcr, digest_idx, restarts = 0, first = 1;
+
+	in.pcrSelectionIn = *selection;
+
+	while (!tss_pcr_selection_empty(&in.pcrSelectionIn)) {
+		rc = TSS_Execute(tssContext, (RESPONSE_PARAMETERS *)&out,
+				 (COMMAND_PARAMETERS *)&in, NULL,
+				 TPM_CC_PCR_Read, TPM_RH_NULL, NULL, 0);
+		if (rc) {
+			tss_print_error("TPM_CC_PCR_Read", rc);
+			return -EINVAL;
+		}
+
+		if (!first && out.pcrUpdateCounter != update_counter) {
+			if (++restarts > PCRREAD_MAX_RESTARTS)
+				return -EAGAIN;
+
+			in.pcrSelectionIn = *selection;
+			first = 1;
+			continue;
+		}
+
+		update_counter = out.pcrUpdateCounter;
+		first = 0;
+
+		/* banks not allocated or PCRs not implemented */
+		if (!out.pcrValues.count) {
+			printf("Selected PCRs not found\n");
+			return -EINVAL;
+		}
+
+		digest_idx = 0;
+
+		for (i = 0; i < out.pcrSelectionOut.count; i++) {
+			sel_out = &out.pcrSelectionOut.pcrSelections[i];
+			sel_in = tss_pcr_selection_bank(&in.pcrSelectionIn,
+							sel_out->hash);
+			if (!sel_in)
+				return -EINVAL;
+
+			for (pcr = 0; pcr < sel_out->sizeofSelect * 8; pcr++) {
+				if (!(sel_out->pcrSelect[pcr / 8] &
+				      (1 << (pcr % 8))))
+					continue;
+
+				if (digest_idx == out.pcrValues.count)
+					return -EINVAL;
+
+				rc = func(priv, pcr, sel_out->hash,
+					  &out.pcrValues.digests[digest_idx++]);
+				if (rc < 0)
+					return rc;
+
+				sel_in->pcrSelect[pcr / 8] &= ~(1 << (pcr % 8));
+			}
+		}
+	}
+
+	return 0;
+}
+
 #define TYPE_ST                 2
 
 /**
@@ -1038,6 +1148,40 @@ int attest_tss_check_key(TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle)
 	return 0;
 }
 
+/**
+ * Read the public area of a key
+ * @param[in] tssContext	TSS context
+ * @param[in] keyHandle		Key handle
+ * @param[in,out] public_len	Marshalled TPM2B_PUBLIC length
+ * @param[in,out] public	Marshalled TPM2B_PUBLIC
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_tss_readpublic(TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle,
+			  UINT16 *public_len, BYTE **public)
+{
+	ReadPublic_In in;
+	ReadPublic_Out out;
+	int rc;
+
+	in.objectHandle = keyHandle;
+
+	rc = TSS_Execute(tssContext, (RESPONSE_PARAMETERS *)&out,
+			 (COMMAND_PARAMETERS *)&in, NULL, TPM_CC_ReadPublic,
+			 TPM_RH_NULL, NULL, 0);
+	if (rc)
+		return -ENOENT;
+
+	*public = NULL;
+	*public_len = 0;
+	rc = TSS_Structure_Marshal(public, public_len, &out.outPublic,
+				(MarshalFunction_t)TSS_TPM2B_PUBLIC_Marshal);
+	if (rc)
+		return -ENOMEM;
+
+	return 0;
+}
+
 /**
  * Make primary key as permanent
  * @param[in] tssContext	TSS context
@@ -25,26 +25,27 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
 
 #include <sys/stat.h>
 #include <sys/mman.h>
 
 #include <curl/curl.h>
+#include <zlib.h>
 
 #include <openssl/evp.h>
 
 #include "util.h"
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000
-#define EVP_ENCODE_CTX_new() OPENSSL_malloc(sizeof(EVP_ENCODE_CTX))
-#define EVP_ENCODE_CTX_free(ctx) OPENSSL_free(ctx)
-#endif
-
 #define DECODED_BLOCK_SIZE 48
 #define ENCODED_BLOCK_SIZE 65
 
@@ -70,64 +71,86 @@ int attest_util_read_file(const char *path, size_t *len, unsigned char **data)
 	return rc;
 }
 
-int attest_util_read_seq_file(const char *path, size_t *len,
-			      unsigned char **data)
+#define SEQ_FILE_BUF_SIZE 65536
+
+int attest_util_read_seq_file_offset(const char *path, size_t offset,
+				     size_t *len, unsigned char **data)
 {
-	unsigned char buf[512], *buf_ptr = buf;
-	size_t total_len = 0, cur_len, buf_len = sizeof(buf);
+	unsigned char *buf = NULL, *new_buf;
+	size_t total_len = 0, buf_len;
+	ssize_t cur_len;
+	struct stat st;
 	int rc = 0, fd;
 
 	fd = open(path, O_RDONLY);
 	if (fd < 0)
-		return -EACCES;
+		return errno == ENOENT ? -ENOENT : -EACCES;
 
-	*data = NULL;
-again:
-	if (*data) {
-		close(fd);
-		fd = open(path, O_RDONLY);
-		if (fd < 0) {
-			free (*data);
-			return -EACCES;
-		}
+	if (offset && lseek(fd, offset, SEEK_SET) != (off_t)offset) {
+		rc = -EIO;
+		goto out;
 	}
 
-	while (buf_len) {
-		cur_len = read(fd, buf_ptr, buf_len);
-		if (cur_len <= 0) {
-			if (*data) {
-				if (buf_len)
-					return -EIO;
+	/* regular files are read with one allocation, if they don't grow */
+	buf_len = SEQ_FILE_BUF_SIZE;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) &&
+	    st.st_size > (off_t)offset)
+		buf_len = st.st_size - offset + 2;
 
-				break;
+	buf = malloc(buf_len);
+	if (!buf) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	while (1) {
+		/* keep space for the terminator */
+		if (buf_len - total_len < 2) {
+			buf_len *= 2;
+			new_buf = realloc(buf, buf_len);
+			if (!new_buf) {
+				rc = -ENOMEM;
+				goto out;
 			}
 
-			if (!total_len)
-				return -EIO;
+			buf = new_buf;
+		}
 
-			*data = malloc(total_len + 1);
-			if (!*data)
-				return -ENOMEM;
+		cur_len = read(fd, buf + total_len, buf_len - total_len - 1);
+		if (cur_len < 0) {
+			rc = -EIO;
+			goto out;
+		}
 
-			(*data)[total_len] = '\0';
+		if (!cur_len)
+			break;
 
-			buf_ptr = *data;
-			buf_len = *len = total_len;
-			goto again;
-		}
+		total_len += cur_len;
+	}
 
-		if (*data) {
-			buf_ptr += cur_len;
-			buf_len -= cur_len;
-		} else {
-			total_len += cur_len;
-		}
+	/* an empty file is valid only if reading from an offset */
+	if (!total_len && !offset) {
+		rc = -EIO;
+		goto out;
 	}
 
+	buf[total_len] = '\0';
+	*data = buf;
+	*len = total_len;
+out:
+	if (rc)
+		free(buf);
+
 	close(fd);
 	return rc;
 }
 
+int attest_util_read_seq_file(const char *path, size_t *len,
+			      unsigned char **data)
+{
+	return attest_util_read_seq_file_offset(path, 0, len, data);
+}
+
 int attest_util_write_file(const char *path, size_t len, unsigned char *data,
 			   int append)
 {
@@ -151,19 +174,38 @@ int attest_util_copy_file(const char *path_source, const char *path_dest)
 	size_t len;
 	int rc;
 
-	rc = attest_util_read_file(path_source, &len, &data);
+	/* the source can be truncated, a mapping would cause SIGBUS */
+	rc = attest_util_read_seq_file(path_source, &len, &data);
 	if (rc)
 		return rc;
 
 	rc = attest_util_write_file(path_dest, len, data, 0);
-	munmap(data, len);
+	free(data);
 	return rc;
 }
 
+/* milliseconds before deadline (CLOCK_MONOTONIC), 0 if expired */
+static int attest_util_ms_left(const struct timespec *deadline)
+{
+	struct timespec now;
+	int64_t ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+	     (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+	return ms > 0 ? ms : 0;
+}
+
 static int attest_util_rw_buf(int fd, unsigned char *buf, size_t buf_len,
-			      int op)
+			      int op, const struct timespec *deadline)
 {
-	size_t processed = 0, cur_processed;
+	struct pollfd pfd = { .fd = fd,
+			      .events = (op == O_RDONLY) ? POLLIN : POLLOUT };
+	size_t processed = 0;
+	ssize_t cur_processed;
+	int rc;
 
 	while (processed < buf_len) {
 		if (op == O_RDONLY)
@@ -172,6 +214,25 @@ static int attest_util_rw_buf(int fd, unsigned char *buf, size_t buf_len,
 		else
 			cur_processed = write(fd, buf + processed,
 					      buf_len - processed);
+		if (cur_processed < 0 && errno == EINTR)
+			continue;
+
+		/* non-blocking descriptor, wait until the deadline */
+		if (cur_processed < 0 && deadline &&
+		    (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			rc = poll(&pfd, 1, attest_util_ms_left(deadline));
+			if (rc < 0 && errno == EINTR)
+				continue;
+
+			if (!rc)
+				return -ETIMEDOUT;
+
+			if (rc < 0)
+				return -EIO;
+
+			continue;
+		}
+
 		if (cur_processed <= 0)
 			return -EIO;
 
@@ -183,12 +244,42 @@ static int attest_util_rw_buf(int fd, unsigned char *buf, size_t buf_len,
 
 int attest_util_read_buf(int fd, unsigned char *buf, size_t buf_len)
 {
-	return attest_util_rw_buf(fd, buf, buf_len, O_RDONLY);
+	return attest_util_rw_buf(fd, buf, buf_len, O_RDONLY, NULL);
 }
 
 int attest_util_write_buf(int fd, unsigned char *buf, size_t buf_len)
 {
-	return attest_util_rw_buf(fd, buf, buf_len, O_WRONLY);
+	return attest_util_rw_buf(fd, buf, buf_len, O_WRONLY, NULL);
+}
+
+/**
+ * Read from a non-blocking descriptor until deadline
+ * @param[in] fd	file descriptor
+ * @param[in] buf	buffer
+ * @param[in] buf_len	number of bytes to read
+ * @param[in] deadline	deadline (CLOCK_MONOTONIC)
+ *
+ * @returns 0 on success, -ETIMEDOUT if the deadline expired, -EIO on error
+ */
+int attest_util_read_buf_deadline(int fd, unsigned char *buf, size_t buf_len,
+				  const struct timespec *deadline)
+{
+	return attest_util_rw_buf(fd, buf, buf_len, O_RDONLY, deadline);
+}
+
+/**
+ * Write to a non-blocking descriptor until deadline
+ * @param[in] fd	file descriptor
+ * @param[in] buf	buffer
+ * @param[in] buf_len	number of bytes to write
+ * @param[in] deadline	deadline (CLOCK_MONOTONIC)
+ *
+ * @returns 0 on success, -ETIMEDOUT if the deadline expired, -EIO on error
+ */
+int attest_util_write_buf_deadline(int fd, unsigned char *buf, size_t buf_len,
+				   const struct timespec *deadline)
+{
+	return attest_util_rw_buf(fd, buf, buf_len, O_WRONLY, deadline);
 }
 
 int attest_util_calc_digest(const char *algo, int *digest_len,
@@ -217,147 +308,852 @@ out:
 	return rc;
 }
 
-int attest_util_decode_data(size_t input_len, const char *input, int offset,
-			    size_t *output_len, unsigned char **output)
+/*
+ * Base64 and hex codecs.
+ *
+ * The scalar code handles any input; on x86 the bulk of the data is
+ * processed by SSSE3 or AVX2 kernels, selected once at runtime. Kernels
+ * only consume whole blocks of valid characters and return how much they
+ * processed, leaving whitespace, padding, invalid characters and tails to
+ * the scalar code.
+ */
+static const char b64_enc_table[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define B64_INVALID	0xff
+#define B64_SPACE	0xfe
+#define B64_PAD		0xfd
+
+static unsigned char b64_dec_table[256];
+
+/* bytes the SIMD decoders may write past the last decoded byte */
+#define B64_DEC_SLACK	8
+
+struct codec_ops {
+	size_t (*b64_encode)(char *dst, const unsigned char *src, size_t len,
+			     size_t avail);
+	size_t (*b64_decode)(unsigned char *dst, const char *src, size_t len);
+	size_t (*hex_encode)(char *dst, const unsigned char *src, size_t count);
+	size_t (*hex_decode)(unsigned char *dst, const char *src, size_t count);
+};
+
+static struct codec_ops codec;
+static pthread_once_t codec_once = PTHREAD_ONCE_INIT;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#define CODEC_SSSE3 __attribute__((target("ssse3")))
+#define CODEC_AVX2 __attribute__((target("avx2")))
+
+static inline CODEC_SSSE3 __m128i b64_enc_reshuffle_ssse3(__m128i in)
 {
-	unsigned char *buf , *buf_ptr;
-	EVP_ENCODE_CTX *ctx = NULL;
-	int rc = -ENOMEM, decoded_len;
+	__m128i t0, t1, t2, t3;
+
+	in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+						7, 6, 8, 7, 10, 9, 11, 10));
+	t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
 
-	input_len -= offset;
-	input += offset;
+static inline CODEC_SSSE3 __m128i b64_enc_translate_ssse3(__m128i in)
+{
+	const __m128i lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+					  '0' - 52, '0' - 52, '0' - 52,
+					  '0' - 52, '0' - 52, '0' - 52,
+					  '0' - 52, '0' - 52, '+' - 62,
+					  '/' - 63, 'A', 0, 0);
+	__m128i idx, less;
+
+	idx = _mm_subs_epu8(in, _mm_set1_epi8(51));
+	less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+	idx = _mm_or_si128(idx, _mm_and_si128(less, _mm_set1_epi8(13)));
+	return _mm_add_epi8(in, _mm_shuffle_epi8(lut, idx));
+}
 
-	buf_ptr = buf = malloc(input_len / 4 * 3);
-	if (!buf_ptr)
-		return rc;
+static CODEC_SSSE3 size_t b64_encode_ssse3(char *dst,
+					   const unsigned char *src,
+					   size_t len, size_t avail)
+{
+	size_t done = 0;
+	__m128i in;
+
+	/* each iteration consumes 12 bytes but loads 16 */
+	while (len - done >= 12 && avail - done >= 16) {
+		in = _mm_loadu_si128((const __m128i *)(src + done));
+		in = b64_enc_translate_ssse3(b64_enc_reshuffle_ssse3(in));
+		_mm_storeu_si128((__m128i *)dst, in);
+		dst += 16;
+		done += 12;
+	}
 
-	ctx = EVP_ENCODE_CTX_new();
-	if (!ctx)
-		goto out;
+	return done;
+}
 
-	EVP_DecodeInit(ctx);
+static inline CODEC_SSSE3 __m128i b64_dec_reshuffle_ssse3(__m128i in)
+{
+	__m128i t;
 
-	rc = EVP_DecodeUpdate(ctx, buf, &decoded_len,
-			      (unsigned char *)input, input_len);
-	if (rc == -1) {
-		rc = -EINVAL;
-		goto out;
+	t = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+	t = _mm_madd_epi16(t, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(t, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+						 14, 13, 12, -1, -1, -1, -1));
+}
+
+static CODEC_SSSE3 size_t b64_decode_ssse3(unsigned char *dst,
+					   const char *src, size_t len)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+					     0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+					     0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+					     0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+					     0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+					       0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	__m128i in, hi_nibbles, lo, hi, roll;
+	size_t done = 0;
+
+	while (len - done >= 16) {
+		in = _mm_loadu_si128((const __m128i *)(src + done));
+		hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+		lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(in, mask_2f));
+		hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+
+		/* whitespace, padding or garbage, let the caller handle it */
+		if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+						     _mm_setzero_si128())))
+			break;
+
+		roll = _mm_shuffle_epi8(lut_roll,
+				_mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f),
+					     hi_nibbles));
+		in = b64_dec_reshuffle_ssse3(_mm_add_epi8(in, roll));
+		_mm_storeu_si128((__m128i *)dst, in);
+		dst += 12;
+		done += 16;
 	}
 
-	buf_ptr += decoded_len;
+	return done;
+}
 
-	if (rc == 1) {
-		rc = EVP_DecodeFinal(ctx, buf_ptr, &decoded_len);
-		if (rc == -1) {
-			rc = -EINVAL;
-			goto out;
+static CODEC_AVX2 size_t b64_encode_avx2(char *dst, const unsigned char *src,
+					 size_t len, size_t avail)
+{
+	const __m256i lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+					     '0' - 52, '0' - 52, '0' - 52,
+					     '0' - 52, '0' - 52, '0' - 52,
+					     '0' - 52, '0' - 52, '+' - 62,
+					     '/' - 63, 'A', 0, 0,
+					     'a' - 26, '0' - 52, '0' - 52,
+					     '0' - 52, '0' - 52, '0' - 52,
+					     '0' - 52, '0' - 52, '0' - 52,
+					     '0' - 52, '0' - 52, '+' - 62,
+					     '/' - 63, 'A', 0, 0);
+	const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+					      7, 6, 8, 7, 10, 9, 11, 10,
+					      1, 0, 2, 1, 4, 3, 5, 4,
+					      7, 6, 8, 7, 10, 9, 11, 10);
+	__m256i in, t0, t1, t2, t3, idx, less;
+	size_t done = 0;
+
+	/* each iteration consumes 24 bytes, the second lane loads 16 at 12 */
+	while (len - done >= 24 && avail - done >= 28) {
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)(src + done))),
+			_mm_loadu_si128((const __m128i *)(src + done + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuf);
+		t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		in = _mm256_or_si256(t1, t3);
+
+		idx = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+		less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), in);
+		idx = _mm256_or_si256(idx,
+				      _mm256_and_si256(less,
+						       _mm256_set1_epi8(13)));
+		in = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, idx));
+
+		_mm256_storeu_si256((__m256i *)dst, in);
+		dst += 32;
+		done += 24;
+	}
+
+	_mm256_zeroupper();
+	return done;
+}
+
+static CODEC_AVX2 size_t b64_decode_avx2(unsigned char *dst, const char *src,
+					 size_t len)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11,
+						0x11, 0x11, 0x11, 0x11, 0x11,
+						0x13, 0x1a, 0x1b, 0x1b, 0x1b,
+						0x1a,
+						0x15, 0x11, 0x11, 0x11, 0x11,
+						0x11, 0x11, 0x11, 0x11, 0x11,
+						0x13, 0x1a, 0x1b, 0x1b, 0x1b,
+						0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04,
+						0x08, 0x04, 0x08, 0x10, 0x10,
+						0x10, 0x10, 0x10, 0x10, 0x10,
+						0x10,
+						0x10, 0x10, 0x01, 0x02, 0x04,
+						0x08, 0x04, 0x08, 0x10, 0x10,
+						0x10, 0x10, 0x10, 0x10, 0x10,
+						0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71,
+						  -71, 0, 0, 0, 0, 0, 0, 0, 0,
+						  0, 16, 19, 4, -65, -65, -71,
+						  -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+					      14, 13, 12, -1, -1, -1, -1,
+					      2, 1, 0, 6, 5, 4, 10, 9, 8,
+					      14, 13, 12, -1, -1, -1, -1);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	__m256i in, hi_nibbles, lo, hi, roll;
+	size_t done = 0;
+
+	while (len - done >= 32) {
+		in = _mm256_loadu_si256((const __m256i *)(src + done));
+		hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+					      mask_2f);
+		lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(in, mask_2f));
+		hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+
+		if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(
+				_mm256_and_si256(lo, hi),
+				_mm256_setzero_si256())))
+			break;
+
+		roll = _mm256_shuffle_epi8(lut_roll,
+				_mm256_add_epi8(_mm256_cmpeq_epi8(in, mask_2f),
+						hi_nibbles));
+		in = _mm256_add_epi8(in, roll);
+		in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+		in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+		in = _mm256_shuffle_epi8(in, shuf);
+		in = _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 1, 2,
+							4, 5, 6, 3, 7));
+		_mm256_storeu_si256((__m256i *)dst, in);
+		dst += 24;
+		done += 32;
+	}
+
+	_mm256_zeroupper();
+	return done;
+}
+
+static CODEC_SSSE3 size_t hex_encode_ssse3(char *dst,
+					   const unsigned char *src,
+					   size_t count)
+{
+	const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6',
+					  '7', '8', '9', 'a', 'b', 'c', 'd',
+					  'e', 'f');
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	__m128i in, hi, lo;
+	size_t done = 0;
+
+	while (count - done >= 16) {
+		in = _mm_loadu_si128((const __m128i *)(src + done));
+		hi = _mm_shuffle_epi8(lut,
+				_mm_and_si128(_mm_srli_epi16(in, 4), mask));
+		lo = _mm_shuffle_epi8(lut, _mm_and_si128(in, mask));
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(dst + 16),
+				 _mm_unpackhi_epi8(hi, lo));
+		dst += 32;
+		done += 16;
+	}
+
+	return done;
+}
+
+static inline CODEC_SSSE3 int hex_nibbles_ssse3(__m128i in, __m128i *out)
+{
+	__m128i digit, alpha, is_digit, is_alpha;
+
+	digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+	is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	alpha = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)),
+			     _mm_set1_epi8('a'));
+	is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+
+	if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xffff)
+		return -1;
+
+	*out = _mm_or_si128(_mm_and_si128(is_digit, digit),
+			    _mm_and_si128(is_alpha,
+				_mm_add_epi8(alpha, _mm_set1_epi8(10))));
+	/* pair (hi, lo) nibbles into 16 bit words: hi * 16 + lo */
+	*out = _mm_maddubs_epi16(*out, _mm_set1_epi16(0x0110));
+	return 0;
+}
+
+static CODEC_SSSE3 size_t hex_decode_ssse3(unsigned char *dst,
+					   const char *src, size_t count)
+{
+	__m128i lo, hi;
+	size_t done = 0;
+
+	while (count - done >= 16) {
+		if (hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)src),
+				      &lo) ||
+		    hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)
+						      (src + 16)), &hi))
+			break;
+
+		_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+		src += 32;
+		dst += 16;
+		done += 16;
+	}
+
+	return done;
+}
+
+static void codec_init_arch(void)
+{
+	__builtin_cpu_init();
+
+	if (!__builtin_cpu_supports("ssse3"))
+		return;
+
+	codec.b64_encode = b64_encode_ssse3;
+	codec.b64_decode = b64_decode_ssse3;
+	codec.hex_encode = hex_encode_ssse3;
+	codec.hex_decode = hex_decode_ssse3;
+
+	if (!__builtin_cpu_supports("avx2"))
+		return;
+
+	codec.b64_encode = b64_encode_avx2;
+	codec.b64_decode = b64_decode_avx2;
+}
+#else
+static void codec_init_arch(void)
+{
+}
+#endif
+
+static void codec_init(void)
+{
+	int i;
+
+	memset(b64_dec_table, B64_INVALID, sizeof(b64_dec_table));
+
+	for (i = 0; i < 64; i++)
+		b64_dec_table[(unsigned char)b64_enc_table[i]] = i;
+
+	b64_dec_table['\n'] = b64_dec_table['\r'] = B64_SPACE;
+	b64_dec_table[' '] = b64_dec_table['\t'] = B64_SPACE;
+	b64_dec_table['='] = B64_PAD;
+
+	codec_init_arch();
+}
+
+static char *b64_encode_line(char *dst, const unsigned char *src, size_t len,
+			     size_t avail)
+{
+	size_t done = 0;
+	uint32_t v;
+
+	if (codec.b64_encode) {
+		done = codec.b64_encode(dst, src, len, avail);
+		dst += done / 3 * 4;
+	}
+
+	for (; len - done >= 3; done += 3) {
+		v = src[done] << 16 | src[done + 1] << 8 | src[done + 2];
+		*dst++ = b64_enc_table[v >> 18];
+		*dst++ = b64_enc_table[(v >> 12) & 0x3f];
+		*dst++ = b64_enc_table[(v >> 6) & 0x3f];
+		*dst++ = b64_enc_table[v & 0x3f];
+	}
+
+	if (len - done) {
+		v = src[done] << 16;
+		if (len - done == 2)
+			v |= src[done + 1] << 8;
+
+		*dst++ = b64_enc_table[v >> 18];
+		*dst++ = b64_enc_table[(v >> 12) & 0x3f];
+		*dst++ = (len - done == 2) ? b64_enc_table[(v >> 6) & 0x3f] :
+					     '=';
+		*dst++ = '=';
+	}
+
+	return dst;
+}
+
+static int b64_decode(unsigned char *dst, const char *src, size_t len,
+		      size_t *dst_len)
+{
+	unsigned char *dst_ptr = dst, c;
+	int n = 0, pad = 0;
+	uint32_t v = 0;
+	size_t done;
+
+	while (len) {
+		if (!n && codec.b64_decode) {
+			done = codec.b64_decode(dst_ptr, src, len);
+			dst_ptr += done / 4 * 3;
+			src += done;
+			len -= done;
+			if (!len)
+				break;
 		}
 
-		buf_ptr += decoded_len;
-		rc = 0;
+		c = b64_dec_table[(unsigned char)*src++];
+		len--;
+
+		if (c == B64_SPACE)
+			continue;
+
+		if (c == B64_PAD) {
+			if (n < 2 || n + ++pad > 4)
+				return -EINVAL;
+			continue;
+		}
+
+		if (c == B64_INVALID || pad)
+			return -EINVAL;
+
+		v = v << 6 | c;
+		if (++n < 4)
+			continue;
+
+		*dst_ptr++ = v >> 16;
+		*dst_ptr++ = v >> 8;
+		*dst_ptr++ = v;
+		n = v = 0;
 	}
 
-	*output_len = buf_ptr - buf;
-	*output = buf;
-out:
-	if (rc)
+	switch (n) {
+	case 0:
+		break;
+	case 2:
+		*dst_ptr++ = v >> 4;
+		break;
+	case 3:
+		*dst_ptr++ = v >> 10;
+		*dst_ptr++ = v >> 2;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	*dst_len = dst_ptr - dst;
+	return 0;
+}
+
+int attest_util_decode_data(size_t input_len, const char *input, int offset,
+			    size_t *output_len, unsigned char **output)
+{
+	unsigned char *buf;
+	int rc;
+
+	pthread_once(&codec_once, codec_init);
+
+	input_len -= offset;
+	input += offset;
+
+	buf = malloc((input_len + 3) / 4 * 3 + B64_DEC_SLACK);
+	if (!buf)
+		return -ENOMEM;
+
+	rc = b64_decode(buf, input, input_len, output_len);
+	if (rc) {
 		free(buf);
+		return rc;
+	}
 
-	EVP_ENCODE_CTX_free(ctx);
-	return rc;
+	*output = buf;
+	return 0;
 }
 
 int attest_util_encode_data(size_t input_len, const unsigned char *input,
 			    int offset, size_t *output_len, char **output)
 {
-	EVP_ENCODE_CTX *ctx = NULL;
-	int nr_blocks = input_len / DECODED_BLOCK_SIZE + 1, encoded_len = 0;
-	unsigned char *buf, *buf_ptr;
-	int rc = -ENOMEM, i, cur_len;
+	int nr_blocks = input_len / DECODED_BLOCK_SIZE + 1;
+	size_t cur_len;
+	char *buf, *buf_ptr;
+
+	pthread_once(&codec_once, codec_init);
 
 	buf_ptr = buf = malloc(offset + nr_blocks * ENCODED_BLOCK_SIZE + 1);
 	if (!buf_ptr)
-		return rc;
+		return -ENOMEM;
 
 	buf_ptr += offset;
 
-	ctx = EVP_ENCODE_CTX_new();
-	if (!ctx) {
-		printf("Out of memory\n");
-		goto out;
-	}
-
-	EVP_EncodeInit(ctx);
-
-	for (i = 0; i < nr_blocks; i++) {
+	/* same layout as EVP_EncodeUpdate(): 64 characters per line */
+	while (input_len) {
 		cur_len = input_len < DECODED_BLOCK_SIZE ?
 			  input_len : DECODED_BLOCK_SIZE;
 
-		EVP_EncodeUpdate(ctx, buf_ptr, &encoded_len,
-				 (unsigned char *)input, cur_len);
-		if (i == DECODED_BLOCK_SIZE && !encoded_len) {
-			rc = -EINVAL;
-			goto out;
-		}
+		buf_ptr = b64_encode_line(buf_ptr, input, cur_len, input_len);
+		*buf_ptr++ = '\n';
 
-		buf_ptr += encoded_len;
 		input_len -= cur_len;
 		input += cur_len;
 	}
 
-	EVP_EncodeFinal(ctx, buf_ptr, &encoded_len);
-	buf_ptr += encoded_len;
-
 	*output_len = buf_ptr - buf;
-	*output = (char *)buf;
-	*(*output + *output_len) = '\0';
-	rc = 0;
-out:
-	if (rc)
+	*output = buf;
+	*buf_ptr = '\0';
+	return 0;
+}
+
+int attest_util_compress_data(size_t input_len, const unsigned char *input,
+			      size_t *output_len, unsigned char **output)
+{
+	uLongf buf_len = compressBound(input_len);
+	unsigned char *buf;
+
+	buf = malloc(buf_len);
+	if (!buf)
+		return -ENOMEM;
+
+	if (compress2(buf, &buf_len, input, input_len,
+		      Z_DEFAULT_COMPRESSION) != Z_OK) {
 		free(buf);
+		return -EINVAL;
+	}
 
-	EVP_ENCODE_CTX_free(ctx);
-	return rc;
+	*output_len = buf_len;
+	*output = buf;
+	return 0;
 }
 
-int attest_util_download_data(const char *url, int fd)
+/* initial size of the buffer of decompressed data */
+#define DECOMPRESS_BUF_SIZE 65536
+
+/*
+ * The output buffer grows while the stream is decompressed, up to
+ * max_output_len, so that memory is allocated only for data actually in the
+ * stream. reserve(), if set, is called before growing with the additional
+ * length, and its error stops decompression.
+ */
+int attest_util_decompress_data(size_t input_len, const unsigned char *input,
+				size_t max_output_len,
+				int (*reserve)(void *priv, size_t len),
+				void *priv, size_t *output_len,
+				unsigned char **output)
 {
-	CURL *curl;
-	FILE *f;
+	z_stream strm = { 0 };
+	unsigned char *buf = NULL, *new_buf;
+	size_t size = 0, new_size, limit;
 	int rc;
 
-	f = fdopen(fd, "wb");
-	if (!f)
-		return -EIO;
+	if (input_len > UINT32_MAX || max_output_len >= UINT32_MAX)
+		return -E2BIG;
+
+	if (inflateInit(&strm) != Z_OK)
+		return -ENOMEM;
+
+	strm.next_in = (unsigned char *)input;
+	strm.avail_in = input_len;
+
+	/* one more byte, to detect streams longer than the maximum */
+	limit = max_output_len + 1;
+
+	while (1) {
+		if (!strm.avail_out) {
+			if (size == limit) {
+				rc = -E2BIG;
+				break;
+			}
+
+			new_size = size ? size * 2 : DECOMPRESS_BUF_SIZE;
+			if (new_size > limit)
+				new_size = limit;
+
+			if (reserve) {
+				rc = reserve(priv, new_size - size);
+				if (rc)
+					break;
+			}
+
+			new_buf = realloc(buf, new_size);
+			if (!new_buf) {
+				rc = -ENOMEM;
+				break;
+			}
+
+			buf = new_buf;
+			strm.next_out = buf + size;
+			strm.avail_out = new_size - size;
+			size = new_size;
+		}
+
+		rc = inflate(&strm, Z_NO_FLUSH);
+		if (rc == Z_STREAM_END) {
+			rc = (strm.avail_in || strm.total_out > max_output_len) ?
+			     -EINVAL : 0;
+			break;
+		}
+
+		if (rc != Z_OK) {
+			rc = -EINVAL;
+			break;
+		}
+	}
+
+	inflateEnd(&strm);
+
+	if (rc) {
+		free(buf);
+		return rc;
+	}
+
+	*output_len = strm.total_out;
+	*output = buf;
+	return 0;
+}
+
+/* maximum number of connections opened by a batch of downloads */
+#define DOWNLOAD_MAX_CONNECTIONS 16
+/* maximum length of downloaded data, to a file or to memory */
+#define DOWNLOAD_MAX_LEN (64 * 1024 * 1024)
+
+/* state kept for the process lifetime: DNS, connection and TLS caches */
+static pthread_once_t download_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t download_locks[CURL_LOCK_DATA_LAST];
+static CURLSH *download_share;
+
+static void download_lock(CURL *handle, curl_lock_data data,
+			  curl_lock_access access, void *userptr)
+{
+	pthread_mutex_lock(&download_locks[data]);
+}
+
+static void download_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+	pthread_mutex_unlock(&download_locks[data]);
+}
+
+static void download_init(void)
+{
+	int i;
 
 	curl_global_init(CURL_GLOBAL_DEFAULT);
 
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&download_locks[i], NULL);
+
+	download_share = curl_share_init();
+	if (!download_share)
+		return;
+
+	curl_share_setopt(download_share, CURLSHOPT_LOCKFUNC, download_lock);
+	curl_share_setopt(download_share, CURLSHOPT_UNLOCKFUNC,
+			  download_unlock);
+	curl_share_setopt(download_share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_DNS);
+	curl_share_setopt(download_share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt(download_share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+static size_t download_write(char *ptr, size_t size, size_t nmemb,
+			     void *userdata)
+{
+	struct download_item *item = userdata;
+	size_t len = size * nmemb, new_size;
+	unsigned char *new_data;
+
+	/* servers not sending the length are stopped here */
+	if (len > DOWNLOAD_MAX_LEN - item->len)
+		return 0;
+
+	if (item->fd >= 0) {
+		if (attest_util_write_buf(item->fd, (unsigned char *)ptr, len))
+			return 0;
+
+		item->len += len;
+		return len;
+	}
+
+	if (item->len + len > item->size) {
+		new_size = item->size ? item->size : 4096;
+		while (new_size < item->len + len)
+			new_size *= 2;
+
+		new_data = realloc(item->data, new_size);
+		if (!new_data)
+			return 0;
+
+		item->data = new_data;
+		item->size = new_size;
+	}
+
+	memcpy(item->data + item->len, ptr, len);
+	item->len += len;
+	return len;
+}
+
+static CURL *download_easy_init(struct download_item *item)
+{
+	CURL *curl;
+
 	curl = curl_easy_init();
 	if (!curl)
-		goto out_close;
+		return NULL;
 
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)f);
+	curl_easy_setopt(curl, CURLOPT_URL, item->url);
+	curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE,
+			 (curl_off_t)DOWNLOAD_MAX_LEN);
 	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, download_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, item);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, item);
+
+	if (download_share)
+		curl_easy_setopt(curl, CURLOPT_SHARE, download_share);
 
-	rc = curl_easy_perform(curl);
-	if(rc != CURLE_OK) {
-		printf("curl_easy_perform() failed: %s\n",
-		       curl_easy_strerror(rc));
-		rc = -EACCES;
-		goto out_cleanup;
+	return curl;
+}
+
+static void download_item_end(struct download_item *item, CURLcode code)
+{
+	if (code == CURLE_OK) {
+		item->rc = 0;
+		return;
+	}
+
+	printf("%s download failed: %s\n", item->url,
+	       curl_easy_strerror(code));
+	item->rc = (code == CURLE_FILESIZE_EXCEEDED) ? -E2BIG : -EACCES;
+
+	if (item->fd < 0) {
+		free(item->data);
+		item->data = NULL;
 	}
 
-	fclose(f);
-	f = NULL;
-out_cleanup:
+	item->len = 0;
+}
+
+/**
+ * Download data from a URL
+ * @param[in] url	URL
+ * @param[in] fd	destination file descriptor (not closed)
+ *
+ * Downloads of more than 64 MiB fail.
+ *
+ * @returns 0 on success, a negative value on error
+ */
+int attest_util_download_data(const char *url, int fd)
+{
+	struct download_item item = { .url = url, .fd = fd };
+	CURL *curl;
+
+	pthread_once(&download_once, download_init);
+
+	curl = download_easy_init(&item);
+	if (!curl)
+		return -ENOMEM;
+
+	download_item_end(&item, curl_easy_perform(curl));
 	curl_easy_cleanup(curl);
-out_close:
-	curl_global_cleanup();
 
-	if (f)
-		fclose(f);
+	return item.rc;
+}
+
+/**
+ * Download data from multiple URLs concurrently
+ * @param[in] num_items		number of items
+ * @param[in,out] items		URL and destination of each download
+ *
+ * Items with fd set to -1 are downloaded to memory: on success, data must
+ * be freed by the caller. The result of each download is stored in rc.
+ * Downloads of more than 64 MiB fail.
+ *
+ * @returns 0 if all downloads succeeded, a negative value on error
+ */
+int attest_util_download_items(int num_items, struct download_item *items)
+{
+	struct download_item *item;
+	CURL **curl = NULL;
+	CURLM *multi;
+	CURLMsg *msg;
+	int rc = -ENOMEM, i, running, left;
+
+	pthread_once(&download_once, download_init);
+
+	for (i = 0; i < num_items; i++) {
+		items[i].rc = -EINPROGRESS;
+		items[i].len = 0;
+		items[i].size = 0;
+		items[i].data = NULL;
+	}
+
+	multi = curl_multi_init();
+	if (!multi)
+		return -ENOMEM;
+
+	curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+			  (long)DOWNLOAD_MAX_CONNECTIONS);
 
+	curl = calloc(num_items, sizeof(*curl));
+	if (!curl)
+		goto out;
+
+	for (i = 0; i < num_items; i++) {
+		curl[i] = download_easy_init(&items[i]);
+		if (!curl[i])
+			goto out;
+
+		curl_multi_add_handle(multi, curl[i]);
+	}
+
+	do {
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+			break;
+
+		while ((msg = curl_multi_info_read(multi, &left))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+					  (char **)&item);
+			download_item_end(item, msg->data.result);
+		}
+
+		if (running &&
+		    curl_multi_wait(multi, NULL, 0, 1000, NULL) != CURLM_OK)
+			break;
+	} while (running);
+
+	rc = 0;
+out:
+	for (i = 0; i < num_items; i++) {
+		if (curl && curl[i]) {
+			curl_multi_remove_handle(multi, curl[i]);
+			curl_easy_cleanup(curl[i]);
+		}
+
+		/* interrupted transfers */
+		if (items[i].rc == -EINPROGRESS)
+			download_item_end(&items[i], CURLE_ABORTED_BY_CALLBACK);
+
+		if (items[i].rc && !rc)
+			rc = items[i].rc;
+	}
+
+	free(curl);
+	curl_multi_cleanup(multi);
 	return rc;
 }
 
@@ -417,6 +1213,14 @@ out:
 	return rc;
 }
 
+unsigned int attest_util_hash_str(const char *str, unsigned int hash)
+{
+	while (*str)
+		hash = hash * 33 + *str++;
+
+	return hash;
+}
+
 /**
  * @name Kernel Functions
  *  @{
@@ -447,6 +1251,17 @@ static int hex_to_bin(char ch)
 
 int _hex2bin(unsigned char *dst, const char *src, size_t count)
 {
+	size_t done;
+
+	pthread_once(&codec_once, codec_init);
+
+	if (codec.hex_decode) {
+		done = codec.hex_decode(dst, src, count);
+		dst += done;
+		src += done * 2;
+		count -= done;
+	}
+
 	while (count--) {
 		int hi = hex_to_bin(*src++);
 		int lo = hex_to_bin(*src++);
@@ -462,6 +1277,16 @@ int _hex2bin(unsigned char *dst, const char *src, size_t count)
 char *_bin2hex(char *dst, const void *src, size_t count)
 {
 	const unsigned char *_src = src;
+	size_t done;
+
+	pthread_once(&codec_once, codec_init);
+
+	if (codec.hex_encode) {
+		done = codec.hex_encode(dst, _src, count);
+		dst += done * 2;
+		_src += done;
+		count -= done;
+	}
 
 	while (count--)
 		dst = hex_byte_pack(dst, *_src++);
@@ -40,6 +40,8 @@
 
 #include <ibmtss/cryptoutils.h>
 
+#define IMA_BOOT_AGGREGATE_ID "ima_boot_aggregate|verify"
+
 static int attest_verifier_check_signature(attest_ctx_data *d_ctx,
 					   attest_ctx_verifier *v_ctx,
 					   INT32 tpms_attest_len,
@@ -249,7 +251,9 @@ static int attest_verifier_check_pcrs(attest_ctx_data *d_ctx,
 				      TPML_PCR_SELECTION *pcr_selection,
 				      BYTE *pcr_digest, int parse_logs)
 {
+	struct event_log_checkpoint *checkpoint;
 	struct verification_log *log;
+	uint8_t pcr_bank_mask = v_ctx->pcr_bank_mask;
 	int rc;
 
 	log = attest_ctx_verifier_add_log(v_ctx, "check PCR policy");
@@ -264,12 +268,36 @@ static int attest_verifier_check_pcrs(attest_ctx_data *d_ctx,
 	if (rc)
 		goto out;
 
+	/* calculate only the banks in the quote, unless set by the caller */
+	if (!pcr_bank_mask) {
+		rc = attest_pcr_select_banks(v_ctx, pcr_selection);
+		if (rc)
+			goto out_cleanup;
+
+		/* the boot aggregate is usually calculated from SHA1 PCRs */
+		if (attest_ctx_verifier_lookup(v_ctx, IMA_BOOT_AGGREGATE_ID))
+			v_ctx->pcr_bank_mask |= (1 << PCR_BANK_SHA1);
+	}
+
 	rc = attest_event_log_parse_verify(d_ctx, v_ctx, 1);
 	if (rc)
 		goto out_cleanup;
 
 	rc = attest_pcr_verify(v_ctx, pcr_selection, hashAlg, pcr_digest);
+	if (!rc && v_ctx->new_checkpoint) {
+		checkpoint = v_ctx->new_checkpoint;
+		checkpoint->pcr = attest_pcr_snapshot(v_ctx);
+		checkpoint->pcr_bank_mask = attest_pcr_bank_mask(v_ctx);
+		if (!checkpoint->pcr)
+			rc = -ENOMEM;
+	}
+
+	if (rc) {
+		attest_event_log_checkpoint_free(v_ctx->new_checkpoint);
+		v_ctx->new_checkpoint = NULL;
+	}
 out_cleanup:
+	v_ctx->pcr_bank_mask = pcr_bank_mask;
 	attest_pcr_cleanup(v_ctx);
 out:
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
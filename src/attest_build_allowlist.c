@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: attest_build_allowlist.c
+ *      Build the table of known-good digests for the ima_allowlist verifier.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "ima_allowlist.h"
+#include "util.h"
+#include "conf.h"
+
+#define MAX_ALGS 16
+#define NEW_SUFFIX ".new"
+
+struct allowlist_alg {
+	char algo[IMA_ALLOWLIST_ALGO_LEN];
+	uint32_t digest_len;
+	uint8_t *digests;
+	size_t num_digests;
+	size_t max_digests;
+	uint32_t index[IMA_ALLOWLIST_INDEX_SIZE + 1];
+};
+
+static struct allowlist_alg *algs[MAX_ALGS];
+static int num_algs;
+static uint32_t sort_digest_len;
+
+static struct allowlist_alg *lookup_alg(const char *algo, size_t algo_len,
+					uint32_t digest_len)
+{
+	struct allowlist_alg *alg;
+	int i;
+
+	for (i = 0; i < num_algs; i++) {
+		if (strlen(algs[i]->algo) == algo_len &&
+		    !memcmp(algs[i]->algo, algo, algo_len)) {
+			if (algs[i]->digest_len != digest_len)
+				return NULL;
+
+			return algs[i];
+		}
+	}
+
+	if (num_algs == MAX_ALGS || algo_len >= IMA_ALLOWLIST_ALGO_LEN)
+		return NULL;
+
+	alg = calloc(1, sizeof(*alg));
+	if (!alg)
+		return NULL;
+
+	memcpy(alg->algo, algo, algo_len);
+	alg->digest_len = digest_len;
+
+	algs[num_algs++] = alg;
+	return alg;
+}
+
+/* format: <algo>:<hex digest> [anything], '#' starts a comment */
+static int add_digest(char *line)
+{
+	struct allowlist_alg *alg;
+	uint8_t *new_digests;
+	char *sep, *digest_str, *ptr;
+	size_t digest_str_len;
+
+	ptr = strchr(line, '#');
+	if (ptr)
+		*ptr = '\0';
+
+	line += strspn(line, " \t\n");
+	if (!*line)
+		return 0;
+
+	sep = strchr(line, ':');
+	if (!sep)
+		return -EINVAL;
+
+	digest_str = sep + 1;
+	digest_str_len = strcspn(digest_str, " \t\n");
+
+	if (digest_str_len % 2 || digest_str_len < 4 ||
+	    digest_str_len > IMA_ALLOWLIST_MAX_DIGEST_LEN * 2)
+		return -EINVAL;
+
+	alg = lookup_alg(line, sep - line, digest_str_len / 2);
+	if (!alg)
+		return -EINVAL;
+
+	if (alg->num_digests == UINT32_MAX)
+		return -E2BIG;
+
+	if (alg->num_digests == alg->max_digests) {
+		alg->max_digests = alg->max_digests ?
+				   alg->max_digests * 2 : 65536;
+		new_digests = realloc(alg->digests,
+				      alg->max_digests * alg->digest_len);
+		if (!new_digests)
+			return -ENOMEM;
+
+		alg->digests = new_digests;
+	}
+
+	if (_hex2bin(alg->digests + alg->num_digests * alg->digest_len,
+		     digest_str, alg->digest_len) < 0)
+		return -EINVAL;
+
+	alg->num_digests++;
+	return 0;
+}
+
+static int compare_digests(const void *a, const void *b)
+{
+	return memcmp(a, b, sort_digest_len);
+}
+
+/* digests are sorted, duplicates removed and the prefix index built */
+static void sort_alg(struct allowlist_alg *alg)
+{
+	uint32_t prefix, next_prefix = 0;
+	size_t i, num = 0;
+	uint8_t *digest;
+
+	sort_digest_len = alg->digest_len;
+	qsort(alg->digests, alg->num_digests, alg->digest_len,
+	      compare_digests);
+
+	for (i = 0; i < alg->num_digests; i++) {
+		digest = alg->digests + i * alg->digest_len;
+
+		if (i && !memcmp(digest - alg->digest_len, digest,
+				 alg->digest_len))
+			continue;
+
+		memmove(alg->digests + num * alg->digest_len, digest,
+			alg->digest_len);
+
+		prefix = ima_allowlist_prefix(digest);
+		while (next_prefix <= prefix)
+			alg->index[next_prefix++] = num;
+
+		num++;
+	}
+
+	while (next_prefix <= IMA_ALLOWLIST_INDEX_SIZE)
+		alg->index[next_prefix++] = num;
+
+	alg->num_digests = num;
+}
+
+static size_t align_offset(size_t offset)
+{
+	return (offset + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+static int write_padding(int fd, size_t *offset)
+{
+	uint8_t zero[sizeof(uint64_t)] = { 0 };
+	size_t pad = align_offset(*offset) - *offset;
+
+	*offset += pad;
+	return attest_util_write_buf(fd, zero, pad);
+}
+
+static int write_allowlist(int fd)
+{
+	struct ima_allowlist_hdr hdr = { .version = IMA_ALLOWLIST_VERSION,
+					 .num_algs = num_algs };
+	struct ima_allowlist_alg_hdr alg_hdr[MAX_ALGS];
+	size_t offset, digests_len;
+	int rc, i;
+
+	memcpy(hdr.magic, IMA_ALLOWLIST_MAGIC, sizeof(hdr.magic));
+
+	memset(alg_hdr, 0, sizeof(alg_hdr));
+	offset = align_offset(sizeof(hdr) + num_algs * sizeof(*alg_hdr));
+
+	for (i = 0; i < num_algs; i++) {
+		memcpy(alg_hdr[i].algo, algs[i]->algo, sizeof(alg_hdr[i].algo));
+		alg_hdr[i].digest_len = algs[i]->digest_len;
+		alg_hdr[i].num_digests = algs[i]->num_digests;
+		alg_hdr[i].index_offset = offset;
+		offset += sizeof(algs[i]->index);
+		alg_hdr[i].digests_offset = offset;
+		offset += algs[i]->num_digests * algs[i]->digest_len;
+		offset = align_offset(offset);
+	}
+
+	rc = attest_util_write_buf(fd, (uint8_t *)&hdr, sizeof(hdr));
+	if (rc)
+		return rc;
+
+	rc = attest_util_write_buf(fd, (uint8_t *)alg_hdr,
+				   num_algs * sizeof(*alg_hdr));
+	if (rc)
+		return rc;
+
+	offset = sizeof(hdr) + num_algs * sizeof(*alg_hdr);
+
+	for (i = 0; i < num_algs; i++) {
+		rc = write_padding(fd, &offset);
+		if (rc)
+			return rc;
+
+		rc = attest_util_write_buf(fd, (uint8_t *)algs[i]->index,
+					   sizeof(algs[i]->index));
+		if (rc)
+			return rc;
+
+		digests_len = algs[i]->num_digests * algs[i]->digest_len;
+
+		rc = attest_util_write_buf(fd, algs[i]->digests, digests_len);
+		if (rc)
+			return rc;
+
+		offset += sizeof(algs[i]->index) + digests_len;
+	}
+
+	return write_padding(fd, &offset);
+}
+
+static struct option long_options[] = {
+	{"input", 1, 0, 'i'},
+	{"output", 1, 0, 'o'},
+	{"help", 0, 0, 'h'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+static void usage(char *argv0)
+{
+	fprintf(stdout, "Usage: %s [options]\n\n"
+		"Options:\n"
+		"\t-i, --input <file>            digest list (default: stdin)\n"
+		"\t-o, --output <file>           allowlist (default: "
+		IMA_ALLOWLIST_PATH ")\n"
+		"\t-h, --help                    print this help message\n"
+		"\t-v, --version                 print package version\n"
+		"\n"
+		"Input lines have the format <algo>:<hex digest>.\n"
+		"\n"
+		"Report bugs to " PACKAGE_BUGREPORT "\n",
+		argv0);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	char *input_path = NULL, *output_path = IMA_ALLOWLIST_PATH;
+	char line[8192], *new_path = NULL;
+	int rc = 0, option_index, c, fd = -1, i;
+	unsigned long line_num = 0;
+	FILE *fp = stdin;
+
+	while (1) {
+		option_index = 0;
+		c = getopt_long(argc, argv, "i:o:hv", long_options,
+				&option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'i':
+				input_path = optarg;
+				break;
+			case 'o':
+				output_path = optarg;
+				break;
+			case 'h':
+				usage(argv[0]);
+				break;
+			case 'v':
+				fprintf(stdout, "%s " VERSION "\n"
+					"Copyright 2026 attest-tools contributors\n"
+					"License GPLv2: GNU GPL version 2\n",
+					argv[0]);
+				exit(0);
+			default:
+				printf("Unknown option '%c'\n", c);
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (input_path) {
+		fp = fopen(input_path, "r");
+		if (!fp) {
+			printf("Cannot open %s\n", input_path);
+			return 1;
+		}
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		line_num++;
+
+		rc = add_digest(line);
+		if (rc < 0) {
+			printf("Invalid digest at line %lu\n", line_num);
+			break;
+		}
+	}
+
+	if (input_path)
+		fclose(fp);
+
+	if (rc < 0)
+		goto out;
+
+	for (i = 0; i < num_algs; i++)
+		sort_alg(algs[i]);
+
+	new_path = malloc(strlen(output_path) + sizeof(NEW_SUFFIX));
+	if (!new_path) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	sprintf(new_path, "%s" NEW_SUFFIX, output_path);
+
+	fd = open(new_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Cannot create %s\n", new_path);
+		rc = -EACCES;
+		goto out;
+	}
+
+	rc = write_allowlist(fd);
+	if (!rc && fsync(fd) < 0)
+		rc = -EIO;
+
+	close(fd);
+
+	/* servers keep the mapping of the old table until they reload it */
+	if (!rc && rename(new_path, output_path) < 0)
+		rc = -EIO;
+
+	if (rc) {
+		printf("Cannot write %s\n", output_path);
+		unlink(new_path);
+		goto out;
+	}
+
+	for (i = 0; i < num_algs; i++)
+		printf("%s: %zu digests\n", algs[i]->algo,
+		       algs[i]->num_digests);
+out:
+	for (i = 0; i < num_algs; i++) {
+		free(algs[i]->digests);
+		free(algs[i]);
+	}
+
+	free(new_path);
+	return rc ? 1 : 0;
+}
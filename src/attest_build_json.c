@@ -113,7 +113,7 @@ static void add_json(json_object *parent, int append,
 
 static int add_file_base64(json_object *parent, enum ctx_fields field,
 			   const char *data_location, const char *data_label,
-			   int append, int newline)
+			   enum data_formats fmt, int append, int newline)
 {
 	size_t line_len, input_len;
 	char *input_ptr, *newline_ptr, *output;
@@ -137,7 +137,7 @@ static int add_file_base64(json_object *parent, enum ctx_fields field,
 			line_len = newline_ptr - input_ptr;
 		}
 
-		rc = attest_ctx_data_new_string(DATA_FMT_BASE64, line_len,
+		rc = attest_ctx_data_new_string(fmt, line_len,
 						(unsigned char *)input_ptr,
 						&output);
 		if (rc) {
@@ -192,7 +192,7 @@ static int add_file(json_object *root, enum ctx_fields field,
 		return rc;
 	}
 
-	if (field == CTX_EVENT_LOG || field == CTX_AUX_DATA) {
+	if (CTX_FIELD_LABELED(field)) {
 		if (!default_label && !data_label) {
 			data_label = ask_question(sizeof(data_label_buf),
 				data_label_buf, "Enter label for %s: ",
@@ -213,7 +213,7 @@ static int add_file(json_object *root, enum ctx_fields field,
 
 	json_object_object_get_ex(root, field_str, &parent);
 	if (!parent) {
-		if (field == CTX_EVENT_LOG || field == CTX_AUX_DATA)
+		if (CTX_FIELD_LABELED(field))
 			parent = json_object_new_object();
 		else
 			parent = json_object_new_array();
@@ -223,8 +223,9 @@ static int add_file(json_object *root, enum ctx_fields field,
 
 	switch (fmt) {
 	case DATA_FMT_BASE64:
+	case DATA_FMT_ZLIB_BASE64:
 		rc = add_file_base64(parent, field, data_location, data_label,
-				     append, newline);
+				     fmt, append, newline);
 		break;
 	case DATA_FMT_URI:
 		rc = add_file_uri(parent, field, data_location, data_label,
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,6 +28,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 
+#include "ctx_json.h"
 #include "enroll_client.h"
 #include "util.h"
 #include "conf.h"
@@ -34,11 +36,18 @@
 #define SERVER_HOSTNAME "test-server"
 #define SERVER_PORT "3000"
 
-static int send_receive(char *test_server_fqdn, int op, char *message_in,
-			char **message_out)
+/* connection to the RA server, kept open for all requests */
+static int server_fd = -1;
+
+/* directory where quote requests are saved for attest_ra_load */
+static char *record_dir;
+
+/* set by signals received in daemon mode */
+static volatile sig_atomic_t quote_now, daemon_stop;
+
+static int server_connect(char *test_server_fqdn)
 {
 	struct addrinfo hints, *result = NULL, *rp;
-	size_t len;
 	int rc, fd = -1;
 
 	memset(&hints, 0, sizeof(struct addrinfo));
@@ -49,7 +58,7 @@ static int send_receive(char *test_server_fqdn, int op, char *message_in,
 
 	rc = getaddrinfo(test_server_fqdn, SERVER_PORT, &hints, &result);
 	if (rc)
-		goto out;
+		return -EIO;
 
 	for (rp = result; rp != NULL; rp = rp->ai_next) {
 		fd = socket(rp->ai_family, rp->ai_socktype,
@@ -65,47 +74,247 @@ static int send_receive(char *test_server_fqdn, int op, char *message_in,
 
 	freeaddrinfo(result);
 
-	if (!rp) {
-		rc = -EIO;
-		goto out;
-	}
+	if (!rp)
+		return -EIO;
+
+	return fd;
+}
 
-	len = strlen(message_in);
+static int send_request(int fd, int op, char *message_in)
+{
+	size_t len;
+	int rc;
+
+	len = attest_ctx_msg_len(message_in);
 	len += sizeof(len) * 2;
 
 	rc = attest_util_write_buf(fd, (uint8_t *)&len, sizeof(len));
 	if (rc)
-		goto out;
+		return rc;
 
 	rc = attest_util_write_buf(fd, (uint8_t *)&op, sizeof(op));
 	if (rc)
-		goto out;
+		return rc;
 
-	rc = attest_util_write_buf(fd, (uint8_t *)message_in,
-				   len - sizeof(len) * 2);
-	if (rc)
-		goto out;
+	return attest_util_write_buf(fd, (uint8_t *)message_in,
+				     len - sizeof(len) * 2);
+}
+
+static int receive_response(int fd, size_t len, char **message_out)
+{
+	int rc;
+
+	if (len <= sizeof(len))
+		return -EINVAL;
 
-	rc = attest_util_read_buf(fd, (uint8_t *)&len, sizeof(len));
+	*message_out = malloc(len);
+	if (!*message_out)
+		return -ENOMEM;
+
+	len -= sizeof(len);
+
+	rc = attest_util_read_buf(fd, (uint8_t *)*message_out, len);
 	if (rc)
+		return rc;
+
+	(*message_out)[len] = '\0';
+	return attest_ctx_msg_check(*message_out, len);
+}
+
+/* files are named op<op>-<pid>.msg, the format read by attest_ra_load */
+static int record_request(int op, char *message_in)
+{
+	char path[MAX_PATH_LENGTH];
+
+	snprintf(path, sizeof(path), "%s/op%d-%d.msg", record_dir, op,
+		 getpid());
+
+	return attest_util_write_file(path, attest_ctx_msg_len(message_in),
+				      (unsigned char *)message_in, 0);
+}
+
+/* attest data is saved in JSON format, also when messages are in TLV */
+static int save_attest_data(const char *path, char *message)
+{
+	attest_ctx_data *d_ctx = NULL;
+	char *json_str = NULL;
+	int rc;
+
+	if (attest_ctx_msg_get_format(message) != CTX_MSG_TLV)
+		return attest_util_write_file(path, strlen(message),
+					      (unsigned char *)message, 0);
+
+	rc = attest_ctx_data_init_flags(&d_ctx, CTX_IN_MEMORY);
+	if (rc < 0)
+		return rc;
+
+	rc = attest_ctx_data_add_msg(d_ctx, message);
+	if (rc < 0)
 		goto out;
 
-	if (len == 0) {
-		rc = -EINVAL;
+	rc = attest_ctx_data_print_json(d_ctx, &json_str);
+	if (rc < 0)
 		goto out;
+
+	rc = attest_util_write_file(path, strlen(json_str),
+				    (unsigned char *)json_str, 0);
+	free(json_str);
+out:
+	attest_ctx_data_cleanup(d_ctx);
+	return rc;
+}
+
+/* requests are sent on the same connection, as long as the server keeps it */
+static int send_receive(char *test_server_fqdn, int op, char *message_in,
+			char **message_out)
+{
+	size_t len;
+	int rc, reused;
+
+	if (record_dir && (op == 3 || op == 4)) {
+		rc = record_request(op, message_in);
+		if (rc < 0) {
+			printf("Cannot record request in %s\n", record_dir);
+			return rc;
+		}
 	}
 
-	*message_out = malloc(len);
-	if (!*message_out) {
-		rc = -ENOMEM;
+	while (1) {
+		reused = (server_fd != -1);
+
+		if (!reused) {
+			server_fd = server_connect(test_server_fqdn);
+			if (server_fd < 0)
+				return server_fd;
+		}
+
+		rc = send_request(server_fd, op, message_in);
+		if (!rc)
+			rc = attest_util_read_buf(server_fd, (uint8_t *)&len,
+						  sizeof(len));
+		if (!rc)
+			break;
+
+		close(server_fd);
+		server_fd = -1;
+
+		/* the server closed an idle connection, retry on a new one */
+		if (!reused)
+			return rc;
+	}
+
+	/* an error was reported, but the connection can still be used */
+	if (len == 0)
+		return -EINVAL;
+
+	rc = receive_response(server_fd, len, message_out);
+	if (rc) {
+		close(server_fd);
+		server_fd = -1;
+	}
+
+	return rc;
+}
+
+struct quote_opts {
+	char *test_server_fqdn;
+	int kernel_bios_log;
+	int kernel_ima_log;
+	char *pcr_alg_name;
+	char *pcr_list_str;
+	int skip_sig_ver;
+	int send_unsigned_files;
+	int compress_data;
+};
+
+static int send_quote(struct quote_opts *o)
+{
+	char *message_in = NULL, *message_out = NULL;
+	int rc;
+
+	rc = attest_enroll_msg_quote_nonce_request(o->kernel_ima_log,
+						   o->send_unsigned_files,
+						   &message_out);
+	if (rc < 0)
+		goto out;
+
+	rc = send_receive(o->test_server_fqdn, 3, message_out, &message_in);
+	if (rc < 0)
+		goto out;
+
+	free(message_out);
+	message_out = NULL;
+
+	rc = attest_enroll_msg_quote_request(PRIVACY_CA_DIR,
+					     o->kernel_bios_log,
+					     o->kernel_ima_log,
+					     o->pcr_alg_name, o->pcr_list_str,
+					     o->skip_sig_ver,
+					     o->send_unsigned_files,
+					     o->compress_data, message_in,
+					     &message_out);
+	if (rc < 0) {
+		/* a cursor not matching the logs would fail again */
+		if (o->kernel_ima_log)
+			attest_enroll_update_ima_cursor(0);
 		goto out;
 	}
 
-	len -= sizeof(len);
+	free(message_in);
+	message_in = NULL;
 
-	rc = attest_util_read_buf(fd, (uint8_t *)*message_out, len);
+	rc = send_receive(o->test_server_fqdn, 4, message_out, &message_in);
+	if (!rc)
+		printf("successful verification\n");
+	else
+		printf("failed verification\n");
+
+	if (o->kernel_ima_log)
+		attest_enroll_update_ima_cursor(!rc);
 out:
-	close(fd);
+	free(message_in);
+	free(message_out);
+	return rc;
+}
+
+static void daemon_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		quote_now = 1;
+	else
+		daemon_stop = 1;
+}
+
+/* quote every interval seconds, or immediately at SIGUSR1 */
+static int run_daemon(struct quote_opts *o, int interval,
+		      TPM_HANDLE ak_handle)
+{
+	struct sigaction act = { .sa_handler = daemon_signal,
+				 .sa_flags = SA_RESTART };
+	unsigned int left;
+	int rc;
+
+	rc = attest_enroll_session_open(PRIVACY_CA_DIR, ak_handle);
+	if (rc < 0) {
+		printf("Cannot open session, rc: %d\n", rc);
+		return rc;
+	}
+
+	/* requests in progress are not interrupted, sleep() is */
+	sigaction(SIGUSR1, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGINT, &act, NULL);
+
+	while (!daemon_stop) {
+		quote_now = 0;
+		rc = send_quote(o);
+
+		left = interval;
+		while (left && !quote_now && !daemon_stop)
+			left = sleep(left);
+	}
+
+	attest_enroll_session_close();
 	return rc;
 }
 
@@ -124,6 +333,11 @@ static struct option long_options[] = {
 	{"save-attest-data", 1, 0, 'r'},
 	{"attest-data-url", 1, 0, 'U'},
 	{"send-unsigned-files", 0, 0, 'u'},
+	{"binary-format", 0, 0, 'B'},
+	{"compress-data", 0, 0, 'z'},
+	{"record", 1, 0, 'R'},
+	{"daemon", 1, 0, 'D'},
+	{"ak-handle", 1, 0, 'K'},
 	{"help", 0, 0, 'h'},
 	{"version", 0, 0, 'v'},
 	{0, 0, 0, 0}
@@ -147,6 +361,12 @@ static void usage(char *argv0)
 		"\t-r, --save-attest-data <file> save attest data\n"
 		"\t-U, --attest-data-url 	 attest data URL\n"
 		"\t-u, --send-unsigned-files     send unsigned files\n"
+		"\t-B, --binary-format           send messages in TLV format\n"
+		"\t-z, --compress-data           compress event logs and aux data\n"
+		"\t-R, --record <dir>            save quote requests for replay\n"
+		"\t-D, --daemon <sec>            send quote every <sec> seconds,\n"
+		"\t                              and at SIGUSR1\n"
+		"\t-K, --ak-handle <handle>      make the AK persistent (daemon)\n"
 		"\t-h, --help                    print this help message\n"
 		"\t-v, --version                 print package version\n"
 		"\n"
@@ -166,8 +386,11 @@ int main(int argc, char **argv)
 	char **attest_data_ptr = NULL, *attest_data, *attest_data_path = NULL;
 	char *pcr_alg_name = "sha1", *attest_data_url = NULL;
 	char hostname[128];
-	int skip_sig_ver = 0, send_unsigned_files = 0;
+	int skip_sig_ver = 0, send_unsigned_files = 0, compress_data = 0;
 	int rc = 0, option_index, c, kernel_bios_log = 0, kernel_ima_log = 0;
+	int daemon_interval = 0;
+	TPM_HANDLE ak_handle = 0;
+	struct quote_opts quote_opts;
 	char *csr_subject_entries[] = {
 		"DE",
 		"Bayern",
@@ -179,9 +402,12 @@ int main(int argc, char **argv)
 
 	setvbuf(stdout, NULL, _IONBF, 1);
 
+	/* writing to a connection closed by the server is not fatal */
+	signal(SIGPIPE, SIG_IGN);
+
 	while (1) {
 		option_index = 0;
-		c = getopt_long(argc, argv, "aAkyqSs:bip:P:r:U:uhv",
+		c = getopt_long(argc, argv, "aAkyqSs:bip:P:r:U:uBzR:D:K:hv",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -230,6 +456,21 @@ int main(int argc, char **argv)
 			case 'u':
 				send_unsigned_files = 1;
 				break;
+			case 'B':
+				attest_enroll_msg_set_format(CTX_MSG_TLV);
+				break;
+			case 'z':
+				compress_data = 1;
+				break;
+			case 'R':
+				record_dir = optarg;
+				break;
+			case 'D':
+				daemon_interval = atoi(optarg);
+				break;
+			case 'K':
+				ak_handle = strtoul(optarg, NULL, 0);
+				break;
 			case 'h':
 				usage(argv[0]);
 				break;
@@ -255,9 +496,7 @@ int main(int argc, char **argv)
 			break;
 
 		if (attest_data_ptr)
-			rc = attest_util_write_file(attest_data_path,
-					strlen(message_in),
-					(unsigned char *)message_in, 0);
+			rc = save_attest_data(attest_data_path, message_in);
 
 		rc = send_receive(test_server_fqdn, 0, message_in,
 				  &message_out);
@@ -328,36 +567,22 @@ int main(int argc, char **argv)
 						  pcr_list_str);
 		break;
 	case SEND_QUOTE:
-		rc = attest_enroll_msg_quote_nonce_request(&message_out);
-		if (rc < 0)
-			break;
-
-		rc = send_receive(test_server_fqdn, 3, message_out,
-				  &message_in);
-		if (rc < 0)
-			break;
-
-		free(message_out);
-		message_out = NULL;
-
-		rc = attest_enroll_msg_quote_request(PRIVACY_CA_DIR,
-						kernel_bios_log, kernel_ima_log,
-						pcr_alg_name, pcr_list_str,
-						skip_sig_ver,
-						send_unsigned_files,
-						message_in, &message_out);
-		if (rc < 0)
-			break;
-
-		free(message_in);
-		message_in = NULL;
-
-		rc = send_receive(test_server_fqdn, 4, message_out,
-				  &message_in);
-		if (!rc)
-			printf("successful verification\n");
+		quote_opts = (struct quote_opts) {
+			.test_server_fqdn = test_server_fqdn,
+			.kernel_bios_log = kernel_bios_log,
+			.kernel_ima_log = kernel_ima_log,
+			.pcr_alg_name = pcr_alg_name,
+			.pcr_list_str = pcr_list_str,
+			.skip_sig_ver = skip_sig_ver,
+			.send_unsigned_files = send_unsigned_files,
+			.compress_data = compress_data,
+		};
+
+		if (daemon_interval > 0)
+			rc = run_daemon(&quote_opts, daemon_interval,
+					ak_handle);
 		else
-			printf("failed verification\n");
+			rc = send_quote(&quote_opts);
 		break;
 	default:
 		printf("Request not provided\n");
@@ -368,6 +593,8 @@ int main(int argc, char **argv)
 		free(message_in);
 	if (message_out)
 		free(message_out);
+	if (server_fd != -1)
+		close(server_fd);
 
 	return rc;
 }
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: attest_ra_fleet.c
+ *      Send RA requests to many servers concurrently.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <json-c/json.h>
+
+#include "ra_async.h"
+#include "ctx_tlv.h"
+#include "util.h"
+
+#define SERVER_PORT "3000"
+#define DEFAULT_OP 3
+#define DEFAULT_IN_FLIGHT 256
+#define DEFAULT_TIMEOUT 30
+
+struct fleet_host {
+	struct list_head list;
+	char *host;
+	size_t len;
+	unsigned char *message;
+	int mapped;
+};
+
+static LIST_HEAD(hosts);
+
+static int fleet_host_add(char *host, char *message_path,
+			  size_t default_len, unsigned char *default_message)
+{
+	struct fleet_host *h;
+	int rc;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	h->host = strdup(host);
+	if (!h->host) {
+		free(h);
+		return -ENOMEM;
+	}
+
+	h->len = default_len;
+	h->message = default_message;
+
+	if (message_path) {
+		rc = attest_util_read_file(message_path, &h->len, &h->message);
+		if (rc < 0) {
+			printf("Cannot read message %s\n", message_path);
+			free(h->host);
+			free(h);
+			return rc;
+		}
+
+		h->mapped = 1;
+	}
+
+	if (!h->message) {
+		printf("Message for host %s not provided\n", host);
+		free(h->host);
+		free(h);
+		return -EINVAL;
+	}
+
+	list_add_tail(&h->list, &hosts);
+	return 0;
+}
+
+/* lines have the format: <host> [message file], '#' starts a comment */
+static int fleet_hosts_read(FILE *fp, size_t default_len,
+			    unsigned char *default_message)
+{
+	char line[1024], *host, *message_path, *ptr;
+	int rc;
+
+	while (fgets(line, sizeof(line), fp)) {
+		ptr = strchr(line, '#');
+		if (ptr)
+			*ptr = '\0';
+
+		host = strtok(line, " \t\n");
+		if (!host)
+			continue;
+
+		message_path = strtok(NULL, " \t\n");
+
+		rc = fleet_host_add(host, message_path, default_len,
+				    default_message);
+		if (rc < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void fleet_hosts_free(void)
+{
+	struct fleet_host *h, *temp_h;
+
+	list_for_each_entry_safe(h, temp_h, &hosts, list) {
+		if (h->mapped)
+			munmap(h->message, h->len);
+
+		free(h->host);
+		free(h);
+	}
+}
+
+static void print_result(struct ra_async_req *req, int rc, char *message_out)
+{
+	struct timespec now;
+	json_object *root;
+	long time_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	time_ms = (now.tv_sec - req->start.tv_sec) * 1000 +
+		  (now.tv_nsec - req->start.tv_nsec) / 1000000;
+
+	root = json_object_new_object();
+	if (!root)
+		return;
+
+	json_object_object_add(root, "host", json_object_new_string(req->host));
+	json_object_object_add(root, "op", json_object_new_int(req->op));
+	json_object_object_add(root, "rc", json_object_new_int(rc));
+	json_object_object_add(root, "time_ms", json_object_new_int(time_ms));
+
+	if (message_out) {
+		if (attest_ctx_msg_get_format(message_out) == CTX_MSG_JSON)
+			json_object_object_add(root, "response",
+					json_object_new_string(message_out));
+		else
+			json_object_object_add(root, "response_len",
+					json_object_new_int(
+					attest_ctx_msg_len(message_out)));
+	}
+
+	printf("%s\n", json_object_to_json_string_ext(root,
+						      JSON_C_TO_STRING_PLAIN));
+	json_object_put(root);
+}
+
+static void raise_fd_limit(void)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		return;
+
+	rlim.rlim_cur = rlim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rlim);
+}
+
+static struct option long_options[] = {
+	{"hosts", 1, 0, 'f'},
+	{"op", 1, 0, 'o'},
+	{"message", 1, 0, 'm'},
+	{"port", 1, 0, 'p'},
+	{"concurrency", 1, 0, 'c'},
+	{"timeout", 1, 0, 't'},
+	{"help", 0, 0, 'h'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+static void usage(char *argv0)
+{
+	fprintf(stdout, "Usage: %s [options]\n\n"
+		"Options:\n"
+		"\t-f, --hosts <file>            host list (default: stdin)\n"
+		"\t-o, --op <op>                 RA protocol operation\n"
+		"\t-m, --message <file>          default message (JSON or TLV)\n"
+		"\t-p, --port <port>             RA server port\n"
+		"\t-c, --concurrency <num>       max concurrent requests\n"
+		"\t-t, --timeout <sec>           request timeout\n"
+		"\t-h, --help                    print this help message\n"
+		"\t-v, --version                 print package version\n"
+		"\n"
+		"Report bugs to " PACKAGE_BUGREPORT "\n",
+		argv0);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct ra_async *a = NULL;
+	struct fleet_host *h;
+	unsigned char *message = NULL;
+	char *hosts_path = NULL, *message_path = NULL, *port = SERVER_PORT;
+	int op = DEFAULT_OP, max_in_flight = DEFAULT_IN_FLIGHT;
+	int timeout = DEFAULT_TIMEOUT;
+	int rc = 0, option_index, c;
+	size_t len = 0;
+	FILE *fp = stdin;
+
+	/* writing to a connection closed by the server is not fatal */
+	signal(SIGPIPE, SIG_IGN);
+
+	while (1) {
+		option_index = 0;
+		c = getopt_long(argc, argv, "f:o:m:p:c:t:hv",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'f':
+				hosts_path = optarg;
+				break;
+			case 'o':
+				op = atoi(optarg);
+				break;
+			case 'm':
+				message_path = optarg;
+				break;
+			case 'p':
+				port = optarg;
+				break;
+			case 'c':
+				max_in_flight = atoi(optarg);
+				break;
+			case 't':
+				timeout = atoi(optarg);
+				break;
+			case 'h':
+				usage(argv[0]);
+				break;
+			case 'v':
+				fprintf(stdout, "%s " VERSION "\n"
+					"Copyright 2026 attest-tools contributors\n"
+					"License GPLv2: GNU GPL version 2\n",
+					argv[0]);
+				exit(0);
+			default:
+				printf("Unknown option '%c'\n", c);
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (message_path) {
+		rc = attest_util_read_file(message_path, &len, &message);
+		if (rc < 0) {
+			printf("Cannot read message %s\n", message_path);
+			return 1;
+		}
+	}
+
+	if (hosts_path) {
+		fp = fopen(hosts_path, "r");
+		if (!fp) {
+			printf("Cannot open %s\n", hosts_path);
+			rc = -ENOENT;
+			goto out;
+		}
+	}
+
+	rc = fleet_hosts_read(fp, len, message);
+
+	if (hosts_path)
+		fclose(fp);
+
+	if (rc < 0)
+		goto out;
+
+	/* one socket per request in flight */
+	raise_fd_limit();
+
+	rc = attest_ra_async_init(&a, max_in_flight, timeout * 1000);
+	if (rc < 0)
+		goto out;
+
+	list_for_each_entry(h, &hosts, list) {
+		rc = attest_ra_async_add(a, h->host, port, op, h->len,
+					 (char *)h->message, print_result,
+					 NULL);
+		if (rc < 0)
+			goto out;
+	}
+
+	rc = attest_ra_async_run(a);
+out:
+	attest_ra_async_cleanup(a);
+	fleet_hosts_free();
+
+	if (message)
+		munmap(message, len);
+
+	return rc ? 1 : 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: attest_ra_load.c
+ *      Replay recorded RA requests to a server at a target rate.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <json-c/json.h>
+
+#include "ra_async.h"
+#include "ctx.h"
+#include "util.h"
+
+#define SERVER_HOST "localhost"
+#define SERVER_PORT "3000"
+#define DEFAULT_IN_FLIGHT 256
+#define DEFAULT_TIMEOUT 30
+#define DEFAULT_REQUESTS 1000
+
+/* request recorded by attest_ra_client -R */
+struct load_msg {
+	int op;
+	size_t len;
+	unsigned char *data;
+};
+
+static struct load_msg *msgs;
+static int num_msgs;
+
+static uint64_t *latency_us;
+static int num_done, num_errors;
+static struct timespec last_done;
+
+/* files are named op<op>-<pid>.msg */
+static int load_msgs_read(char *dir_path, int op_filter)
+{
+	char path[MAX_PATH_LENGTH];
+	struct load_msg *new_msgs;
+	struct dirent *dentry;
+	int rc = 0, op;
+	DIR *dir;
+
+	dir = opendir(dir_path);
+	if (!dir) {
+		printf("Cannot open %s\n", dir_path);
+		return -ENOENT;
+	}
+
+	while ((dentry = readdir(dir))) {
+		if ((dentry->d_type != DT_REG &&
+		     dentry->d_type != DT_UNKNOWN) ||
+		    sscanf(dentry->d_name, "op%d-", &op) != 1 ||
+		    (op_filter >= 0 && op != op_filter))
+			continue;
+
+		new_msgs = realloc(msgs, (num_msgs + 1) * sizeof(*msgs));
+		if (!new_msgs) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		msgs = new_msgs;
+
+		snprintf(path, sizeof(path), "%s/%s", dir_path,
+			 dentry->d_name);
+
+		rc = attest_util_read_file(path, &msgs[num_msgs].len,
+					   &msgs[num_msgs].data);
+		if (rc < 0) {
+			printf("Cannot read message %s\n", path);
+			break;
+		}
+
+		msgs[num_msgs++].op = op;
+	}
+
+	closedir(dir);
+	return rc;
+}
+
+static void load_msgs_free(void)
+{
+	int i;
+
+	for (i = 0; i < num_msgs; i++)
+		munmap(msgs[i].data, msgs[i].len);
+
+	free(msgs);
+}
+
+/* latency includes the time a request waited for a free slot */
+static void load_done(struct ra_async_req *req, int rc, char *message_out)
+{
+	clock_gettime(CLOCK_MONOTONIC, &last_done);
+
+	latency_us[num_done++] =
+		(last_done.tv_sec - req->start.tv_sec) * 1000000 +
+		(last_done.tv_nsec - req->start.tv_nsec) / 1000;
+
+	if (rc)
+		num_errors++;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	uint64_t l1 = *(uint64_t *)a, l2 = *(uint64_t *)b;
+
+	return l1 < l2 ? -1 : l1 > l2;
+}
+
+static double percentile_ms(int p)
+{
+	return latency_us[(num_done - 1) * p / 100] / 1000.0;
+}
+
+static void print_report(struct timespec *start, int rate, int max_in_flight)
+{
+	double duration;
+	json_object *root;
+
+	duration = (last_done.tv_sec - start->tv_sec) +
+		   (last_done.tv_nsec - start->tv_nsec) / 1000000000.0;
+
+	qsort(latency_us, num_done, sizeof(*latency_us), compare_latency);
+
+	root = json_object_new_object();
+	if (!root)
+		return;
+
+	json_object_object_add(root, "requests", json_object_new_int(num_done));
+	json_object_object_add(root, "errors", json_object_new_int(num_errors));
+	json_object_object_add(root, "target_rate", json_object_new_int(rate));
+	json_object_object_add(root, "concurrency",
+			       json_object_new_int(max_in_flight));
+	json_object_object_add(root, "duration_s",
+			       json_object_new_double(duration));
+	json_object_object_add(root, "throughput",
+			       json_object_new_double(duration > 0 ?
+						      num_done / duration : 0));
+	json_object_object_add(root, "p50_ms",
+			       json_object_new_double(percentile_ms(50)));
+	json_object_object_add(root, "p90_ms",
+			       json_object_new_double(percentile_ms(90)));
+	json_object_object_add(root, "p99_ms",
+			       json_object_new_double(percentile_ms(99)));
+	json_object_object_add(root, "max_ms",
+			       json_object_new_double(percentile_ms(100)));
+
+	printf("%s\n", json_object_to_json_string_ext(root,
+						      JSON_C_TO_STRING_PLAIN));
+	json_object_put(root);
+}
+
+static void raise_fd_limit(void)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		return;
+
+	rlim.rlim_cur = rlim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rlim);
+}
+
+static struct option long_options[] = {
+	{"dir", 1, 0, 'd'},
+	{"host", 1, 0, 'H'},
+	{"port", 1, 0, 'p'},
+	{"op", 1, 0, 'o'},
+	{"requests", 1, 0, 'n'},
+	{"rate", 1, 0, 'r'},
+	{"concurrency", 1, 0, 'c'},
+	{"timeout", 1, 0, 't'},
+	{"help", 0, 0, 'h'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+static void usage(char *argv0)
+{
+	fprintf(stdout, "Usage: %s [options]\n\n"
+		"Options:\n"
+		"\t-d, --dir <dir>               requests recorded by\n"
+		"\t                              attest_ra_client -R\n"
+		"\t-H, --host <host>             RA server host\n"
+		"\t-p, --port <port>             RA server port\n"
+		"\t-o, --op <op>                 replay only requests of op\n"
+		"\t-n, --requests <num>          number of requests\n"
+		"\t-r, --rate <num>              requests per second\n"
+		"\t                              (default: closed loop)\n"
+		"\t-c, --concurrency <num>       max concurrent requests\n"
+		"\t-t, --timeout <sec>           request timeout\n"
+		"\t-h, --help                    print this help message\n"
+		"\t-v, --version                 print package version\n"
+		"\n"
+		"Quote requests are accepted again only by servers started\n"
+		"with -N and the HMAC keys (-k) of the recording server.\n"
+		"\n"
+		"Report bugs to " PACKAGE_BUGREPORT "\n",
+		argv0);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct ra_async *a = NULL;
+	struct timespec start, sched;
+	struct load_msg *msg;
+	char *dir_path = NULL, *host = SERVER_HOST, *port = SERVER_PORT;
+	int max_in_flight = DEFAULT_IN_FLIGHT, timeout = DEFAULT_TIMEOUT;
+	int num_requests = DEFAULT_REQUESTS, rate = 0, op = -1;
+	int rc = 0, option_index, c, i;
+	uint64_t offset_ns;
+
+	/* writing to a connection closed by the server is not fatal */
+	signal(SIGPIPE, SIG_IGN);
+
+	while (1) {
+		option_index = 0;
+		c = getopt_long(argc, argv, "d:H:p:o:n:r:c:t:hv",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'd':
+				dir_path = optarg;
+				break;
+			case 'H':
+				host = optarg;
+				break;
+			case 'p':
+				port = optarg;
+				break;
+			case 'o':
+				op = atoi(optarg);
+				break;
+			case 'n':
+				num_requests = atoi(optarg);
+				break;
+			case 'r':
+				rate = atoi(optarg);
+				break;
+			case 'c':
+				max_in_flight = atoi(optarg);
+				break;
+			case 't':
+				timeout = atoi(optarg);
+				break;
+			case 'h':
+				usage(argv[0]);
+				break;
+			case 'v':
+				fprintf(stdout, "%s " VERSION "\n"
+					"Copyright 2026 attest-tools contributors\n"
+					"License GPLv2: GNU GPL version 2\n",
+					argv[0]);
+				exit(0);
+			default:
+				printf("Unknown option '%c'\n", c);
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (!dir_path || num_requests <= 0 || rate < 0) {
+		printf("Missing directory or invalid parameters\n");
+		return 1;
+	}
+
+	rc = load_msgs_read(dir_path, op);
+	if (rc < 0)
+		goto out;
+
+	if (!num_msgs) {
+		printf("No requests found in %s\n", dir_path);
+		rc = -ENOENT;
+		goto out;
+	}
+
+	latency_us = malloc(num_requests * sizeof(*latency_us));
+	if (!latency_us) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* one socket per request in flight */
+	raise_fd_limit();
+
+	rc = attest_ra_async_init(&a, max_in_flight, timeout * 1000);
+	if (rc < 0)
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* open loop: requests are sent at their time, completed or not */
+	for (i = 0; i < num_requests; i++) {
+		msg = &msgs[i % num_msgs];
+
+		if (!rate) {
+			rc = attest_ra_async_add(a, host, port, msg->op,
+						 msg->len, (char *)msg->data,
+						 load_done, NULL);
+			if (rc < 0)
+				goto out;
+
+			continue;
+		}
+
+		offset_ns = (uint64_t)i * 1000000000 / rate;
+		sched.tv_sec = start.tv_sec + offset_ns / 1000000000;
+		sched.tv_nsec = start.tv_nsec + offset_ns % 1000000000;
+		if (sched.tv_nsec >= 1000000000) {
+			sched.tv_sec++;
+			sched.tv_nsec -= 1000000000;
+		}
+
+		rc = attest_ra_async_add_at(a, host, port, msg->op, msg->len,
+					    (char *)msg->data, load_done, NULL,
+					    &sched);
+		if (rc < 0)
+			goto out;
+	}
+
+	rc = attest_ra_async_run(a);
+	if (!rc && num_done)
+		print_report(&start, rate, max_in_flight);
+out:
+	attest_ra_async_cleanup(a);
+	load_msgs_free();
+	free(latency_us);
+
+	return rc ? 1 : 0;
+}
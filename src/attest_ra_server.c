@@ -19,6 +19,9 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,7 +30,9 @@
 #include <sys/un.h>
 
 #include "enroll_server.h"
+#include "ctx_tlv.h"
 #include "util.h"
+#include "metrics.h"
 
 #include <ibmtss/tss.h>
 #include <ibmtss/tssmarshal.h>
@@ -38,12 +43,38 @@
 #include <openssl/rand.h>
 #include <openssl/conf.h>
 
+/* seconds a connection can be idle between two requests */
+#define CONN_IDLE_TIMEOUT 10
+/* maximum number of idle connections polled by the acceptor */
+#define CONN_IDLE_MAX 1024
+
+#define DEFAULT_TIMEOUT 30
+#define DEFAULT_MAX_MESSAGE_SIZE 64
+#define DEFAULT_MEMORY_LIMIT 1024
+#define DEFAULT_PORT 3000
+
+/* first descriptor passed by systemd socket activation */
+#define LISTEN_FDS_START 3
+
 static struct option long_options[] = {
 	{"pcr-list", 0, 0, 'p'},
 	{"requirements", 1, 0, 'r'},
 	{"ima-violations", 0, 0, 'i'},
 	{"skip-sig-ver", 0, 0, 's'},
+	{"log-timing", 0, 0, 'T'},
+	{"replay-hmac-keys", 1, 0, 'N'},
+	{"quiet", 0, 0, 'q'},
 	{"openssl-ca-section", 1, 0, 'S'},
+	{"workers", 1, 0, 'w'},
+	{"backlog", 1, 0, 'b'},
+	{"hmac-keys", 1, 0, 'k'},
+	{"metrics-port", 1, 0, 'm'},
+	{"timeout", 1, 0, 't'},
+	{"max-message-size", 1, 0, 'M'},
+	{"memory-limit", 1, 0, 'l'},
+	{"port", 1, 0, 'P'},
+	{"processes", 1, 0, 'f'},
+	{"uri-allowlist", 1, 0, 'U'},
 	{"help", 0, 0, 'h'},
 	{"version", 0, 0, 'v'},
 	{0, 0, 0, 0}
@@ -55,29 +86,888 @@ static void usage(char *argv0)
 		"Options:\n"
 		"\t-p, --pcr-list                PCR list\n"
 		"\t-r, --requirements            verifier requirements\n"
+		"\t                              (reloaded on SIGHUP)\n"
 		"\t-i, --ima-violations          allow IMA violations\n"
 		"\t-s, --skip-sig-ver            skip signature verification\n"
+		"\t-T, --log-timing              report duration of verification\n"
+		"\t                              steps\n"
+		"\t-N, --replay-hmac-keys <file> accept reused nonces of these\n"
+		"\t                              test HMAC keys\n"
+		"\t                              (only for load tests)\n"
+		"\t-q, --quiet                   print logs only of failed\n"
+		"\t                              requests\n"
 		"\t-S, --openssl-ca-section      openssl CA section to use\n"
+		"\t-w, --workers                 number of worker threads\n"
+		"\t                              (default: number of CPUs)\n"
+		"\t-b, --backlog                 listen backlog (default: %d)\n"
+		"\t-k, --hmac-keys               HMAC keys shared with other\n"
+		"\t                              servers (reloaded on SIGHUP)\n"
+		"\t-m, --metrics-port [<addr>:]<port>\n"
+		"\t                              export metrics over HTTP\n"
+		"\t                              (default addr: 127.0.0.1)\n"
+		"\t-t, --timeout <sec>           time to receive a request or\n"
+		"\t                              send a response (default: %d)\n"
+		"\t-M, --max-message-size <MB>   max request size (default: %d)\n"
+		"\t-l, --memory-limit <MB>       max memory for requests being\n"
+		"\t                              processed (default: %d)\n"
+		"\t-P, --port <port>             TCP port (default: %d)\n"
+		"\t-f, --processes <num>         number of worker processes\n"
+		"\t                              sharing the port\n"
+		"\t-U, --uri-allowlist <file>    URL prefixes of uri: items to\n"
+		"\t                              download (default: none)\n"
 		"\t-h, --help                    print this help message\n"
 		"\t-v, --version                 print package version\n"
 		"\n"
 		"Report bugs to " PACKAGE_BUGREPORT "\n",
-		argv0);
+		argv0, SOMAXCONN, DEFAULT_TIMEOUT, DEFAULT_MAX_MESSAGE_SIZE,
+		DEFAULT_MEMORY_LIMIT, DEFAULT_PORT);
 	exit(-1);
 }
 
-int main(int argc, char *argv[])
+/* request names in metrics, indexed by op */
+static const char *op_names[] = {
+	"make_credential",
+	"make_cert",
+	"process_csr",
+	"gen_quote_nonce",
+	"process_quote",
+	"process_quote_batch",
+};
+
+#define NUM_OPS (sizeof(op_names) / sizeof(*op_names))
+
+/* state shared by the worker threads, read-only after startup */
+struct server_ctx {
+	BYTE hmac_key[64];
+	char *hmac_keys_path;
+	uint8_t pcr_mask[3];
+	uint16_t verifier_flags;
+	char *req_path;
+	char *caCertPath;
+	char *caKeyPath;
+	char *caKeyPassword;
+	char *openssl_ca_section;
+	char **cert_subject_entries;
+	size_t num_subject_entries;
+	int timeout;
+	size_t max_message_size;
+	size_t memory_limit;
+	char *metrics_addr;
+};
+
+/* memory taken by requests being received or processed */
+static pthread_mutex_t memory_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t memory_used;
+
+/* accepted connections waiting for a worker */
+struct conn_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	int *fds;
+	int size;
+	int head;
+	int count;
+	int active;
+	unsigned int batches;
+};
+
+/* set at SIGTERM, connections being processed are completed */
+static volatile sig_atomic_t stopping;
+
+/* idle connections returned by the workers to the acceptor */
+static int idle_pipe[2] = { -1, -1 };
+
+static struct conn_queue queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.not_empty = PTHREAD_COND_INITIALIZER,
+	.not_full = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * The TSS global properties are not safe for concurrent use: serialize AK
+ * certificate creation, while credentials (made in software), CSR signing
+ * and quote verification (the common case) run in parallel.
+ */
+static pthread_mutex_t enroll_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void queue_put(int fd)
+{
+	pthread_mutex_lock(&queue.lock);
+	while (queue.count == queue.size)
+		pthread_cond_wait(&queue.not_full, &queue.lock);
+
+	queue.fds[(queue.head + queue.count) % queue.size] = fd;
+	queue.count++;
+
+	pthread_cond_signal(&queue.not_empty);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+/* idle workers verify quotes of batches processed by other workers */
+static void queue_batch_notify(void)
+{
+	pthread_mutex_lock(&queue.lock);
+	queue.batches++;
+	pthread_cond_broadcast(&queue.not_empty);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+static int queue_get(void)
+{
+	unsigned int batches = 0;
+	int fd;
+
+	pthread_mutex_lock(&queue.lock);
+	while (!queue.count) {
+		if (batches != queue.batches) {
+			batches = queue.batches;
+			pthread_mutex_unlock(&queue.lock);
+
+			while (attest_enroll_quote_batch_help())
+				;
+
+			pthread_mutex_lock(&queue.lock);
+			continue;
+		}
+
+		pthread_cond_wait(&queue.not_empty, &queue.lock);
+	}
+
+	fd = queue.fds[queue.head];
+	queue.head = (queue.head + 1) % queue.size;
+	queue.count--;
+	queue.active++;
+
+	pthread_cond_signal(&queue.not_full);
+	pthread_mutex_unlock(&queue.lock);
+
+	return fd;
+}
+
+static int process_request_op(struct server_ctx *s, int op,
+			      char *message_in, char **message_out)
 {
-	char *message_in = NULL, *message_out = NULL, *req_path = NULL;
 	char *csr_str = NULL, *cert_str = NULL, *ca_cert_str = NULL;
-	char *pcr_list_str = NULL;
-	size_t len, ca_cert_str_len;
-	struct sockaddr_in addr;
-	BYTE hmac_key[64];
-	uint8_t pcr_mask[3] = { 0 };
+	size_t ca_cert_str_len;
+	int rc;
+
+	switch (op) {
+	case 0:
+		rc = attest_enroll_msg_make_credential(s->hmac_key,
+					sizeof(s->hmac_key), s->caKeyPath,
+					s->caKeyPassword, s->caCertPath,
+					message_in, message_out);
+		break;
+	case 1:
+		pthread_mutex_lock(&enroll_lock);
+		rc = attest_enroll_msg_make_cert(s->hmac_key,
+						 sizeof(s->hmac_key),
+						 s->caKeyPath, s->caKeyPassword,
+						 s->caCertPath,
+						 s->cert_subject_entries,
+						 s->num_subject_entries,
+						 message_in, message_out);
+		pthread_mutex_unlock(&enroll_lock);
+		break;
+	case 2:
+		rc = attest_enroll_msg_process_csr(sizeof(s->pcr_mask),
+						   s->pcr_mask, s->req_path,
+						   s->verifier_flags,
+						   message_in, &csr_str);
+		if (rc < 0)
+			break;
+
+		rc = attest_enroll_sign_csr(s->caKeyPath, s->caKeyPassword,
+					    s->caCertPath,
+					    s->openssl_ca_section, csr_str,
+					    &cert_str);
+		if (rc < 0)
+			break;
+
+		rc = attest_util_read_seq_file(s->caCertPath,
+					       &ca_cert_str_len,
+					       (uint8_t **)&ca_cert_str);
+		if (rc < 0)
+			break;
+
+		rc = attest_enroll_msg_return_cert(cert_str, ca_cert_str,
+						   message_out);
+		break;
+	case 3:
+		rc = attest_enroll_msg_gen_quote_nonce(sizeof(s->hmac_key),
+						       s->hmac_key, message_in,
+						       message_out);
+		break;
+	case 4:
+		rc = attest_enroll_msg_process_quote(sizeof(s->hmac_key),
+						     s->hmac_key,
+						     sizeof(s->pcr_mask),
+						     s->pcr_mask, s->req_path,
+						     s->verifier_flags,
+						     message_in, message_out);
+		break;
+	case 5:
+		rc = attest_enroll_msg_process_quote_batch(sizeof(s->hmac_key),
+						s->hmac_key,
+						sizeof(s->pcr_mask),
+						s->pcr_mask, s->req_path,
+						s->verifier_flags,
+						message_in, message_out);
+		break;
+	default:
+		rc = -EINVAL;
+		break;
+	}
+
+	free(csr_str);
+	free(cert_str);
+	free(ca_cert_str);
+
+	return rc;
+}
+
+static int process_request(struct server_ctx *s, int op, char *message_in,
+			   char **message_out)
+{
+	const char *op_name = (op >= 0 && op < NUM_OPS) ?
+			      op_names[op] : "unknown";
+	uint64_t start = attest_metrics_time_us();
+	int rc;
+
+	attest_metrics_gauge_add(METRIC_REQUESTS_IN_FLIGHT, 1, NULL);
+	rc = process_request_op(s, op, message_in, message_out);
+	attest_metrics_gauge_add(METRIC_REQUESTS_IN_FLIGHT, -1, NULL);
+
+	attest_metrics_inc(METRIC_REQUESTS, 1, "op=\"%s\"", op_name);
+	if (rc)
+		attest_metrics_inc(METRIC_REQUEST_ERRORS, 1,
+				   "op=\"%s\",rc=\"%d\"", op_name, rc);
+
+	attest_metrics_observe(METRIC_REQUEST_DURATION,
+			       attest_metrics_time_us() - start,
+			       "op=\"%s\"", op_name);
+	return rc;
+}
+
+static void queue_done(void)
+{
+	pthread_mutex_lock(&queue.lock);
+	queue.active--;
+	pthread_mutex_unlock(&queue.lock);
+}
+
+/* number of connections waiting for a worker, and optionally being served */
+static int queue_pending(int include_active)
+{
+	int count;
+
+	pthread_mutex_lock(&queue.lock);
+	count = queue.count + (include_active ? queue.active : 0);
+	pthread_mutex_unlock(&queue.lock);
+
+	return count;
+}
+
+static int memory_get(struct server_ctx *s, size_t len)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&memory_lock);
+	if (memory_used + len > s->memory_limit)
+		rc = -ENOMEM;
+	else
+		memory_used += len;
+	pthread_mutex_unlock(&memory_lock);
+
+	return rc;
+}
+
+static void memory_put(size_t len)
+{
+	pthread_mutex_lock(&memory_lock);
+	memory_used -= len;
+	pthread_mutex_unlock(&memory_lock);
+}
+
+/* data decompressed while processing requests counts against the limit */
+static int data_memory_get(void *priv, size_t len)
+{
+	return memory_get((struct server_ctx *)priv, len);
+}
+
+static void data_memory_put(void *priv, size_t len)
+{
+	memory_put(len);
+}
+
+static void deadline_set(struct timespec *deadline, int timeout)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += timeout;
+}
+
+/* skip a rejected request, so that the client can read the error */
+static int discard_request(int fd, size_t len, struct timespec *deadline)
+{
+	uint8_t buf[4096];
+	size_t cur_len;
+	int rc;
+
+	while (len) {
+		cur_len = len < sizeof(buf) ? len : sizeof(buf);
+
+		rc = attest_util_read_buf_deadline(fd, buf, cur_len, deadline);
+		if (rc)
+			return rc;
+
+		len -= cur_len;
+	}
+
+	return 0;
+}
+
+/* returns 0 if the connection can be used for the next request */
+static int handle_request(struct server_ctx *s, int fd)
+{
+	char *message_in = NULL, *message_out = NULL;
+	const char *reason = NULL;
+	struct timespec deadline;
+	size_t len, reserved = 0;
+	int rc, op;
+
+	deadline_set(&deadline, s->timeout);
+
+	rc = attest_util_read_buf_deadline(fd, (uint8_t *)&len, sizeof(len),
+					   &deadline);
+	if (rc)
+		goto out;
+
+	rc = attest_util_read_buf_deadline(fd, (uint8_t *)&op, sizeof(op),
+					   &deadline);
+	if (rc)
+		goto out;
+
+	if (len < 2 * sizeof(len)) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	len -= 2 * sizeof(len);
+
+	/* rejected before allocating memory for the message */
+	if (len > s->max_message_size) {
+		reason = "too_large";
+		goto reject;
+	}
+
+	if (memory_get(s, len + 1)) {
+		reason = "memory_limit";
+		goto reject;
+	}
+
+	reserved = len + 1;
+
+	message_in = malloc(len + 1);
+	if (!message_in) {
+		reason = "no_memory";
+		goto reject;
+	}
+
+	message_in[len] = '\0';
+
+	rc = attest_util_read_buf_deadline(fd, (uint8_t *)message_in, len,
+					   &deadline);
+	if (rc)
+		goto out;
+
+	attest_metrics_inc(METRIC_RECEIVED_BYTES, len + 2 * sizeof(len), NULL);
+
+	/* TLV messages carry their length, which must match */
+	rc = attest_ctx_msg_check(message_in, len);
+
+	len = 0;
+
+	if (!rc)
+		rc = process_request(s, op, message_in, &message_out);
+	if (!rc)
+		len = attest_ctx_msg_len(message_out) + sizeof(len) + 1;
+
+	rc = 0;
+	goto response;
+reject:
+	attest_metrics_inc(METRIC_REQUESTS_REJECTED, 1, "reason=\"%s\"",
+			   reason);
+
+	rc = discard_request(fd, len, &deadline);
+	if (rc)
+		goto out;
+
+	len = 0;
+response:
+	if (!len)
+		printf("error\n");
+
+	deadline_set(&deadline, s->timeout);
+
+	if (attest_util_write_buf_deadline(fd, (uint8_t *)&len, sizeof(len),
+					   &deadline) ||
+	    (len && attest_util_write_buf_deadline(fd, (uint8_t *)message_out,
+						   len - sizeof(len),
+						   &deadline)))
+		rc = -EIO;
+out:
+	if (rc == -ETIMEDOUT)
+		attest_metrics_inc(METRIC_REQUESTS_REJECTED, 1,
+				   "reason=\"timeout\"");
+
+	/* data items of TLV messages are borrowed, and not zeroed on cleanup */
+	if (message_in)
+		memset(message_in, 0, reserved);
+
+	free(message_in);
+	free(message_out);
+
+	if (reserved)
+		memory_put(reserved);
+
+	return rc;
+}
+
+/*
+ * Requests on a connection are processed in order until the client closes
+ * it, so that clients can pipeline requests and avoid a new connection for
+ * each of them. A connection with no request pending is returned to the
+ * acceptor, which queues it again at the next request, or closes it after
+ * CONN_IDLE_TIMEOUT, so that idle clients do not hold a worker.
+ *
+ * Connections are non-blocking, so that a stalled client holds a worker
+ * only until the request or response deadline.
+ */
+static void handle_connection(struct server_ctx *s, int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	while (!handle_request(s, fd)) {
+		if (poll(&pfd, 1, 0) == 1)
+			continue;
+
+		if (!stopping &&
+		    write(idle_pipe[1], &fd, sizeof(fd)) == sizeof(fd))
+			return;
+
+		break;
+	}
+
+	close(fd);
+}
+
+static time_t idle_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/*
+ * Queue idle connections with a new request, close those idle for
+ * CONN_IDLE_TIMEOUT, and add those returned by the workers. pfds[0] is the
+ * listening socket, pfds[1] the idle pipe, the others the idle connections.
+ */
+static int idle_update(struct pollfd *pfds, time_t *idle_since, int num_idle)
+{
+	time_t now = idle_now();
+	int i = 0, fd;
+
+	while (i < num_idle) {
+		if (pfds[2 + i].revents)
+			queue_put(pfds[2 + i].fd);
+		else if (now - idle_since[i] >= CONN_IDLE_TIMEOUT)
+			close(pfds[2 + i].fd);
+		else {
+			i++;
+			continue;
+		}
+
+		num_idle--;
+		pfds[2 + i] = pfds[2 + num_idle];
+		idle_since[i] = idle_since[num_idle];
+	}
+
+	if (!pfds[1].revents)
+		return num_idle;
+
+	while (read(idle_pipe[0], &fd, sizeof(fd)) == sizeof(fd)) {
+		if (num_idle == CONN_IDLE_MAX) {
+			close(fd);
+			continue;
+		}
+
+		pfds[2 + num_idle].fd = fd;
+		pfds[2 + num_idle].events = POLLIN;
+		pfds[2 + num_idle].revents = 0;
+		idle_since[num_idle++] = now;
+	}
+
+	return num_idle;
+}
+
+/*
+ * Reload requirements, HMAC keys and CA on SIGHUP, blocked in the other
+ * threads. Plugins are reloaded only with worker processes (-f), as
+ * requests being processed may refer to them.
+ */
+static void *reload_reqs(void *arg)
+{
+	struct server_ctx *s = (struct server_ctx *)arg;
+	sigset_t set;
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+
+	while (1) {
+		if (sigwait(&set, &sig))
+			continue;
+
+		if (s->req_path && attest_enroll_load_reqs(s->req_path) < 0)
+			printf("Cannot reload requirements %s, keeping the "
+			       "previous ones\n", s->req_path);
+		else if (s->req_path)
+			printf("Requirements %s reloaded\n", s->req_path);
+
+		if (s->hmac_keys_path &&
+		    attest_enroll_load_hmac_keys(s->hmac_keys_path) < 0)
+			printf("Cannot reload HMAC keys %s, keeping the "
+			       "previous ones\n", s->hmac_keys_path);
+		else if (s->hmac_keys_path)
+			printf("HMAC keys %s reloaded\n", s->hmac_keys_path);
+
+		if (attest_enroll_reload_ca(s->caKeyPath, s->caKeyPassword,
+					    s->caCertPath,
+					    s->openssl_ca_section) < 0)
+			printf("Cannot reload CA from section %s, keeping the "
+			       "previous one\n", s->openssl_ca_section);
+		else
+			printf("CA from section %s reloaded\n",
+			       s->openssl_ca_section);
+	}
+
+	return NULL;
+}
+
+static void *worker(void *arg)
+{
+	struct server_ctx *s = (struct server_ctx *)arg;
+
+	while (1) {
+		handle_connection(s, queue_get());
+		queue_done();
+	}
+
+	return NULL;
+}
+
+static void stop_handler(int sig)
+{
+	stopping = 1;
+}
+
+/* accept connections until SIGTERM, then complete those accepted */
+static int serve(struct server_ctx *s, int fd_socket, int num_workers,
+		 int metrics_port)
+{
+	struct sigaction act = { .sa_handler = stop_handler };
+	struct pollfd pfds[2 + CONN_IDLE_MAX];
+	time_t idle_since[CONN_IDLE_MAX];
+	pthread_t thread;
+	int rc, fd, i, num_idle = 0;
+
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGINT, &act, NULL);
+
+	if (pipe(idle_pipe) < 0)
+		return -errno;
+
+	for (i = 0; i < 2; i++)
+		fcntl(idle_pipe[i], F_SETFL,
+		      fcntl(idle_pipe[i], F_GETFL) | O_NONBLOCK);
+
+	pfds[0].fd = fd_socket;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = idle_pipe[0];
+	pfds[1].events = POLLIN;
+
+	/* metrics are recorded only if enabled before creating the workers */
+	if (metrics_port) {
+		rc = attest_metrics_serve(s->metrics_addr, metrics_port);
+		if (rc < 0) {
+			printf("Cannot export metrics on port %d: %s\n",
+			       metrics_port, strerror(-rc));
+			return rc;
+		}
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		rc = pthread_create(&thread, NULL, worker, s);
+		if (rc) {
+			printf("Cannot create worker thread: %s\n",
+			       strerror(rc));
+			return -rc;
+		}
+
+		pthread_detach(thread);
+	}
+
+	while (!stopping) {
+		if (poll(pfds, 2 + num_idle, 1000) < 0)
+			continue;
+
+		num_idle = idle_update(pfds, idle_since, num_idle);
+
+		if (!pfds[0].revents)
+			continue;
+
+		fd = accept(fd_socket, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		queue_put(fd);
+	}
+
+	/* other processes sharing the socket accept the new connections */
+	close(fd_socket);
+
+	while (queue_pending(1))
+		usleep(100000);
+
+	/* workers close connections after stopping, and no longer return them */
+	for (i = 0; i < num_idle; i++)
+		close(pfds[2 + i].fd);
+
+	while (read(idle_pipe[0], &fd, sizeof(fd)) == sizeof(fd))
+		close(fd);
+
+	return 0;
+}
+
+static int listen_socket(int port, int backlog, int reuse_port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	int fd_socket, reuse_addr = 1;
+
+	fd_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd_socket < 0)
+		return -errno;
+
+	setsockopt(fd_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_addr,
+		   sizeof(reuse_addr));
+
+	/* the kernel distributes connections among the processes */
+	if (reuse_port &&
+	    setsockopt(fd_socket, SOL_SOCKET, SO_REUSEPORT, &reuse_port,
+		       sizeof(reuse_port)))
+		goto err;
+
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(fd_socket, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd_socket, backlog))
+		goto err;
+
+	return fd_socket;
+err:
+	close(fd_socket);
+	return -errno;
+}
+
+/* socket passed by systemd (LISTEN_PID, LISTEN_FDS), -ENOENT if not found */
+static int listen_fds_socket(void)
+{
+	char *pid_str = getenv("LISTEN_PID"), *fds_str = getenv("LISTEN_FDS");
+	int fd = -ENOENT;
+
+	if (pid_str && fds_str && atoi(pid_str) == getpid() &&
+	    atoi(fds_str) >= 1)
+		fd = LISTEN_FDS_START;
+
+	/* not for the processes created by this one */
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	return fd;
+}
+
+/* worker processes, replaced when they exit or at SIGHUP */
+struct worker_procs {
+	struct server_ctx *s;
+	int num;
+	int num_workers;
+	int metrics_port;
+	pid_t *pids;
+	int *fds;
+};
+
+static pid_t worker_proc_start(struct worker_procs *w, int i)
+{
+	sigset_t set;
+	pid_t pid;
+
+	pid = fork();
+	if (pid) {
+		if (pid > 0)
+			w->pids[i] = pid;
+
+		return pid;
+	}
+
+	/* configuration is reloaded by starting new processes */
+	signal(SIGHUP, SIG_IGN);
+
+	sigemptyset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+	/* metrics are exported by each process on a different port */
+	exit(serve(w->s, w->fds[i], w->num_workers,
+		   w->metrics_port ? w->metrics_port + i : 0) ? 1 : 0);
+}
+
+/*
+ * Plugins can be loaded again only after releasing the current ones, and
+ * the requirements referring to them. The new configuration is checked by
+ * a child process first, so that the current one is kept if not valid.
+ */
+static int worker_procs_check_config(struct server_ctx *s)
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+
+	if (!pid)
+		_exit(attest_enroll_reload(s->req_path, s->hmac_keys_path,
+					   s->caKeyPath, s->caKeyPassword,
+					   s->caCertPath, s->openssl_ca_section,
+					   1) < 0 ? 1 : 0);
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -errno;
+
+	return (WIFEXITED(status) && !WEXITSTATUS(status)) ? 0 : -EINVAL;
+}
+
+/* the new configuration is inherited by the new processes */
+static int worker_procs_reload(struct server_ctx *s)
+{
+	int rc;
+
+	rc = worker_procs_check_config(s);
+	if (!rc)
+		rc = attest_enroll_reload(s->req_path, s->hmac_keys_path,
+					  s->caKeyPath, s->caKeyPassword,
+					  s->caCertPath, s->openssl_ca_section,
+					  1);
+	if (rc < 0)
+		printf("Cannot reload requirements, HMAC keys or CA\n");
+
+	return rc;
+}
+
+/*
+ * At SIGHUP, new processes are started with the reloaded configuration,
+ * and the previous ones stop accepting connections and exit after
+ * completing those accepted. Listening sockets are kept open by this
+ * process, so that no connection waiting to be accepted is dropped.
+ */
+static int worker_procs_run(struct worker_procs *w)
+{
+	sigset_t set;
+	pid_t pid, old_pid;
+	int sig, status, i, running;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	for (i = 0; i < w->num; i++)
+		if (worker_proc_start(w, i) < 0)
+			return -errno;
+
+	while (1) {
+		if (sigwait(&set, &sig))
+			continue;
+
+		if (sig == SIGTERM || sig == SIGINT)
+			break;
+
+		if (sig == SIGHUP) {
+			if (worker_procs_reload(w->s) < 0) {
+				printf("Keeping the previous processes\n");
+				continue;
+			}
+
+			for (i = 0; i < w->num; i++) {
+				old_pid = w->pids[i];
+				if (worker_proc_start(w, i) > 0 && old_pid > 0)
+					kill(old_pid, SIGTERM);
+			}
+
+			printf("Worker processes restarted\n");
+			continue;
+		}
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			for (i = 0; i < w->num; i++) {
+				if (w->pids[i] != pid)
+					continue;
+
+				printf("Worker process %d exited, "
+				       "restarting\n", pid);
+				w->pids[i] = 0;
+
+				/* do not restart too often if it fails */
+				sleep(1);
+				worker_proc_start(w, i);
+			}
+		}
+	}
+
+	for (i = 0; i < w->num; i++)
+		if (w->pids[i] > 0)
+			kill(w->pids[i], SIGTERM);
+
+	/* wait also for processes replaced at SIGHUP */
+	do {
+		running = (wait(NULL) > 0);
+	} while (running || errno == EINTR);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct server_ctx s = { .pcr_mask = { 0 }, .timeout = DEFAULT_TIMEOUT };
+	int max_message_size = DEFAULT_MAX_MESSAGE_SIZE;
+	int memory_limit = DEFAULT_MEMORY_LIMIT;
+	char *pcr_list_str = NULL, *uri_allowlist_path = NULL;
+	char *replay_keys_path = NULL, *sep;
 	int pcr_list[IMPLEMENTATION_PCR];
-	uint16_t verifier_flags = 0;
-	int rc, option_index, c, fd, fd_socket = -1, op, reuse_addr = 1, i;
+	int rc, option_index, c, fd_socket = -1, i;
+	int num_workers = 0, backlog = SOMAXCONN, metrics_port = 0;
+	int port = DEFAULT_PORT, num_procs = 0;
+	struct worker_procs procs = { .s = &s };
+	pthread_t thread;
+	sigset_t set;
 	CONF *conf = NULL;
 	char *openssl_config_file = NULL;
 	char *cert_subject_entries[] = {
@@ -88,15 +978,19 @@ int main(int argc, char *argv[])
 		NULL,
 		NULL,
 		NULL};
-	size_t num_subject_entries = sizeof(cert_subject_entries) / sizeof(char *);
-	char *caCertPath = NULL, *caKeyPath, *caKeyPassword;
-	char *openssl_ca_section = NULL;
 
 	setvbuf(stdout, NULL, _IONBF, 1);
 
+	/* clients may close kept-alive connections at any time */
+	signal(SIGPIPE, SIG_IGN);
+
+	s.cert_subject_entries = cert_subject_entries;
+	s.num_subject_entries = sizeof(cert_subject_entries) / sizeof(char *);
+
 	while (1) {
 		option_index = 0;
-		c = getopt_long(argc, argv, "p:r:isS:hv",
+		c = getopt_long(argc, argv,
+				"p:r:isTN:qS:w:b:k:m:t:M:l:P:f:U:hv",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -106,16 +1000,61 @@ int main(int argc, char *argv[])
 				pcr_list_str = optarg;
 				break;
 			case 'r':
-				req_path = optarg;
+				s.req_path = optarg;
 				break;
 			case 'i':
-				verifier_flags |= CTX_ALLOW_IMA_VIOLATIONS;
+				s.verifier_flags |= CTX_ALLOW_IMA_VIOLATIONS;
 				break;
 			case 's':
-				verifier_flags |= CTX_SKIP_SIG_VER;
+				s.verifier_flags |= CTX_SKIP_SIG_VER;
+				break;
+			case 'T':
+				s.verifier_flags |= CTX_LOG_TIMING;
+				break;
+			case 'N':
+				replay_keys_path = optarg;
+				break;
+			case 'q':
+				attest_enroll_log_errors_only();
 				break;
 			case 'S':
-				openssl_ca_section = optarg;
+				s.openssl_ca_section = optarg;
+				break;
+			case 'w':
+				num_workers = atoi(optarg);
+				break;
+			case 'b':
+				backlog = atoi(optarg);
+				break;
+			case 'k':
+				s.hmac_keys_path = optarg;
+				break;
+			case 'm':
+				sep = strrchr(optarg, ':');
+				if (sep) {
+					*sep = '\0';
+					s.metrics_addr = optarg;
+				}
+
+				metrics_port = atoi(sep ? sep + 1 : optarg);
+				break;
+			case 't':
+				s.timeout = atoi(optarg);
+				break;
+			case 'M':
+				max_message_size = atoi(optarg);
+				break;
+			case 'l':
+				memory_limit = atoi(optarg);
+				break;
+			case 'P':
+				port = atoi(optarg);
+				break;
+			case 'f':
+				num_procs = atoi(optarg);
+				break;
+			case 'U':
+				uri_allowlist_path = optarg;
 				break;
 			case 'h':
 				usage(argv[0]);
@@ -134,6 +1073,35 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (replay_keys_path)
+		printf("Warning: quotes with nonces of the HMAC keys %s can be "
+		       "replayed\n", replay_keys_path);
+
+	if (num_workers <= 0)
+		num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_workers <= 0)
+		num_workers = 1;
+
+	if (backlog <= 0)
+		backlog = SOMAXCONN;
+
+	if (s.timeout <= 0 || max_message_size <= 0 || memory_limit <= 0) {
+		printf("Invalid timeout or memory limits\n");
+		return 1;
+	}
+
+	s.max_message_size = (size_t)max_message_size << 20;
+	s.memory_limit = (size_t)memory_limit << 20;
+
+	attest_ctx_data_set_memory_funcs(data_memory_get, data_memory_put, &s);
+	attest_enroll_set_quote_batch_notify(queue_batch_notify);
+
+	if (uri_allowlist_path &&
+	    attest_ctx_data_load_uri_allowlist(uri_allowlist_path) < 0) {
+		printf("Cannot load URI allowlist %s\n", uri_allowlist_path);
+		return 1;
+	}
+
 	conf = NCONF_new(NCONF_default());
 	if (!conf) {
 		printf("Out of memory\n");
@@ -144,21 +1112,25 @@ int main(int argc, char *argv[])
 	NCONF_load(conf, openssl_config_file, NULL);
 	free(openssl_config_file);
 
-	if (!openssl_ca_section) {
-		openssl_ca_section = NCONF_get_string(conf, "ca", "default_ca");
-		if (!openssl_ca_section) {
+	if (!s.openssl_ca_section) {
+		s.openssl_ca_section = NCONF_get_string(conf, "ca",
+							"default_ca");
+		if (!s.openssl_ca_section) {
 			printf("Cannot find default openssl CA section\n");
 			rc = -ENOENT;
 			goto out;
 		}
 	}
 
-	caCertPath = NCONF_get_string(conf, openssl_ca_section, "certificate");
-	caKeyPath = NCONF_get_string(conf, openssl_ca_section, "private_key");
-	caKeyPassword = NCONF_get_string(conf, openssl_ca_section, "input_password");
+	s.caCertPath = NCONF_get_string(conf, s.openssl_ca_section,
+					"certificate");
+	s.caKeyPath = NCONF_get_string(conf, s.openssl_ca_section,
+				       "private_key");
+	s.caKeyPassword = NCONF_get_string(conf, s.openssl_ca_section,
+					   "input_password");
 
 
-	if (!caCertPath || !caKeyPath) {
+	if (!s.caCertPath || !s.caKeyPath) {
 		printf("Cannot read openssl config\n");
 		rc = -ENOENT;
 		goto out;
@@ -175,165 +1147,125 @@ int main(int argc, char *argv[])
 			if (pcr_list[i] == -1)
 				continue;
 
-			pcr_mask[pcr_list[i] / 8] |= 1 << (pcr_list[i] % 8);
+			s.pcr_mask[pcr_list[i] / 8] |= 1 << (pcr_list[i] % 8);
 		}
 	}
 
 	OpenSSL_add_all_algorithms();
 
-	rc = RAND_bytes(hmac_key, sizeof(hmac_key));
+	/* the CA key is decrypted once, and not at every CSR */
+	rc = attest_enroll_load_ca(s.caKeyPath, s.caKeyPassword, s.caCertPath,
+				   s.openssl_ca_section);
+	if (rc < 0) {
+		printf("Cannot load CA from section %s\n",
+		       s.openssl_ca_section);
+		goto out;
+	}
+
+	rc = RAND_bytes(s.hmac_key, sizeof(s.hmac_key));
 	if (!rc) {
 		printf("Cannot generate HMAC key\n");
 		rc = -EINVAL;
 		goto out;
 	}
 
-	fd_socket = socket(AF_INET, SOCK_STREAM, 0);
-	setsockopt(fd_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_addr,
-		   sizeof(reuse_addr));
+	if (s.req_path) {
+		rc = attest_enroll_load_reqs(s.req_path);
+		if (rc < 0) {
+			printf("Cannot load requirements %s\n", s.req_path);
+			goto out;
+		}
+	}
 
-	memset(&addr, 0, sizeof(addr));
+	/* the random key is used only if HMAC keys are not provided */
+	if (s.hmac_keys_path) {
+		rc = attest_enroll_load_hmac_keys(s.hmac_keys_path);
+		if (rc < 0) {
+			printf("Cannot load HMAC keys %s\n", s.hmac_keys_path);
+			goto out;
+		}
+	}
 
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	addr.sin_port = htons(3000);
+	if (replay_keys_path) {
+		rc = attest_enroll_load_replay_hmac_keys(replay_keys_path);
+		if (rc < 0) {
+			printf("Cannot load HMAC keys %s\n", replay_keys_path);
+			goto out;
+		}
+	}
 
-	rc = bind(fd_socket, (struct sockaddr *)&addr, sizeof(addr));
-	if (rc) {
-		printf("%s\n", strerror(errno));
+	queue.size = backlog;
+	queue.fds = malloc(queue.size * sizeof(*queue.fds));
+	if (!queue.fds) {
+		printf("Out of memory\n");
+		rc = -ENOMEM;
 		goto out;
 	}
 
-	rc = listen(fd_socket, 5);
-	if (rc) {
-		printf("%s\n", strerror(errno));
+	fd_socket = listen_fds_socket();
+	if (fd_socket == -ENOENT)
+		fd_socket = listen_socket(port, backlog, num_procs > 0);
+	if (fd_socket < 0) {
+		printf("Cannot listen on port %d: %s\n", port,
+		       strerror(-fd_socket));
+		rc = fd_socket;
+		fd_socket = -1;
 		goto out;
 	}
 
-	while (1) {
-		fd = accept(fd_socket, NULL, NULL);
-		if (fd < 0)
-			continue;
-
-		rc = attest_util_read_buf(fd, (uint8_t *)&len, sizeof(len));
-		if (rc)
-			goto out_free;
-
-		rc = attest_util_read_buf(fd, (uint8_t *)&op, sizeof(op));
-		if (rc)
-			goto out_free;
-
-		len -= 2 * sizeof(len);
-		message_in = malloc(len + 1);
-
-		if (!message_in) {
-			len = 0;
-			goto response;
+	if (num_procs > 0) {
+		procs.num = num_procs;
+		procs.num_workers = num_workers;
+		procs.metrics_port = metrics_port;
+		procs.pids = calloc(num_procs, sizeof(*procs.pids));
+		procs.fds = calloc(num_procs, sizeof(*procs.fds));
+		if (!procs.pids || !procs.fds) {
+			printf("Out of memory\n");
+			rc = -ENOMEM;
+			goto out;
 		}
 
-		message_in[len] = '\0';
-
-		rc = attest_util_read_buf(fd, (uint8_t *)message_in, len);
-		if (rc)
-			goto out_free;
-
-		len = 0;
-
-		message_out = NULL;
-
-		csr_str = NULL;
-		cert_str = NULL;
-		ca_cert_str = NULL;
-
-		switch (op) {
-		case 0:
-			rc = attest_enroll_msg_make_credential(hmac_key,
-						sizeof(hmac_key), caKeyPath,
-						caKeyPassword, caCertPath,
-						message_in, &message_out);
-			break;
-		case 1:
-			rc = attest_enroll_msg_make_cert(hmac_key, sizeof(hmac_key),
-							 caKeyPath, caKeyPassword,
-							 caCertPath,
-							 cert_subject_entries,
-							 num_subject_entries,
-							 message_in, &message_out);
-			break;
-		case 2:
-			rc = attest_enroll_msg_process_csr(sizeof(pcr_mask),
-							pcr_mask, req_path,
-							verifier_flags,
-							message_in, &csr_str);
-			if (rc < 0)
-				break;
-
-			rc = attest_enroll_sign_csr(caKeyPath, caKeyPassword,
-						    caCertPath,
-						    openssl_ca_section, csr_str,
-						    &cert_str);
-			if (rc < 0)
-				break;
-
-			rc = attest_util_read_seq_file(caCertPath,
-						&ca_cert_str_len,
-						(uint8_t **)&ca_cert_str);
-			if (rc < 0)
-				break;
-
-			rc = attest_enroll_msg_return_cert(cert_str,
-							   ca_cert_str,
-							   &message_out);
-			break;
-		case 3:
-			rc = attest_enroll_msg_gen_quote_nonce(sizeof(hmac_key),
-							       hmac_key,
-							       message_in,
-							       &message_out);
-			break;
-		case 4:
-			rc = attest_enroll_msg_process_quote(sizeof(hmac_key),
-							     hmac_key,
-							     sizeof(pcr_mask),
-							     pcr_mask, req_path,
-							     verifier_flags,
-							     message_in,
-							     &message_out);
-			break;
-		default:
-			rc = -EINVAL;
-			break;
+		/* a socket passed by systemd is shared by all processes */
+		procs.fds[0] = fd_socket;
+		for (i = 1; i < num_procs; i++) {
+			procs.fds[i] = (fd_socket == LISTEN_FDS_START) ?
+				fd_socket : listen_socket(port, backlog, 1);
+			if (procs.fds[i] < 0) {
+				printf("Cannot listen on port %d: %s\n", port,
+				       strerror(-procs.fds[i]));
+				rc = procs.fds[i];
+				goto out;
+			}
 		}
 
-		if (!rc)
-			len = strlen(message_out) + sizeof(len) + 1;
-response:
-		if (!len)
-			printf("error\n");
+		rc = worker_procs_run(&procs);
+		goto out;
+	}
 
-		rc = attest_util_write_buf(fd, (uint8_t *)&len, sizeof(len));
-		if (rc)
-			goto out;
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-		if (len)
-			rc = attest_util_write_buf(fd, (uint8_t *)message_out,
-						   len - sizeof(len));
-out_free:
-		free(message_in);
-		free(message_out);
-		free(csr_str);
-		free(cert_str);
-		free(ca_cert_str);
+	rc = pthread_create(&thread, NULL, reload_reqs, &s);
+	if (rc) {
+		printf("Cannot create reload thread: %s\n", strerror(rc));
+		goto out;
+	}
 
-		close(fd);
+	pthread_detach(thread);
 
-		if (rc)
-			break;
-	}
+	rc = serve(&s, fd_socket, num_workers, metrics_port);
+	fd_socket = -1;
 out:
 	EVP_cleanup();
 	NCONF_free(conf);
+	free(queue.fds);
 	if (fd_socket != -1)
 		close(fd_socket);
+	for (i = 1; procs.fds && i < num_procs; i++)
+		if (procs.fds[i] > 0 && procs.fds[i] != fd_socket)
+			close(procs.fds[i]);
+	free(procs.pids);
+	free(procs.fds);
 	return 0;
 }
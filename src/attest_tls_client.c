@@ -166,6 +166,7 @@ static void usage(char *argv0)
 
 int main(int argc, char **argv)
 {
+	struct skae_callback_ctx attest = { NULL, NULL };
 	SSL_CTX *ctx;
 	SSL *ssl;
 	char request[256], reply[10];
@@ -268,8 +269,13 @@ int main(int argc, char **argv)
 		goto free;
 	}
 
-	attest_ctx_data_init(NULL);
-	attest_ctx_verifier_init(NULL);
+	rc = attest_ctx_data_init(&attest.d_ctx);
+	if (rc < 0)
+		goto error;
+
+	rc = attest_ctx_verifier_init(&attest.v_ctx);
+	if (rc < 0)
+		goto error;
 
 	if (custom_protocol) {
 		rc = send_receive_attest_data(server, attest_data_path,
@@ -280,7 +286,7 @@ int main(int argc, char **argv)
 	}
 
 	if (verify_skae) {
-		rc = configure_attest(server, server_attest_data_size,
+		rc = configure_attest(&attest, server_attest_data_size,
 				      server_attest_data, pcr_list_str,
 				      req_path);
 		if (rc < 0)
@@ -290,12 +296,17 @@ int main(int argc, char **argv)
 	ssl = SSL_new(ctx);
 	SSL_set_fd(ssl, server);
 
+	rc = skae_callback_set_ctx(ssl, &attest);
+	if (rc < 0)
+		goto error_ssl;
+
 	rc = SSL_connect(ssl);
 
 	if (verify_skae && verbose) {
-		logs = attest_ctx_verifier_result_print_json(
-					attest_ctx_verifier_get_global());
-		printf("%s\n", logs);
+		logs = attest_ctx_verifier_result_print_json(attest.v_ctx);
+		if (logs)
+			printf("%s\n", logs);
+
 		free(logs);
 	}
 
@@ -339,7 +350,9 @@ free:
 cleanup:
 	cleanup_openssl();
 	free(server_attest_data);
-	attest_ctx_data_cleanup(NULL);
-	attest_ctx_verifier_cleanup(NULL);
+	if (attest.d_ctx)
+		attest_ctx_data_cleanup(attest.d_ctx);
+	if (attest.v_ctx)
+		attest_ctx_verifier_cleanup(attest.v_ctx);
 	return rc;
 }
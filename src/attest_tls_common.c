@@ -163,7 +163,7 @@ out:
 	return rc;
 }
 
-static int configure_pcr(char *pcr_list_str)
+static int configure_pcr(attest_ctx_verifier *v_ctx, char *pcr_list_str)
 {
 	unsigned char pcr_mask[] = { 0x00, 0x00, 0x00 };
 	int pcr_list[IMPLEMENTATION_PCR];
@@ -185,28 +185,26 @@ static int configure_pcr(char *pcr_list_str)
 		pcr_mask[pcr_list[i] / 8] |= 1 << (pcr_list[i] % 8);
 	}
 
-	attest_ctx_verifier_set_pcr_mask(attest_ctx_verifier_get_global(),
-					 sizeof(pcr_mask), pcr_mask);
+	attest_ctx_verifier_set_pcr_mask(v_ctx, sizeof(pcr_mask), pcr_mask);
 
 	return 0;
 }
 
-int configure_attest(int fd, size_t recv_data_size,
+int configure_attest(struct skae_callback_ctx *ctx, size_t recv_data_size,
 		     unsigned char *recv_attest_data, char *pcr_list_str,
 		     char *req_path)
 {
 	int rc;
 
-	rc = configure_pcr(pcr_list_str);
+	rc = configure_pcr(ctx->v_ctx, pcr_list_str);
 	if (rc < 0)
 		return rc;
 
-	attest_ctx_verifier_req_add_json_file(attest_ctx_verifier_get_global(),
-					      req_path);
+	attest_ctx_verifier_req_add_json_file(ctx->v_ctx, req_path);
 	if (!recv_data_size)
 		return 0;
 
-	return attest_ctx_data_add_json_data(attest_ctx_data_get_global(),
+	return attest_ctx_data_add_json_data(ctx->d_ctx,
 					     (char *)recv_attest_data,
 					     recv_data_size);
 }
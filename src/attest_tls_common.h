@@ -18,6 +18,7 @@
 #define _ATTEST_TLS_COMMON_H
 
 #include "ctx_json.h"
+#include "skae.h"
 #include "util.h"
 
 void init_openssl();
@@ -30,7 +31,7 @@ SSL_CTX *create_context(int context_type);
 
 int configure_context(SSL_CTX *ctx, int engine, int verify_skae, char *key_path,
 		      char *cert_path, char *ca_path);
-int configure_attest(int fd, size_t recv_data_size,
+int configure_attest(struct skae_callback_ctx *ctx, size_t recv_data_size,
 		     unsigned char *recv_attest_data, char *pcr_list_str,
 		     char *req_path);
 
@@ -19,6 +19,8 @@
 #include <string.h>
 #include <getopt.h>
 #include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include <arpa/inet.h>
@@ -27,6 +29,7 @@
 #include <openssl/engine.h>
 
 #include "attest_tls_common.h"
+#include "metrics.h"
 
 #define SERVER_PORT 4433
 #define BUFLEN 1024
@@ -55,7 +58,7 @@ int create_socket(void)
 		goto out;
 	}
 
-	if (listen(s, 1) < 0) {
+	if (listen(s, SOMAXCONN) < 0) {
 		perror("Unable to listen");
 		goto out;
 	}
@@ -63,6 +66,169 @@ out:
 	return s;
 }
 
+/* state shared by the worker threads, read-only after startup */
+struct tls_server {
+	SSL_CTX *ctx;
+	int sock;
+	int verify_skae;
+	int verbose;
+	char *attest_data_path;
+	char *pcr_list_str;
+	char *req_path;
+};
+
+static void handle_connection(struct tls_server *s, int client)
+{
+	struct skae_callback_ctx attest = { NULL, NULL };
+	unsigned char *client_attest_data = NULL, *server_attest_data = NULL;
+	size_t file_size, data_size;
+	const char reply[] = "test\n";
+	uint64_t start = attest_metrics_time_us();
+	char *logs;
+	SSL *ssl;
+	int rc;
+
+	attest_metrics_gauge_add(METRIC_REQUESTS_IN_FLIGHT, 1, NULL);
+
+	rc = attest_ctx_data_init_flags(&attest.d_ctx, CTX_RESTRICT_URI);
+	if (rc < 0)
+		goto error;
+
+	rc = attest_ctx_verifier_init(&attest.v_ctx);
+	if (rc < 0)
+		goto error;
+
+	rc = attest_util_read_buf(client, (unsigned char *)&data_size,
+				  sizeof(data_size));
+	if (rc < 0)
+		goto error;
+
+	data_size = ntohl(data_size);
+	attest_metrics_inc(METRIC_RECEIVED_BYTES,
+			   sizeof(data_size) + data_size, NULL);
+
+	if (data_size) {
+		client_attest_data = malloc(data_size);
+		if (!client_attest_data) {
+			rc = -ENOMEM;
+			goto error;
+		}
+
+		rc = attest_util_read_buf(client, client_attest_data,
+					  data_size);
+		if (rc < 0)
+			goto error;
+
+		if (s->verify_skae) {
+			rc = configure_attest(&attest, data_size,
+					      client_attest_data,
+					      s->pcr_list_str, s->req_path);
+			if (rc < 0)
+				goto error;
+		}
+	}
+
+	data_size = 0;
+
+	if (s->attest_data_path) {
+		rc = attest_util_read_file(s->attest_data_path, &file_size,
+					   &server_attest_data);
+		if (!rc)
+			data_size = file_size;
+	}
+
+	data_size = htonl(data_size);
+
+	rc = attest_util_write_buf(client, (unsigned char *)&data_size,
+				   sizeof(data_size));
+	if (rc < 0)
+		goto error;
+
+	if (data_size) {
+		rc = attest_util_write_buf(client, server_attest_data,
+					   file_size);
+		if (rc < 0)
+			goto error;
+	}
+
+	ssl = SSL_new(s->ctx);
+	SSL_set_fd(ssl, client);
+
+	rc = skae_callback_set_ctx(ssl, &attest);
+	if (rc < 0)
+		goto error_ssl;
+
+	rc = SSL_accept(ssl);
+
+	if (s->verify_skae && s->verbose) {
+		logs = attest_ctx_verifier_result_print_json(attest.v_ctx);
+		if (logs)
+			printf("%s\n", logs);
+
+		free(logs);
+	}
+
+	if (rc <= 0) {
+		ERR_print_errors_fp(stderr);
+		rc = -EACCES;
+		goto error_ssl;
+	}
+
+	rc = 0;
+
+	if (SSL_get_verify_result(ssl) == X509_V_OK) {
+		printf("good client cert\n");
+		SSL_write(ssl, reply, strlen(reply));
+	} else {
+		ERR_print_errors_fp(stderr);
+		printf("bad client cert\n");
+		rc = -EACCES;
+	}
+error_ssl:
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+error:
+	close(client);
+	free(client_attest_data);
+
+	if (server_attest_data)
+		munmap(server_attest_data, file_size);
+
+	if (attest.d_ctx)
+		attest_ctx_data_cleanup(attest.d_ctx);
+	if (attest.v_ctx)
+		attest_ctx_verifier_cleanup(attest.v_ctx);
+
+	attest_metrics_gauge_add(METRIC_REQUESTS_IN_FLIGHT, -1, NULL);
+	attest_metrics_inc(METRIC_REQUESTS, 1, "op=\"handshake\"");
+	if (rc < 0)
+		attest_metrics_inc(METRIC_REQUEST_ERRORS, 1,
+				   "op=\"handshake\",rc=\"%d\"", rc);
+
+	attest_metrics_observe(METRIC_REQUEST_DURATION,
+			       attest_metrics_time_us() - start,
+			       "op=\"handshake\"");
+}
+
+/* workers accept from the same socket, each handles one client at a time */
+static void *worker(void *arg)
+{
+	struct tls_server *s = arg;
+	int client;
+
+	while (1) {
+		client = accept(s->sock, NULL, NULL);
+		if (client < 0) {
+			perror("Unable to accept");
+			continue;
+		}
+
+		handle_connection(s, client);
+	}
+
+	return NULL;
+}
+
 static struct option long_options[] = {
 	{"key", 1, 0, 'k'},
 	{"cert", 1, 0, 'c'},
@@ -73,6 +239,8 @@ static struct option long_options[] = {
 	{"requirements", 1, 0, 'r'},
 	{"verify-skae", 0, 0, 'S'},
 	{"verbose", 0, 0, 'V'},
+	{"workers", 1, 0, 'w'},
+	{"metrics-port", 1, 0, 'm'},
 	{"help", 0, 0, 'h'},
 	{"version", 0, 0, 'v'},
 	{0, 0, 0, 0}
@@ -91,6 +259,11 @@ static void usage(char *argv0)
 		"\t-r, --requirements            verifier requirements\n"
 		"\t-S, --verify-skae             verify peer's SKAE\n"
 		"\t-V, --verbose                 verbose mode\n"
+		"\t-w, --workers                 number of worker threads\n"
+		"\t                              (default: 1)\n"
+		"\t-m, --metrics-port [<addr>:]<port>\n"
+		"\t                              export metrics over HTTP\n"
+		"\t                              (default addr: 127.0.0.1)\n"
 		"\t-h, --help                    print this help message\n"
 		"\t-v, --version                 print package version\n"
 		"\n"
@@ -101,20 +274,21 @@ static void usage(char *argv0)
 
 int main(int argc, char **argv)
 {
-	SSL_CTX *ctx;
+	struct tls_server s = { .ctx = NULL };
 	char *key_path = NULL, *cert_path = NULL, *ca_path = NULL;
-	char *attest_data_path = NULL, *req_path = NULL;
-	char *pcr_list_str = NULL, *logs;
-	unsigned char *client_attest_data, *server_attest_data;
-	size_t file_size, data_size;
-	int sock, option_index, c;
-	int rc = -EINVAL, engine = 0, verify_skae = 0, verbose = 0;
+	pthread_t thread;
+	int option_index, c, i, num_workers = 1, metrics_port = 0;
+	int rc = -EINVAL, engine = 0;
+	char *metrics_addr = NULL, *sep;
 
 	setvbuf(stdout, NULL, _IONBF, 1);
 
+	/* a client closing early must not terminate the other workers */
+	signal(SIGPIPE, SIG_IGN);
+
 	while (1) {
 		option_index = 0;
-		c = getopt_long(argc, argv, "k:c:d:a:ep:r:SVhv", long_options,
+		c = getopt_long(argc, argv, "k:c:d:a:ep:r:SVw:m:hv", long_options,
 				&option_index);
 		if (c == -1)
 			break;
@@ -130,22 +304,34 @@ int main(int argc, char **argv)
 				ca_path = optarg;
 				break;
 			case 'a':
-				attest_data_path = optarg;
+				s.attest_data_path = optarg;
 				break;
 			case 'e':
 				engine = 1;
 				break;
 			case 'p':
-				pcr_list_str = optarg;
+				s.pcr_list_str = optarg;
 				break;
 			case 'r':
-				req_path = optarg;
+				s.req_path = optarg;
 				break;
 			case 'S':
-				verify_skae = 1;
+				s.verify_skae = 1;
 				break;
 			case 'V':
-				verbose = 1;
+				s.verbose = 1;
+				break;
+			case 'w':
+				num_workers = atoi(optarg);
+				break;
+			case 'm':
+				sep = strrchr(optarg, ':');
+				if (sep) {
+					*sep = '\0';
+					metrics_addr = optarg;
+				}
+
+				metrics_port = atoi(sep ? sep + 1 : optarg);
 				break;
 			case 'h':
 				usage(argv[0]);
@@ -169,140 +355,60 @@ int main(int argc, char **argv)
 		return -EINVAL;
 	}
 
-	if (verify_skae && !req_path) {
+	if (s.verify_skae && !s.req_path) {
 		printf("Missing requirements\n");
 		return -EINVAL;
 	}
 
+	if (num_workers <= 0)
+		num_workers = 1;
+
 	init_openssl();
 
-	ctx = create_context(CONTEXT_SERVER);
-	if (!ctx)
+	s.ctx = create_context(CONTEXT_SERVER);
+	if (!s.ctx)
 		goto cleanup;
 
-	rc = SSL_CTX_set_max_early_data(ctx, BUFLEN);
+	rc = SSL_CTX_set_max_early_data(s.ctx, BUFLEN);
 	if (rc <= 0) {
 		ERR_print_errors_fp(stderr);
 		goto cleanup;
 	}
 
-	rc = configure_context(ctx, engine, verify_skae, key_path, cert_path,
-			       ca_path);
+	rc = configure_context(s.ctx, engine, s.verify_skae, key_path,
+			       cert_path, ca_path);
 	if (rc < 0)
 		goto free;
 
-	sock = create_socket();
-
-	while(1) {
-		struct sockaddr_in addr;
-		uint len = sizeof(addr);
-		SSL *ssl;
-		const char reply[] = "test\n";
+	s.sock = create_socket();
+	if (s.sock < 0)
+		goto free;
 
-		int client = accept(sock, (struct sockaddr*)&addr, &len);
-		if (client < 0) {
-			perror("Unable to accept");
+	if (metrics_port) {
+		rc = attest_metrics_serve(metrics_addr, metrics_port);
+		if (rc < 0) {
+			printf("Cannot export metrics on port %d: %s\n",
+			       metrics_port, strerror(-rc));
 			goto close;
 		}
+	}
 
-		attest_ctx_data_init(NULL);
-		attest_ctx_verifier_init(NULL);
-
-		client_attest_data = NULL;
-		server_attest_data = NULL;
-
-		rc = attest_util_read_buf(client, (unsigned char *)&data_size,
-					  sizeof(data_size));
-		if (rc < 0)
-			goto error;
-
-		data_size = ntohl(data_size);
-		if (data_size) {
-			client_attest_data = malloc(data_size);
-			if (!client_attest_data) {
-				rc = -ENOMEM;
-				goto error;
-			}
-
-			rc = attest_util_read_buf(client, client_attest_data,
-						  data_size);
-			if (rc < 0)
-				goto error;
-
-			if (verify_skae) {
-				rc = configure_attest(client, data_size,
-						      client_attest_data,
-						      pcr_list_str, req_path);
-				if (rc < 0)
-					goto error;
-			}
-		}
-
-		data_size = 0;
-
-		if (attest_data_path) {
-			rc = attest_util_read_file(attest_data_path, &file_size,
-						   &server_attest_data);
-			if (!rc)
-				data_size = file_size;
-		}
-
-		data_size = htonl(data_size);
-
-		rc = attest_util_write_buf(client, (unsigned char *)&data_size,
-					   sizeof(data_size));
-		if (rc < 0)
-			goto error;
-
-		if (data_size) {
-			rc = attest_util_write_buf(client, server_attest_data,
-						   file_size);
-			if (rc < 0)
-				goto error;
-		}
-
-		ssl = SSL_new(ctx);
-		SSL_set_fd(ssl, client);
-
-		rc = SSL_accept(ssl);
-
-		if (verify_skae && verbose) {
-			logs = attest_ctx_verifier_result_print_json(
-					attest_ctx_verifier_get_global());
-			printf("%s\n", logs);
-			free(logs);
-		}
-
-		if (rc <= 0) {
-			ERR_print_errors_fp(stderr);
-			rc = -EIO;
-			goto error_ssl;
-		}
-
-		if (SSL_get_verify_result(ssl) == X509_V_OK) {
-			printf("good client cert\n");
-			SSL_write(ssl, reply, strlen(reply));
-		} else {
-			ERR_print_errors_fp(stderr);
-			printf("bad client cert\n");
+	for (i = 1; i < num_workers; i++) {
+		rc = pthread_create(&thread, NULL, worker, &s);
+		if (rc) {
+			printf("Cannot create worker thread: %s\n",
+			       strerror(rc));
+			goto close;
 		}
-error_ssl:
-		SSL_shutdown(ssl);
-		SSL_free(ssl);
-error:
-		close(client);
-		free(client_attest_data);
-
-		if (server_attest_data)
-			munmap(server_attest_data, file_size);
 
-		attest_ctx_data_cleanup(NULL);
-		attest_ctx_verifier_cleanup(NULL);
+		pthread_detach(thread);
 	}
+
+	worker(&s);
 close:
-	close(sock);
+	close(s.sock);
 free:
-	SSL_CTX_free(ctx);
+	SSL_CTX_free(s.ctx);
 cleanup:
 	cleanup_openssl();
 
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: attest_verify_quotes.c
+ *      Verify archived quote messages in parallel.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <dirent.h>
+
+#include <sys/mman.h>
+#include <json-c/json.h>
+#include <openssl/evp.h>
+
+#include "ctx_json.h"
+#include "enroll_server.h"
+#include "util.h"
+
+#define MAX_WORKERS 64
+#define MAX_NAME_LENGTH 512
+
+struct verify_ctx {
+	uint8_t hmac_key[64];
+	uint8_t pcr_mask[3];
+	char *req_path;
+	uint16_t verifier_flags;
+	char *dir_path;
+	struct dirent **entries;
+	int num_entries;
+	char *input_path;
+	FILE *fp;
+	int next;
+	pthread_mutex_t input_lock;
+	pthread_mutex_t output_lock;
+	int num_verified;
+	int num_failed;
+};
+
+static int dir_filter(const struct dirent *dentry)
+{
+	return dentry->d_name[0] != '.' &&
+	       (dentry->d_type == DT_REG || dentry->d_type == DT_UNKNOWN);
+}
+
+/* files are verified in name order, lines in the order of the stream */
+static int verify_next(struct verify_ctx *v, char *name, char **message)
+{
+	char path[MAX_PATH_LENGTH];
+	unsigned char *data;
+	size_t len = 0;
+	ssize_t line_len;
+	int rc = 0;
+
+	pthread_mutex_lock(&v->input_lock);
+	if (v->dir_path) {
+		if (v->next == v->num_entries)
+			goto out;
+
+		snprintf(name, MAX_NAME_LENGTH, "%s",
+			 v->entries[v->next++]->d_name);
+		snprintf(path, sizeof(path), "%s/%s", v->dir_path, name);
+
+		if (attest_util_read_file(path, &len, &data) < 0) {
+			rc = -EIO;
+			goto out;
+		}
+
+		*message = strndup((char *)data, len);
+		munmap(data, len);
+
+		rc = *message ? 1 : -ENOMEM;
+		goto out;
+	}
+
+	*message = NULL;
+
+	while ((line_len = getline(message, &len, v->fp)) > 0) {
+		v->next++;
+
+		if ((*message)[line_len - 1] == '\n')
+			(*message)[--line_len] = '\0';
+
+		if (!line_len)
+			continue;
+
+		snprintf(name, MAX_NAME_LENGTH, "%s:%d", v->input_path,
+			 v->next);
+		rc = 1;
+		goto out;
+	}
+
+	free(*message);
+out:
+	pthread_mutex_unlock(&v->input_lock);
+	return rc;
+}
+
+static void verify_result(struct verify_ctx *v, char *name, int result,
+			  char *logs)
+{
+	json_object *root, *logs_obj = NULL;
+
+	if (logs)
+		logs_obj = attest_ctx_parse_json_data(logs, strlen(logs));
+
+	root = json_object_new_object();
+	if (!root) {
+		json_object_put(logs_obj);
+		return;
+	}
+
+	json_object_object_add(root, "message", json_object_new_string(name));
+	json_object_object_add(root, "result", json_object_new_int(result));
+	json_object_object_add(root, "log", logs_obj);
+
+	pthread_mutex_lock(&v->output_lock);
+	printf("%s\n", json_object_to_json_string_ext(root,
+						      JSON_C_TO_STRING_PLAIN));
+	if (result)
+		v->num_failed++;
+	else
+		v->num_verified++;
+	pthread_mutex_unlock(&v->output_lock);
+
+	json_object_put(root);
+}
+
+static void *verify_worker(void *arg)
+{
+	struct verify_ctx *v = (struct verify_ctx *)arg;
+	char name[MAX_NAME_LENGTH], *message, *logs;
+	int rc;
+
+	while ((rc = verify_next(v, name, &message)) != 0) {
+		if (rc < 0) {
+			verify_result(v, name, rc, NULL);
+			continue;
+		}
+
+		rc = attest_enroll_verify_quote(sizeof(v->hmac_key),
+						v->hmac_key,
+						sizeof(v->pcr_mask),
+						v->pcr_mask, v->req_path,
+						v->verifier_flags, message,
+						&logs);
+		verify_result(v, name, rc, logs);
+
+		free(logs);
+		free(message);
+	}
+
+	return NULL;
+}
+
+static struct option long_options[] = {
+	{"dir", 1, 0, 'd'},
+	{"input", 1, 0, 'I'},
+	{"pcr-list", 1, 0, 'p'},
+	{"requirements", 1, 0, 'r'},
+	{"hmac-keys", 1, 0, 'k'},
+	{"skip-hmac", 0, 0, 'n'},
+	{"ima-violations", 0, 0, 'i'},
+	{"skip-sig-ver", 0, 0, 's'},
+	{"log-timing", 0, 0, 'T'},
+	{"workers", 1, 0, 'w'},
+	{"help", 0, 0, 'h'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+static void usage(char *argv0)
+{
+	fprintf(stdout, "Usage: %s [options]\n\n"
+		"Options:\n"
+		"\t-d, --dir <dir>               directory of quote messages\n"
+		"\t-I, --input <file>            quote messages, one per line\n"
+		"\t                              (- for stdin)\n"
+		"\t-p, --pcr-list <list>         list of PCRs to verify\n"
+		"\t-r, --requirements <file>     verifier's requirements\n"
+		"\t-k, --hmac-keys <file>        HMAC keys of the RA servers\n"
+		"\t-n, --skip-hmac               do not verify the nonce HMAC\n"
+		"\t-i, --ima-violations          allow IMA violations\n"
+		"\t-s, --skip-sig-ver            skip signature verification\n"
+		"\t-T, --log-timing              add timing to the logs\n"
+		"\t-w, --workers <num>           number of worker threads\n"
+		"\t                              (default: online CPUs)\n"
+		"\t-h, --help                    print this help message\n"
+		"\t-v, --version                 print package version\n"
+		"\n"
+		"Nonces are not checked for expiration and reuse. Messages are\n"
+		"verified independently, and must include the full event logs.\n"
+		"A JSON line with the result and the logs is printed for each\n"
+		"message.\n"
+		"\n"
+		"Report bugs to " PACKAGE_BUGREPORT "\n",
+		argv0);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct verify_ctx v = { .verifier_flags = CTX_ALLOW_NONCE_REUSE };
+	pthread_t threads[MAX_WORKERS];
+	char *pcr_list_str = NULL, *hmac_keys_path = NULL;
+	int pcr_list[IMPLEMENTATION_PCR];
+	int rc = 0, option_index, c, i, n, num_workers = 0;
+
+	while (1) {
+		option_index = 0;
+		c = getopt_long(argc, argv, "d:I:p:r:k:nisTw:hv",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'd':
+				v.dir_path = optarg;
+				break;
+			case 'I':
+				v.input_path = optarg;
+				break;
+			case 'p':
+				pcr_list_str = optarg;
+				break;
+			case 'r':
+				v.req_path = optarg;
+				break;
+			case 'k':
+				hmac_keys_path = optarg;
+				break;
+			case 'n':
+				v.verifier_flags |= CTX_SKIP_NONCE_HMAC;
+				break;
+			case 'i':
+				v.verifier_flags |= CTX_ALLOW_IMA_VIOLATIONS;
+				break;
+			case 's':
+				v.verifier_flags |= CTX_SKIP_SIG_VER;
+				break;
+			case 'T':
+				v.verifier_flags |= CTX_LOG_TIMING;
+				break;
+			case 'w':
+				num_workers = atoi(optarg);
+				break;
+			case 'h':
+				usage(argv[0]);
+				break;
+			case 'v':
+				fprintf(stdout, "%s " VERSION "\n"
+					"Copyright 2026 attest-tools contributors\n"
+					"License GPLv2: GNU GPL version 2\n",
+					argv[0]);
+				exit(0);
+			default:
+				printf("Unknown option '%c'\n", c);
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	if (!v.dir_path == !v.input_path) {
+		printf("Either a directory or an input file must be specified\n");
+		return 1;
+	}
+
+	if (!v.req_path) {
+		printf("Requirements not specified\n");
+		return 1;
+	}
+
+	if (!hmac_keys_path && !(v.verifier_flags & CTX_SKIP_NONCE_HMAC)) {
+		printf("HMAC keys not specified, use -n to skip verification\n");
+		return 1;
+	}
+
+	if (pcr_list_str) {
+		rc = attest_util_parse_pcr_list(pcr_list_str,
+					sizeof(pcr_list) / sizeof(*pcr_list),
+					pcr_list);
+		if (rc < 0)
+			return 1;
+
+		for (i = 0; i < sizeof(pcr_list) / sizeof(*pcr_list); i++) {
+			if (pcr_list[i] == -1)
+				continue;
+
+			v.pcr_mask[pcr_list[i] / 8] |= 1 << (pcr_list[i] % 8);
+		}
+	}
+
+	OpenSSL_add_all_algorithms();
+
+	if (hmac_keys_path) {
+		rc = attest_enroll_load_hmac_keys(hmac_keys_path);
+		if (rc < 0) {
+			printf("Cannot load HMAC keys from %s\n",
+			       hmac_keys_path);
+			return 1;
+		}
+	}
+
+	/* requirements are parsed once and shared by the workers */
+	rc = attest_enroll_load_reqs(v.req_path);
+	if (rc < 0) {
+		printf("Cannot load requirements %s\n", v.req_path);
+		return 1;
+	}
+
+	if (v.dir_path) {
+		v.num_entries = scandir(v.dir_path, &v.entries, dir_filter,
+					alphasort);
+		if (v.num_entries < 0) {
+			printf("Cannot open %s\n", v.dir_path);
+			rc = -ENOENT;
+			goto out;
+		}
+	} else {
+		v.fp = strcmp(v.input_path, "-") ?
+		       fopen(v.input_path, "r") : stdin;
+		if (!v.fp) {
+			printf("Cannot open %s\n", v.input_path);
+			rc = -ENOENT;
+			goto out;
+		}
+	}
+
+	pthread_mutex_init(&v.input_lock, NULL);
+	pthread_mutex_init(&v.output_lock, NULL);
+
+	if (num_workers <= 0)
+		num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_workers > MAX_WORKERS)
+		num_workers = MAX_WORKERS;
+
+	for (n = 0; n < num_workers; n++) {
+		if (pthread_create(&threads[n], NULL, verify_worker, &v))
+			break;
+	}
+
+	/* process in the current thread if no thread could be created */
+	if (!n)
+		verify_worker(&v);
+
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&v.input_lock);
+	pthread_mutex_destroy(&v.output_lock);
+
+	fprintf(stderr, "%d messages verified, %d failed\n", v.num_verified,
+		v.num_failed);
+out:
+	for (i = 0; i < v.num_entries; i++)
+		free(v.entries[i]);
+
+	free(v.entries);
+
+	if (v.fp && v.fp != stdin)
+		fclose(v.fp);
+
+	attest_enroll_unload_reqs();
+	return (rc || v.num_failed) ? 1 : 0;
+}
@@ -22,11 +22,17 @@
 
 #define BIOS_ID "bios|verify"
 
-int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
+struct bios_state {
+	struct verification_log *log;
+	struct event_log *bios_log;
+};
+
+static int begin(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		 void **state)
 {
 	struct verifier_struct *verifier;
 	struct event_log *bios_log;
-	struct event_log_entry *log_entry;
+	struct bios_state *s;
 	struct verification_log *log;
 	int rc = 0;
 
@@ -43,13 +49,43 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 	check_goto(!bios_log, -ENOENT, out, v_ctx,
 		   "BIOS event log not provided");
 
-	list_for_each_entry(log_entry, &bios_log->logs, list)
-		log_entry->flags |= LOG_ENTRY_PROCESSED;
+	s = calloc(1, sizeof(*s));
+	check_goto(!s, -ENOMEM, out, v_ctx, "out of memory");
+
+	s->log = log;
+	s->bios_log = bios_log;
+	*state = s;
 out:
-	attest_ctx_verifier_end_log(v_ctx, log, rc);
+	if (rc)
+		attest_ctx_verifier_end_log(v_ctx, log, rc);
+
+	return rc;
+}
+
+static int on_entry(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		    struct event_log *event_log,
+		    struct event_log_entry *log_entry, void *state)
+{
+	struct bios_state *s = (struct bios_state *)state;
+
+	if (event_log == s->bios_log)
+		attest_event_log_entry_set_processed(log_entry);
+
+	return 0;
+}
+
+static int end(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+	       void *state, int rc)
+{
+	struct bios_state *s = (struct bios_state *)state;
+
+	attest_ctx_verifier_end_log(v_ctx, s->log, rc);
+	free(s);
 	return rc;
 }
 
 int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
 
-struct verifier_struct func_array[1] = {{.id = BIOS_ID, .func = verify}};
+struct verifier_struct func_array[1] = {{.id = BIOS_ID, .begin = begin,
+					 .on_entry = on_entry, .end = end}};
@@ -32,12 +32,14 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 
 	list_for_each_entry(event_log, &v_ctx->event_logs, list)
 		list_for_each_entry(log_entry, &event_log->logs, list)
-			log_entry->flags |= LOG_ENTRY_PROCESSED;
+			attest_event_log_entry_set_processed(log_entry);
 
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 	return rc;
 }
 
 int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
 
-struct verifier_struct func_array[1] = {{.id = DUMMY_ID, .func = verify}};
+struct verifier_struct func_array[1] = {{.id = DUMMY_ID, .func = verify,
+					 .flags = VERIFIER_PARALLEL}};
@@ -13,6 +13,7 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "verifier.h"
@@ -21,6 +22,38 @@
 
 #define EVM_KEY_ID "evm_key|verify"
 #define SYM_KEY_ID "trusted_key.blob"
+#define PCR_MASK_LEN 3
+
+/* requirement: PCR mask in hex format */
+static int init(attest_ctx_verifier *v_ctx, const char *req, void **priv)
+{
+	uint8_t *pcr_mask_bin = NULL;
+	int rc = 0, req_len;
+
+	current_log(v_ctx);
+
+	req_len = strlen(req);
+	check_goto((req_len > PCR_MASK_LEN * 2 || (req_len % 2)), -EINVAL, out,
+		   v_ctx, "invalid requirement");
+
+	pcr_mask_bin = calloc(PCR_MASK_LEN, sizeof(*pcr_mask_bin));
+	check_goto(!pcr_mask_bin, -ENOMEM, out, v_ctx, "out of memory");
+
+	rc = _hex2bin(pcr_mask_bin, req, req_len / 2);
+	check_goto(rc, -EINVAL, out, v_ctx, "invalid requirement");
+
+	*priv = pcr_mask_bin;
+out:
+	if (rc)
+		free(pcr_mask_bin);
+
+	return rc;
+}
+
+static void cleanup(void *priv)
+{
+	free(priv);
+}
 
 int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 {
@@ -33,22 +66,17 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 	TPM_ALG_ID nameAlg;
 	UINT32 req_mask = (TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT |
 			   TPMA_OBJECT_SENSITIVEDATAORIGIN);
-	uint8_t pcr_mask_bin[3];
+	uint8_t *pcr_mask_bin;
 	uint8_t *sym_key_bin = NULL;
-	int rc = 0, req_len;
+	int rc = 0;
 
 	log = attest_ctx_verifier_add_log(v_ctx, "verify EVM key");
 
 	verifier = attest_ctx_verifier_lookup(v_ctx, EVM_KEY_ID);
-	check_goto(!verifier->req, -ENOENT, out, v_ctx,
+	check_goto(!verifier->priv, -ENOENT, out, v_ctx,
 		   "requirement not provided");
 
-	req_len = strlen(verifier->req);
-	check_goto((req_len > 6 || (req_len % 2)), -EINVAL, out, v_ctx,
-		   "invalid requirement");
-
-	rc = _hex2bin(pcr_mask_bin, verifier->req, req_len / 2);
-	check_goto(rc, rc, out, v_ctx, "invalid requirement");
+	pcr_mask_bin = (uint8_t *)verifier->priv;
 
 	ima_log = attest_event_log_get(v_ctx, "ima");
 	check_goto(!ima_log, -ENOENT, out, v_ctx,
@@ -73,13 +101,12 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 
 	rc = attest_verifier_check_key_policy(d_ctx, v_ctx, nameAlg, 0,
 					      CTX_SYM_KEY_POLICY,
-					      sizeof(pcr_mask_bin),
-					      pcr_mask_bin);
+					      PCR_MASK_LEN, pcr_mask_bin);
 	check_goto(rc, rc, out, v_ctx,
 		   "attest_verifier_check_key_policy() error: %d", rc);
 
 	if (key_entry)
-		key_entry->flags |= LOG_ENTRY_PROCESSED;
+		attest_event_log_entry_set_processed(key_entry);
 out:
 	free(sym_key_bin);
 
@@ -88,5 +115,7 @@ out:
 }
 
 int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
 
-struct verifier_struct func_array[1] = {{.id = EVM_KEY_ID, .func = verify}};
+struct verifier_struct func_array[1] = {{.id = EVM_KEY_ID, .func = verify,
+					 .init = init, .cleanup = cleanup}};
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2026 attest-tools contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2 of the
+ * License.
+ *
+ * File: ima_allowlist.c
+ *      Verifier of IMA digests against a table of known-good digests.
+ *
+ * Requirements:
+ *      "": use the table at IMA_ALLOWLIST_PATH
+ *      "<path>": use the table at <path>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ctx.h"
+#include "conf.h"
+#include "ima_allowlist.h"
+#include "event_log/ima.h"
+
+#define IMA_ALLOWLIST_ID "ima_allowlist|verify"
+
+/* table mapped when requirements are added, shared by all requests */
+struct ima_allowlist {
+	unsigned char *data;
+	size_t len;
+	struct ima_allowlist_hdr *hdr;
+	struct ima_allowlist_alg_hdr *algs;
+};
+
+static void cleanup(void *priv)
+{
+	struct ima_allowlist *list = (struct ima_allowlist *)priv;
+
+	munmap(list->data, list->len);
+	free(list);
+}
+
+static int check_alg(struct ima_allowlist *list,
+		     struct ima_allowlist_alg_hdr *alg)
+{
+	uint32_t *index;
+	int i;
+
+	if (!memchr(alg->algo, '\0', sizeof(alg->algo)))
+		return -EINVAL;
+
+	if (alg->digest_len < 2 ||
+	    alg->digest_len > IMA_ALLOWLIST_MAX_DIGEST_LEN)
+		return -EINVAL;
+
+	if (alg->index_offset % sizeof(uint64_t) ||
+	    alg->index_offset > list->len ||
+	    list->len - alg->index_offset <
+	    (IMA_ALLOWLIST_INDEX_SIZE + 1) * sizeof(*index))
+		return -EINVAL;
+
+	if (alg->digests_offset > list->len ||
+	    (list->len - alg->digests_offset) / alg->digest_len <
+	    alg->num_digests)
+		return -EINVAL;
+
+	/* lookups rely on the index, and do not check it again */
+	index = (uint32_t *)(list->data + alg->index_offset);
+
+	if (index[0])
+		return -EINVAL;
+
+	for (i = 0; i < IMA_ALLOWLIST_INDEX_SIZE; i++)
+		if (index[i] > index[i + 1])
+			return -EINVAL;
+
+	if (index[IMA_ALLOWLIST_INDEX_SIZE] != alg->num_digests)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int init(attest_ctx_verifier *v_ctx, const char *req_str, void **priv)
+{
+	struct ima_allowlist *list;
+	const char *path = *req_str ? req_str : IMA_ALLOWLIST_PATH;
+	struct stat st;
+	int rc = -EINVAL, fd, i;
+
+	current_log(v_ctx);
+
+	list = calloc(1, sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		attest_ctx_verifier_set_log(log, "cannot open allowlist %s",
+					    path);
+		free(list);
+		return -ENOENT;
+	}
+
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(*list->hdr)) {
+		close(fd);
+		goto out;
+	}
+
+	list->len = st.st_size;
+
+	/* pages are in the page cache, shared with other server processes */
+	list->data = mmap(NULL, list->len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (list->data == MAP_FAILED) {
+		list->data = NULL;
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	madvise(list->data, list->len, MADV_RANDOM);
+
+	list->hdr = (struct ima_allowlist_hdr *)list->data;
+	list->algs = (struct ima_allowlist_alg_hdr *)(list->hdr + 1);
+
+	if (memcmp(list->hdr->magic, IMA_ALLOWLIST_MAGIC,
+		   sizeof(list->hdr->magic)) ||
+	    list->hdr->version != IMA_ALLOWLIST_VERSION)
+		goto out;
+
+	if ((list->len - sizeof(*list->hdr)) / sizeof(*list->algs) <
+	    list->hdr->num_algs)
+		goto out;
+
+	for (i = 0; i < list->hdr->num_algs; i++) {
+		rc = check_alg(list, list->algs + i);
+		if (rc)
+			goto out;
+	}
+
+	rc = 0;
+out:
+	if (rc) {
+		attest_ctx_verifier_set_log(log, "invalid allowlist %s", path);
+
+		if (list->data)
+			munmap(list->data, list->len);
+
+		free(list);
+		return rc;
+	}
+
+	*priv = list;
+	return 0;
+}
+
+static int lookup_digest(struct ima_allowlist *list, uint32_t algo_len,
+			 const char *algo_ptr, uint32_t digest_len,
+			 const unsigned char *digest_ptr)
+{
+	struct ima_allowlist_alg_hdr *alg;
+	const unsigned char *digests;
+	uint32_t *index, prefix, lo, hi, mid;
+	int i, rc;
+
+	for (i = 0; i < list->hdr->num_algs; i++) {
+		alg = list->algs + i;
+
+		if (alg->digest_len == digest_len &&
+		    strlen(alg->algo) == algo_len &&
+		    !memcmp(alg->algo, algo_ptr, algo_len))
+			break;
+	}
+
+	if (i == list->hdr->num_algs)
+		return 0;
+
+	index = (uint32_t *)(list->data + alg->index_offset);
+	digests = list->data + alg->digests_offset;
+
+	/* the index narrows the search to digests with the same prefix */
+	prefix = ima_allowlist_prefix(digest_ptr);
+	lo = index[prefix];
+	hi = index[prefix + 1];
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		rc = memcmp(digests + (size_t)mid * digest_len, digest_ptr,
+			    digest_len);
+		if (!rc)
+			return 1;
+
+		if (rc < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+struct ima_allowlist_state {
+	struct verification_log *log;
+	struct event_log *ima_log;
+	struct ima_allowlist *list;
+};
+
+static int begin(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		 void **state)
+{
+	struct verifier_struct *verifier;
+	struct verification_log *log;
+	struct ima_allowlist_state *s;
+	struct event_log *ima_log;
+	int rc = 0;
+
+	log = attest_ctx_verifier_add_log(v_ctx, "verify IMA allowlist");
+
+	verifier = attest_ctx_verifier_lookup(v_ctx, IMA_ALLOWLIST_ID);
+	check_goto(!verifier->priv, -ENOENT, out, v_ctx,
+		   "allowlist not provided");
+
+	ima_log = attest_event_log_get(v_ctx, "ima");
+	check_goto(!ima_log, -ENOENT, out, v_ctx,
+		   "IMA event log not provided");
+
+	s = calloc(1, sizeof(*s));
+	check_goto(!s, -ENOMEM, out, v_ctx, "out of memory");
+
+	s->log = log;
+	s->ima_log = ima_log;
+	s->list = (struct ima_allowlist *)verifier->priv;
+
+	*state = s;
+out:
+	if (rc)
+		attest_ctx_verifier_end_log(v_ctx, log, rc);
+
+	return rc;
+}
+
+/* entries not in the table are left to the other verifiers */
+static int on_entry(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		    struct event_log *event_log,
+		    struct event_log_entry *cur_log_entry, void *state)
+{
+	struct ima_allowlist_state *s = (struct ima_allowlist_state *)state;
+	struct verification_log *log = s->log;
+	struct ima_log_entry *ima_log_entry;
+	const unsigned char *digest_ptr;
+	const char *algo_ptr;
+	uint32_t algo_len, digest_len;
+	int rc;
+
+	if (event_log != s->ima_log)
+		return 0;
+
+	ima_log_entry = (struct ima_log_entry *)cur_log_entry->log;
+
+	rc = ima_template_get_digest(ima_log_entry, &algo_len, &algo_ptr,
+				     &digest_len, &digest_ptr);
+	check_goto(rc, rc, out, v_ctx, "event digest not found");
+
+	if (lookup_digest(s->list, algo_len, algo_ptr, digest_len, digest_ptr))
+		attest_event_log_entry_set_processed(cur_log_entry);
+out:
+	return rc;
+}
+
+static int end(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+	       void *state, int rc)
+{
+	struct ima_allowlist_state *s = (struct ima_allowlist_state *)state;
+
+	attest_ctx_verifier_end_log(v_ctx, s->log, rc);
+	free(s);
+	return rc;
+}
+
+int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
+
+struct verifier_struct func_array[1] = {{.id = IMA_ALLOWLIST_ID, .init = init,
+					 .cleanup = cleanup, .begin = begin,
+					 .on_entry = on_entry, .end = end}};
@@ -43,6 +43,12 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 	check_goto(!ima_log, -ENOENT, out, v_ctx,
 		   "IMA event log not provided");
 
+	/* boot aggregate verified before the checkpoint */
+	if (ima_log->offset) {
+		rc = 0;
+		goto out;
+	}
+
 	boot_aggregate_entry = list_first_entry(&ima_log->logs,
 						struct event_log_entry, list);
 
@@ -59,8 +65,9 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 			continue;
 
 		pcr = attest_pcr_get(v_ctx, i, digest.hashAlg);
-		if (!pcr)
-			goto out;
+		check_goto(!pcr, -ENOENT, out, v_ctx,
+			   "PCR %d of bank %.*s not calculated", i, algo_len,
+			   algo_ptr);
 
 		rc = TSS_Array_Marshal((uint8_t *)&pcr->digest,
 				       TSS_GetDigestSize(digest.hashAlg),
@@ -73,7 +80,7 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 	check_goto(rc, -EINVAL, out, v_ctx,
 		   "TSS_Hash_Generate() error: %d", rc);
 
-	boot_aggregate_entry->flags |= LOG_ENTRY_PROCESSED;
+	attest_event_log_entry_set_processed(boot_aggregate_entry);
 
 	rc = memcmp((uint8_t *)&digest.digest, digest_ptr,
 		    TSS_GetDigestSize(digest.hashAlg));
@@ -84,6 +91,8 @@ out:
 }
 
 int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
 
 struct verifier_struct func_array[1] = {{.id = IMA_BOOT_AGGREGATE_ID,
-					 .func = verify}};
+					 .func = verify,
+					 .flags = VERIFIER_PARALLEL}};
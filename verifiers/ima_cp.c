@@ -10,51 +10,135 @@
  *
  * File: ima_cp.c
  *      Add measured files to data context
+ *
+ * Requirements:
+ *      "": add unsigned measured files and keys
+ *      "digests": add only the digests of unsigned measured files
+ *      "missing": add keys and only unsigned measured files whose digest
+ *                 is in the data context
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "ctx.h"
 #include "util.h"
 #include "event_log/ima.h"
 
-#include <sys/mman.h>
 #include <sys/wait.h>
 
 #define IMA_CP_ID "ima_cp|verify"
 #define PGP_SCRIPT "/usr/bin/get_pgp_keys.sh"
+#define PGP_KEYS_REFRESH_INTERVAL 3600
+#define MAX_DIGEST_STR_LEN (CRYPTO_MAX_ALG_NAME + 1 + 64 * 2)
+
+enum cp_modes { CP_ALL, CP_DIGESTS, CP_MISSING };
+
+static pthread_mutex_t pgp_keys_mutex = PTHREAD_MUTEX_INITIALIZER;
+static time_t pgp_keys_last_refresh;
 
-int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
+/* run the PGP script at most once per refresh interval */
+static void refresh_pgp_keys(void)
 {
-	struct event_log *bios_log, *ima_log;
-	struct event_log_entry *cur_log_entry;
-	struct ima_log_entry *ima_log_entry;
-	const char *data_ptr;
-	uint32_t data_len;
-	unsigned char *file_content;
-	size_t file_content_len;
+	time_t now = time(NULL);
+	pid_t pid;
+
+	pthread_mutex_lock(&pgp_keys_mutex);
+	if (pgp_keys_last_refresh &&
+	    now - pgp_keys_last_refresh < PGP_KEYS_REFRESH_INTERVAL)
+		goto out;
+
+	pid = fork();
+	if (pid < 0)
+		goto out;
+
+	if (!pid) {
+		execlp(PGP_SCRIPT, PGP_SCRIPT, NULL);
+		_exit(1);
+	}
+
+	waitpid(pid, NULL, 0);
+	pgp_keys_last_refresh = now;
+out:
+	pthread_mutex_unlock(&pgp_keys_mutex);
+}
+
+/* format: <algo>:<hex digest> */
+static int get_digest_str(struct ima_log_entry *ima_log_entry, char *str,
+			  size_t *str_len)
+{
+	const unsigned char *digest_ptr;
+	const char *algo_ptr;
+	uint32_t algo_len, digest_len;
+	int rc;
+
+	rc = ima_template_get_digest(ima_log_entry, &algo_len, &algo_ptr,
+				     &digest_len, &digest_ptr);
+	if (rc)
+		return rc;
+
+	if (algo_len + 1 + digest_len * 2 > MAX_DIGEST_STR_LEN)
+		return -EINVAL;
+
+	memcpy(str, algo_ptr, algo_len);
+	str[algo_len] = ':';
+	_bin2hex(str + algo_len + 1, digest_ptr, digest_len);
+
+	*str_len = algo_len + 1 + digest_len * 2;
+	return 0;
+}
+
+static int digest_requested(attest_ctx_data *d_ctx, char *str, size_t str_len)
+{
+	struct data_item *item;
+
+	list_for_each_entry(item, &d_ctx->ctx_data[CTX_AUX_DIGEST], list) {
+		if (item->len == str_len && !memcmp(item->data, str, str_len))
+			return 1;
+	}
+
+	return 0;
+}
+
+struct ima_cp_state {
+	struct event_log *bios_log;
+	struct event_log *ima_log;
+	enum cp_modes mode;
+};
+
+static int begin(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		 void **state)
+{
+	struct verifier_struct *verifier;
+	struct ima_cp_state *s;
+	struct event_log *ima_log;
+	enum cp_modes mode = CP_ALL;
 	DIR *dir;
 	struct dirent *d_entry;
 	char path[PATH_MAX];
-	int rc = 0;
 
-	bios_log = attest_event_log_get(v_ctx, "bios");
-	if (bios_log)
-		list_for_each_entry(cur_log_entry, &bios_log->logs, list)
-			cur_log_entry->flags |= LOG_ENTRY_PROCESSED;
+	verifier = attest_ctx_verifier_lookup(v_ctx, IMA_CP_ID);
+	if (verifier && verifier->req) {
+		if (!strcmp(verifier->req, "digests"))
+			mode = CP_DIGESTS;
+		else if (!strcmp(verifier->req, "missing"))
+			mode = CP_MISSING;
+	}
 
 	ima_log = attest_event_log_get(v_ctx, "ima");
 	if (!ima_log)
 		return -ENOENT;
 
-	if (fork() == 0)
-		return execlp(PGP_SCRIPT, PGP_SCRIPT, NULL);
+	if (mode == CP_DIGESTS)
+		goto out;
 
-	wait(NULL);
+	refresh_pgp_keys();
 
 	dir = opendir("/etc/keys");
 	if (!dir)
@@ -67,50 +151,96 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 
 		snprintf(path, sizeof(path), "/etc/keys/%s", d_entry->d_name);
 
-		rc = attest_util_read_file(path, &file_content_len,
-					   &file_content);
-		if (!rc) {
-			rc = attest_ctx_data_add_copy(d_ctx, CTX_AUX_DATA,
-					file_content_len, file_content,
+		attest_ctx_data_add_ref(d_ctx, CTX_AUX_DATA, path,
 					d_entry->d_name);
-			munmap(file_content, file_content_len);
-		}
 	}
 
 	closedir(dir);
+out:
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	/* BIOS log entries are accepted as they are */
+	s->bios_log = attest_event_log_get(v_ctx, "bios");
+	s->ima_log = ima_log;
+	s->mode = mode;
+
+	*state = s;
+	return 0;
+}
 
-	list_for_each_entry(cur_log_entry, &ima_log->logs, list) {
-		ima_log_entry = (struct ima_log_entry *)cur_log_entry->log;
-		cur_log_entry->flags |= LOG_ENTRY_PROCESSED;
+static int on_entry(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		    struct event_log *event_log,
+		    struct event_log_entry *cur_log_entry, void *state)
+{
+	struct ima_cp_state *s = (struct ima_cp_state *)state;
+	struct ima_log_entry *ima_log_entry;
+	const char *data_ptr;
+	uint32_t data_len;
+	char digest_str[MAX_DIGEST_STR_LEN];
+	size_t digest_str_len;
+	int rc;
 
-		rc = ima_template_get_field(ima_log_entry, FIELD_SIG, &data_len,
-					    (const unsigned char **)&data_ptr);
-		if (!rc && data_len)
-			continue;
+	if (event_log == s->bios_log)
+		attest_event_log_entry_set_processed(cur_log_entry);
+
+	if (event_log != s->ima_log)
+		return 0;
 
-		rc = ima_template_get_eventname(ima_log_entry, &data_len,
-						&data_ptr);
+	ima_log_entry = (struct ima_log_entry *)cur_log_entry->log;
+	attest_event_log_entry_set_processed(cur_log_entry);
+
+	rc = ima_template_get_field(ima_log_entry, FIELD_SIG, &data_len,
+				    (const unsigned char **)&data_ptr);
+	if (!rc && data_len)
+		return 0;
+
+	rc = ima_template_get_eventname(ima_log_entry, &data_len, &data_ptr);
+	if (rc)
+		return rc;
+
+	if (!strncmp(data_ptr, "boot_aggregate", data_len))
+		return 0;
+
+	if (s->mode != CP_ALL) {
+		rc = get_digest_str(ima_log_entry, digest_str, &digest_str_len);
 		if (rc)
-			break;
+			return rc;
+	}
 
-		if (!strncmp(data_ptr, "boot_aggregate", data_len))
-			continue;
+	if (s->mode == CP_DIGESTS) {
+		if (access(data_ptr, R_OK))
+			return 0;
 
-		rc = attest_util_read_file(data_ptr, &file_content_len,
-					   &file_content);
-		if (!rc) {
-			rc = attest_ctx_data_add_copy(d_ctx, CTX_AUX_DATA,
-					file_content_len, file_content,
-					basename(data_ptr));
-			munmap(file_content, file_content_len);
-		} else if (rc == -ENOENT) {
-			rc = 0;
-		}
+		return attest_ctx_data_add_copy(d_ctx, CTX_AUX_DIGEST,
+						digest_str_len,
+						(unsigned char *)digest_str,
+						NULL);
 	}
 
+	/* the verifier has the file already */
+	if (s->mode == CP_MISSING &&
+	    !digest_requested(d_ctx, digest_str, digest_str_len))
+		return 0;
+
+	rc = attest_ctx_data_add_ref(d_ctx, CTX_AUX_DATA, (char *)data_ptr,
+				     basename(data_ptr));
+	if (rc == -ENOENT)
+		rc = 0;
+
+	return rc;
+}
+
+static int end(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+	       void *state, int rc)
+{
+	free(state);
 	return rc;
 }
 
 int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
 
-struct verifier_struct func_array[1] = {{.id = IMA_CP_ID, .func = verify}};
+struct verifier_struct func_array[1] = {{.id = IMA_CP_ID, .begin = begin,
+					 .on_entry = on_entry, .end = end}};
@@ -52,7 +52,7 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 	struct verifier_struct *verifier;
 	struct verification_log *log;
 	struct event_log *ima_log;
-	struct event_log_entry *log_entry;
+	struct event_log_entry *log_entry = NULL;
 	int rc;
 
 	log = attest_ctx_verifier_add_log(v_ctx, "verify IMA policy");
@@ -74,12 +74,14 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 	rc = !(policy->len == strlen(known_policies[policy_type]) &&
 	       !memcmp(policy->data, known_policies[policy_type], policy->len));
 	check_goto(rc, rc, out, v_ctx, "found policy != requested policy");
-	log_entry->flags |= LOG_ENTRY_PROCESSED;
+	if (log_entry)
+		attest_event_log_entry_set_processed(log_entry);
 out:
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 	return rc;
 }
 
 int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
 
 struct verifier_struct func_array[1] = {{.id = IMA_POLICY_ID, .func = verify}};
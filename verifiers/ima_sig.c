@@ -13,23 +13,38 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+
+#include <openssl/evp.h>
 
 #include <digestlist/crypto.h>
 #include "ctx.h"
 #include "util.h"
+#include "metrics.h"
 #include "event_log/ima.h"
 
 #define IMA_SIG_ID "ima_sig|verify"
 #define IMA_CERT_ID "x509_ima.der"
+#define MAX_THREADS 256
+
+#define SIG_CACHE_HASH_SIZE 4096
+#define SIG_CACHE_MAX_ENTRIES 65536
+#define EVM_IMA_XATTR_DIGSIG 3
+#define DIGSIG_VERSION_2 2
+#define DIGSIG_KEYID_OFFSET 3
+#define DIGSIG_HDR_LEN 9
 
-enum req_types { REQ_ISSUER, REQ_SUBJECT, REQ_SUBJECT_ID, REQ__LAST };
+enum req_types { REQ_ISSUER, REQ_SUBJECT, REQ_SUBJECT_ID, REQ_THREADS,
+		 REQ__LAST };
 
 char *requirements[REQ__LAST] = {
 	[REQ_ISSUER] = "issuer:",
 	[REQ_SUBJECT] = "subject:",
 	[REQ_SUBJECT_ID] = "subject_id:",
+	[REQ_THREADS] = "threads:",
 };
 
 struct req_struct {
@@ -38,6 +53,13 @@ struct req_struct {
 	char *req;
 };
 
+/* requirements parsed when they are added to the verifier context */
+struct ima_sig_reqs {
+	struct list_head head;
+	char *req_copy;
+	int num_threads;
+};
+
 static void free_reqs(struct list_head *head)
 {
 	struct req_struct *p, *q;
@@ -48,42 +70,32 @@ static void free_reqs(struct list_head *head)
 	}
 }
 
-int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
+static void cleanup(void *priv)
 {
-	struct data_item *ima_cert_item;
-#ifdef DIGESTLISTS_PGP
-	struct data_item *item;
-#endif
-	struct event_log_entry *cur_log_entry, *key_entry = NULL;
-	struct ima_log_entry *ima_log_entry;
-	struct event_log *ima_log;
-	struct verifier_struct *verifier;
-	struct verification_log *log;
-	struct key_struct *key;
+	struct ima_sig_reqs *reqs = (struct ima_sig_reqs *)priv;
+
+	free_reqs(&reqs->head);
+	free(reqs->req_copy);
+	free(reqs);
+}
+
+static int init(attest_ctx_verifier *v_ctx, const char *req_str, void **priv)
+{
+	struct ima_sig_reqs *reqs;
 	struct req_struct *req_struct, *new_req;
-	LIST_HEAD(head);
-	LIST_HEAD(req_head);
-	enum hash_algo algo;
-	const u8 *sig_ptr, *digest_ptr;
-	const char *algo_ptr, *eventname_ptr;
-	u32 sig_len, digest_len, algo_len, eventname_len;
-	X509 *cert = NULL;
-	X509_NAME *name = NULL;
-	ASN1_OCTET_STRING *skid = NULL;
-	const unsigned char *ptr, *skid_str;
-	char issuer[256], subject[256], keyid[9] = { 0 };
-	char *req_copy = NULL, *req_copy_ptr, *req;
-	int rc = 0, req_found = 0, i, skid_len;
+	char *req_copy_ptr, *req, *endptr;
+	int rc = 0, i;
 
-	log = attest_ctx_verifier_add_log(v_ctx, "verify IMA signatures");
+	current_log(v_ctx);
 
-	verifier = attest_ctx_verifier_lookup(v_ctx, IMA_SIG_ID);
+	reqs = calloc(1, sizeof(*reqs));
+	if (!reqs)
+		return -ENOMEM;
 
-	check_goto(!verifier->req, -ENOENT, out, v_ctx,
-		   "requirement not provided");
+	INIT_LIST_HEAD(&reqs->head);
 
-	req_copy_ptr = req_copy = strdup(verifier->req);
-	check_goto(!req_copy, -ENOMEM, out, v_ctx, "out of memory");
+	req_copy_ptr = reqs->req_copy = strdup(req_str);
+	check_goto(!reqs->req_copy, -ENOMEM, out, v_ctx, "out of memory");
 
 	while ((req = strsep(&req_copy_ptr, ","))) {
 		for (i = 0; i < REQ__LAST; i++) {
@@ -97,15 +109,370 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 
 		new_req = malloc(sizeof(*new_req));
 		check_goto(!new_req, -ENOMEM, out, v_ctx, "out of memory");
+
 		new_req->type = i;
 		new_req->req = req + strlen(requirements[i]);
-		list_add(&new_req->list, &req_head);
+		list_add(&new_req->list, &reqs->head);
+	}
+
+	/* if not specified, set by the verifier context */
+	list_for_each_entry(req_struct, &reqs->head, list) {
+		if (req_struct->type != REQ_THREADS)
+			continue;
+
+		reqs->num_threads = strtol(req_struct->req, &endptr, 10);
+		check_goto(*endptr || reqs->num_threads < 1, -EINVAL, out,
+			   v_ctx, "invalid number of threads: %s",
+			   req_struct->req);
+	}
+out:
+	if (rc) {
+		cleanup(reqs);
+		return rc;
+	}
+
+	*priv = reqs;
+	return 0;
+}
+
+/* successfully verified signatures, shared by all requests */
+struct sig_cache_entry {
+	struct list_head lru;
+	struct list_head hash_list;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+};
+
+static pthread_mutex_t sig_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head sig_cache_hash[SIG_CACHE_HASH_SIZE];
+static LIST_HEAD(sig_cache_lru);
+static int sig_cache_init;
+static int sig_cache_num;
+static unsigned long sig_cache_hits;
+static unsigned long sig_cache_misses;
+
+/// @private
+void attest_ima_sig_cache_stats(unsigned long *hits, unsigned long *misses)
+{
+	pthread_mutex_lock(&sig_cache_lock);
+	*hits = sig_cache_hits;
+	*misses = sig_cache_misses;
+	pthread_mutex_unlock(&sig_cache_lock);
+}
+
+/* the key fingerprint binds the entry to the key that verified it */
+static int sig_cache_key(const uint8_t *key_fpr, const u8 *sig_ptr,
+			 u32 sig_len, enum hash_algo algo,
+			 const u8 *digest_ptr, u32 digest_len, uint8_t *key)
+{
+	EVP_MD_CTX *mdctx;
+	uint8_t algo_byte = algo;
+	int rc = -EINVAL;
+
+	if (sig_len < DIGSIG_HDR_LEN || sig_ptr[0] != EVM_IMA_XATTR_DIGSIG ||
+	    sig_ptr[1] != DIGSIG_VERSION_2)
+		return -ENOTSUP;
+
+	mdctx = EVP_MD_CTX_create();
+	if (!mdctx)
+		return -ENOMEM;
+
+	if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1 ||
+	    EVP_DigestUpdate(mdctx, key_fpr, SHA256_DIGEST_LENGTH) != 1 ||
+	    EVP_DigestUpdate(mdctx, &algo_byte, sizeof(algo_byte)) != 1 ||
+	    EVP_DigestUpdate(mdctx, digest_ptr, digest_len) != 1 ||
+	    EVP_DigestUpdate(mdctx, sig_ptr, sig_len) != 1 ||
+	    EVP_DigestFinal_ex(mdctx, key, NULL) != 1)
+		goto out;
+
+	rc = 0;
+out:
+	EVP_MD_CTX_destroy(mdctx);
+	return rc;
+}
+
+static struct sig_cache_entry *sig_cache_lookup(uint8_t *key,
+						unsigned int *hash)
+{
+	struct sig_cache_entry *entry;
+	int i;
+
+	if (!sig_cache_init) {
+		for (i = 0; i < SIG_CACHE_HASH_SIZE; i++)
+			INIT_LIST_HEAD(&sig_cache_hash[i]);
+
+		sig_cache_init = 1;
+	}
+
+	*hash = ((key[0] << 8) | key[1]) % SIG_CACHE_HASH_SIZE;
+
+	list_for_each_entry(entry, &sig_cache_hash[*hash], hash_list) {
+		if (!memcmp(entry->key, key, SHA256_DIGEST_LENGTH))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static int sig_cache_get(uint8_t *key)
+{
+	struct sig_cache_entry *entry;
+	unsigned int hash;
+
+	pthread_mutex_lock(&sig_cache_lock);
+	entry = sig_cache_lookup(key, &hash);
+	if (entry) {
+		list_move_tail(&entry->lru, &sig_cache_lru);
+		sig_cache_hits++;
+	} else {
+		sig_cache_misses++;
+	}
+	pthread_mutex_unlock(&sig_cache_lock);
+
+	attest_metrics_cache("ima_sig", entry != NULL);
+	return entry != NULL;
+}
+
+static void sig_cache_add(uint8_t *key)
+{
+	struct sig_cache_entry *entry;
+	unsigned int hash;
+
+	pthread_mutex_lock(&sig_cache_lock);
+	if (sig_cache_lookup(key, &hash))
+		goto out;
+
+	if (sig_cache_num == SIG_CACHE_MAX_ENTRIES) {
+		entry = list_first_entry(&sig_cache_lru,
+					 struct sig_cache_entry, lru);
+		list_del(&entry->lru);
+		list_del(&entry->hash_list);
+		sig_cache_num--;
+	} else {
+		entry = malloc(sizeof(*entry));
+		if (!entry)
+			goto out;
+	}
+
+	memcpy(entry->key, key, SHA256_DIGEST_LENGTH);
+	list_add_tail(&entry->lru, &sig_cache_lru);
+	list_add(&entry->hash_list, &sig_cache_hash[hash]);
+	sig_cache_num++;
+out:
+	pthread_mutex_unlock(&sig_cache_lock);
+}
+
+/* fingerprint of a key in the keyring */
+struct sig_key {
+	struct key_struct *key;
+	uint8_t fpr[SHA256_DIGEST_LENGTH];
+};
+
+/*
+ * Return the fingerprint of the key selected by verify_sig() (the first one
+ * with the key ID of the signature), NULL if there is none.
+ */
+static const uint8_t *sig_key_fpr(struct list_head *keys,
+				  struct sig_key *sig_keys, int num_sig_keys,
+				  const u8 *sig_ptr, u32 sig_len)
+{
+	struct key_struct *key;
+	int i;
+
+	if (sig_len < DIGSIG_HDR_LEN)
+		return NULL;
+
+	list_for_each_entry(key, keys, list) {
+		if (memcmp(key->keyid, sig_ptr + DIGSIG_KEYID_OFFSET,
+			   sizeof(key->keyid)))
+			continue;
+
+		for (i = 0; i < num_sig_keys; i++)
+			if (sig_keys[i].key == key)
+				return sig_keys[i].fpr;
+
+		break;
+	}
+
+	return NULL;
+}
+
+struct sig_job {
+	struct event_log_entry *log_entry;
+	const u8 *sig_ptr;
+	const u8 *digest_ptr;
+	u32 sig_len;
+	u32 digest_len;
+	enum hash_algo algo;
+	int rc;
+};
+
+struct sig_pool {
+	struct list_head *keys;
+	struct sig_key *sig_keys;
+	int num_sig_keys;
+	struct sig_job *jobs;
+	int num_jobs;
+	int next_job;
+	pthread_mutex_t lock;
+};
+
+static void *verify_sig_worker(void *arg)
+{
+	struct sig_pool *pool = (struct sig_pool *)arg;
+	uint8_t cache_key[SHA256_DIGEST_LENGTH];
+	const uint8_t *key_fpr;
+	struct sig_job *job;
+	int i, cached;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next_job++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->num_jobs)
+			break;
+
+		job = &pool->jobs[i];
+
+		key_fpr = sig_key_fpr(pool->keys, pool->sig_keys,
+				      pool->num_sig_keys, job->sig_ptr,
+				      job->sig_len);
+		cached = key_fpr && !sig_cache_key(key_fpr, job->sig_ptr,
+						   job->sig_len, job->algo,
+						   job->digest_ptr,
+						   job->digest_len, cache_key);
+		if (cached && sig_cache_get(cache_key)) {
+			job->rc = 0;
+			continue;
+		}
+
+		job->rc = verify_sig(pool->keys, -1, (u8 *)job->sig_ptr,
+				     job->sig_len, (u8 *)job->digest_ptr,
+				     job->algo);
+		if (!job->rc && cached)
+			sig_cache_add(cache_key);
 	}
 
+	return NULL;
+}
+
+/* keys are not modified while signatures are verified */
+static void verify_sigs(struct list_head *keys, struct sig_key *sig_keys,
+			int num_sig_keys, struct sig_job *jobs, int num_jobs,
+			int num_threads)
+{
+	struct sig_pool pool = { .keys = keys, .sig_keys = sig_keys,
+				 .num_sig_keys = num_sig_keys, .jobs = jobs,
+				 .num_jobs = num_jobs };
+	pthread_t threads[MAX_THREADS];
+	int i, started = 0;
+
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (i = 1; i < num_threads && i < num_jobs; i++) {
+		if (pthread_create(&threads[started], NULL, verify_sig_worker,
+				   &pool))
+			break;
+
+		started++;
+	}
+
+	verify_sig_worker(&pool);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&pool.lock);
+}
+
+/* signatures are collected while the IMA log is walked */
+struct ima_sig_state {
+	struct verification_log *log;
+	struct event_log *ima_log;
+	struct list_head keys;
+	struct sig_key *sig_keys;
+	int num_sig_keys;
+	struct sig_job *jobs;
+	int num_jobs;
+	int max_jobs;
+	int num_threads;
+};
+
+static void free_state(struct ima_sig_state *s)
+{
+	free(s->sig_keys);
+	free(s->jobs);
+	free_keys(&s->keys);
+	free(s);
+}
+
+static int sig_key_add(struct ima_sig_state *s, struct key_struct *key,
+		       const uint8_t *fpr)
+{
+	struct sig_key *new_sig_keys;
+
+	new_sig_keys = realloc(s->sig_keys,
+			       (s->num_sig_keys + 1) * sizeof(*s->sig_keys));
+	if (!new_sig_keys)
+		return -ENOMEM;
+
+	s->sig_keys = new_sig_keys;
+	s->sig_keys[s->num_sig_keys].key = key;
+	memcpy(s->sig_keys[s->num_sig_keys].fpr, fpr, SHA256_DIGEST_LENGTH);
+	s->num_sig_keys++;
+	return 0;
+}
+
+static int begin(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		 void **state)
+{
+	struct data_item *ima_cert_item;
+#ifdef DIGESTLISTS_PGP
+	struct data_item *item;
+	char *path;
+#endif
+	struct event_log_entry *key_entry = NULL;
+	struct event_log *ima_log;
+	struct verifier_struct *verifier;
+	struct verification_log *log;
+	struct key_struct *key;
+	struct req_struct *req_struct;
+	struct ima_sig_reqs *reqs;
+	struct ima_sig_state *s = NULL;
+	X509 *cert = NULL;
+	X509_NAME *name = NULL;
+	ASN1_OCTET_STRING *skid = NULL;
+	const unsigned char *ptr, *skid_str;
+	uint8_t fpr[SHA256_DIGEST_LENGTH];
+	unsigned int fpr_len;
+	char issuer[256], subject[256], keyid[9] = { 0 };
+	int rc = 0, req_found = 0, skid_len;
+
+	log = attest_ctx_verifier_add_log(v_ctx, "verify IMA signatures");
+
+	verifier = attest_ctx_verifier_lookup(v_ctx, IMA_SIG_ID);
+
+	check_goto(!verifier->priv, -ENOENT, out, v_ctx,
+		   "requirement not provided");
+
+	reqs = (struct ima_sig_reqs *)verifier->priv;
+
 	ima_log = attest_event_log_get(v_ctx, "ima");
 	check_goto(!ima_log, -ENOENT, out, v_ctx,
 		   "IMA event log not provided");
 
+	s = calloc(1, sizeof(*s));
+	check_goto(!s, -ENOMEM, out, v_ctx, "out of memory");
+
+	INIT_LIST_HEAD(&s->keys);
+	s->log = log;
+	s->ima_log = ima_log;
+	s->num_threads = reqs->num_threads ? reqs->num_threads :
+			 attest_ctx_verifier_get_num_threads(v_ctx);
+
 	ima_cert_item = ima_lookup_data_item(d_ctx, ima_log, IMA_CERT_ID,
 					     &key_entry);
 	if (ima_cert_item) {
@@ -126,7 +493,7 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 		X509_NAME_oneline(name, subject, sizeof(subject));
 
 		req_found = 0;
-		list_for_each_entry(req_struct, &req_head, list) {
+		list_for_each_entry(req_struct, &reqs->head, list) {
 			switch (req_struct->type) {
 			case REQ_ISSUER:
 				if (!strcmp(issuer, req_struct->req))
@@ -158,12 +525,22 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 		}
 
 		if (req_found) {
-			key = new_key(&head, -1, ima_cert_item->mapped_file,
-				      NULL, false);
+			key = new_key(&s->keys, -1,
+				attest_ctx_data_get_path(d_ctx, ima_cert_item),
+				NULL, false);
 			check_goto(!key, -ENOENT, out, v_ctx,
 				   "IMA public key cannot be retrieved");
 
-			key_entry->flags |= LOG_ENTRY_PROCESSED;
+			rc = X509_pubkey_digest(cert, EVP_sha256(), fpr,
+						&fpr_len) != 1 ? -EINVAL : 0;
+			check_goto(rc, rc, out, v_ctx,
+				   "IMA public key cannot be retrieved");
+
+			rc = sig_key_add(s, key, fpr);
+			check_goto(rc, rc, out, v_ctx, "out of memory");
+
+			if (key_entry)
+				attest_event_log_entry_set_processed(key_entry);
 		} else {
 			printf("Warning: not adding key %s to the keyring, "
 			       "requirements not satisfied\n",
@@ -173,19 +550,20 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 
 #ifdef DIGESTLISTS_PGP
 	list_for_each_entry(item, &d_ctx->ctx_data[CTX_AUX_DATA], list) {
-		if (!item->mapped_file)
+		if (!item->label || strncmp(item->label, "pgp-key", 7))
 			continue;
 
-		if (strncmp(item->label, "pgp-key", 7))
+		path = attest_ctx_data_get_path(d_ctx, item);
+		if (!path)
 			continue;
 
-		key = new_key_pgp(&head, -1, item->mapped_file);
+		key = new_key_pgp(&s->keys, -1, path);
 		check_goto(!key, -ENOENT, out, v_ctx, "key cannot be imported");
 
 		_bin2hex(keyid, key->keyid, 4);
 
 		req_found = 0;
-		list_for_each_entry(req_struct, &req_head, list) {
+		list_for_each_entry(req_struct, &reqs->head, list) {
 			switch (req_struct->type) {
 			case REQ_SUBJECT_ID:
 				if (!strcmp(keyid, req_struct->req))
@@ -199,52 +577,125 @@ int verify(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx)
 		if (!req_found) {
 			printf("Warning: not adding key %s to the keyring, "
 			       "requirements not satisfied\n", item->label);
-			free_key(&head, key);
+			free_key(&s->keys, key);
+			continue;
 		}
+
+		rc = EVP_Digest(item->data, item->len, fpr, &fpr_len,
+				EVP_sha256(), NULL) != 1 ? -EINVAL : 0;
+		check_goto(rc, rc, out, v_ctx, "key cannot be imported");
+
+		rc = sig_key_add(s, key, fpr);
+		check_goto(rc, rc, out, v_ctx, "out of memory");
 	}
 #endif
 
-	list_for_each_entry(cur_log_entry, &ima_log->logs, list) {
-		ima_log_entry = (struct ima_log_entry *)cur_log_entry->log;
+	*state = s;
+out:
+	X509_free(cert);
 
-		rc = ima_template_get_digest(ima_log_entry, &algo_len,
-					     &algo_ptr, &digest_len, &digest_ptr);
-		check_goto(rc, rc, out, v_ctx, "event digest not found");
+	if (rc) {
+		if (s)
+			free_state(s);
 
-		rc = ima_template_get_eventname(ima_log_entry, &eventname_len,
-						&eventname_ptr);
-		check_goto(rc, rc, out, v_ctx, "event name not found");
+		attest_ctx_verifier_end_log(v_ctx, log, rc);
+	}
 
-		if (!strcmp(eventname_ptr, "boot_aggregate"))
-			continue;
+	return rc;
+}
 
-		for (algo = 0; algo < HASH_ALGO__LAST; algo++)
-			if (!strncmp(hash_algo_name[algo], algo_ptr, algo_len))
-				break;
+static int on_entry(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+		    struct event_log *event_log,
+		    struct event_log_entry *cur_log_entry, void *state)
+{
+	struct ima_sig_state *s = (struct ima_sig_state *)state;
+	struct verification_log *log = s->log;
+	struct ima_log_entry *ima_log_entry;
+	struct sig_job *new_jobs;
+	enum hash_algo algo;
+	const u8 *sig_ptr, *digest_ptr;
+	const char *algo_ptr, *eventname_ptr;
+	u32 sig_len, digest_len, algo_len, eventname_len;
+	int rc;
 
-		check_goto(algo == HASH_ALGO__LAST, -ENOENT, out, v_ctx,
-			   "Unknown hash algorithm");
+	if (event_log != s->ima_log)
+		return 0;
 
-		rc = ima_template_get_field(ima_log_entry, FIELD_SIG, &sig_len,
-					    &sig_ptr);
-		if (rc < 0 || ! sig_len)
-			continue;
+	ima_log_entry = (struct ima_log_entry *)cur_log_entry->log;
+
+	rc = ima_template_get_digest(ima_log_entry, &algo_len,
+				     &algo_ptr, &digest_len, &digest_ptr);
+	check_goto(rc, rc, out, v_ctx, "event digest not found");
+
+	rc = ima_template_get_eventname(ima_log_entry, &eventname_len,
+					&eventname_ptr);
+	check_goto(rc, rc, out, v_ctx, "event name not found");
+
+	if (!strcmp(eventname_ptr, "boot_aggregate"))
+		goto out;
+
+	for (algo = 0; algo < HASH_ALGO__LAST; algo++)
+		if (!strncmp(hash_algo_name[algo], algo_ptr, algo_len))
+			break;
+
+	check_goto(algo == HASH_ALGO__LAST, -ENOENT, out, v_ctx,
+		   "Unknown hash algorithm");
+
+	rc = ima_template_get_field(ima_log_entry, FIELD_SIG, &sig_len,
+				    &sig_ptr);
+	if (rc < 0 || ! sig_len) {
+		rc = 0;
+		goto out;
+	}
 
-		rc = verify_sig(&head, -1, (u8 *)sig_ptr, sig_len,
-				(u8 *)digest_ptr, algo);
+	if (s->num_jobs == s->max_jobs) {
+		s->max_jobs = s->max_jobs ? s->max_jobs * 2 : 1024;
+		new_jobs = realloc(s->jobs, s->max_jobs * sizeof(*s->jobs));
+		check_goto(!new_jobs, -ENOMEM, out, v_ctx, "out of memory");
+		s->jobs = new_jobs;
+	}
+
+	s->jobs[s->num_jobs].log_entry = cur_log_entry;
+	s->jobs[s->num_jobs].sig_ptr = sig_ptr;
+	s->jobs[s->num_jobs].sig_len = sig_len;
+	s->jobs[s->num_jobs].digest_ptr = digest_ptr;
+	s->jobs[s->num_jobs].digest_len = digest_len;
+	s->jobs[s->num_jobs].algo = algo;
+	s->jobs[s->num_jobs].rc = 0;
+	s->num_jobs++;
+out:
+	return rc;
+}
+
+static int end(attest_ctx_data *d_ctx, attest_ctx_verifier *v_ctx,
+	       void *state, int rc)
+{
+	struct ima_sig_state *s = (struct ima_sig_state *)state;
+	struct verification_log *log = s->log;
+	int i;
+
+	if (rc)
+		goto out;
+
+	verify_sigs(&s->keys, s->sig_keys, s->num_sig_keys, s->jobs,
+		    s->num_jobs, s->num_threads);
+
+	/* report the first failure in log order */
+	for (i = 0; i < s->num_jobs; i++) {
+		rc = s->jobs[i].rc;
 		check_goto(rc, rc, out, v_ctx, "invalid signature");
 
-		cur_log_entry->flags |= LOG_ENTRY_PROCESSED;
+		attest_event_log_entry_set_processed(s->jobs[i].log_entry);
 	}
 out:
-	X509_free(cert);
-	free_keys(&head);
-	free(req_copy);
-	free_reqs(&req_head);
+	free_state(s);
 	attest_ctx_verifier_end_log(v_ctx, log, rc);
 	return rc;
 }
 
 int num_func = 1;
+size_t func_size = sizeof(struct verifier_struct);
 
-struct verifier_struct func_array[1] = {{.id = IMA_SIG_ID, .func = verify}};
+struct verifier_struct func_array[1] = {{.id = IMA_SIG_ID, .init = init,
+					 .cleanup = cleanup, .begin = begin,
+					 .on_entry = on_entry, .end = end}};